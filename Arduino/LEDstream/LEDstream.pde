@@ -71,13 +71,144 @@
 // XOR 0x55).  LED data follows, 3 bytes per LED, in order R, G, B,
 // where 0 = off and 255 = max brightness.
 
+// Version 2 of the protocol ends the magic word with '2' instead of
+// 'a', and five more bytes follow the header: the frame type, a
+// sequence number, a 16-bit payload length (high byte first) and a
+// checksum (type XOR sequence XOR length high XOR length low XOR 0x55).
+// Then comes the payload and finally the XOR of all the payload bytes.
+// A raw frame's payload is 3 bytes per LED as above.  Run-length and
+// delta frames are a series of ops, each a control byte with the op in
+// the top two bits and the number of LEDs - 1 in the other six:
+// literal (that many LEDs follow, 3 bytes each), repeat (one color
+// follows for that many LEDs) or skip (that many LEDs are unchanged,
+// only in delta frames, which may also stop short of the last LED).
+// Deltas are only applied on top of the frame with the previous
+// sequence number, so after any frame we missed or couldn't decode we
+// wait for the next raw or run-length frame.  Version 2 frames are
+// decoded into RAM before they're issued, so they're limited to
+// MAX_LEDS; the host sends version 1 frames to longer strips.
+
+// The host can also send commands shaped like a header, with a
+// different third character.  "Ad?" asks what we support, and we
+// answer with a line like "Ada:2 500000 400 WS2801": the highest
+// protocol version, the fastest baud rate we can switch to (0 on
+// native USB boards, which ignore it), MAX_LEDS and the LED chip.
+// "AdB" switches to the baud rate in the 16-bit count field, in units
+// of 100 baud.  We answer "AdaB" at the old rate and then switch, but
+// go back to the default rate if no valid header or command follows
+// within BAUD_REVERT_TIME, in case the host couldn't keep up.  "AdF"
+// with a 1 in the low count byte asks for a READY_TOKEN byte every
+// time we latch a frame (0 turns them off again), so the host doesn't
+// send frames faster than we can issue them; we answer "AdaF".  Older
+// host software never sends these and older sketches ignore them.
+
 static const uint8_t magic[] = {'A','d','a'};
 #define MAGICSIZE  sizeof(magic)
 #define HEADERSIZE (MAGICSIZE + 3)
+#define MAGIC_V2   '2'
+#define FRAMEHEADERSIZE 5
+
+#define CMD_QUERY '?'
+#define CMD_BAUD  'B'
+#define CMD_FLOW  'F'
+
+#define READY_TOKEN 0x06
+
+#define DEFAULT_BAUD     115200
+#define BAUD_REVERT_TIME 2000 // 2 seconds
+
+// The LED chip on the strip.  The host encodes the frames for it (see
+// "output" in AdaLight.config.json) and we pass them through, but the
+// startup test pattern and the blackout come from here, so they have
+// to be framed for the chip too.  Set LED_CHIP to match the host.
+#define CHIP_WS2801  0
+#define CHIP_LPD8806 1
+#define CHIP_APA102  2
+#define LED_CHIP     CHIP_WS2801
+
+#if LED_CHIP == CHIP_LPD8806
+#define CHIP "LPD8806"
+#elif LED_CHIP == CHIP_APA102
+#define CHIP "APA102"
+#else
+#define CHIP "WS2801"
+#endif
+
+// How many LEDs the test pattern and the blackout cover, not knowing
+// how many are actually connected.
+#define TEST_LEDS  25000
+#define BLANK_LEDS 10922 // About 32K bytes of WS2801 data
+
+// Fastest baud rate we'll switch to when the host asks.  Faster rates
+// may outrun the loop below on slower boards, in which case lower it.
+#if defined(USBCON) || defined(CORE_TEENSY)
+#define MAX_BAUD 0L // Native USB ignores the baud rate
+#else
+#define MAX_BAUD 500000L
+#endif
+
+#define FRAME_RAW   0
+#define FRAME_RLE   1
+#define FRAME_DELTA 2
+
+#define OP_LITERAL 0x00
+#define OP_REPEAT  0x40
+#define OP_SKIP    0x80
+#define OP_MASK    0xC0
+
+#define MAX_LEDS 400
+
+#define MODE_HEADER  0
+#define MODE_HOLD    1
+#define MODE_DATA    2
+#define MODE_FRAME   3
+#define MODE_PAYLOAD 4
+
+// Decoded LED data for version 2 frames, R, G, B for each LED.
+static uint8_t frame[MAX_LEDS * 3];
+
+static void spiWrite(uint8_t b)
+{
+  for(SPDR = b; !(SPSR & _BV(SPIF)); );
+}
 
-#define MODE_HEADER 0
-#define MODE_HOLD   1
-#define MODE_DATA   2
+// Set the first n LEDs to the same three color bytes, in the order
+// they go out, with whatever the chip needs around them, and latch.
+// This blocks until it's all out, like the original loops did.
+static void showColor(uint8_t first, uint8_t second, uint8_t third,
+  uint16_t n)
+{
+  uint16_t j;
+
+#if LED_CHIP == CHIP_APA102
+  // Start frame, full global brightness on every LED, and an end
+  // frame of one bit of 1 for every 2 LEDs, in whole bytes.
+  for(j=0; j<4; j++) spiWrite(0);
+  for(j=0; j<n; j++) {
+    spiWrite(0xFF);
+    spiWrite(first);
+    spiWrite(second);
+    spiWrite(third);
+  }
+  for(j=0; j<(n+15)/16; j++) spiWrite(0xFF);
+#elif LED_CHIP == CHIP_LPD8806
+  // 7 bits per color with the high bit set, then the zeros which
+  // latch it, 3 for every 64 LEDs.
+  for(j=0; j<n; j++) {
+    spiWrite(0x80 | (first  >> 1));
+    spiWrite(0x80 | (second >> 1));
+    spiWrite(0x80 | (third  >> 1));
+  }
+  for(j=0; j<((n+63)/64)*3; j++) spiWrite(0);
+#else
+  for(j=0; j<n; j++) {
+    spiWrite(first);
+    spiWrite(second);
+    spiWrite(third);
+  }
+#endif
+  delay(1); // One millisecond pause = latch
+}
 
 // If no serial data is received for a while, the LEDs are shut off
 // automatically.  This avoids the annoying "stuck pixel" look when
@@ -97,23 +228,37 @@ void setup()
     indexIn       = 0,
     indexOut      = 0,
     mode          = MODE_HEADER,
-    hi, lo, chk, i, spiFlag;
+    version       = 0,
+    synced        = 0,
+    failed        = 0,
+    baudPending   = 0,
+    readyTokens   = 0,
+    hi, lo, chk, i, spiFlag,
+    type, seq, lastSeq, frameChk, op, colorByte,
+    color[3];
   int16_t
     bytesBuffered = 0,
     hold          = 0,
+    position      = 0,
+    opCount       = 0,
     c;
   int32_t
-    bytesRemaining;
+    bytesRemaining,
+    payloadRemaining,
+    ledCount      = 0,
+    lastCount     = 0,
+    baud;
   unsigned long
     startTime,
     lastByteTime,
     lastAckTime,
+    baudTime      = 0,
     t;
 
   LED_DDR  |=  LED_PIN; // Enable output for LED
   LED_PORT &= ~LED_PIN; // LED off
 
-  Serial.begin(115200); // Teensy/32u4 disregards baud rate; is OK!
+  Serial.begin(DEFAULT_BAUD); // Teensy/32u4 disregards baud rate; is OK!
 
   SPI.begin();
   SPI.setBitOrder(MSBFIRST);
@@ -126,14 +271,12 @@ void setup()
   // to the first 25,000, so as not to be TOO time consuming) to red,
   // green, blue, then off.  Once you're confident everything is working
   // end-to-end, it's OK to comment this out and reprogram the Arduino.
+  // The colors go out in the first, second and third place of each
+  // LED, so they only come out as red, green and blue in that order
+  // if the strip takes R, G, B.
   uint8_t testcolor[] = { 0, 0, 0, 255, 0, 0 };
   for(char n=3; n>=0; n--) {
-    for(c=0; c<25000; c++) {
-      for(i=0; i<3; i++) {
-        for(SPDR = testcolor[n + i]; !(SPSR & _BV(SPIF)); );
-      }
-    }
-    delay(1); // One millisecond pause = latch
+    showColor(testcolor[n], testcolor[n + 1], testcolor[n + 2], TEST_LEDS);
   }
 
   Serial.print("Ada\n"); // Send ACK string to host
@@ -162,40 +305,187 @@ void setup()
       }
       // If no data received for an extended time, turn off all LEDs.
       if((t - lastByteTime) > serialTimeout) {
-        for(c=0; c<32767; c++) {
-          for(SPDR=0; !(SPSR & _BV(SPIF)); );
-        }
-        delay(1); // One millisecond pause = latch
+        showColor(0, 0, 0, BLANK_LEDS);
         lastByteTime = t; // Reset counter
+        readyTokens  = 0; // The next host has to ask for them again
       }
     }
 
+    // If we switched baud rates and haven't heard a valid header or
+    // command since, the host probably couldn't follow, so go back.
+    if(baudPending && ((t - baudTime) > BAUD_REVERT_TIME)) {
+      Serial.begin(DEFAULT_BAUD);
+      baudPending = 0;
+    }
+
     switch(mode) {
 
      case MODE_HEADER:
 
       // In header-seeking mode.  Is there enough data to check?
       if(bytesBuffered >= HEADERSIZE) {
-        // Indeed.  Check for a 'magic word' match.
-        for(i=0; (i<MAGICSIZE) && (buffer[indexOut++] == magic[i++]););
-        if(i == MAGICSIZE) {
+        // Indeed.  Check for a 'magic word' match.  The last character
+        // is 'a' for the original protocol, '2' for version 2, or one
+        // of the commands.
+        for(i=0; (i<MAGICSIZE-1) &&
+          (buffer[(uint8_t)(indexOut + i)] == magic[i]); i++);
+        c = buffer[(uint8_t)(indexOut + i)];
+        if((i == MAGICSIZE-1) && ((c == magic[i]) || (c == MAGIC_V2) ||
+           (c == CMD_QUERY) || (c == CMD_BAUD) || (c == CMD_FLOW))) {
           // Magic word matches.  Now how about the checksum?
-          hi  = buffer[indexOut++];
-          lo  = buffer[indexOut++];
-          chk = buffer[indexOut++];
+          hi  = buffer[(uint8_t)(indexOut + MAGICSIZE)];
+          lo  = buffer[(uint8_t)(indexOut + MAGICSIZE + 1)];
+          chk = buffer[(uint8_t)(indexOut + MAGICSIZE + 2)];
           if(chk == (hi ^ lo ^ 0x55)) {
+            indexOut      += HEADERSIZE;
+            bytesBuffered -= HEADERSIZE;
+            baudPending    = 0; // The host can hear us at this rate
+            if(c == CMD_QUERY) {
+              Serial.print("Ada:2 ");
+              Serial.print(MAX_BAUD);
+              Serial.print(' ');
+              Serial.print(MAX_LEDS);
+              Serial.print(" " CHIP "\n");
+              break;
+            }
+            if(c == CMD_BAUD) {
+              baud = 100L * (256L * (long)hi + (long)lo);
+              if((baud >= DEFAULT_BAUD) && (baud <= MAX_BAUD)) {
+                Serial.print("AdaB\n");
+                Serial.flush(); // Finish sending at the old rate
+                Serial.begin(baud);
+                baudPending = 1;
+                baudTime    = millis();
+              }
+              break;
+            }
+            if(c == CMD_FLOW) {
+              readyTokens = lo;
+              Serial.print("AdaF\n");
+              break;
+            }
             // Checksum looks valid.  Get 16-bit LED count, add 1
-            // (# LEDs is always > 0) and multiply by 3 for R,G,B.
-            bytesRemaining = 3L * (256L * (long)hi + (long)lo + 1L);
-            bytesBuffered -= 3;
-            spiFlag        = 0;         // No data out yet
-            mode           = MODE_HOLD; // Proceed to latch wait mode
+            // (# LEDs is always > 0).
+            version  = c;
+            ledCount = 256L * (long)hi + (long)lo + 1L;
+            if(version == MAGIC_V2) {
+              mode = MODE_FRAME; // Read the frame header next
+            } else {
+              // Multiply by 3 for R,G,B.  This frame replaces whatever
+              // a version 2 delta would build on.
+              bytesRemaining = 3L * ledCount;
+              synced         = 0;
+              spiFlag        = 0;         // No data out yet
+              mode           = MODE_HOLD; // Proceed to latch wait mode
+            }
           } else {
             // Checksum didn't match; search resumes after magic word.
-            indexOut  -= 3; // Rewind
+            indexOut      += MAGICSIZE;
+            bytesBuffered -= MAGICSIZE;
           }
-        } // else no header match.  Resume at first mismatched byte.
-        bytesBuffered -= i;
+        } else {
+          // No header match.  Resume at first mismatched byte, which
+          // might be the start of the next magic word.
+          if(i == 0) i = 1;
+          indexOut      += i;
+          bytesBuffered -= i;
+        }
+      }
+      break;
+
+     case MODE_FRAME:
+
+      // Version 2 frame header.  Is there enough data to check?
+      if(bytesBuffered >= FRAMEHEADERSIZE) {
+        type = buffer[indexOut];
+        seq  = buffer[(uint8_t)(indexOut + 1)];
+        hi   = buffer[(uint8_t)(indexOut + 2)];
+        lo   = buffer[(uint8_t)(indexOut + 3)];
+        chk  = buffer[(uint8_t)(indexOut + 4)];
+        if((chk != (type ^ seq ^ hi ^ lo ^ 0x55)) || (type > FRAME_DELTA)) {
+          // Not a valid frame header after all; resume header search.
+          mode = MODE_HEADER;
+          break;
+        }
+        indexOut      += FRAMEHEADERSIZE;
+        bytesBuffered -= FRAMEHEADERSIZE;
+        if((ledCount > MAX_LEDS) || ((type == FRAME_DELTA) &&
+          (!synced || (ledCount != lastCount) ||
+           (seq != (uint8_t)(lastSeq + 1))))) {
+          // Too many LEDs for the frame buffer, or a delta we can't
+          // apply because we missed the frame before it.  Skip it.
+          synced = 0;
+          mode   = MODE_HEADER;
+          break;
+        }
+        payloadRemaining = 256L * (long)hi + (long)lo;
+        frameChk         = 0;
+        position         = 0;
+        colorByte        = 0;
+        failed           = 0;
+        if(type == FRAME_RAW) {
+          // A raw frame is one long literal.
+          op      = OP_LITERAL;
+          opCount = ledCount;
+        } else {
+          opCount = 0;
+        }
+        mode = MODE_PAYLOAD;
+      }
+      break;
+
+     case MODE_PAYLOAD:
+
+      // Decode one byte of a version 2 payload into the frame buffer.
+      if(bytesBuffered <= 0) break;
+      c = buffer[indexOut++];
+      bytesBuffered--;
+      if(payloadRemaining > 0) {
+        payloadRemaining--;
+        frameChk ^= c;
+        if(failed) break;
+        if(opCount == 0) {
+          // Control byte for the next op.
+          op        = c & OP_MASK;
+          opCount   = (c & ~OP_MASK) + 1;
+          colorByte = 0;
+          if(op == OP_SKIP) {
+            position += opCount;
+            opCount   = 0;
+            failed    = (type != FRAME_DELTA) || (position > ledCount);
+          } else if((op == OP_MASK) || (position + opCount > ledCount)) {
+            failed = 1;
+          }
+        } else if(op == OP_LITERAL) {
+          frame[position * 3 + colorByte] = c;
+          if(++colorByte == 3) {
+            colorByte = 0;
+            position++;
+            opCount--;
+          }
+        } else {
+          color[colorByte++] = c;
+          if(colorByte == 3) {
+            for(; opCount > 0; opCount--, position++) {
+              memcpy(&frame[position * 3], color, 3);
+            }
+          }
+        }
+      } else {
+        // Last byte is the payload checksum.
+        if(!failed && (c == frameChk) && (opCount == 0) &&
+          ((type == FRAME_DELTA) || (position == ledCount))) {
+          synced         = 1;
+          lastSeq        = seq;
+          lastCount      = ledCount;
+          bytesRemaining = 3L * ledCount;
+          spiFlag        = 0;         // No data out yet
+          mode           = MODE_HOLD; // Proceed to latch wait mode
+        } else {
+          // Bad frame; the next delta can't be applied either.
+          synced = 0;
+          mode   = MODE_HEADER;
+        }
       }
       break;
 
@@ -215,7 +505,12 @@ void setup()
 
       while(spiFlag && !(SPSR & _BV(SPIF))); // Wait for prior byte
       if(bytesRemaining > 0) {
-        if(bytesBuffered > 0) {
+        if(version == MAGIC_V2) {
+          // Already decoded, so there's no underrun to worry about.
+          SPDR = frame[3L * ledCount - bytesRemaining];
+          bytesRemaining--;
+          spiFlag = 1;
+        } else if(bytesBuffered > 0) {
           SPDR = buffer[indexOut++];   // Issue next byte
           bytesBuffered--;
           bytesRemaining--;
@@ -224,7 +519,8 @@ void setup()
         // If serial buffer is threatening to underrun, start
         // introducing progressively longer pauses to allow more
         // data to arrive (up to a point).
-        if((bytesBuffered < 32) && (bytesRemaining > bytesBuffered)) {
+        if((version != MAGIC_V2) &&
+          (bytesBuffered < 32) && (bytesRemaining > bytesBuffered)) {
           startTime = micros();
           hold      = 100 + (32 - bytesBuffered) * 10;
           mode      = MODE_HOLD;
@@ -235,6 +531,7 @@ void setup()
         hold       = 1000;        // Latch duration = 1000 uS
         LED_PORT  |= LED_PIN;     // LED on
         mode       = MODE_HEADER; // Begin next header search
+        if(readyTokens) Serial.write(READY_TOKEN); // Ready for more
       }
     } // end switch
   } // end for(;;)
@@ -50,7 +50,8 @@
 #include "gamma_correction.h"
 #include "serial_buffer.h"
 #include "screen_samples.h"
-#include "serial_port.h"
+#include "serial_devices.h"
+#include "udp_devices.h"
 #include "update_timer.h"
 
 static const settings parameters(L"AdaLight.config.json");
@@ -58,7 +59,8 @@ static const settings parameters(L"AdaLight.config.json");
 static serial_buffer serial(parameters);
 static gamma_correction gamma;
 static screen_samples samples(parameters, gamma);
-static serial_port port(parameters);
+static serial_devices devices(parameters);
+static udp_devices network(parameters);
 
 // Construct an update_timer and keep a std::weak_ptr to it for re-use as long as it's alive.
 static std::shared_ptr<update_timer> get_timer()
@@ -74,9 +76,17 @@ static std::shared_ptr<update_timer> get_timer()
 			// Try to get the resources and resume the timer.
 			if (samples.empty())
 			{
-				if (port.open()
+				// Nothing else may touch the ports while they're being opened.
+				devices.stop();
+
+				if (devices.open()
+					&& network.open()
 					&& samples.create_resources())
 				{
+					devices.start();
+
+					// Don't sample frames faster than the slowest link can send them.
+					timer->limit(devices.frame_time());
 					timer->resume();
 				}
 				else if (timer->throttle())
@@ -85,18 +95,22 @@ static std::shared_ptr<update_timer> get_timer()
 				}
 			}
 
-			// Update the LED strip.
+			// Update the LED strip. The writers send the frame while we sample the next one.
 			samples.take_samples(serial);
-			port.send(serial);
+			devices.send(serial);
+			network.send(serial);
 		}, [](std::shared_ptr<update_timer> /*timer*/)
 		{
-			// Reset the LED strip.
+			// Reset the LED strip, and wait for the writers to send that before closing the ports.
 			serial.clear();
-			port.send(serial);
+			devices.send(serial);
+			network.send(serial);
+			devices.stop();
 
 			// Free resources anytime the update timer stops completely.
 			samples.free_resources();
-			port.close();
+			devices.close();
+			network.close();
 		});
 
 		weakTimer = timer;
@@ -178,6 +192,16 @@ static LRESULT CALLBACK HiddenWindowProc(HWND hwnd, UINT message, WPARAM wParam,
 			AttachToConsole();
 			break;
 
+		case WM_DEVICECHANGE:
+			// Look for the Arduino again the next time we try to open the port.
+			if (DBT_DEVICEARRIVAL == wParam
+				&& DBT_DEVTYP_PORT == reinterpret_cast<PDEV_BROADCAST_HDR>(lParam)->dbch_devicetype)
+			{
+				devices.ports_changed();
+			}
+
+			return TRUE;
+
 		default:
 			return DefWindowProcW(hwnd, message, wParam, lParam);
 	}
@@ -0,0 +1,273 @@
+#include "stdafx.h"
+#include "ada_decoder.h"
+
+#include <algorithm>
+
+constexpr size_t bytes_per_led = 3;
+
+ada_decoder::ada_decoder(size_t maxV2Leds)
+	: _maxV2Leds(maxV2Leds)
+{
+}
+
+bool ada_decoder::push(uint8_t value)
+{
+	switch (_state)
+	{
+		case state::header:
+			_header[_headerSize++] = value;
+
+			// Slide past anything which can't be the start of a header.
+			while (_headerSize > 0
+				&& !valid_header())
+			{
+				std::copy(_header.cbegin() + 1, _header.cbegin() + _headerSize, _header.begin());
+				--_headerSize;
+			}
+
+			if (_headerSize == ada_header_size + ((ada_magic_v2 == _header[2]) ? ada_frame_header_size : 0))
+			{
+				begin_frame();
+			}
+
+			return false;
+
+		case state::data:
+			_leds[_position++] = value;
+
+			if (_position < _leds.size())
+			{
+				return false;
+			}
+
+			_state = state::header;
+			_version = 1;
+			++_frames;
+
+			return true;
+
+		default:
+			if (_payloadRemaining > 0)
+			{
+				--_payloadRemaining;
+				_checksum ^= value;
+				decode(value);
+
+				return false;
+			}
+
+			_state = state::header;
+
+			return end_frame(value);
+	}
+}
+
+size_t ada_decoder::push(const uint8_t* data, size_t size)
+{
+	size_t frames = 0;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		if (push(data[i]))
+		{
+			++frames;
+		}
+	}
+
+	return frames;
+}
+
+const std::vector<uint8_t>& ada_decoder::leds() const
+{
+	return _leds;
+}
+
+int ada_decoder::version() const
+{
+	return _version;
+}
+
+size_t ada_decoder::frames() const
+{
+	return _frames;
+}
+
+size_t ada_decoder::errors() const
+{
+	return _errors;
+}
+
+bool ada_decoder::valid_header() const
+{
+	for (size_t i = 0; i < std::min(_headerSize, sizeof(ada_magic) - 1); ++i)
+	{
+		if (ada_magic[i] != _header[i])
+		{
+			return false;
+		}
+	}
+
+	if (_headerSize < sizeof(ada_magic))
+	{
+		return true;
+	}
+
+	const uint8_t last = _header[sizeof(ada_magic) - 1];
+
+	if (ada_magic[sizeof(ada_magic) - 1] != last
+		&& ada_magic_v2 != last)
+	{
+		return false;
+	}
+
+	if (_headerSize >= ada_header_size
+		&& _header[5] != (_header[3] ^ _header[4] ^ 0x55))
+	{
+		return false;
+	}
+
+	if (_headerSize == ada_header_size + ada_frame_header_size)
+	{
+		const uint8_t* frameHeader = _header.data() + ada_header_size;
+
+		return frameHeader[0] <= static_cast<uint8_t>(ada_frame_type::delta)
+			&& frameHeader[4] == (frameHeader[0] ^ frameHeader[1] ^ frameHeader[2] ^ frameHeader[3] ^ 0x55);
+	}
+
+	return true;
+}
+
+void ada_decoder::begin_frame()
+{
+	const size_t ledCount = ((static_cast<size_t>(_header[3]) << 8) | _header[4]) + 1;
+	const bool v2 = (ada_magic_v2 == _header[2]);
+
+	_headerSize = 0;
+
+	if (!v2)
+	{
+		_leds.resize(ledCount * bytes_per_led);
+		_ledCount = ledCount;
+		_position = 0;
+		_synced = false;
+		_state = state::data;
+		return;
+	}
+
+	const uint8_t* frameHeader = _header.data() + ada_header_size;
+
+	_type = static_cast<ada_frame_type>(frameHeader[0]);
+	_sequence = frameHeader[1];
+
+	if (ledCount > _maxV2Leds
+		|| (ada_frame_type::delta == _type
+			&& (!_synced
+				|| ledCount != _ledCount
+				|| _sequence != static_cast<uint8_t>(_lastSequence + 1))))
+	{
+		// We can't apply this frame, so go back to looking for the next header.
+		_synced = false;
+		++_errors;
+		return;
+	}
+
+	_leds.resize(ledCount * bytes_per_led);
+	_ledCount = ledCount;
+	_payloadRemaining = (static_cast<size_t>(frameHeader[2]) << 8) | frameHeader[3];
+	_checksum = 0;
+	_position = 0;
+	_colorByte = 0;
+	_failed = false;
+
+	if (ada_frame_type::raw == _type)
+	{
+		// A raw frame is one long literal.
+		_op = ada_op_literal;
+		_opRemaining = ledCount;
+	}
+	else
+	{
+		_opRemaining = 0;
+	}
+
+	_state = state::payload;
+}
+
+void ada_decoder::decode(uint8_t value)
+{
+	if (_failed)
+	{
+		return;
+	}
+
+	if (0 == _opRemaining)
+	{
+		_op = value & ada_op_mask;
+		_opRemaining = static_cast<size_t>(value & ~ada_op_mask) + 1;
+		_colorByte = 0;
+
+		if (ada_op_skip == _op)
+		{
+			if (ada_frame_type::delta != _type)
+			{
+				_failed = true;
+				return;
+			}
+
+			_position += _opRemaining;
+			_opRemaining = 0;
+			_failed = (_position > _ledCount);
+		}
+		else if (ada_op_mask == _op
+			|| _position + _opRemaining > _ledCount)
+		{
+			_failed = true;
+		}
+
+		return;
+	}
+
+	if (ada_op_literal == _op)
+	{
+		_leds[(_position * bytes_per_led) + _colorByte] = value;
+
+		if (++_colorByte == bytes_per_led)
+		{
+			_colorByte = 0;
+			++_position;
+			--_opRemaining;
+		}
+
+		return;
+	}
+
+	_color[_colorByte++] = value;
+
+	if (_colorByte == bytes_per_led)
+	{
+		for (; _opRemaining > 0; --_opRemaining, ++_position)
+		{
+			std::copy(_color.cbegin(), _color.cend(), _leds.begin() + (_position * bytes_per_led));
+		}
+	}
+}
+
+bool ada_decoder::end_frame(uint8_t checksum)
+{
+	if (_failed
+		|| checksum != _checksum
+		|| 0 != _opRemaining
+		|| (ada_frame_type::delta != _type && _position != _ledCount))
+	{
+		_synced = false;
+		++_errors;
+		return false;
+	}
+
+	_synced = true;
+	_lastSequence = _sequence;
+	_version = 2;
+	++_frames;
+
+	return true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ada_protocol.h"
+
+// Portable reference decoder for the serial stream the driver sends to the LEDstream sketch,
+// in either protocol version (see ada_protocol.h). It takes the bytes one at a time the same
+// way the sketch does, and it follows the same rules for which frames to apply, so it can
+// stand in for the sketch when checking the encoder or running without an Arduino.
+//
+// The LEDs are decoded in place, so like on the Arduino a frame which fails its checksum
+// leaves them partly updated, and the decoder ignores deltas until the next key frame.
+class ada_decoder
+{
+public:
+	// Version 2 frames for more than maxV2Leds LEDs are skipped, the same as the sketch does
+	// when they don't fit in its buffer.
+	explicit ada_decoder(size_t maxV2Leds = ada_max_v2_leds);
+
+	// Feed the next byte from the stream. Returns true if it completed a frame.
+	bool push(uint8_t value);
+
+	// Feed a block of bytes, returning the number of frames they completed.
+	size_t push(const uint8_t* data, size_t size);
+
+	// R, G, B bytes for every LED as of the last frame.
+	const std::vector<uint8_t>& leds() const;
+
+	// Protocol version of the last frame.
+	int version() const;
+
+	// Number of frames decoded, and number of frames which failed their checksums or had to
+	// be skipped.
+	size_t frames() const;
+	size_t errors() const;
+
+private:
+	enum class state
+	{
+		header,
+		data,
+		payload,
+	};
+
+	// Check the bytes of the header we have so far. Returns false if they can't be the start
+	// of a header.
+	bool valid_header() const;
+
+	// Start a frame once we have the whole header.
+	void begin_frame();
+
+	// Decode the next payload byte of a version 2 frame.
+	void decode(uint8_t value);
+
+	// Check a finished version 2 frame. Returns true if it was applied.
+	bool end_frame(uint8_t checksum);
+
+	const size_t _maxV2Leds;
+	state _state = state::header;
+	std::array<uint8_t, ada_header_size + ada_frame_header_size> _header = {};
+	size_t _headerSize = 0;
+
+	std::vector<uint8_t> _leds;
+	size_t _ledCount = 0;
+	size_t _position = 0;
+	int _version = 0;
+	size_t _frames = 0;
+	size_t _errors = 0;
+
+	// State of the version 2 frame we're decoding.
+	ada_frame_type _type = ada_frame_type::raw;
+	uint8_t _sequence = 0;
+	size_t _payloadRemaining = 0;
+	uint8_t _checksum = 0;
+	uint8_t _op = 0;
+	size_t _opRemaining = 0;
+	size_t _colorByte = 0;
+	std::array<uint8_t, 3> _color = {};
+	bool _failed = false;
+
+	// The last version 2 frame we applied, which a delta has to follow.
+	bool _synced = false;
+	uint8_t _lastSequence = 0;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Constants for the serial protocol between the driver and the LEDstream sketch.
+//
+// Version 1 is the original protocol: the magic word "Ada", the LED count - 1 as a 16-bit
+// big endian value, a checksum of (high byte ^ low byte ^ 0x55), and then 3 bytes of R, G, B
+// for every LED.
+//
+// Version 2 starts with the same header but ends the magic word with '2' instead of 'a', so the
+// old sketch skips it. After that come 5 more bytes: the frame type, a sequence number which
+// counts up for every frame, the payload length as a 16-bit big endian value, and a checksum
+// of (type ^ sequence ^ length high ^ length low ^ 0x55). Then comes the payload, and finally
+// the XOR of all of the payload bytes.
+//
+// A raw frame's payload is the same 3 bytes per LED as version 1. The run-length and delta
+// frames are a series of ops, each a control byte with the op in the top 2 bits and the number
+// of LEDs - 1 (up to ada_max_run) in the rest:
+//   - literal: that many LEDs follow, 3 bytes each.
+//   - repeat: 3 bytes of one color follow, for that many LEDs.
+//   - skip: that many LEDs keep their color from the last frame, only in delta frames.
+// A run-length frame has to cover every LED, and a delta frame may stop early and leave the
+// rest of the LEDs as they were. The decoder only applies a delta frame if it follows the
+// frame with the previous sequence number, and it ignores deltas after any frame it missed or
+// couldn't decode until the next raw or run-length frame.
+//
+// Newer sketches also take commands shaped like a header, with a different third character:
+//   - "Ad?" asks what the device supports. It answers with a line of text, "Ada:" followed by
+//     the highest protocol version, the fastest baud rate it can switch to (0 for native USB
+//     boards which ignore the baud rate), the most LEDs it can decode in version 2 frames and
+//     the LED chip type, separated by spaces, e.g. "Ada:2 500000 400 WS2801\n".
+//   - "AdB" switches to the baud rate in the 16-bit value, in units of 100 baud. The device
+//     answers "AdaB\n" at the old rate and switches, then goes back to the default rate if it
+//     doesn't get a valid header or command at the new rate within ada_baud_revert_time ms.
+//   - "AdF" turns ready tokens on if the low byte is 1, or off if it's 0. The device answers
+//     "AdaF\n", and while they're on it sends a single ada_ready_token byte every time it
+//     latches a frame, so the driver can wait for it instead of sending faster than the LEDs
+//     can take the frames.
+// Older sketches skip these like any other header that doesn't match, and never answer, so they
+// stay at the default rate with version 1. Every sketch also sends "Ada\n" when it starts and
+// about once a second while it's idle.
+
+constexpr uint8_t ada_magic[] = { 'A', 'd', 'a' };
+constexpr uint8_t ada_magic_v2 = '2';
+constexpr size_t ada_header_size = sizeof(ada_magic) + 3;
+constexpr size_t ada_frame_header_size = 5;
+
+constexpr uint8_t ada_command_query = '?';
+constexpr uint8_t ada_command_baud_rate = 'B';
+constexpr uint32_t ada_baud_rate_unit = 100;
+constexpr uint32_t ada_default_baud_rate = 115200;
+constexpr uint32_t ada_baud_revert_time = 2000;
+constexpr uint8_t ada_command_flow_control = 'F';
+constexpr uint8_t ada_ready_token = 0x06;
+
+enum class ada_frame_type : uint8_t
+{
+	raw,
+	rle,
+	delta,
+};
+
+constexpr uint8_t ada_op_literal = 0x00;
+constexpr uint8_t ada_op_repeat = 0x40;
+constexpr uint8_t ada_op_skip = 0x80;
+constexpr uint8_t ada_op_mask = 0xC0;
+constexpr size_t ada_max_run = 64;
+
+// The sketch decodes version 2 frames into a buffer in RAM before it sends them to the LEDs,
+// so it can only handle a limited number of LEDs, which it reports in the capabilities. This
+// is MAX_LEDS in LEDstream.pde, and the driver sends version 1 frames to longer strips.
+constexpr size_t ada_max_v2_leds = 400;
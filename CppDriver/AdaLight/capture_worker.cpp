@@ -0,0 +1,92 @@
+#include "stdafx.h"
+#include "capture_worker.h"
+
+capture_worker::capture_worker(std::function<void()> job)
+	: _job(std::move(job))
+{
+	// Start the thread last, once everything it uses has been initialized.
+	_thread = std::thread(&capture_worker::run, this);
+}
+
+capture_worker::~capture_worker()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_stopping = true;
+	}
+
+	_started.notify_one();
+	_thread.join();
+}
+
+bool capture_worker::start()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (state::idle != _state)
+		{
+			return false;
+		}
+
+		_state = state::running;
+	}
+
+	_started.notify_one();
+
+	return true;
+}
+
+bool capture_worker::wait_until(clock::time_point deadline)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	return _finished.wait_until(lock, deadline, [this]()
+	{
+		return state::running != _state;
+	}) && state::finished == _state;
+}
+
+bool capture_worker::finished()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	return state::finished == _state;
+}
+
+void capture_worker::reset()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (state::finished == _state)
+	{
+		_state = state::idle;
+	}
+}
+
+void capture_worker::run()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	for (;;)
+	{
+		_started.wait(lock, [this]()
+		{
+			return _stopping || state::running == _state;
+		});
+
+		if (state::running != _state)
+		{
+			// We're stopping and there's no job left to finish.
+			return;
+		}
+
+		lock.unlock();
+		_job();
+		lock.lock();
+
+		_state = state::finished;
+		_finished.notify_all();
+	}
+}
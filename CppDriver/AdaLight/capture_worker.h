@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Run the capture and sampling for one display on a thread of its own, so the displays are
+// captured in parallel and a display which is slow to deliver a frame doesn't hold up the rest.
+//
+// Each frame screen_samples starts the job on every idle worker and then waits for all of them
+// up to a deadline. A worker which misses the deadline keeps running, and its results are picked
+// up on a later frame once it's finished.
+class capture_worker
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	explicit capture_worker(std::function<void()> job);
+
+	// Wait for the job to finish if it's running and stop the thread.
+	~capture_worker();
+
+	// Start the job if the worker is idle. Returns false if it's still running or it finished
+	// and nobody has collected the results yet.
+	bool start();
+
+	// Wait until the job finishes or the deadline passes. Returns true if the results are ready.
+	bool wait_until(clock::time_point deadline);
+
+	// Returns true if the job finished and nobody has collected the results yet.
+	bool finished();
+
+	// Go back to idle after collecting the results of a finished job.
+	void reset();
+
+private:
+	enum class state
+	{
+		idle,
+		running,
+		finished,
+	};
+
+	void run();
+
+	const std::function<void()> _job;
+	std::mutex _mutex;
+	std::condition_variable _started;
+	std::condition_variable _finished;
+	state _state = state::idle;
+	bool _stopping = false;
+	std::thread _thread;
+};
@@ -0,0 +1,289 @@
+#include "stdafx.h"
+#include "color_lut.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LUT_SSE2
+#include <emmintrin.h>
+#elif defined(_M_ARM) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define LUT_NEON
+#include <arm_neon.h>
+#endif
+
+#undef min
+#undef max
+
+// Each entry is padded to 4 floats so it loads into one register.
+constexpr size_t entry_size = 4;
+
+// The .cube format allows up to 256 entries on each side, but anything over 64 is rare.
+constexpr size_t max_lut_size = 256;
+
+#if defined(LUT_SSE2)
+
+typedef __m128 lut_entry;
+
+static inline lut_entry load_entry(const float* entry)
+{
+	return _mm_loadu_ps(entry);
+}
+
+static inline lut_entry lerp(lut_entry from, lut_entry to, float t)
+{
+	return _mm_add_ps(from, _mm_mul_ps(_mm_sub_ps(to, from), _mm_set1_ps(t)));
+}
+
+// Round each channel to the nearest level.
+static inline void store_levels(lut_entry entry, int32_t* levels)
+{
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(levels), _mm_cvtps_epi32(entry));
+}
+
+static const wchar_t* lut_name = L"SSE2";
+
+#elif defined(LUT_NEON)
+
+typedef float32x4_t lut_entry;
+
+static inline lut_entry load_entry(const float* entry)
+{
+	return vld1q_f32(entry);
+}
+
+static inline lut_entry lerp(lut_entry from, lut_entry to, float t)
+{
+	return vmlaq_n_f32(from, vsubq_f32(to, from), t);
+}
+
+static inline void store_levels(lut_entry entry, int32_t* levels)
+{
+	vst1q_s32(levels, vcvtq_s32_f32(vaddq_f32(entry, vdupq_n_f32(0.5f))));
+}
+
+static const wchar_t* lut_name = L"NEON";
+
+#else
+
+struct lut_entry
+{
+	float values[entry_size];
+};
+
+static inline lut_entry load_entry(const float* entry)
+{
+	lut_entry result;
+
+	std::copy(entry, entry + entry_size, result.values);
+
+	return result;
+}
+
+static inline lut_entry lerp(lut_entry from, lut_entry to, float t)
+{
+	for (size_t i = 0; i < entry_size; ++i)
+	{
+		from.values[i] += (to.values[i] - from.values[i]) * t;
+	}
+
+	return from;
+}
+
+static inline void store_levels(lut_entry entry, int32_t* levels)
+{
+	for (size_t i = 0; i < entry_size; ++i)
+	{
+		levels[i] = static_cast<int32_t>(entry.values[i] + 0.5f);
+	}
+}
+
+static const wchar_t* lut_name = L"Scalar";
+
+#endif
+
+bool color_lut::load(const std::wstring& path)
+{
+	_size = 0;
+	_table.clear();
+
+#ifdef _WIN32
+	std::ifstream ifs(path);
+#else
+	std::ifstream ifs(std::string(path.cbegin(), path.cend()));
+#endif
+
+	if (!ifs.is_open())
+	{
+		return false;
+	}
+
+	const float levels = static_cast<float>(gamma_correction::fine_levels - 1);
+	std::array<float, channels> domainMin = { 0.0f, 0.0f, 0.0f };
+	std::array<float, channels> domainMax = { 1.0f, 1.0f, 1.0f };
+	size_t size = 0;
+	std::vector<float> table;
+	std::string line;
+
+	while (std::getline(ifs, line))
+	{
+		std::istringstream iss(line);
+		std::string keyword;
+
+		if (!(iss >> keyword)
+			|| keyword[0] == '#'
+			|| keyword == "TITLE")
+		{
+			continue;
+		}
+		else if (keyword == "LUT_3D_SIZE")
+		{
+			if (!(iss >> size)
+				|| size < 2
+				|| size > max_lut_size)
+			{
+				return false;
+			}
+
+			table.reserve(size * size * size * entry_size);
+		}
+		else if (keyword == "DOMAIN_MIN"
+			|| keyword == "DOMAIN_MAX")
+		{
+			auto& domain = (keyword == "DOMAIN_MIN") ? domainMin : domainMax;
+
+			if (!(iss >> domain[0] >> domain[1] >> domain[2]))
+			{
+				return false;
+			}
+		}
+		else if (keyword == "LUT_3D_INPUT_RANGE")
+		{
+			float minimum, maximum;
+
+			if (!(iss >> minimum >> maximum))
+			{
+				return false;
+			}
+
+			domainMin.fill(minimum);
+			domainMax.fill(maximum);
+		}
+		else if (keyword == "LUT_1D_SIZE")
+		{
+			// We only handle 3D LUTs.
+			return false;
+		}
+		else if (isalpha(static_cast<unsigned char>(keyword[0])))
+		{
+			// Skip any other keywords some tools add.
+			continue;
+		}
+		else if (size == 0)
+		{
+			// The entries have to come after the size.
+			return false;
+		}
+		else
+		{
+			std::istringstream entry(line);
+			float r, g, b;
+
+			if (!(entry >> r >> g >> b)
+				|| table.size() == size * size * size * entry_size)
+			{
+				return false;
+			}
+
+			table.push_back(std::min(std::max(r, 0.0f), 1.0f) * levels);
+			table.push_back(std::min(std::max(g, 0.0f), 1.0f) * levels);
+			table.push_back(std::min(std::max(b, 0.0f), 1.0f) * levels);
+			table.push_back(0.0f);
+		}
+	}
+
+	if (size == 0
+		|| table.size() != size * size * size * entry_size)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < channels; ++i)
+	{
+		if (domainMax[i] <= domainMin[i])
+		{
+			return false;
+		}
+
+		_domainMin[i] = domainMin[i];
+		_domainScale[i] = static_cast<float>(size - 1) / (domainMax[i] - domainMin[i]);
+	}
+
+	_size = size;
+	_table = std::move(table);
+
+	return true;
+}
+
+bool color_lut::empty() const
+{
+	return _size == 0;
+}
+
+void color_lut::apply(size_t count, const int32_t* red, const int32_t* green, const int32_t* blue,
+	const gamma_correction& gamma, serial_buffer::vector_type::iterator output) const
+{
+	// The colors are in 8.8 fixed point, so 255 << 8 is full brightness.
+	constexpr int32_t full = 0xFF00;
+	const float inputScale = 1.0f / static_cast<float>(full);
+	const float last = static_cast<float>(_size - 1);
+	const size_t strides[channels] = { entry_size, _size * entry_size, _size * _size * entry_size };
+	const int32_t* colors[channels] = { red, green, blue };
+	const float* table = _table.data();
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		size_t offset = 0;
+		float fraction[channels];
+
+		// Find the entry below the color on each axis and how far it is towards the next one.
+		for (size_t channel = 0; channel < channels; ++channel)
+		{
+			const float value = static_cast<float>(std::min(std::max(colors[channel][i], 0), full)) * inputScale;
+			const float position = std::min(std::max((value - _domainMin[channel]) * _domainScale[channel], 0.0f), last);
+			const size_t index = std::min(static_cast<size_t>(position), _size - 2);
+
+			fraction[channel] = position - static_cast<float>(index);
+			offset += index * strides[channel];
+		}
+
+		const float* corner = table + offset;
+		const size_t r = strides[0];
+		const size_t g = strides[1];
+		const size_t b = strides[2];
+
+		// Interpolate along red, then green, then blue.
+		const lut_entry lower = lerp(
+			lerp(load_entry(corner), load_entry(corner + r), fraction[0]),
+			lerp(load_entry(corner + g), load_entry(corner + g + r), fraction[0]),
+			fraction[1]);
+		const lut_entry upper = lerp(
+			lerp(load_entry(corner + b), load_entry(corner + b + r), fraction[0]),
+			lerp(load_entry(corner + b + g), load_entry(corner + b + g + r), fraction[0]),
+			fraction[1]);
+		int32_t levels[entry_size];
+
+		store_levels(lerp(lower, upper, fraction[2]), levels);
+
+		*(output++) = gamma.fine_red(static_cast<uint16_t>(levels[0]));
+		*(output++) = gamma.fine_green(static_cast<uint16_t>(levels[1]));
+		*(output++) = gamma.fine_blue(static_cast<uint16_t>(levels[2]));
+	}
+}
+
+const wchar_t* color_lut::name()
+{
+	return lut_name;
+}
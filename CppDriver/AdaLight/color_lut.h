@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gamma_correction.h"
+#include "serial_buffer.h"
+
+// 3D lookup table which calibrates the colors of the LEDs, loaded from a .cube file like the
+// ones color grading and display calibration tools export.
+//
+// The entries are stored as 4 floats (R, G, B and padding) already scaled to the levels of the
+// fine gamma tables, so each LED is a trilinear interpolation between the 8 entries around its
+// color, done on all 3 channels at once in a SIMD register, and then a gamma lookup of the
+// result. That's a single pass over the LEDs from the blended colors to the serial data.
+class color_lut
+{
+public:
+	// Load a .cube file with a LUT_3D_SIZE. Returns false and leaves the table empty if the
+	// file is missing or can't be parsed.
+	bool load(const std::wstring& path);
+
+	bool empty() const;
+
+	// Calibrate and gamma correct a batch of colors, given as separate channels in 8.8 fixed
+	// point, and write them to the serial data as R, G, B bytes.
+	void apply(size_t count, const int32_t* red, const int32_t* green, const int32_t* blue,
+		const gamma_correction& gamma, serial_buffer::vector_type::iterator output) const;
+
+	// Name of the interpolation implementation, for diagnostics.
+	static const wchar_t* name();
+
+private:
+	static constexpr size_t channels = 3;
+
+	size_t _size = 0;
+	std::array<float, channels> _domainMin = {};
+	std::array<float, channels> _domainScale = {};
+	std::vector<float> _table;
+};
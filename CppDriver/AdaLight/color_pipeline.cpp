@@ -0,0 +1,226 @@
+#include "stdafx.h"
+#include "color_pipeline.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+color_pipeline::color_pipeline(const settings& parameters, const gamma_correction& gamma)
+	: _parameters(parameters)
+	, _gamma(gamma)
+	, _fade(static_cast<int32_t>(parameters.fade * 256.0 + 0.5))
+	, _weight(256 - _fade)
+	, _minBrightness(static_cast<int32_t>(parameters.minBrightness) << 8)
+	, _adaptive(parameters.temporalFilter.enabled)
+	, _previousMask(_adaptive ? 0xFFFF : 0xFF00)
+	, _smoothingRange(static_cast<float>(std::min(std::max(parameters.temporalFilter.smoothing, parameters.fade), 0.9) * 256.0) - static_cast<float>(_fade))
+	, _threshold(static_cast<int32_t>(std::max(parameters.temporalFilter.threshold, uint8_t(1))) << 8)
+	, _inverseThreshold(1.0f / static_cast<float>(_threshold))
+	, _sceneCutCount(std::max(static_cast<size_t>(std::ceil(parameters.temporalFilter.sceneCut * static_cast<double>(parameters.totalLedCount))), size_t(1)))
+{
+	if (!parameters.colorLut.empty()
+		&& !_lut.load(parameters.colorLut))
+	{
+#ifdef _DEBUG
+		OutputDebugStringW((L"Failed to load the color LUT: " + parameters.colorLut + L"\n").c_str());
+#endif
+	}
+}
+
+// One channel at a time keeps the loop simple enough for the compiler to vectorize. With fading
+// disabled the weight is 256 and this is just the average.
+static void blend_channel(size_t count, const int32_t* sums, const float* scale, const int32_t* previous, int32_t* colors, int32_t weight, int32_t fade)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		colors[i] = ((static_cast<int32_t>(static_cast<float>(sums[i]) * scale[i]) * weight) + (previous[i] * fade)) >> 8;
+	}
+}
+
+static void average_channel(size_t count, const int32_t* sums, const float* scale, int32_t* colors)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		colors[i] = static_cast<int32_t>(static_cast<float>(sums[i]) * scale[i]);
+	}
+}
+
+// Find the largest change of any channel from the previous color of each LED.
+static void measure_change(size_t count, const int32_t* red, const int32_t* green, const int32_t* blue,
+	const int32_t* previousRed, const int32_t* previousGreen, const int32_t* previousBlue, int32_t* change)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		change[i] = std::max(std::abs(red[i] - previousRed[i]),
+			std::max(std::abs(green[i] - previousGreen[i]), std::abs(blue[i] - previousBlue[i])));
+	}
+}
+
+// Turn the change for each LED into its fade, in place.
+static void adapt_fade(size_t count, int32_t* fades, int32_t fade, float range, float inverseThreshold)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		fades[i] = fade + static_cast<int32_t>(range * std::max(1.0f - (static_cast<float>(fades[i]) * inverseThreshold), 0.0f));
+	}
+}
+
+static void blend_adaptive(size_t count, int32_t* colors, const int32_t* previous, const int32_t* fades)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		colors[i] = ((colors[i] * (256 - fades[i])) + (previous[i] * fades[i])) >> 8;
+	}
+}
+
+void color_pipeline::reset()
+{
+	const size_t count = _parameters.totalLedCount;
+	const int32_t minimum = static_cast<int32_t>(_parameters.minBrightness / 3) << 8;
+
+	_sumRed.assign(count, 0);
+	_sumGreen.assign(count, 0);
+	_sumBlue.assign(count, 0);
+	_scale.assign(count, 0.0f);
+
+	_red.resize(count);
+	_green.resize(count);
+	_blue.resize(count);
+
+	_previousRed.assign(count, minimum);
+	_previousGreen.assign(count, minimum);
+	_previousBlue.assign(count, minimum);
+
+	_fades.resize(_adaptive ? count : 0);
+}
+
+void color_pipeline::set_samples(size_t index, const channel_sums& sums, uint32_t totalWeight)
+{
+	_sumRed[index] = static_cast<int32_t>(sums.r);
+	_sumGreen[index] = static_cast<int32_t>(sums.g);
+	_sumBlue[index] = static_cast<int32_t>(sums.b);
+	_scale[index] = 256.0f / static_cast<float>(totalWeight);
+}
+
+void color_pipeline::process(serial_buffer& serial, frame_telemetry& telemetry)
+{
+	const size_t count = _red.size();
+	const int32_t minBrightness = _minBrightness;
+	const int32_t minimum = minBrightness / 3;
+
+	int32_t* red = _red.data();
+	int32_t* green = _green.data();
+	int32_t* blue = _blue.data();
+
+	// Get the average RGB values in 8.8 fixed point and average in the previous color.
+	{
+		frame_telemetry::scoped_timer timer(telemetry, frame_telemetry::stage::filter);
+
+		if (_adaptive)
+		{
+			adaptive_blend(telemetry);
+		}
+		else
+		{
+			blend_channel(count, _sumRed.data(), _scale.data(), _previousRed.data(), red, _weight, _fade);
+			blend_channel(count, _sumGreen.data(), _scale.data(), _previousGreen.data(), green, _weight, _fade);
+			blend_channel(count, _sumBlue.data(), _scale.data(), _previousBlue.data(), blue, _weight, _fade);
+		}
+	}
+
+	frame_telemetry::scoped_timer timer(telemetry, frame_telemetry::stage::color);
+
+	// Boost pixels that fall below the minimum brightness. Black is spread equally to R, G and B,
+	// anything else spreads the "brightness deficit" back into R, G, and B in proportion to their
+	// individual contribition to that deficit. Rather than simply boosting all pixels at the low
+	// end, this allows deep (but saturated) colors to stay saturated...they don't "pink out."
+	for (size_t i = 0; i < count; ++i)
+	{
+		const int32_t r = red[i];
+		const int32_t g = green[i];
+		const int32_t b = blue[i];
+		const int32_t sum = r + g + b;
+		const int32_t deficit = std::max(minBrightness - sum, 0);
+		const float spread = static_cast<float>(deficit) / static_cast<float>((2 * sum) + (sum == 0));
+		const int32_t black = minimum & -static_cast<int32_t>(sum == 0);
+
+		red[i] = black + r + static_cast<int32_t>(static_cast<float>(sum - r) * spread);
+		green[i] = black + g + static_cast<int32_t>(static_cast<float>(sum - g) * spread);
+		blue[i] = black + b + static_cast<int32_t>(static_cast<float>(sum - b) * spread);
+	}
+
+	if (!_lut.empty())
+	{
+		// Keep the uncalibrated colors for the fades, and calibrate and gamma correct the 8.8
+		// fixed point colors in one pass.
+		for (size_t i = 0; i < count; ++i)
+		{
+			_previousRed[i] = std::min(red[i], 0xFFFF) & _previousMask;
+			_previousGreen[i] = std::min(green[i], 0xFFFF) & _previousMask;
+			_previousBlue[i] = std::min(blue[i], 0xFFFF) & _previousMask;
+		}
+
+		_lut.apply(count, red, green, blue, _gamma, serial.begin());
+		return;
+	}
+
+	// Truncate to 8 bits and write the gamma corrected values to the serial data.
+	auto output = serial.begin();
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const uint8_t ledR = static_cast<uint8_t>(std::min(red[i] >> 8, 0xFF));
+		const uint8_t ledG = static_cast<uint8_t>(std::min(green[i] >> 8, 0xFF));
+		const uint8_t ledB = static_cast<uint8_t>(std::min(blue[i] >> 8, 0xFF));
+
+		_previousRed[i] = std::min(red[i], 0xFFFF) & _previousMask;
+		_previousGreen[i] = std::min(green[i], 0xFFFF) & _previousMask;
+		_previousBlue[i] = std::min(blue[i], 0xFFFF) & _previousMask;
+
+		*(output++) = _gamma.red(ledR);
+		*(output++) = _gamma.green(ledG);
+		*(output++) = _gamma.blue(ledB);
+	}
+}
+
+void color_pipeline::adaptive_blend(frame_telemetry& telemetry)
+{
+	const size_t count = _red.size();
+	int32_t* red = _red.data();
+	int32_t* green = _green.data();
+	int32_t* blue = _blue.data();
+	int32_t* fades = _fades.data();
+
+	average_channel(count, _sumRed.data(), _scale.data(), red);
+	average_channel(count, _sumGreen.data(), _scale.data(), green);
+	average_channel(count, _sumBlue.data(), _scale.data(), blue);
+
+	measure_change(count, red, green, blue, _previousRed.data(), _previousGreen.data(), _previousBlue.data(), fades);
+
+	size_t moved = 0;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		moved += static_cast<size_t>(fades[i] > _threshold);
+	}
+
+	if (moved >= _sceneCutCount)
+	{
+		// Snap every LED to the new scene.
+		telemetry.add_scene_cut();
+		std::fill(_fades.begin(), _fades.end(), 0);
+	}
+	else
+	{
+		adapt_fade(count, fades, _fade, _smoothingRange, _inverseThreshold);
+	}
+
+	blend_adaptive(count, red, _previousRed.data(), fades);
+	blend_adaptive(count, green, _previousGreen.data(), fades);
+	blend_adaptive(count, blue, _previousBlue.data(), fades);
+}
+
+bool color_pipeline::calibrated() const
+{
+	return !_lut.empty();
+}
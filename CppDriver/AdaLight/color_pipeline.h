@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "settings.h"
+#include "gamma_correction.h"
+#include "serial_buffer.h"
+#include "sample_kernel.h"
+#include "color_lut.h"
+#include "frame_telemetry.h"
+
+// Turn the channel sums for every LED into serial data in one batch. The LEDs are stored as
+// separate arrays for each channel, and the average, fade and minimum brightness boost are
+// done in 8.8 fixed point without branches, so the compiler can vectorize each pass across
+// all of the LEDs.
+//
+// This matches the floating point math in the original C++ driver to within 1 step of each
+// 8-bit channel before gamma correction, and exactly unless it's fading and boosting the minimum
+// brightness at the same time (see color_pipeline_tests). The divisions in the average and the
+// brightness boost are multiplications by a float reciprocal, which may round the 8 fractional
+// bits differently from a double.
+//
+// With the temporal filter enabled, the fade for each LED adapts to how much it changed since
+// the last frame, with separate passes to measure the changes, count how many LEDs moved for
+// the scene cut detection, and work out the fade for each LED before blending.
+//
+// If the settings have a color LUT, the last pass calibrates the colors with it and looks up
+// the results in the fine gamma tables instead of truncating them to 8 bits first.
+class color_pipeline
+{
+public:
+	color_pipeline(const settings& parameters, const gamma_correction& gamma);
+
+	// Reset the previous colors for fades to the minimum brightness.
+	void reset();
+
+	// Store the channel sums sampled for an LED, where the weights of the pixels in the sums
+	// add up to totalWeight. The sums are kept until they are replaced, so an LED which is not
+	// sampled in a frame reuses the sums from the last frame.
+	void set_samples(size_t index, const channel_sums& sums, uint32_t totalWeight);
+
+	// Run every LED through the pipeline and write the gamma corrected colors to the serial data.
+	// The cost of the fades and the rest of the pipeline are added to separate stages.
+	void process(serial_buffer& serial, frame_telemetry& telemetry);
+
+	// Returns true if the colors are calibrated with a LUT.
+	bool calibrated() const;
+
+private:
+	// Blend the averages with the previous colors using the fade for each LED from the temporal
+	// filter.
+	void adaptive_blend(frame_telemetry& telemetry);
+
+	const settings& _parameters;
+	const gamma_correction& _gamma;
+	color_lut _lut;
+
+	// Weights of the previous and new colors in 8-bit fixed point, they always add up to 256.
+	const int32_t _fade;
+	const int32_t _weight;
+
+	// Minimum brightness of the sum of R, G and B in 8.8 fixed point.
+	const int32_t _minBrightness;
+
+	// The temporal filter blends the fade for each LED from the smoothing down to the regular
+	// fade as the change approaches the threshold in 8.8 fixed point, unless at least
+	// _sceneCutCount LEDs changed by more than the threshold.
+	const bool _adaptive;
+
+	// The previous colors are kept in 8.8 fixed point. Without the temporal filter they're
+	// truncated to the 8-bit colors we sent, but the filter keeps the fractions, or else heavy
+	// smoothing would stall short of the new color once each step rounds down to nothing.
+	const int32_t _previousMask;
+	const float _smoothingRange;
+	const int32_t _threshold;
+	const float _inverseThreshold;
+	const size_t _sceneCutCount;
+
+	std::vector<int32_t> _sumRed;
+	std::vector<int32_t> _sumGreen;
+	std::vector<int32_t> _sumBlue;
+	std::vector<float> _scale;
+
+	std::vector<int32_t> _red;
+	std::vector<int32_t> _green;
+	std::vector<int32_t> _blue;
+
+	std::vector<int32_t> _previousRed;
+	std::vector<int32_t> _previousGreen;
+	std::vector<int32_t> _previousBlue;
+
+	// Largest change of any channel for each LED, and then the fade for each LED.
+	std::vector<int32_t> _fades;
+};
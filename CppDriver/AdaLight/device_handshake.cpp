@@ -0,0 +1,125 @@
+#include "stdafx.h"
+#include "device_handshake.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+// Replies are short lines of text, anything longer is noise.
+constexpr size_t max_line_length = 64;
+
+constexpr char ack_line[] = "Ada";
+constexpr char baud_rate_line[] = "AdaB";
+constexpr char flow_control_line[] = "AdaF";
+constexpr char capabilities_prefix[] = "Ada:";
+
+// Rates we'll switch to, in ascending order. Besides the default, these all divide evenly from
+// the 16 MHz clock on most AVR boards, and the usual USB serial chips can handle them.
+constexpr uint32_t standard_baud_rates[] = { 250000, 500000, 1000000, 2000000 };
+
+device_handshake::command device_handshake::query()
+{
+	return { ada_magic[0], ada_magic[1], ada_command_query, 0, 0, 0x55 };
+}
+
+device_handshake::command device_handshake::set_baud_rate(uint32_t baudRate)
+{
+	const uint32_t units = baudRate / ada_baud_rate_unit;
+	const uint8_t hi = static_cast<uint8_t>(units >> 8);
+	const uint8_t lo = static_cast<uint8_t>(units);
+
+	return { ada_magic[0], ada_magic[1], ada_command_baud_rate, hi, lo, static_cast<uint8_t>(hi ^ lo ^ 0x55) };
+}
+
+device_handshake::command device_handshake::set_flow_control(bool enabled)
+{
+	const uint8_t lo = enabled ? 1 : 0;
+
+	return { ada_magic[0], ada_magic[1], ada_command_flow_control, 0, lo, static_cast<uint8_t>(lo ^ 0x55) };
+}
+
+uint32_t device_handshake::select_baud_rate(const device_capabilities& device, uint32_t maxBaudRate)
+{
+	const uint32_t limit = std::min(device.maxBaudRate, maxBaudRate);
+	uint32_t selected = ada_default_baud_rate;
+
+	for (const auto baudRate : standard_baud_rates)
+	{
+		if (baudRate <= limit)
+		{
+			selected = baudRate;
+		}
+	}
+
+	return selected;
+}
+
+device_handshake::reply device_handshake::push(uint8_t value)
+{
+	if ('\n' != value)
+	{
+		if (_line.size() < max_line_length)
+		{
+			_line.push_back(static_cast<char>(value));
+		}
+
+		return reply::none;
+	}
+
+	reply result = reply::none;
+
+	// Ignore anything before the start of the reply, e.g. a partial line from before we opened
+	// the port.
+	const size_t start = _line.rfind(ack_line);
+
+	if (std::string::npos != start)
+	{
+		_line.erase(0, start);
+
+		if (_line == ack_line)
+		{
+			result = reply::ack;
+		}
+		else if (_line == baud_rate_line)
+		{
+			result = reply::baud_rate;
+		}
+		else if (_line == flow_control_line)
+		{
+			result = reply::flow_control;
+		}
+		else if (0 == _line.compare(0, sizeof(capabilities_prefix) - 1, capabilities_prefix)
+			&& parse_capabilities())
+		{
+			result = reply::capabilities;
+		}
+	}
+
+	_line.clear();
+
+	return result;
+}
+
+const device_capabilities& device_handshake::capabilities() const
+{
+	return _capabilities;
+}
+
+bool device_handshake::parse_capabilities()
+{
+	std::istringstream iss(_line.substr(sizeof(capabilities_prefix) - 1));
+	device_capabilities capabilities;
+
+	if (!(iss >> capabilities.protocolVersion >> capabilities.maxBaudRate >> capabilities.maxLeds)
+		|| 0 == capabilities.protocolVersion)
+	{
+		return false;
+	}
+
+	// The chip type is optional.
+	iss >> capabilities.chip;
+	capabilities.extended = true;
+	_capabilities = std::move(capabilities);
+
+	return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "ada_protocol.h"
+
+// What the LEDstream sketch on the other end of the port supports. Older sketches don't answer
+// the capability query, so the defaults are what every sketch can do.
+struct device_capabilities
+{
+	// True if the device answered the capability query.
+	bool extended = false;
+
+	unsigned int protocolVersion = 1;
+
+	// Fastest baud rate the device can switch to, or 0 if it ignores the baud rate.
+	uint32_t maxBaudRate = ada_default_baud_rate;
+
+	// Most LEDs the device can decode in version 2 frames.
+	size_t maxLeds = ada_max_v2_leds;
+
+	// LED chip type, e.g. "WS2801", or empty if the device didn't say.
+	std::string chip;
+};
+
+// Portable half of the handshake with the sketch (see ada_protocol.h). It builds the commands
+// and parses the lines the device sends back, and the serial_port does the actual I/O.
+class device_handshake
+{
+public:
+	enum class reply
+	{
+		none,
+		ack,
+		capabilities,
+		baud_rate,
+		flow_control,
+	};
+
+	typedef std::array<uint8_t, ada_header_size> command;
+
+	// Ask the device what it supports.
+	static command query();
+
+	// Ask the device to switch to a different baud rate.
+	static command set_baud_rate(uint32_t baudRate);
+
+	// Ask the device to send a ready token after every frame it latches, or to stop.
+	static command set_flow_control(bool enabled);
+
+	// Pick the fastest standard rate up to maxBaudRate which the device supports, or the
+	// default rate if it can't switch or doesn't need to.
+	static uint32_t select_baud_rate(const device_capabilities& device, uint32_t maxBaudRate);
+
+	// Feed the next byte from the device. Returns the reply if it finished one.
+	reply push(uint8_t value);
+
+	// Capabilities from the last reply::capabilities.
+	const device_capabilities& capabilities() const;
+
+private:
+	bool parse_capabilities();
+
+	std::string _line;
+	device_capabilities _capabilities;
+};
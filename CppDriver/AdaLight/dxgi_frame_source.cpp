@@ -0,0 +1,344 @@
+#include "stdafx.h"
+#include "dxgi_frame_source.h"
+
+IDXGIFactory1Ptr dxgi_frame_source::s_factory;
+
+// Desktop formats we can sample, in order of preference.
+static const DXGI_FORMAT supported_formats[] = {
+	DXGI_FORMAT_R16G16B16A16_FLOAT,
+	DXGI_FORMAT_R10G10B10A2_UNORM,
+	DXGI_FORMAT_B8G8R8A8_UNORM,
+};
+
+static pixel_format to_pixel_format(DXGI_FORMAT format, bool hdr10)
+{
+	switch (format)
+	{
+		case DXGI_FORMAT_R16G16B16A16_FLOAT:
+			return pixel_format::r16g16b16a16_float;
+
+		case DXGI_FORMAT_R10G10B10A2_UNORM:
+			return hdr10
+				? pixel_format::r10g10b10a2_pq
+				: pixel_format::r10g10b10a2;
+
+		default:
+			return pixel_format::b8g8r8a8;
+	}
+}
+
+frame_source_list dxgi_frame_source::create_sources(const settings& parameters)
+{
+	frame_source_list sources;
+
+	if (!get_factory())
+	{
+		return sources;
+	}
+
+	sources.reserve(parameters.displays.size());
+
+	// Get the display dimensions and devices.
+	IDXGIAdapter1Ptr adapter;
+
+	for (UINT i = 0; sources.size() < parameters.displays.size() && SUCCEEDED(s_factory->EnumAdapters1(i, &adapter)); ++i)
+	{
+		IDXGIOutputPtr output;
+
+		for (UINT j = 0; sources.size() < parameters.displays.size() && SUCCEEDED(adapter->EnumOutputs(j, &output)); ++j)
+		{
+			IDXGIOutput1Ptr output1(output);
+			IDXGIOutput5Ptr output5(output);
+			IDXGIOutput6Ptr output6(output);
+			DXGI_OUTPUT_DESC outputDescription;
+			DXGI_OUTPUT_DESC1 outputDescription1;
+			IDXGIOutputDuplicationPtr duplication;
+			ID3D11DevicePtr device;
+			ID3D11DeviceContextPtr context;
+
+			constexpr D3D_DRIVER_TYPE driverType = D3D_DRIVER_TYPE_UNKNOWN;
+			constexpr ULONG createFlags = D3D11_CREATE_DEVICE_SINGLETHREADED | D3D11_CREATE_DEVICE_BGRA_SUPPORT;
+
+			if (output1
+				&& SUCCEEDED(output1->GetDesc(&outputDescription))
+				&& outputDescription.AttachedToDesktop
+				&& SUCCEEDED(D3D11CreateDevice(adapter, driverType, NULL, createFlags, nullptr, 0, D3D11_SDK_VERSION, &device, nullptr, &context))
+				&& ((output5 && SUCCEEDED(output5->DuplicateOutput1(device, 0, static_cast<UINT>(_countof(supported_formats)), supported_formats, &duplication)))
+					|| SUCCEEDED(output1->DuplicateOutput(device, &duplication))))
+			{
+				DXGI_OUTDUPL_DESC duplicationDescription;
+
+				duplication->GetDesc(&duplicationDescription);
+
+				const bool useMapDesktopSurface = !!duplicationDescription.DesktopImageInSystemMemory;
+				const bool hdr10 = output6
+					&& SUCCEEDED(output6->GetDesc1(&outputDescription1))
+					&& DXGI_COLOR_SPACE_RGB_FULL_G2084_NONE_P2020 == outputDescription1.ColorSpace;
+				ID3D11Texture2DPtr staging;
+				const RECT& bounds = outputDescription.DesktopCoordinates;
+				const LONG width = bounds.right - bounds.left;
+				const LONG height = bounds.bottom - bounds.top;
+
+				if (!useMapDesktopSurface)
+				{
+					D3D11_TEXTURE2D_DESC textureDescription;
+
+					textureDescription.Width = static_cast<UINT>(width);
+					textureDescription.Height = static_cast<UINT>(height);
+					textureDescription.MipLevels = 1;
+					textureDescription.ArraySize = 1;
+					textureDescription.Format = duplicationDescription.ModeDesc.Format;
+					textureDescription.SampleDesc.Count = 1;
+					textureDescription.SampleDesc.Quality = 0;
+					textureDescription.Usage = D3D11_USAGE_STAGING;
+					textureDescription.BindFlags = 0;
+					textureDescription.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+					textureDescription.MiscFlags = 0;
+
+					device->CreateTexture2D(&textureDescription, NULL, &staging);
+				}
+
+				if (useMapDesktopSurface || staging)
+				{
+					sources.push_back(std::make_unique<dxgi_frame_source>(
+						adapter,
+						device,
+						context,
+						duplication,
+						staging,
+						SIZE { width, height },
+						to_pixel_format(duplicationDescription.ModeDesc.Format, hdr10)
+					));
+				}
+			}
+
+			output.Release();
+		}
+
+		adapter.Release();
+	}
+
+	return sources;
+}
+
+dxgi_frame_source::dxgi_frame_source(IDXGIAdapter1Ptr adapter, ID3D11DevicePtr device, ID3D11DeviceContextPtr context, IDXGIOutputDuplicationPtr duplication, ID3D11Texture2DPtr staging, SIZE bounds, pixel_format format)
+	: _adapter(adapter)
+	, _device(device)
+	, _context(context)
+	, _duplication(duplication)
+	, _staging(staging)
+	, _bounds(bounds)
+	, _format(format)
+{
+}
+
+dxgi_frame_source::~dxgi_frame_source()
+{
+	if (_acquiredFrame)
+	{
+		_duplication->ReleaseFrame();
+		_acquiredFrame = false;
+	}
+}
+
+size_t dxgi_frame_source::width() const
+{
+	return static_cast<size_t>(_bounds.cx);
+}
+
+size_t dxgi_frame_source::height() const
+{
+	return static_cast<size_t>(_bounds.cy);
+}
+
+frame_status dxgi_frame_source::acquire_frame(UINT timeout)
+{
+	IDXGIResourcePtr resource;
+	DXGI_OUTDUPL_FRAME_INFO info;
+	ID3D11Texture2DPtr screenTexture;
+
+	if (_acquiredFrame)
+	{
+		_duplication->ReleaseFrame();
+		_acquiredFrame = false;
+	}
+
+	// We need to acquire the frame even if the desktop image is already in system memory, both
+	// so MapDesktopSurface has a frame to map and so we can tell when it hasn't changed.
+	HRESULT hr = _duplication->AcquireNextFrame(timeout, &info, &resource);
+
+	if (SUCCEEDED(hr))
+	{
+		_acquiredFrame = true;
+
+		if (0 == info.AccumulatedFrames
+			|| 0 == info.LastPresentTime.QuadPart)
+		{
+			// Only the mouse pointer moved, the desktop image is the same.
+			return frame_status::unchanged;
+		}
+
+		_changesKnown = read_metadata(info);
+
+		// Only the devices that require a staging texture need to take a screenshot.
+		if (_staging)
+		{
+			screenTexture = resource;
+
+			if (screenTexture)
+			{
+				_context->CopyResource(_staging, screenTexture);
+			}
+		}
+
+		return frame_status::available;
+	}
+	else if (DXGI_ERROR_ACCESS_LOST == hr
+		|| DXGI_ERROR_INVALID_CALL == hr)
+	{
+		// Recreate the duplication interface if this fails with with an expected error that invalidates
+		// the duplication interface or that might allow us to switch to MapDesktopSurface.
+		return frame_status::lost;
+	}
+	else if (DXGI_ERROR_WAIT_TIMEOUT == hr)
+	{
+		return frame_status::unchanged;
+	}
+
+	return frame_status::unavailable;
+}
+
+bool dxgi_frame_source::read_metadata(const DXGI_OUTDUPL_FRAME_INFO& info)
+{
+	_changes.clear();
+
+	if (0 == info.TotalMetadataBufferSize)
+	{
+		return false;
+	}
+
+	_metadata.resize(info.TotalMetadataBufferSize);
+
+	UINT moveSize = 0;
+
+	if (FAILED(_duplication->GetFrameMoveRects(static_cast<UINT>(_metadata.size()), reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT*>(_metadata.data()), &moveSize)))
+	{
+		return false;
+	}
+
+	const auto moves = reinterpret_cast<const DXGI_OUTDUPL_MOVE_RECT*>(_metadata.data());
+	const size_t moveCount = moveSize / sizeof(DXGI_OUTDUPL_MOVE_RECT);
+
+	// Both the source and destination of a move may have changed.
+	for (size_t i = 0; i < moveCount; ++i)
+	{
+		const auto& move = moves[i];
+		const LONG sourceLeft = move.SourcePoint.x;
+		const LONG sourceTop = move.SourcePoint.y;
+		const LONG sourceRight = sourceLeft + (move.DestinationRect.right - move.DestinationRect.left);
+		const LONG sourceBottom = sourceTop + (move.DestinationRect.bottom - move.DestinationRect.top);
+
+		_changes.push_back({ static_cast<size_t>(sourceLeft), static_cast<size_t>(sourceTop), static_cast<size_t>(sourceRight), static_cast<size_t>(sourceBottom) });
+		_changes.push_back({ static_cast<size_t>(move.DestinationRect.left), static_cast<size_t>(move.DestinationRect.top), static_cast<size_t>(move.DestinationRect.right), static_cast<size_t>(move.DestinationRect.bottom) });
+	}
+
+	UINT dirtySize = 0;
+
+	if (FAILED(_duplication->GetFrameDirtyRects(static_cast<UINT>(_metadata.size()), reinterpret_cast<RECT*>(_metadata.data()), &dirtySize)))
+	{
+		return false;
+	}
+
+	const auto dirty = reinterpret_cast<const RECT*>(_metadata.data());
+	const size_t dirtyCount = dirtySize / sizeof(RECT);
+
+	for (size_t i = 0; i < dirtyCount; ++i)
+	{
+		const auto& rect = dirty[i];
+
+		_changes.push_back({ static_cast<size_t>(rect.left), static_cast<size_t>(rect.top), static_cast<size_t>(rect.right), static_cast<size_t>(rect.bottom) });
+	}
+
+	return true;
+}
+
+frame_status dxgi_frame_source::map(frame_view& view)
+{
+	D3D11_MAPPED_SUBRESOURCE stagingMap;
+	DXGI_MAPPED_RECT desktopMap;
+
+	if (_staging)
+	{
+		if (FAILED(_context->Map(_staging, 0, D3D11_MAP_READ, 0, &stagingMap)))
+		{
+			return frame_status::unavailable;
+		}
+
+		view.pixels = reinterpret_cast<const uint8_t*>(stagingMap.pData);
+		view.pitch = static_cast<size_t>(stagingMap.RowPitch);
+	}
+	else
+	{
+		HRESULT hr = _duplication->MapDesktopSurface(&desktopMap);
+
+		if (DXGI_ERROR_ACCESS_LOST == hr
+			|| DXGI_ERROR_UNSUPPORTED == hr
+			|| DXGI_ERROR_INVALID_CALL == hr)
+		{
+			// Recreate the duplication interface if this fails with with an expected error that invalidates
+			// the duplication interface or requires that we switch to AcquireNextFrame.
+			return frame_status::lost;
+		}
+		else if (FAILED(hr))
+		{
+			return frame_status::unavailable;
+		}
+
+		view.pixels = reinterpret_cast<const uint8_t*>(desktopMap.pBits);
+		view.pitch = static_cast<size_t>(desktopMap.Pitch);
+	}
+
+	view.format = _format;
+	view.width = width();
+	view.height = height();
+
+	return frame_status::available;
+}
+
+void dxgi_frame_source::unmap()
+{
+	if (_staging)
+	{
+		_context->Unmap(_staging, 0);
+	}
+	else
+	{
+		_duplication->UnMapDesktopSurface();
+	}
+}
+
+bool dxgi_frame_source::dirty_rects(std::vector<pixel_rect>& rects)
+{
+	if (!_changesKnown)
+	{
+		return false;
+	}
+
+	rects = _changes;
+
+	// Treat everything as changed the next time unless we acquire a new frame.
+	_changes.clear();
+	_changesKnown = false;
+
+	return true;
+}
+
+bool dxgi_frame_source::get_factory()
+{
+	if (!s_factory)
+	{
+		CreateDXGIFactory1(_uuidof(IDXGIFactory1), reinterpret_cast<void**>(&s_factory));
+	}
+
+	return s_factory;
+}
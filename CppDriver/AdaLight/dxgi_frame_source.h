@@ -0,0 +1,66 @@
+#pragma once
+
+#include <comdef.h>
+#include <d3d11.h>
+#include <dxgi1_6.h>
+
+#include "frame_source.h"
+
+_COM_SMARTPTR_TYPEDEF(IDXGIFactory1, __uuidof(IDXGIFactory1));
+_COM_SMARTPTR_TYPEDEF(IDXGIAdapter1, __uuidof(IDXGIAdapter1));
+_COM_SMARTPTR_TYPEDEF(IDXGIOutput, __uuidof(IDXGIOutput));
+_COM_SMARTPTR_TYPEDEF(IDXGIOutput1, __uuidof(IDXGIOutput1));
+_COM_SMARTPTR_TYPEDEF(IDXGIOutput5, __uuidof(IDXGIOutput5));
+_COM_SMARTPTR_TYPEDEF(IDXGIOutput6, __uuidof(IDXGIOutput6));
+_COM_SMARTPTR_TYPEDEF(IDXGIOutputDuplication, __uuidof(IDXGIOutputDuplication));
+_COM_SMARTPTR_TYPEDEF(IDXGIResource, __uuidof(IDXGIResource));
+_COM_SMARTPTR_TYPEDEF(ID3D11Device, __uuidof(ID3D11Device));
+_COM_SMARTPTR_TYPEDEF(ID3D11DeviceContext, __uuidof(ID3D11DeviceContext));
+_COM_SMARTPTR_TYPEDEF(ID3D11Texture2D, __uuidof(ID3D11Texture2D));
+
+// Capture a display with the DXGI desktop duplication API. If the desktop image is not
+// already in system memory, each frame is copied to a staging texture that we can map.
+//
+// On Windows 10 and later we ask for the desktop in FP16 or 10-bit when HDR is turned on,
+// rather than letting DXGI convert it to 8-bit BGRA and clip everything above SDR white. A
+// 10-bit desktop is HDR10 if the output's color space uses the PQ curve, otherwise it's sRGB.
+class dxgi_frame_source
+	: public frame_source
+{
+public:
+	static frame_source_list create_sources(const settings& parameters);
+
+	dxgi_frame_source(IDXGIAdapter1Ptr adapter, ID3D11DevicePtr device, ID3D11DeviceContextPtr context, IDXGIOutputDuplicationPtr duplication, ID3D11Texture2DPtr staging, SIZE bounds, pixel_format format);
+	~dxgi_frame_source() override;
+
+	size_t width() const override;
+	size_t height() const override;
+
+	frame_status acquire_frame(UINT timeout) override;
+	frame_status map(frame_view& view) override;
+	void unmap() override;
+
+	bool dirty_rects(std::vector<pixel_rect>& rects) override;
+
+private:
+	static bool get_factory();
+
+	// Read the move and dirty rects for the frame we just acquired.
+	bool read_metadata(const DXGI_OUTDUPL_FRAME_INFO& info);
+
+	static IDXGIFactory1Ptr s_factory;
+
+	const IDXGIAdapter1Ptr _adapter;
+	const ID3D11DevicePtr _device;
+	const ID3D11DeviceContextPtr _context;
+	const IDXGIOutputDuplicationPtr _duplication;
+	const ID3D11Texture2DPtr _staging;
+	const SIZE _bounds;
+	const pixel_format _format;
+	bool _acquiredFrame = false;
+
+	// Changes reported by the duplication interface since the last frame we mapped.
+	std::vector<BYTE> _metadata;
+	std::vector<pixel_rect> _changes;
+	bool _changesKnown = false;
+};
@@ -0,0 +1,63 @@
+#include "stdafx.h"
+#include "frame_source.h"
+
+#include "synthetic_frame_source.h"
+#include "raw_frame_source.h"
+
+#ifdef _WIN32
+#include "dxgi_frame_source.h"
+#endif
+
+size_t pixel_size(pixel_format format)
+{
+	switch (format)
+	{
+		case pixel_format::r16g16b16a16_float:
+			return 8;
+
+		default:
+			return 4;
+	}
+}
+
+pixel_format configured_format(const settings& parameters)
+{
+	switch (parameters.frameSource.format)
+	{
+		case settings::frame_format::r10g10b10a2:
+			return pixel_format::r10g10b10a2;
+
+		case settings::frame_format::hdr10:
+			return pixel_format::r10g10b10a2_pq;
+
+		case settings::frame_format::fp16:
+			return pixel_format::r16g16b16a16_float;
+
+		default:
+			return pixel_format::b8g8r8a8;
+	}
+}
+
+bool frame_source::dirty_rects(std::vector<pixel_rect>& /*rects*/)
+{
+	return false;
+}
+
+frame_source_list create_frame_sources(const settings& parameters)
+{
+	switch (parameters.frameSource.type)
+	{
+		case settings::source_type::synthetic:
+			return synthetic_frame_source::create_sources(parameters);
+
+		case settings::source_type::raw_file:
+			return raw_frame_source::create_sources(parameters);
+
+		default:
+#ifdef _WIN32
+			return dxgi_frame_source::create_sources(parameters);
+#else
+			return frame_source_list();
+#endif
+	}
+}
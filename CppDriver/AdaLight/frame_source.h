@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "settings.h"
+
+// Pixel layouts which a frame_source may hand to the sampler.
+enum class pixel_format
+{
+	// 32-bit pixels stored as B, G, R, A bytes.
+	b8g8r8a8,
+
+	// 32-bit pixels with 10 bits each of R, G and B from the low bits up, and 2 bits of A, in
+	// SDR sRGB.
+	r10g10b10a2,
+
+	// The same layout in HDR10, with BT.2020 primaries and the SMPTE ST 2084 (PQ) curve, where
+	// 1.0 is 10000 nits.
+	r10g10b10a2_pq,
+
+	// 64-bit pixels with R, G, B, A half floats in linear scRGB, where 1.0 is 80 nits.
+	r16g16b16a16_float,
+};
+
+// Bytes per pixel in a format.
+size_t pixel_size(pixel_format format);
+
+// Format of the frames the synthetic and raw file sources produce. DXGI sources use whatever
+// format the desktop duplication hands back.
+pixel_format configured_format(const settings& parameters);
+
+// Result of acquiring or mapping a frame from a frame_source.
+enum class frame_status
+{
+	// The pixels are available.
+	available,
+
+	// No new frame arrived, so the pixels are the same as the last frame.
+	unchanged,
+
+	// The pixels are not available this time, but the source is still usable.
+	unavailable,
+
+	// The source was lost and every frame_source needs to be recreated.
+	lost,
+};
+
+// Rectangle of pixels from left/top up to but not including right/bottom.
+struct pixel_rect
+{
+	size_t left;
+	size_t top;
+	size_t right;
+	size_t bottom;
+};
+
+// A mapped view of the pixels in a captured frame. The pixels are only valid until
+// the frame_source is unmapped.
+struct frame_view
+{
+	const uint8_t* pixels;
+	size_t pitch;
+	pixel_format format;
+	size_t width;
+	size_t height;
+};
+
+// Interface to one display worth of captured frames, which decouples screen_samples
+// from the DXGI desktop duplication API.
+class frame_source
+{
+public:
+	virtual ~frame_source() = default;
+
+	// Dimensions of the display in pixels.
+	virtual size_t width() const = 0;
+	virtual size_t height() const = 0;
+
+	// Capture the next frame, waiting at most timeout milliseconds for it to arrive. If the
+	// frame does not arrive in time, or it has the same content as the last frame, this
+	// returns unchanged and there's no need to map it.
+	virtual frame_status acquire_frame(UINT timeout) = 0;
+
+	// Map the most recently acquired frame for reading. Every successful call to map must
+	// be followed by a call to unmap before the next call to acquire_frame.
+	virtual frame_status map(frame_view& view) = 0;
+	virtual void unmap() = 0;
+
+	// Get the parts of the mapped frame which changed since the last frame we mapped. Sources
+	// which can't tell return false, and then the caller should look for changes itself.
+	virtual bool dirty_rects(std::vector<pixel_rect>& rects);
+};
+
+typedef std::vector<std::unique_ptr<frame_source>> frame_source_list;
+
+// Create a frame_source for each of the displays in the settings using the configured
+// frameSource type. If the list is empty none of the displays could be captured.
+frame_source_list create_frame_sources(const settings& parameters);
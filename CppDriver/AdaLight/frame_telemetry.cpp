@@ -0,0 +1,160 @@
+#include "stdafx.h"
+#include "frame_telemetry.h"
+
+static constexpr const wchar_t* stage_names[] = {
+	L"Acquire",
+	L"Map",
+	L"Letterbox",
+	L"Changes",
+	L"Table",
+	L"Pyramid",
+	L"Sample",
+	L"Filter",
+	L"Color",
+};
+
+static_assert(_countof(stage_names) == static_cast<size_t>(frame_telemetry::stage::count), "size mismatch!");
+
+frame_telemetry::scoped_timer::scoped_timer(frame_telemetry& telemetry, stage counter)
+	: _telemetry(telemetry)
+	, _counter(counter)
+	, _start(clock::now())
+{
+}
+
+frame_telemetry::scoped_timer::~scoped_timer()
+{
+	_telemetry.add(_counter, clock::now() - _start);
+}
+
+void frame_telemetry::add(stage counter, clock::duration elapsed)
+{
+	auto& entry = _stages[static_cast<size_t>(counter)];
+
+	entry.elapsed += elapsed;
+	++entry.calls;
+}
+
+void frame_telemetry::next_frame()
+{
+	++_frames;
+}
+
+void frame_telemetry::reset()
+{
+	_stages = {};
+	_stalls.clear();
+	_sceneCuts = 0;
+	_frames = 0;
+}
+
+void frame_telemetry::merge(frame_telemetry& other)
+{
+	for (size_t i = 0; i < _stages.size(); ++i)
+	{
+		_stages[i].elapsed += other._stages[i].elapsed;
+		_stages[i].calls += other._stages[i].calls;
+	}
+
+	other._stages = {};
+}
+
+void frame_telemetry::add_stall(size_t display)
+{
+	if (display >= _stalls.size())
+	{
+		_stalls.resize(display + 1, 0);
+	}
+
+	++_stalls[display];
+}
+
+void frame_telemetry::add_scene_cut()
+{
+	++_sceneCuts;
+}
+
+void frame_telemetry::set_led_count(size_t ledCount)
+{
+	_ledCount = ledCount;
+}
+
+size_t frame_telemetry::frames() const
+{
+	return _frames;
+}
+
+size_t frame_telemetry::stalls(size_t display) const
+{
+	return (display < _stalls.size()) ? _stalls[display] : 0;
+}
+
+size_t frame_telemetry::scene_cuts() const
+{
+	return _sceneCuts;
+}
+
+double frame_telemetry::milliseconds_per_frame(stage counter) const
+{
+	if (_frames == 0)
+	{
+		return 0.0;
+	}
+
+	const auto elapsed = std::chrono::duration<double, std::milli>(_stages[static_cast<size_t>(counter)].elapsed);
+
+	return elapsed.count() / static_cast<double>(_frames);
+}
+
+double frame_telemetry::calls_per_frame(stage counter) const
+{
+	if (_frames == 0)
+	{
+		return 0.0;
+	}
+
+	return static_cast<double>(_stages[static_cast<size_t>(counter)].calls) / static_cast<double>(_frames);
+}
+
+double frame_telemetry::per_led_map_milliseconds() const
+{
+	const double calls = calls_per_frame(stage::map);
+
+	if (calls == 0.0)
+	{
+		return 0.0;
+	}
+
+	// Every LED paid for a map and an unmap.
+	return milliseconds_per_frame(stage::map) / calls * static_cast<double>(_ledCount * 2);
+}
+
+void frame_telemetry::report(std::wostream& os) const
+{
+	for (size_t i = 0; i < _stages.size(); ++i)
+	{
+		const auto counter = static_cast<stage>(i);
+
+		os << stage_names[i] << L": " << milliseconds_per_frame(counter) << L" ms/frame ("
+			<< calls_per_frame(counter) << L" calls/frame)" << std::endl;
+	}
+
+	if (_ledCount > 0)
+	{
+		os << L"Map once per LED: " << per_led_map_milliseconds() << L" ms/frame ("
+			<< (_ledCount * 2) << L" calls/frame)" << std::endl;
+	}
+
+	for (size_t i = 0; i < _stalls.size(); ++i)
+	{
+		if (_stalls[i] > 0)
+		{
+			os << L"Display " << i << L" stalls: " << _stalls[i] << L" frames" << std::endl;
+		}
+	}
+
+	if (_sceneCuts > 0)
+	{
+		os << L"Scene cuts: " << _sceneCuts << L" frames" << std::endl;
+	}
+}
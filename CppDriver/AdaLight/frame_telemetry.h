@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+// Accumulate how much time each stage of screen_samples::take_samples spends per frame, so
+// we can report the average cost of each stage along with the frame rate.
+class frame_telemetry
+{
+public:
+	enum class stage
+	{
+		acquire,
+		map,
+		letterbox,
+		changes,
+		table,
+		pyramid,
+		sample,
+		filter,
+		color,
+
+		count
+	};
+
+	typedef std::chrono::steady_clock clock;
+
+	// Add the time elapsed since construction to a stage when it goes out of scope.
+	class scoped_timer
+	{
+	public:
+		scoped_timer(frame_telemetry& telemetry, stage counter);
+		~scoped_timer();
+
+	private:
+		frame_telemetry& _telemetry;
+		const stage _counter;
+		const clock::time_point _start;
+	};
+
+	void add(stage counter, clock::duration elapsed);
+	void next_frame();
+	void reset();
+
+	// Add the stage times from another instance, e.g. one a capture worker kept for a display
+	// while it ran on its own thread, and then clear them there. The frame count stays the same,
+	// so the time per frame is the total across all of the displays.
+	void merge(frame_telemetry& other);
+
+	// Count a frame where a display missed the deadline and reused its last colors.
+	void add_stall(size_t display);
+
+	// Count a frame where the temporal filter detected a scene cut and skipped the fades.
+	void add_scene_cut();
+
+	// Number of LEDs in the strip, which report() uses to compare the map stage with mapping
+	// the frame for every LED. It isn't cleared by reset().
+	void set_led_count(size_t ledCount);
+
+	size_t frames() const;
+	size_t stalls(size_t display) const;
+	size_t scene_cuts() const;
+
+	// Average time in milliseconds and number of calls per frame for a stage.
+	double milliseconds_per_frame(stage counter) const;
+	double calls_per_frame(stage counter) const;
+
+	// What the map stage would cost per frame at the same time per call if we still mapped and
+	// unmapped the frame for every LED, instead of once for each display.
+	double per_led_map_milliseconds() const;
+
+	// Write the average cost per frame of each stage on a separate line, followed by the map
+	// stage for every LED to compare with, the stall count for each display and the scene cut
+	// count if there were any.
+	void report(std::wostream& os) const;
+
+private:
+	struct stage_counter
+	{
+		clock::duration elapsed;
+		size_t calls;
+	};
+
+	std::array<stage_counter, static_cast<size_t>(stage::count)> _stages = {};
+	std::vector<size_t> _stalls;
+	size_t _sceneCuts = 0;
+	size_t _frames = 0;
+	size_t _ledCount = 0;
+};
@@ -5,7 +5,7 @@
 
 gamma_correction::gamma_correction()
 {
-	for (size_t i = 0; i <= _countof(_table); i++)
+	for (size_t i = 0; i < _countof(_table); i++)
 	{
 		const double f = pow(static_cast<double>(i) / 255.0, 2.8);
 
@@ -13,6 +13,15 @@ gamma_correction::gamma_correction()
 		_table[i].g = static_cast<uint8_t>(f * 240.0);
 		_table[i].b = static_cast<uint8_t>(f * 220.0);
 	}
+
+	for (size_t i = 0; i < _countof(_fineTable); i++)
+	{
+		const double f = pow(static_cast<double>(i) / static_cast<double>(fine_levels - 1), 2.8);
+
+		_fineTable[i].r = static_cast<uint8_t>(f * 255.0);
+		_fineTable[i].g = static_cast<uint8_t>(f * 240.0);
+		_fineTable[i].b = static_cast<uint8_t>(f * 220.0);
+	}
 }
 
 uint8_t gamma_correction::red(uint8_t r) const
@@ -29,3 +38,18 @@ uint8_t gamma_correction::blue(uint8_t b) const
 {
 	return _table[b].b;
 }
+
+uint8_t gamma_correction::fine_red(uint16_t r) const
+{
+	return _fineTable[r].r;
+}
+
+uint8_t gamma_correction::fine_green(uint16_t g) const
+{
+	return _fineTable[g].g;
+}
+
+uint8_t gamma_correction::fine_blue(uint16_t b) const
+{
+	return _fineTable[b].b;
+}
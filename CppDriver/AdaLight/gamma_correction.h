@@ -1,16 +1,25 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 class gamma_correction
 {
 public:
+	// Number of levels in the fine tables, for colors with more than 8 bits of precision.
+	static constexpr size_t fine_levels = 4096;
+
 	gamma_correction();
 
 	uint8_t red(uint8_t r) const;
 	uint8_t green(uint8_t g) const;
 	uint8_t blue(uint8_t b) const;
 
+	// Look up a color with 12 bits of precision, e.g. the output of the color_lut.
+	uint8_t fine_red(uint16_t r) const;
+	uint8_t fine_green(uint16_t g) const;
+	uint8_t fine_blue(uint16_t b) const;
+
 private:
 	struct levels
 	{
@@ -20,4 +29,5 @@ private:
 	};
 
 	levels _table[256];
+	levels _fineTable[fine_levels];
 };
@@ -0,0 +1,29 @@
+#pragma once
+
+// Constants for the HDR frame formats, shared by the pixel_converter which decodes them and the
+// synthetic_frame_source which encodes its test pattern in them.
+
+// scRGB measures brightness in units of 80 nits.
+constexpr double scrgb_nits = 80.0;
+
+// SMPTE ST 2084 (PQ) curve used by HDR10, where 1.0 is 10000 nits.
+constexpr double pq_max_nits = 10000.0;
+constexpr double pq_m1 = 2610.0 / 16384.0;
+constexpr double pq_m2 = (2523.0 / 4096.0) * 128.0;
+constexpr double pq_c1 = 3424.0 / 4096.0;
+constexpr double pq_c2 = (2413.0 / 4096.0) * 32.0;
+constexpr double pq_c3 = (2392.0 / 4096.0) * 32.0;
+
+// Convert linear R, G, B between the BT.2020 primaries of HDR10 and the BT.709 primaries of
+// sRGB and scRGB. Each row is the weights of the source channels for one output channel.
+constexpr double bt2020_to_bt709[3][3] = {
+	{ 1.660491, -0.587641, -0.072850 },
+	{ -0.124550, 1.132900, -0.008349 },
+	{ -0.018151, -0.100579, 1.118730 },
+};
+
+constexpr double bt709_to_bt2020[3][3] = {
+	{ 0.627404, 0.329283, 0.043313 },
+	{ 0.069097, 0.919540, 0.011362 },
+	{ 0.016391, 0.088013, 0.895595 },
+};
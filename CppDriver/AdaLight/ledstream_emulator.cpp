@@ -0,0 +1,635 @@
+#include "stdafx.h"
+#include "ledstream_emulator.h"
+
+#include <algorithm>
+#include <sstream>
+#include <tuple>
+
+#undef min
+#undef max
+
+constexpr size_t bytes_per_led = 3;
+
+// Serial sends 10 bits for every byte with 8N1.
+constexpr uint64_t bits_per_byte = 10;
+
+// The receive buffer in the Arduino core, and how much the host's serial driver buffers before
+// its writes block.
+constexpr size_t receive_buffer_size = 64;
+constexpr size_t transmit_queue_size = 4096;
+
+// The sketch starts holding off the LEDs when it has less than this much buffered.
+constexpr size_t underrun_threshold = 32;
+
+// Timing from LEDstream.pde, in us for the latch and ms for the rest.
+constexpr uint64_t latch_time = 1000;
+constexpr uint64_t ack_interval = 1000;
+constexpr uint64_t serial_timeout = 15000;
+
+// How many LEDs the sketch turns off after the timeout, and how many LEDs each color of the
+// test pattern covers.
+constexpr size_t blackout_leds = 10922;
+constexpr size_t test_pattern_leds = 25000;
+
+// What a byte looks like when the baud rates don't match. The real thing is random garbage
+// with framing errors, but it's just as useless to the sketch.
+constexpr uint8_t garbled_byte = 0xFF;
+
+// How many bytes showColor() in the sketch sends to set ledCount LEDs to one color, with the
+// framing of the chip it was built for.
+static uint64_t show_color_bytes(const std::string& chip, size_t ledCount)
+{
+	if ("APA102" == chip)
+	{
+		return 4 + (4 * ledCount) + ((ledCount + 15) / 16);
+	}
+
+	if ("LPD8806" == chip)
+	{
+		return (bytes_per_led * ledCount) + (((ledCount + 63) / 64) * 3);
+	}
+
+	return bytes_per_led * ledCount;
+}
+
+ledstream_emulator::ledstream_emulator(const config& parameters)
+	: _parameters(parameters)
+	, _spiByteTime((8 * 1000000ULL) / std::max<uint32_t>(parameters.spiClock, 1))
+	, _frame(parameters.maxLeds * bytes_per_led, 0)
+{
+	reset(0);
+}
+
+void ledstream_emulator::reset(uint64_t now)
+{
+	_now = now;
+	_spiDone = now;
+	_wire.clear();
+	_receive.clear();
+	_lastArrival = now;
+	_baudRate = ada_default_baud_rate;
+	_transmit.clear();
+	_shifted.clear();
+	_sketch = sketch_state();
+
+	// Red, green, blue and then off, with a latch after each.
+	if (_parameters.testPattern)
+	{
+		_now += 4 * ((show_color_bytes(_parameters.chip, test_pattern_leds) * _spiByteTime) + latch_time);
+		std::fill(_leds.begin(), _leds.end(), 0);
+	}
+
+	print("Ada\n");
+
+	_sketch.startTime = _now;
+	_sketch.lastByteTime = _sketch.lastAckTime = _now / 1000;
+}
+
+void ledstream_emulator::receive(const uint8_t* data, size_t size, uint64_t now, uint32_t hostBaudRate)
+{
+	const uint32_t baudRate = (0 != hostBaudRate) ? hostBaudRate : _baudRate;
+	const uint64_t byteTime = native_usb()
+		? std::max<uint64_t>(1000000 / std::max<uint32_t>(_parameters.usbBytesPerSecond, 1), 1)
+		: std::max<uint64_t>(((bits_per_byte * 1000000) + (baudRate / 2)) / baudRate, 1);
+
+	_lastArrival = std::max(_lastArrival, now);
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		_lastArrival += byteTime;
+		_wire.push_back({ _lastArrival, data[i], baudRate });
+	}
+}
+
+size_t ledstream_emulator::receive_space() const
+{
+	// Native USB only takes another packet once the last one fits in the receive buffer.
+	const size_t limit = native_usb()
+		? 2 * receive_buffer_size
+		: transmit_queue_size;
+
+	return (_wire.size() < limit) ? limit - _wire.size() : 0;
+}
+
+void ledstream_emulator::run(uint64_t now)
+{
+	while (_now < now)
+	{
+		step(now);
+	}
+}
+
+std::vector<uint8_t> ledstream_emulator::transmit()
+{
+	std::vector<uint8_t> data;
+
+	data.swap(_transmit);
+
+	return data;
+}
+
+const std::vector<uint8_t>& ledstream_emulator::leds() const
+{
+	return _leds;
+}
+
+uint32_t ledstream_emulator::baud_rate() const
+{
+	return _baudRate;
+}
+
+const ledstream_emulator::statistics& ledstream_emulator::stats() const
+{
+	return _stats;
+}
+
+bool ledstream_emulator::native_usb() const
+{
+	return 0 == _parameters.maxBaudRate;
+}
+
+void ledstream_emulator::deliver()
+{
+	while (!_wire.empty()
+		&& _wire.front().arrival <= _now)
+	{
+		const auto& next = _wire.front();
+
+		if (_receive.size() >= receive_buffer_size)
+		{
+			if (native_usb())
+			{
+				// USB holds the rest until the sketch makes room.
+				break;
+			}
+
+			++_stats.droppedBytes;
+		}
+		else if (!native_usb()
+			&& next.baudRate != _baudRate)
+		{
+			_receive.push_back(garbled_byte);
+			++_stats.garbledBytes;
+		}
+		else
+		{
+			_receive.push_back(next.value);
+		}
+
+		_wire.pop_front();
+	}
+}
+
+void ledstream_emulator::step(uint64_t limit)
+{
+	deliver();
+
+	const uint64_t t = _now / 1000;
+	const auto before = std::make_tuple(_sketch.mode, _sketch.bytesBuffered, _sketch.bytesRemaining, _sketch.payloadRemaining);
+	bool received = false;
+
+	// Regardless of mode, check for serial input each time.
+	if (_sketch.bytesBuffered < _sketch.buffer.size()
+		&& !_receive.empty())
+	{
+		_sketch.buffer[_sketch.indexIn++] = _receive.front();
+		_receive.pop_front();
+		++_sketch.bytesBuffered;
+		_sketch.lastByteTime = _sketch.lastAckTime = t;
+		received = true;
+	}
+	else
+	{
+		if (t - _sketch.lastAckTime > ack_interval)
+		{
+			print("Ada\n");
+			_sketch.lastAckTime = t;
+		}
+
+		if (t - _sketch.lastByteTime > serial_timeout)
+		{
+			blackout();
+			_sketch.lastByteTime = t;
+			_sketch.readyTokens = false;
+		}
+	}
+
+	if (_sketch.baudPending
+		&& t - _sketch.baudTime > ada_baud_revert_time)
+	{
+		_baudRate = ada_default_baud_rate;
+		_sketch.baudPending = false;
+	}
+
+	switch (_sketch.mode)
+	{
+		case sketch_mode::header:
+			find_header();
+			break;
+
+		case sketch_mode::frame:
+			decode_frame_header();
+			break;
+
+		case sketch_mode::payload:
+			decode_payload();
+			break;
+
+		case sketch_mode::hold:
+			if (_now - _sketch.startTime < _sketch.hold)
+			{
+				break;
+			}
+
+			_sketch.mode = sketch_mode::data;
+			issue_data();
+			break;
+
+		case sketch_mode::data:
+			issue_data();
+			break;
+	}
+
+	_now += _parameters.loopTime;
+
+	// If the sketch is just waiting, skip ahead to the next thing it's waiting for instead of
+	// spinning through the loop.
+	if (!received
+		&& _receive.empty()
+		&& before == std::make_tuple(_sketch.mode, _sketch.bytesBuffered, _sketch.bytesRemaining, _sketch.payloadRemaining))
+	{
+		_now = std::max(_now, std::min(limit, next_event()));
+	}
+}
+
+void ledstream_emulator::find_header()
+{
+	if (_sketch.bytesBuffered < ada_header_size)
+	{
+		return;
+	}
+
+	// Check for a 'magic word' match. The last character is 'a' for the original protocol, '2'
+	// for version 2, or one of the commands.
+	uint8_t i = 0;
+
+	for (; i < sizeof(ada_magic) - 1
+		&& _sketch.buffer[static_cast<uint8_t>(_sketch.indexOut + i)] == ada_magic[i]; ++i);
+
+	const uint8_t c = _sketch.buffer[static_cast<uint8_t>(_sketch.indexOut + i)];
+
+	if (i != sizeof(ada_magic) - 1
+		|| (c != ada_magic[i]
+			&& c != ada_magic_v2
+			&& c != ada_command_query
+			&& c != ada_command_baud_rate
+			&& c != ada_command_flow_control))
+	{
+		// Resume at the first mismatched byte, which might be the start of the next magic word.
+		i = std::max<uint8_t>(i, 1);
+		_sketch.indexOut += i;
+		_sketch.bytesBuffered -= i;
+		return;
+	}
+
+	const uint8_t hi = _sketch.buffer[static_cast<uint8_t>(_sketch.indexOut + sizeof(ada_magic))];
+	const uint8_t lo = _sketch.buffer[static_cast<uint8_t>(_sketch.indexOut + sizeof(ada_magic) + 1)];
+	const uint8_t chk = _sketch.buffer[static_cast<uint8_t>(_sketch.indexOut + sizeof(ada_magic) + 2)];
+
+	if (chk != (hi ^ lo ^ 0x55))
+	{
+		// Search resumes after the magic word.
+		_sketch.indexOut += sizeof(ada_magic);
+		_sketch.bytesBuffered -= sizeof(ada_magic);
+		return;
+	}
+
+	_sketch.indexOut += ada_header_size;
+	_sketch.bytesBuffered -= ada_header_size;
+	_sketch.baudPending = false;
+
+	if (ada_command_query == c)
+	{
+		std::ostringstream oss;
+
+		oss << "Ada:2 " << _parameters.maxBaudRate << ' ' << _parameters.maxLeds << ' ' << _parameters.chip << '\n';
+		print(oss.str());
+		return;
+	}
+	else if (ada_command_baud_rate == c)
+	{
+		const uint32_t baud = ada_baud_rate_unit * ((static_cast<uint32_t>(hi) << 8) | lo);
+
+		if (baud >= ada_default_baud_rate
+			&& baud <= _parameters.maxBaudRate)
+		{
+			print("AdaB\n");
+			_baudRate = baud;
+			_sketch.baudPending = true;
+			_sketch.baudTime = _now / 1000;
+		}
+
+		return;
+	}
+	else if (ada_command_flow_control == c)
+	{
+		_sketch.readyTokens = (0 != lo);
+		print("AdaF\n");
+		return;
+	}
+
+	_sketch.version = c;
+	_sketch.ledCount = ((static_cast<size_t>(hi) << 8) | lo) + 1;
+
+	if (ada_magic_v2 == c)
+	{
+		_sketch.mode = sketch_mode::frame;
+	}
+	else
+	{
+		// This frame replaces whatever a version 2 delta would build on.
+		_sketch.bytesRemaining = bytes_per_led * _sketch.ledCount;
+		_sketch.synced = false;
+		_sketch.spiFlag = false;
+		_sketch.mode = sketch_mode::hold;
+	}
+}
+
+void ledstream_emulator::decode_frame_header()
+{
+	if (_sketch.bytesBuffered < ada_frame_header_size)
+	{
+		return;
+	}
+
+	const uint8_t type = _sketch.buffer[_sketch.indexOut];
+	const uint8_t seq = _sketch.buffer[static_cast<uint8_t>(_sketch.indexOut + 1)];
+	const uint8_t hi = _sketch.buffer[static_cast<uint8_t>(_sketch.indexOut + 2)];
+	const uint8_t lo = _sketch.buffer[static_cast<uint8_t>(_sketch.indexOut + 3)];
+	const uint8_t chk = _sketch.buffer[static_cast<uint8_t>(_sketch.indexOut + 4)];
+
+	if (chk != (type ^ seq ^ hi ^ lo ^ 0x55)
+		|| type > static_cast<uint8_t>(ada_frame_type::delta))
+	{
+		// Not a valid frame header after all, so resume the header search.
+		_sketch.mode = sketch_mode::header;
+		return;
+	}
+
+	_sketch.indexOut += ada_frame_header_size;
+	_sketch.bytesBuffered -= ada_frame_header_size;
+	_sketch.type = static_cast<ada_frame_type>(type);
+	_sketch.seq = seq;
+
+	if (_sketch.ledCount > _parameters.maxLeds
+		|| (ada_frame_type::delta == _sketch.type
+			&& (!_sketch.synced
+				|| _sketch.ledCount != _sketch.lastCount
+				|| seq != static_cast<uint8_t>(_sketch.lastSeq + 1))))
+	{
+		// Too many LEDs for the frame buffer, or a delta we can't apply because we missed the
+		// frame before it.
+		++_stats.skippedFrames;
+		_sketch.synced = false;
+		_sketch.mode = sketch_mode::header;
+		return;
+	}
+
+	_sketch.payloadRemaining = (static_cast<size_t>(hi) << 8) | lo;
+	_sketch.frameChk = 0;
+	_sketch.position = 0;
+	_sketch.colorByte = 0;
+	_sketch.failed = false;
+
+	if (ada_frame_type::raw == _sketch.type)
+	{
+		// A raw frame is one long literal.
+		_sketch.op = ada_op_literal;
+		_sketch.opCount = _sketch.ledCount;
+	}
+	else
+	{
+		_sketch.opCount = 0;
+	}
+
+	_sketch.mode = sketch_mode::payload;
+}
+
+void ledstream_emulator::decode_payload()
+{
+	if (0 == _sketch.bytesBuffered)
+	{
+		return;
+	}
+
+	const uint8_t c = _sketch.buffer[_sketch.indexOut++];
+
+	--_sketch.bytesBuffered;
+
+	if (0 == _sketch.payloadRemaining)
+	{
+		// The last byte is the payload checksum.
+		if (!_sketch.failed
+			&& c == _sketch.frameChk
+			&& 0 == _sketch.opCount
+			&& (ada_frame_type::delta == _sketch.type || _sketch.position == _sketch.ledCount))
+		{
+			_sketch.synced = true;
+			_sketch.lastSeq = _sketch.seq;
+			_sketch.lastCount = _sketch.ledCount;
+			_sketch.bytesRemaining = bytes_per_led * _sketch.ledCount;
+			_sketch.spiFlag = false;
+			_sketch.mode = sketch_mode::hold;
+		}
+		else
+		{
+			// The next delta can't be applied either.
+			++_stats.skippedFrames;
+			_sketch.synced = false;
+			_sketch.mode = sketch_mode::header;
+		}
+
+		return;
+	}
+
+	--_sketch.payloadRemaining;
+	_sketch.frameChk ^= c;
+
+	if (_sketch.failed)
+	{
+		return;
+	}
+
+	if (0 == _sketch.opCount)
+	{
+		// Control byte for the next op.
+		_sketch.op = c & ada_op_mask;
+		_sketch.opCount = static_cast<size_t>(c & ~ada_op_mask) + 1;
+		_sketch.colorByte = 0;
+
+		if (ada_op_skip == _sketch.op)
+		{
+			_sketch.position += _sketch.opCount;
+			_sketch.opCount = 0;
+			_sketch.failed = (ada_frame_type::delta != _sketch.type) || (_sketch.position > _sketch.ledCount);
+		}
+		else if (ada_op_mask == _sketch.op
+			|| _sketch.position + _sketch.opCount > _sketch.ledCount)
+		{
+			_sketch.failed = true;
+		}
+	}
+	else if (ada_op_literal == _sketch.op)
+	{
+		_frame[(_sketch.position * bytes_per_led) + _sketch.colorByte] = c;
+
+		if (++_sketch.colorByte == bytes_per_led)
+		{
+			_sketch.colorByte = 0;
+			++_sketch.position;
+			--_sketch.opCount;
+		}
+	}
+	else
+	{
+		_sketch.color[_sketch.colorByte++] = c;
+
+		if (_sketch.colorByte == bytes_per_led)
+		{
+			for (; _sketch.opCount > 0; --_sketch.opCount, ++_sketch.position)
+			{
+				std::copy(_sketch.color.cbegin(), _sketch.color.cend(), _frame.begin() + (_sketch.position * bytes_per_led));
+			}
+		}
+	}
+}
+
+void ledstream_emulator::issue_data()
+{
+	spi_wait();
+
+	if (0 == _sketch.bytesRemaining)
+	{
+		// End of data, so issue the latch and begin the next header search.
+		_sketch.startTime = _now;
+		_sketch.hold = latch_time;
+		_sketch.mode = sketch_mode::header;
+		latch();
+
+		if (_sketch.readyTokens)
+		{
+			_transmit.push_back(ada_ready_token);
+		}
+
+		return;
+	}
+
+	const bool v2 = (ada_magic_v2 == _sketch.version);
+
+	if (v2)
+	{
+		// Already decoded, so there's no underrun to worry about.
+		spi_write(_frame[(bytes_per_led * _sketch.ledCount) - _sketch.bytesRemaining]);
+		--_sketch.bytesRemaining;
+	}
+	else if (_sketch.bytesBuffered > 0)
+	{
+		spi_write(_sketch.buffer[_sketch.indexOut++]);
+		--_sketch.bytesBuffered;
+		--_sketch.bytesRemaining;
+	}
+
+	// If the buffer is threatening to underrun, introduce progressively longer pauses to allow
+	// more data to arrive.
+	if (!v2
+		&& _sketch.bytesBuffered < underrun_threshold
+		&& _sketch.bytesRemaining > _sketch.bytesBuffered)
+	{
+		_sketch.startTime = _now;
+		_sketch.hold = 100 + ((underrun_threshold - _sketch.bytesBuffered) * 10);
+		_sketch.mode = sketch_mode::hold;
+		++_stats.underruns;
+		_stats.underrunTime += _sketch.hold;
+	}
+}
+
+void ledstream_emulator::spi_write(uint8_t value)
+{
+	_shifted.push_back(value);
+	_spiDone = _now + _spiByteTime;
+	_sketch.spiFlag = true;
+}
+
+void ledstream_emulator::spi_wait()
+{
+	if (_sketch.spiFlag)
+	{
+		_now = std::max(_now, _spiDone);
+	}
+}
+
+void ledstream_emulator::latch()
+{
+	// LEDs past the end of a shorter frame keep their colors.
+	if (_shifted.size() > _leds.size())
+	{
+		_leds.resize(_shifted.size(), 0);
+	}
+
+	std::copy(_shifted.cbegin(), _shifted.cend(), _leds.begin());
+	_shifted.clear();
+
+	if (_stats.frames > 0)
+	{
+		const uint64_t gap = _now - _stats.lastLatch;
+
+		_stats.minLatchGap = (1 == _stats.frames) ? gap : std::min(_stats.minLatchGap, gap);
+		_stats.maxLatchGap = std::max(_stats.maxLatchGap, gap);
+	}
+	else
+	{
+		_stats.firstLatch = _now;
+	}
+
+	_stats.lastLatch = _now;
+	++_stats.frames;
+}
+
+void ledstream_emulator::blackout()
+{
+	// The sketch blocks on every byte of black, and then latches.
+	_now += (show_color_bytes(_parameters.chip, blackout_leds) * _spiByteTime) + latch_time;
+	_shifted.clear();
+	std::fill(_leds.begin(), _leds.end(), 0);
+	++_stats.blackouts;
+}
+
+void ledstream_emulator::print(const std::string& text)
+{
+	_transmit.insert(_transmit.end(), text.cbegin(), text.cend());
+}
+
+uint64_t ledstream_emulator::next_event() const
+{
+	// The ack and the timeout fire on the first ms after the interval.
+	uint64_t next = (_sketch.lastAckTime + ack_interval + 1) * 1000;
+
+	next = std::min(next, (_sketch.lastByteTime + serial_timeout + 1) * 1000);
+
+	if (_sketch.baudPending)
+	{
+		next = std::min(next, (_sketch.baudTime + ada_baud_revert_time + 1) * 1000);
+	}
+
+	if (sketch_mode::hold == _sketch.mode)
+	{
+		next = std::min(next, _sketch.startTime + _sketch.hold);
+	}
+
+	if (!_wire.empty())
+	{
+		next = std::min(next, _wire.front().arrival);
+	}
+
+	return next;
+}
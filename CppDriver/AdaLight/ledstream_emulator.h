@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "ada_protocol.h"
+
+// Portable model of the LEDstream sketch, for measuring how a host send pattern plays out on
+// the Arduino without one. It runs the same state machine as the sketch's main loop, with the
+// same 256 byte buffer, commands, underrun holds, latches and 15 second blackout, but against
+// a simulated clock in microseconds instead of micros() and millis().
+//
+// The timing model covers the parts which decide the frame rate:
+//   - The serial link delivers one byte every 10 bits at the current baud rate, into the 64 byte
+//     receive buffer in the Arduino core, which drops anything that doesn't fit. Bytes sent at a
+//     different baud rate than the sketch is listening at arrive garbled. Native USB boards
+//     ignore the baud rate and hold the host off instead of dropping bytes.
+//   - Every pass through the main loop costs a fixed loopTime, and the sketch reads at most one
+//     byte per pass.
+//   - Every byte to the LEDs takes 8 SPI clocks, and waiting for it blocks the loop like it does
+//     on the AVR.
+// It doesn't model interrupts stealing cycles or the host's USB scheduling, so treat the results
+// as a best case for the real board.
+//
+// Nothing here does any I/O, see virtual_device for running it behind a serial port.
+class ledstream_emulator
+{
+public:
+	struct config
+	{
+		// Fastest baud rate the sketch switches to, 0 for a native USB board. This is MAX_BAUD
+		// in LEDstream.pde.
+		uint32_t maxBaudRate = 500000;
+
+		// MAX_LEDS and CHIP in LEDstream.pde, which the sketch reports in its capabilities. The
+		// chip also decides how many bytes the test pattern and the blackout take.
+		size_t maxLeds = ada_max_v2_leds;
+		std::string chip = "WS2801";
+
+		// SPI clock to the LEDs in Hz, 1 MHz with SPI_CLOCK_DIV16 on a 16 MHz board.
+		uint32_t spiClock = 1000000;
+
+		// Rough cost of one pass through the main loop in us.
+		uint32_t loopTime = 4;
+
+		// How fast a native USB board can take bytes from the host.
+		uint32_t usbBytesPerSecond = 1000000;
+
+		// Run the red, green, blue test pattern at startup, which takes about 2.4 seconds.
+		bool testPattern = true;
+	};
+
+	struct statistics
+	{
+		// Frames the sketch latched, and version 2 frames it skipped or couldn't decode.
+		size_t frames = 0;
+		size_t skippedFrames = 0;
+
+		// How many times the sketch paused the LEDs to wait for more data, and for how long in us.
+		size_t underruns = 0;
+		uint64_t underrunTime = 0;
+
+		// Bytes lost because the receive buffer was full, or garbled by a baud rate mismatch.
+		size_t droppedBytes = 0;
+		size_t garbledBytes = 0;
+
+		// How many times the sketch turned the LEDs off because the host went quiet.
+		size_t blackouts = 0;
+
+		// When the first and last frames were latched, and the shortest and longest time between
+		// two latches, all in us.
+		uint64_t firstLatch = 0;
+		uint64_t lastLatch = 0;
+		uint64_t minLatchGap = 0;
+		uint64_t maxLatchGap = 0;
+	};
+
+	explicit ledstream_emulator(const config& parameters);
+
+	// Power up or reset the board at time now, like opening the port does on Arduinos which
+	// reset on DTR. Anything still on its way is lost.
+	void reset(uint64_t now);
+
+	// The host sent these bytes at time now, at hostBaudRate (0 if it's unknown, in which case
+	// we assume it matches).
+	void receive(const uint8_t* data, size_t size, uint64_t now, uint32_t hostBaudRate);
+
+	// How many more bytes the host can send before its writes would block, like a serial driver
+	// with a full transmit buffer or USB waiting for the board to make room.
+	size_t receive_space() const;
+
+	// Run the sketch up to time now.
+	void run(uint64_t now);
+
+	// Take the bytes the sketch sent to the host since the last call.
+	std::vector<uint8_t> transmit();
+
+	// R, G, B bytes the LEDs showed as of the last latch.
+	const std::vector<uint8_t>& leds() const;
+
+	// Baud rate the sketch is listening at.
+	uint32_t baud_rate() const;
+
+	const statistics& stats() const;
+
+private:
+	enum class sketch_mode
+	{
+		header,
+		hold,
+		data,
+		frame,
+		payload,
+	};
+
+	struct incoming
+	{
+		uint64_t arrival;
+		uint8_t value;
+		uint32_t baudRate;
+	};
+
+	bool native_usb() const;
+
+	// Move everything which arrived by now into the receive buffer.
+	void deliver();
+
+	// One pass through the sketch's main loop.
+	void step(uint64_t limit);
+
+	// Check for a header or command at the front of the buffer.
+	void find_header();
+	void decode_frame_header();
+	void decode_payload();
+
+	// The data and latch half of the loop, after any hold.
+	void issue_data();
+
+	void spi_write(uint8_t value);
+	void spi_wait();
+	void latch();
+	void blackout();
+	void print(const std::string& text);
+
+	// When something next changes if the sketch is waiting for it.
+	uint64_t next_event() const;
+
+	const config _parameters;
+	const uint64_t _spiByteTime;
+	statistics _stats;
+
+	// Simulated time in us, and when the byte in the SPI register finishes.
+	uint64_t _now = 0;
+	uint64_t _spiDone = 0;
+
+	// Bytes on the wire, and in the Arduino core's receive buffer.
+	std::deque<incoming> _wire;
+	std::deque<uint8_t> _receive;
+	uint64_t _lastArrival = 0;
+	uint32_t _baudRate = ada_default_baud_rate;
+
+	std::vector<uint8_t> _transmit;
+	std::vector<uint8_t> _shifted;
+	std::vector<uint8_t> _leds;
+
+	// The sketch's own state, named after the variables in LEDstream.pde. The times in ms are
+	// from millis(), and the ones in us from micros().
+	struct sketch_state
+	{
+		std::array<uint8_t, 256> buffer = {};
+		uint8_t indexIn = 0;
+		uint8_t indexOut = 0;
+		size_t bytesBuffered = 0;
+		sketch_mode mode = sketch_mode::header;
+		uint8_t version = 0;
+		bool synced = false;
+		bool failed = false;
+		bool baudPending = false;
+		bool readyTokens = false;
+		bool spiFlag = false;
+		ada_frame_type type = ada_frame_type::raw;
+		uint8_t seq = 0;
+		uint8_t lastSeq = 0;
+		uint8_t frameChk = 0;
+		uint8_t op = 0;
+		size_t colorByte = 0;
+		std::array<uint8_t, 3> color = {};
+		size_t position = 0;
+		size_t opCount = 0;
+		size_t bytesRemaining = 0;
+		size_t payloadRemaining = 0;
+		size_t ledCount = 0;
+		size_t lastCount = 0;
+		uint64_t startTime = 0;
+		uint64_t hold = 0;
+		uint64_t lastByteTime = 0;
+		uint64_t lastAckTime = 0;
+		uint64_t baudTime = 0;
+	};
+
+	sketch_state _sketch;
+
+	// Decoded version 2 frame, which the sketch keeps in a static array.
+	std::vector<uint8_t> _frame;
+};
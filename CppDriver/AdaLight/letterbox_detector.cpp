@@ -0,0 +1,182 @@
+#include "stdafx.h"
+#include "letterbox_detector.h"
+
+#include <cstring>
+
+// Never treat more than a quarter of the display on each side as a bar.
+constexpr size_t max_bar_divisor = 4;
+
+// Number of pixels we check across each line.
+constexpr size_t line_probes = 64;
+
+// Measurements within this many pixels of each other count as the same bar.
+constexpr size_t bar_tolerance = 2;
+
+constexpr size_t bytes_per_pixel = 4;
+
+// The largest pixel in any format, for gathering the pixels we check before converting them.
+constexpr size_t max_pixel_size = 8;
+
+static inline bool is_dark(const uint8_t* pixel, uint8_t threshold)
+{
+	return pixel[0] <= threshold
+		&& pixel[1] <= threshold
+		&& pixel[2] <= threshold;
+}
+
+void letterbox_detector::reset(const settings::letterbox_config& config, size_t width, size_t height)
+{
+	_threshold = config.threshold;
+	_frames = config.frames;
+	_width = width;
+	_height = height;
+	_nextEdge = 0;
+	_edges = {};
+	_active = { 0, 0, width, height };
+}
+
+bool letterbox_detector::update(const frame_view& view, const pixel_converter& converter)
+{
+	const edge side = static_cast<edge>(_nextEdge);
+	size_t bar;
+
+	_nextEdge = (_nextEdge + 1) % static_cast<size_t>(edge::count);
+
+	if (!measure(view, converter, side, bar))
+	{
+		return false;
+	}
+
+	auto& state = _edges[static_cast<size_t>(side)];
+	const size_t difference = (bar > state.candidate) ? (bar - state.candidate) : (state.candidate - bar);
+
+	if (difference > bar_tolerance)
+	{
+		state.candidate = bar;
+		state.matches = 1;
+	}
+	else
+	{
+		++state.matches;
+	}
+
+	if (state.matches < _frames
+		|| state.candidate == state.active)
+	{
+		return false;
+	}
+
+	state.active = state.candidate;
+
+	_active = {
+		_edges[static_cast<size_t>(edge::left)].active,
+		_edges[static_cast<size_t>(edge::top)].active,
+		_width - _edges[static_cast<size_t>(edge::right)].active,
+		_height - _edges[static_cast<size_t>(edge::bottom)].active,
+	};
+
+	return true;
+}
+
+const pixel_rect& letterbox_detector::active() const
+{
+	return _active;
+}
+
+bool letterbox_detector::measure(const frame_view& view, const pixel_converter& converter, edge side, size_t& bar) const
+{
+	const bool horizontal = (edge::top == side || edge::bottom == side);
+	const size_t limit = (horizontal ? _height : _width) / max_bar_divisor;
+	size_t low = 0;
+	size_t high = limit;
+
+	// The lines from the edge up to the bar are black and the first line after it isn't.
+	while (low < high)
+	{
+		const size_t middle = low + ((high - low) / 2);
+
+		if (is_black(view, converter, side, middle))
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	if (low == limit)
+	{
+		return false;
+	}
+
+	bar = low;
+
+	return true;
+}
+
+bool letterbox_detector::is_black(const frame_view& view, const pixel_converter& converter, edge side, size_t line) const
+{
+	const bool horizontal = (edge::top == side || edge::bottom == side);
+	const size_t length = horizontal ? _width : _height;
+	const bool convert = (pixel_format::b8g8r8a8 != view.format);
+	const size_t pixelSize = pixel_size(view.format);
+	uint8_t probes[line_probes * max_pixel_size];
+	const uint8_t* start;
+	size_t step;
+
+	switch (side)
+	{
+		case edge::top:
+			start = view.pixels + (line * view.pitch);
+			step = pixelSize;
+			break;
+
+		case edge::bottom:
+			start = view.pixels + ((_height - 1 - line) * view.pitch);
+			step = pixelSize;
+			break;
+
+		case edge::left:
+			start = view.pixels + (line * pixelSize);
+			step = view.pitch;
+			break;
+
+		default:
+			start = view.pixels + ((_width - 1 - line) * pixelSize);
+			step = view.pitch;
+			break;
+	}
+
+	for (size_t i = 0; i < line_probes; ++i)
+	{
+		const size_t position = (((2 * i) + 1) * length) / (2 * line_probes);
+		const uint8_t* pixel = start + (position * step);
+
+		if (convert)
+		{
+			memcpy(probes + (i * pixelSize), pixel, pixelSize);
+		}
+		else if (!is_dark(pixel, _threshold))
+		{
+			return false;
+		}
+	}
+
+	if (convert)
+	{
+		uint8_t converted[line_probes * bytes_per_pixel];
+
+		converter.convert(view.format, probes, line_probes, converted);
+
+		for (size_t i = 0; i < line_probes; ++i)
+		{
+			if (!is_dark(converted + (i * bytes_per_pixel), _threshold))
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "settings.h"
+#include "frame_source.h"
+#include "pixel_converter.h"
+
+// Track the active picture area of a display when a movie is letterboxed (black bars at the
+// top and bottom) or pillarboxed (black bars on the sides), so the LEDs can sample the picture
+// instead of the bars.
+//
+// Each frame we only measure one of the edges, with a binary search for the first line from
+// that edge which isn't black. Each line only checks a few pixels spread across it, so that's
+// about a dozen sparse lines per frame rather than a scan of the whole frame. A bar has to
+// measure the same for several frames in a row before we change the active area, so dark
+// scenes or a subtitle in the bar don't make the LEDs jump around.
+class letterbox_detector
+{
+public:
+	void reset(const settings::letterbox_config& config, size_t width, size_t height);
+
+	// Measure the next edge of a mapped frame. Returns true if the active area changed. Frames
+	// in any other format than 8-bit BGRA only convert the pixels we check.
+	bool update(const frame_view& view, const pixel_converter& converter);
+
+	const pixel_rect& active() const;
+
+private:
+	enum class edge
+	{
+		top,
+		bottom,
+		left,
+		right,
+
+		count
+	};
+
+	struct edge_state
+	{
+		size_t active;
+		size_t candidate;
+		size_t matches;
+	};
+
+	// Find the width of the black bar on an edge, or return false if every line we're willing
+	// to treat as a bar is black, e.g. during a fade to black.
+	bool measure(const frame_view& view, const pixel_converter& converter, edge side, size_t& bar) const;
+	bool is_black(const frame_view& view, const pixel_converter& converter, edge side, size_t line) const;
+
+	uint8_t _threshold = 0;
+	size_t _frames = 0;
+	size_t _width = 0;
+	size_t _height = 0;
+	size_t _nextEdge = 0;
+
+	std::array<edge_state, static_cast<size_t>(edge::count)> _edges = {};
+	pixel_rect _active = {};
+};
@@ -0,0 +1,262 @@
+#include "stdafx.h"
+#include "mip_pyramid.h"
+
+#include <algorithm>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BOX_FILTER_SSE2
+#include <emmintrin.h>
+#elif defined(_M_ARM) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define BOX_FILTER_NEON
+#include <arm_neon.h>
+#endif
+
+#undef min
+#undef max
+
+constexpr size_t channels = 4;
+
+// Average each 2x2 block of pixels from a pair of lines, rounding to the nearest value.
+static inline void average_pixel(const uint8_t* top, const uint8_t* bottom, uint8_t* out)
+{
+	for (size_t channel = 0; channel < channels; ++channel)
+	{
+		const uint32_t sum = static_cast<uint32_t>(top[channel]) + top[channel + channels]
+			+ bottom[channel] + bottom[channel + channels];
+
+		out[channel] = static_cast<uint8_t>((sum + 2) >> 2);
+	}
+}
+
+#if defined(BOX_FILTER_SSE2)
+
+// Add up the 2x2 blocks in 4 pixels from each line, leaving 2 sums of 4 channels in 16-bit lanes.
+static inline __m128i sum_blocks(__m128i top, __m128i bottom)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+	const __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+
+	return _mm_add_epi16(_mm_unpacklo_epi64(low, high), _mm_unpackhi_epi64(low, high));
+}
+
+static void reduce_line(const uint8_t* top, const uint8_t* bottom, uint8_t* out, size_t count)
+{
+	const __m128i rounding = _mm_set1_epi16(2);
+	size_t x = 0;
+
+	// Filter 8 pixels from each line into 4 pixels at a time.
+	for (; x + 4 <= count; x += 4)
+	{
+		const __m128i* topPixels = reinterpret_cast<const __m128i*>(top + (2 * x * channels));
+		const __m128i* bottomPixels = reinterpret_cast<const __m128i*>(bottom + (2 * x * channels));
+		const __m128i first = sum_blocks(_mm_loadu_si128(topPixels), _mm_loadu_si128(bottomPixels));
+		const __m128i second = sum_blocks(_mm_loadu_si128(topPixels + 1), _mm_loadu_si128(bottomPixels + 1));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + (x * channels)), _mm_packus_epi16(
+			_mm_srli_epi16(_mm_add_epi16(first, rounding), 2),
+			_mm_srli_epi16(_mm_add_epi16(second, rounding), 2)));
+	}
+
+	for (; x < count; ++x)
+	{
+		average_pixel(top + (2 * x * channels), bottom + (2 * x * channels), out + (x * channels));
+	}
+}
+
+static const wchar_t* box_filter_name = L"SSE2";
+
+#elif defined(BOX_FILTER_NEON)
+
+static void reduce_line(const uint8_t* top, const uint8_t* bottom, uint8_t* out, size_t count)
+{
+	size_t x = 0;
+
+	// Split 8 pixels from each line into the even and odd pixels, so adding them lines up the
+	// pixels in each 2x2 block, and filter them into 4 pixels at a time.
+	for (; x + 4 <= count; x += 4)
+	{
+		const uint32x4x2_t topPixels = vld2q_u32(reinterpret_cast<const uint32_t*>(top + (2 * x * channels)));
+		const uint32x4x2_t bottomPixels = vld2q_u32(reinterpret_cast<const uint32_t*>(bottom + (2 * x * channels)));
+		const uint8x16_t topEven = vreinterpretq_u8_u32(topPixels.val[0]);
+		const uint8x16_t topOdd = vreinterpretq_u8_u32(topPixels.val[1]);
+		const uint8x16_t bottomEven = vreinterpretq_u8_u32(bottomPixels.val[0]);
+		const uint8x16_t bottomOdd = vreinterpretq_u8_u32(bottomPixels.val[1]);
+		const uint16x8_t low = vaddq_u16(vaddl_u8(vget_low_u8(topEven), vget_low_u8(topOdd)),
+			vaddl_u8(vget_low_u8(bottomEven), vget_low_u8(bottomOdd)));
+		const uint16x8_t high = vaddq_u16(vaddl_u8(vget_high_u8(topEven), vget_high_u8(topOdd)),
+			vaddl_u8(vget_high_u8(bottomEven), vget_high_u8(bottomOdd)));
+
+		vst1q_u8(out + (x * channels), vcombine_u8(vrshrn_n_u16(low, 2), vrshrn_n_u16(high, 2)));
+	}
+
+	for (; x < count; ++x)
+	{
+		average_pixel(top + (2 * x * channels), bottom + (2 * x * channels), out + (x * channels));
+	}
+}
+
+static const wchar_t* box_filter_name = L"NEON";
+
+#else
+
+static void reduce_line(const uint8_t* top, const uint8_t* bottom, uint8_t* out, size_t count)
+{
+	for (size_t x = 0; x < count; ++x)
+	{
+		average_pixel(top + (2 * x * channels), bottom + (2 * x * channels), out + (x * channels));
+	}
+}
+
+static const wchar_t* box_filter_name = L"Scalar";
+
+#endif
+
+void mip_pyramid::resize(size_t width, size_t height, size_t gridSize, const std::vector<uint32_t>& columns, const std::vector<uint32_t>& rows, const std::vector<size_t>& levels)
+{
+	_width = width;
+	_height = height;
+	_pitch = (width >> 1) * channels;
+	_footprints.resize(levels.size());
+
+	std::vector<uint32_t> sorted(gridSize);
+
+	// Merge the columns or rows of one LED into runs, which also drops any it samples twice.
+	const auto merge = [&sorted, gridSize](const uint32_t* samples, std::vector<span>& spans)
+	{
+		std::copy(samples, samples + gridSize, sorted.begin());
+		std::sort(sorted.begin(), sorted.end());
+		spans.clear();
+
+		for (const uint32_t sample : sorted)
+		{
+			if (!spans.empty()
+				&& sample <= spans.back().last)
+			{
+				spans.back().last = std::max<size_t>(spans.back().last, sample + 1);
+			}
+			else
+			{
+				spans.push_back({ sample, static_cast<size_t>(sample) + 1 });
+			}
+		}
+	};
+
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		auto& footprint = _footprints[i];
+
+		footprint.level = levels[i];
+		merge(columns.data() + (i * gridSize), footprint.columns);
+		merge(rows.data() + (i * gridSize), footprint.rows);
+	}
+
+	const size_t topLevel = levels.empty() ? 0 : *std::max_element(levels.cbegin(), levels.cend());
+
+	_pixels.resize(first_row(height, topLevel + 1) * _pitch);
+	_lines.resize(2 * width * channels);
+}
+
+void mip_pyramid::build(const frame_view& view, const pixel_converter& converter, const std::vector<uint8_t>& dirtyLeds)
+{
+	const bool convert = (pixel_format::b8g8r8a8 != view.format);
+	const size_t pixelSize = pixel_size(view.format);
+
+	for (size_t i = 0; i < _footprints.size(); ++i)
+	{
+		if (!dirtyLeds[i])
+		{
+			continue;
+		}
+
+		const auto& footprint = _footprints[i];
+		const size_t topLevel = footprint.level;
+
+		// Work up from the frame, filtering the blocks under the samples on each level.
+		for (size_t level = 1; level <= topLevel; ++level)
+		{
+			const size_t shift = topLevel - level;
+			const uint8_t* source;
+			size_t sourcePitch;
+
+			if (level == 1)
+			{
+				source = view.pixels;
+				sourcePitch = view.pitch;
+			}
+			else
+			{
+				source = _pixels.data() + (first_row(_height, level - 1) * _pitch);
+				sourcePitch = _pitch;
+			}
+
+			uint8_t* target = _pixels.data() + (first_row(_height, level) * _pitch);
+
+			for (const auto& rows : footprint.rows)
+			{
+				const size_t top = rows.first << shift;
+				const size_t bottom = std::min(rows.last << shift, _height >> level);
+
+				for (const auto& columns : footprint.columns)
+				{
+					const size_t left = columns.first << shift;
+					const size_t right = std::min(columns.last << shift, _width >> level);
+
+					if (level == 1
+						&& convert)
+					{
+						const size_t count = 2 * (right - left);
+						uint8_t* upper = _lines.data();
+						uint8_t* lower = upper + (count * channels);
+
+						for (size_t y = top; y < bottom; ++y)
+						{
+							const uint8_t* line = source + (2 * y * sourcePitch) + (2 * left * pixelSize);
+
+							converter.convert(view.format, line, count, upper);
+							converter.convert(view.format, line + sourcePitch, count, lower);
+							reduce_line(upper, lower, target + (y * _pitch) + (left * channels), right - left);
+						}
+
+						continue;
+					}
+
+					for (size_t y = top; y < bottom; ++y)
+					{
+						const uint8_t* line = source + (2 * y * sourcePitch) + (2 * left * channels);
+
+						reduce_line(line, line + sourcePitch, target + (y * _pitch) + (left * channels), right - left);
+					}
+				}
+			}
+		}
+	}
+}
+
+size_t mip_pyramid::first_row(size_t height, size_t level)
+{
+	size_t row = 0;
+
+	for (size_t i = 1; i < level; ++i)
+	{
+		row += height >> i;
+	}
+
+	return row;
+}
+
+frame_view mip_pyramid::view() const
+{
+	return {
+		_pixels.data(),
+		_pitch,
+		pixel_format::b8g8r8a8,
+		_width >> 1,
+		_pixels.size() / std::max<size_t>(_pitch, 1),
+	};
+}
+
+const wchar_t* mip_pyramid::name()
+{
+	return box_filter_name;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "frame_source.h"
+#include "pixel_converter.h"
+
+// Mip pyramid of a display, where each level is a 2x2 box filtered copy of the level below it
+// at half the size, and level 0 is the mapped frame itself.
+//
+// Each LED reads from the level where its samples are about 1 pixel apart, so every sample is
+// the average of the block of the frame around it instead of a single pixel, and fine detail
+// between the sampled points doesn't alias. We only filter the pixels the LEDs actually read on
+// their levels, along with the blocks under them on the lower levels, and skip the LEDs which
+// didn't change. Averaging every pixel under a sample still means reading it, though, so the
+// cost grows with the area of the frame the samples cover, and with the resolution, rather than
+// only with the number of LEDs like the grid. Between 1 and 2 pixels apart, the samples cover a
+// quarter to all of the region between them, or less where an LED is capped at max_level.
+//
+// All of the levels are stacked on top of each other in one image with the pitch of level 1,
+// so the grid kernel can sample any level with the same sample_offsets.
+class mip_pyramid
+{
+public:
+	static constexpr size_t max_level = 6;
+
+	// Allocate the levels for a display. Each LED reads every combination of gridSize columns
+	// and rows at one level, given in pixels of that level, which have to fit inside that level.
+	// The columns and rows of each LED follow those of the LED before it.
+	void resize(size_t width, size_t height, size_t gridSize, const std::vector<uint32_t>& columns, const std::vector<uint32_t>& rows, const std::vector<size_t>& levels);
+
+	// Filter the samples of the LEDs flagged in dirtyLeds from a mapped frame. Frames in any
+	// other format than 8-bit BGRA are converted a pair of lines at a time on the way into
+	// level 1, and the pyramid itself is always 8-bit BGRA.
+	void build(const frame_view& view, const pixel_converter& converter, const std::vector<uint8_t>& dirtyLeds);
+
+	// Row of the stacked image where a level starts, for a display of the given height.
+	static size_t first_row(size_t height, size_t level);
+
+	// The stacked image of every level.
+	frame_view view() const;
+
+	// Name of the box filter implementation, for diagnostics.
+	static const wchar_t* name();
+
+private:
+	size_t _width = 0;
+	size_t _height = 0;
+	size_t _pitch = 0;
+
+	// A run of neighboring columns or rows an LED samples on its level, from first up to but not
+	// including last.
+	struct span
+	{
+		size_t first;
+		size_t last;
+	};
+
+	struct footprint
+	{
+		size_t level;
+		std::vector<span> columns;
+		std::vector<span> rows;
+	};
+
+	std::vector<footprint> _footprints;
+	std::vector<uint8_t> _pixels;
+	std::vector<uint8_t> _lines;
+};
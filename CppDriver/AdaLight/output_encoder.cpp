@@ -0,0 +1,176 @@
+#include "stdafx.h"
+#include "output_encoder.h"
+
+#include <algorithm>
+
+#undef min
+#undef max
+
+constexpr size_t bytes_per_led = 3;
+
+// APA102 global brightness only has 5 bits.
+constexpr uint8_t apa102_max_brightness = 31;
+
+static constexpr size_t padded_size(size_t size)
+{
+	return ((size + bytes_per_led - 1) / bytes_per_led) * bytes_per_led;
+}
+
+// Each chip describes the bytes which come before the LEDs, the bytes for each LED in the order
+// they go out, and the bytes after the LEDs, which also fill the padding.
+
+// WS2801 latches when the clock stays low for 500 us, which the sketch does between frames, so
+// it only needs the colors.
+struct ws2801_chip
+{
+	static constexpr size_t prefix_size = 0;
+	static constexpr uint8_t prefix_byte = 0;
+	static constexpr size_t led_size = 3;
+	static constexpr uint8_t suffix_byte = 0;
+
+	static size_t suffix_size(size_t /*ledCount*/)
+	{
+		return 0;
+	}
+
+	static uint8_t* encode_led(uint8_t first, uint8_t second, uint8_t third, uint8_t /*brightness*/, uint8_t* out)
+	{
+		out[0] = first;
+		out[1] = second;
+		out[2] = third;
+
+		return out + led_size;
+	}
+};
+
+// LPD8806 takes 7 bits per color with the high bit set, and latches when it sees a 0 byte for
+// every 32 LEDs, which the LEDstream_LPD8806 sketch rounds up to 3 for every 64.
+struct lpd8806_chip
+{
+	static constexpr size_t prefix_size = 0;
+	static constexpr uint8_t prefix_byte = 0;
+	static constexpr size_t led_size = 3;
+	static constexpr uint8_t suffix_byte = 0;
+
+	static size_t suffix_size(size_t ledCount)
+	{
+		return ((ledCount + 63) / 64) * 3;
+	}
+
+	static uint8_t* encode_led(uint8_t first, uint8_t second, uint8_t third, uint8_t /*brightness*/, uint8_t* out)
+	{
+		out[0] = static_cast<uint8_t>(0x80 | (first >> 1));
+		out[1] = static_cast<uint8_t>(0x80 | (second >> 1));
+		out[2] = static_cast<uint8_t>(0x80 | (third >> 1));
+
+		return out + led_size;
+	}
+};
+
+// APA102 starts with 32 bits of 0, then each LED is 3 bits of 1 and the 5-bit global brightness
+// followed by the colors. The data is delayed by half a clock at each LED, so it takes an end
+// frame of at least one bit of 1 for every 2 LEDs to push it all the way down the strip.
+struct apa102_chip
+{
+	static constexpr size_t prefix_size = 4;
+	static constexpr uint8_t prefix_byte = 0x00;
+	static constexpr size_t led_size = 4;
+	static constexpr uint8_t suffix_byte = 0xFF;
+
+	static size_t suffix_size(size_t ledCount)
+	{
+		return (ledCount + 15) / 16;
+	}
+
+	static uint8_t* encode_led(uint8_t first, uint8_t second, uint8_t third, uint8_t brightness, uint8_t* out)
+	{
+		out[0] = static_cast<uint8_t>(0xE0 | brightness);
+		out[1] = first;
+		out[2] = second;
+		out[3] = third;
+
+		return out + led_size;
+	}
+};
+
+// First, Second and Third are the offsets of the colors in R, G, B in the order they go out.
+template <class Chip, size_t First, size_t Second, size_t Third>
+class chip_encoder final : public output_encoder
+{
+public:
+	explicit chip_encoder(uint8_t brightness)
+		: _brightness(brightness)
+	{
+	}
+
+	size_t frame_size(size_t ledCount) const override
+	{
+		return padded_size(Chip::prefix_size + (Chip::led_size * ledCount) + Chip::suffix_size(ledCount));
+	}
+
+	void encode(const uint8_t* leds, size_t ledCount, uint8_t* out) const override
+	{
+		uint8_t* const end = out + frame_size(ledCount);
+
+		out = std::fill_n(out, Chip::prefix_size, static_cast<uint8_t>(Chip::prefix_byte));
+
+		for (size_t i = 0; i < ledCount; ++i, leds += bytes_per_led)
+		{
+			out = Chip::encode_led(leds[First], leds[Second], leds[Third], _brightness, out);
+		}
+
+		std::fill(out, end, static_cast<uint8_t>(Chip::suffix_byte));
+	}
+
+private:
+	const uint8_t _brightness;
+};
+
+template <class Chip>
+static std::unique_ptr<output_encoder> create_encoder(settings::color_order order, uint8_t brightness)
+{
+	switch (order)
+	{
+		case settings::color_order::rbg:
+			return std::make_unique<chip_encoder<Chip, 0, 2, 1>>(brightness);
+
+		case settings::color_order::grb:
+			return std::make_unique<chip_encoder<Chip, 1, 0, 2>>(brightness);
+
+		case settings::color_order::gbr:
+			return std::make_unique<chip_encoder<Chip, 1, 2, 0>>(brightness);
+
+		case settings::color_order::brg:
+			return std::make_unique<chip_encoder<Chip, 2, 0, 1>>(brightness);
+
+		case settings::color_order::bgr:
+			return std::make_unique<chip_encoder<Chip, 2, 1, 0>>(brightness);
+
+		default:
+			return std::make_unique<chip_encoder<Chip, 0, 1, 2>>(brightness);
+	}
+}
+
+std::unique_ptr<output_encoder> output_encoder::create(const settings& parameters)
+{
+	const auto& output = parameters.output;
+	const uint8_t brightness = std::min(output.brightness, apa102_max_brightness);
+
+	switch (output.chip)
+	{
+		case settings::led_chip::lpd8806:
+			return create_encoder<lpd8806_chip>(output.order, brightness);
+
+		case settings::led_chip::apa102:
+			return create_encoder<apa102_chip>(output.order, brightness);
+
+		default:
+			if (settings::color_order::rgb == output.order)
+			{
+				// The serial data is already in the right format.
+				return nullptr;
+			}
+
+			return create_encoder<ws2801_chip>(output.order, brightness);
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "settings.h"
+
+// Turn the R, G, B bytes for a device's LEDs into the bytes its LED chips expect (see
+// settings::output), so the sketch can send them straight to SPI instead of reshaping every byte
+// on the Arduino. Each combination of chip and color order is a separate specialization, so the
+// loop over the LEDs doesn't have to check either of them.
+//
+// The serial protocol counts LEDs in units of 3 bytes, so the encoded frame is padded to a
+// multiple of 3 bytes, and that's the LED count we put in the header.
+class output_encoder
+{
+public:
+	virtual ~output_encoder() = default;
+
+	// Returns nullptr if the LEDs take R, G, B as they are, e.g. WS2801 in the default order.
+	static std::unique_ptr<output_encoder> create(const settings& parameters);
+
+	// Number of bytes in an encoded frame for ledCount LEDs, always a multiple of 3.
+	virtual size_t frame_size(size_t ledCount) const = 0;
+
+	// Encode ledCount LEDs from leds, which has 3 bytes of R, G, B for each one, into frame_size
+	// bytes at out.
+	virtual void encode(const uint8_t* leds, size_t ledCount, uint8_t* out) const = 0;
+};
@@ -0,0 +1,393 @@
+#include "stdafx.h"
+#include "pixel_converter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "hdr_constants.h"
+
+#if defined(PIXEL_CONVERTER_SCALAR)
+// Leave out the SIMD paths, so the tests can check the scalar one on any machine.
+#elif defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CONVERT_SSE2
+#include <emmintrin.h>
+#elif defined(_M_ARM) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+#undef min
+#undef max
+
+constexpr size_t channels = 4;
+
+// Fraction of the SDR white level which passes through the tone mapping unchanged.
+constexpr float tone_map_knee = 0.75f;
+
+// Scale a half float's exponent and mantissa bits shifted into a float up by 2^112, which makes
+// up the difference between the exponent biases (127 - 15) and handles denormals for free.
+constexpr float half_exponent_scale = 5.192296858534828e33f;
+
+// Largest finite half float. Infinities and NaNs are clamped to this so they come out white.
+constexpr uint16_t max_half = 0x7BFF;
+
+static inline float half_to_float(uint16_t half)
+{
+	// Negative values are out of gamut for the LEDs, so just clamp them to 0.
+	if (half & 0x8000)
+	{
+		return 0.0f;
+	}
+
+	const uint32_t bits = static_cast<uint32_t>(std::min<uint16_t>(half & 0x7FFF, max_half)) << 13;
+	float value;
+
+	memcpy(&value, &bits, sizeof(value));
+
+	return value * half_exponent_scale;
+}
+
+// Drop the 2 low bits of each 10-bit sRGB channel and swap R and B.
+static void convert_r10g10b10a2(const uint8_t* pixels, size_t count, uint8_t* out)
+{
+	size_t i = 0;
+
+#if defined(CONVERT_SSE2)
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + (i * channels)));
+		const __m128i red = _mm_and_si128(_mm_srli_epi32(packed, 2), mask);
+		const __m128i green = _mm_and_si128(_mm_srli_epi32(packed, 12), mask);
+		const __m128i blue = _mm_and_si128(_mm_srli_epi32(packed, 22), mask);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + (i * channels)),
+			_mm_or_si128(_mm_or_si128(blue, alpha), _mm_or_si128(_mm_slli_epi32(green, 8), _mm_slli_epi32(red, 16))));
+	}
+#elif defined(CONVERT_NEON)
+	const uint32x4_t mask = vdupq_n_u32(0xFF);
+	const uint32x4_t alpha = vdupq_n_u32(0xFF000000);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const uint32x4_t packed = vld1q_u32(reinterpret_cast<const uint32_t*>(pixels + (i * channels)));
+		const uint32x4_t red = vandq_u32(vshrq_n_u32(packed, 2), mask);
+		const uint32x4_t green = vandq_u32(vshrq_n_u32(packed, 12), mask);
+		const uint32x4_t blue = vandq_u32(vshrq_n_u32(packed, 22), mask);
+
+		vst1q_u32(reinterpret_cast<uint32_t*>(out + (i * channels)),
+			vorrq_u32(vorrq_u32(blue, alpha), vorrq_u32(vshlq_n_u32(green, 8), vshlq_n_u32(red, 16))));
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		uint32_t packed;
+
+		memcpy(&packed, pixels + (i * channels), sizeof(packed));
+
+		uint8_t* pixel = out + (i * channels);
+
+		pixel[0] = static_cast<uint8_t>(packed >> 22);
+		pixel[1] = static_cast<uint8_t>(packed >> 12);
+		pixel[2] = static_cast<uint8_t>(packed >> 2);
+		pixel[3] = 0xFF;
+	}
+}
+
+pixel_converter::pixel_converter(const settings::hdr_config& config)
+{
+	const double whiteLevel = std::max(config.whiteLevel, 1.0);
+	const double peak = std::max(config.peakLevel / whiteLevel, 1.0);
+
+	_scale = static_cast<float>(scrgb_nits / whiteLevel);
+	_knee = tone_map_knee;
+	_shoulder = 1.0f - tone_map_knee;
+	_inverseShoulder = 1.0f / _shoulder;
+
+	// The excess above the knee reaches the top of the shoulder at the peak level.
+	const float peakExcess = std::max((static_cast<float>(peak) - _knee) * _inverseShoulder, 1.0f);
+
+	_inversePeakSquared = 1.0f / (peakExcess * peakExcess);
+
+	for (size_t i = 0; i < encode_levels; ++i)
+	{
+		const double linear = static_cast<double>(i) / static_cast<double>(encode_levels - 1);
+		const double encoded = (linear <= 0.0031308)
+			? (linear * 12.92)
+			: ((1.055 * pow(linear, 1.0 / 2.4)) - 0.055);
+
+		_encode[i] = static_cast<uint8_t>((encoded * 255.0) + 0.5);
+	}
+
+	for (size_t i = 0; i < pq_levels; ++i)
+	{
+		const double scaled = pow(static_cast<double>(i) / static_cast<double>(pq_levels - 1), 1.0 / pq_m2);
+		const double nits = pq_max_nits * pow(std::max(scaled - pq_c1, 0.0) / (pq_c2 - (pq_c3 * scaled)), 1.0 / pq_m1);
+
+		_decodePq[i] = static_cast<float>(nits / whiteLevel);
+	}
+}
+
+void pixel_converter::convert(pixel_format format, const uint8_t* pixels, size_t count, uint8_t* out) const
+{
+	switch (format)
+	{
+		case pixel_format::r10g10b10a2:
+			convert_r10g10b10a2(pixels, count, out);
+			break;
+
+		case pixel_format::r10g10b10a2_pq:
+			convert_pq(pixels, count, out);
+			break;
+
+		case pixel_format::r16g16b16a16_float:
+			convert_float(pixels, count, out);
+			break;
+
+		default:
+			memcpy(out, pixels, count * channels);
+			break;
+	}
+}
+
+void pixel_converter::gather(pixel_format format, const uint8_t* pixels, const uint32_t* rowOffsets, size_t rows,
+	const uint32_t* columnOffsets, size_t columns, uint8_t* out) const
+{
+	const size_t size = pixel_size(format);
+	uint8_t packed[max_gather_columns * 8];
+
+	for (size_t row = 0; row < rows; ++row)
+	{
+		const uint8_t* line = pixels + rowOffsets[row];
+
+		for (size_t column = 0; column < columns; ++column)
+		{
+			memcpy(packed + (column * size), line + columnOffsets[column], size);
+		}
+
+		convert(format, packed, columns, out + (row * columns * channels));
+	}
+}
+
+template <void (pixel_converter::*decode)(const uint8_t*, float*) const>
+void pixel_converter::convert_blocks(const uint8_t* pixels, size_t count, size_t pixelSize, uint8_t* out) const
+{
+	float color[3 * block_pixels];
+	size_t i = 0;
+
+	for (; i + block_pixels <= count; i += block_pixels)
+	{
+		(this->*decode)(pixels + (i * pixelSize), color);
+		encode_linear(color, out + (i * channels));
+	}
+
+	// Pad the pixels left over at the end of the run out to a whole block.
+	if (i < count)
+	{
+		uint8_t packed[block_pixels * 8] = {};
+		uint8_t converted[block_pixels * channels];
+
+		memcpy(packed, pixels + (i * pixelSize), (count - i) * pixelSize);
+		(this->*decode)(packed, color);
+		encode_linear(color, converted);
+		memcpy(out + (i * channels), converted, (count - i) * channels);
+	}
+}
+
+void pixel_converter::convert_float(const uint8_t* pixels, size_t count, uint8_t* out) const
+{
+	convert_blocks<&pixel_converter::decode_float>(pixels, count, 8, out);
+}
+
+void pixel_converter::convert_pq(const uint8_t* pixels, size_t count, uint8_t* out) const
+{
+	convert_blocks<&pixel_converter::decode_pq>(pixels, count, channels, out);
+}
+
+void pixel_converter::decode_float(const uint8_t* pixels, float* color) const
+{
+#if defined(CONVERT_SSE2)
+	// Clamp the 16 half floats while they're still packed, then widen each pixel to 32-bit lanes
+	// and move the bits into place for a float.
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scale = _mm_set1_ps(half_exponent_scale * _scale);
+	__m128 pixel[block_pixels];
+
+	for (size_t i = 0; i < block_pixels; i += 2)
+	{
+		const __m128i halves = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + (i * 8)));
+		const __m128i positive = _mm_cmpeq_epi16(_mm_and_si128(halves, _mm_set1_epi16(static_cast<short>(0x8000))), zero);
+		const __m128i magnitude = _mm_and_si128(_mm_min_epi16(_mm_and_si128(halves, _mm_set1_epi16(0x7FFF)), _mm_set1_epi16(max_half)), positive);
+
+		pixel[i] = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(_mm_unpacklo_epi16(magnitude, zero), 13)), scale);
+		pixel[i + 1] = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(_mm_unpackhi_epi16(magnitude, zero), 13)), scale);
+	}
+
+	// Turn the pixels into planes of red, green, blue and the alpha we don't need.
+	_MM_TRANSPOSE4_PS(pixel[0], pixel[1], pixel[2], pixel[3]);
+
+	for (size_t channel = 0; channel < 3; ++channel)
+	{
+		_mm_storeu_ps(color + (channel * block_pixels), pixel[channel]);
+	}
+#elif defined(CONVERT_NEON)
+	// Load the channels of the 4 pixels into a plane each.
+	const uint16x4x4_t halves = vld4_u16(reinterpret_cast<const uint16_t*>(pixels));
+
+	for (size_t channel = 0; channel < 3; ++channel)
+	{
+		const uint16x4_t negative = vtst_u16(halves.val[channel], vdup_n_u16(0x8000));
+		const uint16x4_t magnitude = vbic_u16(vmin_u16(vand_u16(halves.val[channel], vdup_n_u16(0x7FFF)), vdup_n_u16(max_half)), negative);
+
+		vst1q_f32(color + (channel * block_pixels), vmulq_n_f32(vcvt_f32_f16(vreinterpret_f16_u16(magnitude)), _scale));
+	}
+#else
+	for (size_t i = 0; i < block_pixels; ++i)
+	{
+		for (size_t channel = 0; channel < 3; ++channel)
+		{
+			uint16_t half;
+
+			memcpy(&half, pixels + (i * 8) + (channel * 2), sizeof(half));
+
+			color[(channel * block_pixels) + i] = half_to_float(half) * _scale;
+		}
+	}
+#endif
+}
+
+void pixel_converter::decode_pq(const uint8_t* pixels, float* color) const
+{
+	float decoded[3 * block_pixels];
+
+	for (size_t i = 0; i < block_pixels; ++i)
+	{
+		uint32_t packed;
+
+		memcpy(&packed, pixels + (i * channels), sizeof(packed));
+
+		decoded[i] = _decodePq[packed & 0x3FF];
+		decoded[block_pixels + i] = _decodePq[(packed >> 10) & 0x3FF];
+		decoded[(2 * block_pixels) + i] = _decodePq[(packed >> 20) & 0x3FF];
+	}
+
+	// Colors outside of the sRGB gamut come out negative in some channels, which the tone
+	// mapping clamps to 0. Every path adds up the weighted channels in the same order.
+#if defined(CONVERT_SSE2)
+	const __m128 red = _mm_loadu_ps(decoded);
+	const __m128 green = _mm_loadu_ps(decoded + block_pixels);
+	const __m128 blue = _mm_loadu_ps(decoded + (2 * block_pixels));
+
+	for (size_t channel = 0; channel < 3; ++channel)
+	{
+		const auto& weights = bt2020_to_bt709[channel];
+
+		_mm_storeu_ps(color + (channel * block_pixels), _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(_mm_set1_ps(static_cast<float>(weights[0])), red), _mm_mul_ps(_mm_set1_ps(static_cast<float>(weights[1])), green)),
+			_mm_mul_ps(_mm_set1_ps(static_cast<float>(weights[2])), blue)));
+	}
+#elif defined(CONVERT_NEON)
+	const float32x4_t red = vld1q_f32(decoded);
+	const float32x4_t green = vld1q_f32(decoded + block_pixels);
+	const float32x4_t blue = vld1q_f32(decoded + (2 * block_pixels));
+
+	for (size_t channel = 0; channel < 3; ++channel)
+	{
+		const auto& weights = bt2020_to_bt709[channel];
+
+		vst1q_f32(color + (channel * block_pixels), vaddq_f32(
+			vaddq_f32(vmulq_n_f32(red, static_cast<float>(weights[0])), vmulq_n_f32(green, static_cast<float>(weights[1]))),
+			vmulq_n_f32(blue, static_cast<float>(weights[2]))));
+	}
+#else
+	for (size_t channel = 0; channel < 3; ++channel)
+	{
+		const auto& weights = bt2020_to_bt709[channel];
+
+		for (size_t i = 0; i < block_pixels; ++i)
+		{
+			color[(channel * block_pixels) + i] = (static_cast<float>(weights[0]) * decoded[i])
+				+ (static_cast<float>(weights[1]) * decoded[block_pixels + i])
+				+ (static_cast<float>(weights[2]) * decoded[(2 * block_pixels) + i]);
+		}
+	}
+#endif
+}
+
+void pixel_converter::encode_linear(const float* color, uint8_t* out) const
+{
+	const float maxLevel = static_cast<float>(encode_levels - 1);
+	int32_t levels[3 * block_pixels];
+
+	// Every path rounds the levels the same way, by adding 0.5 and truncating.
+#if defined(CONVERT_SSE2)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	for (size_t channel = 0; channel < 3; ++channel)
+	{
+		const __m128 linear = _mm_max_ps(_mm_loadu_ps(color + (channel * block_pixels)), zero);
+
+		// Compress the excess above the knee into the shoulder.
+		const __m128 excess = _mm_mul_ps(_mm_max_ps(_mm_sub_ps(linear, _mm_set1_ps(_knee)), zero), _mm_set1_ps(_inverseShoulder));
+		const __m128 compressed = _mm_div_ps(_mm_mul_ps(excess, _mm_add_ps(one, _mm_mul_ps(excess, _mm_set1_ps(_inversePeakSquared)))), _mm_add_ps(one, excess));
+		const __m128 mapped = _mm_min_ps(_mm_add_ps(_mm_min_ps(linear, _mm_set1_ps(_knee)), _mm_mul_ps(compressed, _mm_set1_ps(_shoulder))), one);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(levels + (channel * block_pixels)),
+			_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(mapped, _mm_set1_ps(maxLevel)), _mm_set1_ps(0.5f))));
+	}
+#elif defined(CONVERT_NEON)
+	const float32x4_t one = vdupq_n_f32(1.0f);
+
+	for (size_t channel = 0; channel < 3; ++channel)
+	{
+		const float32x4_t linear = vmaxq_f32(vld1q_f32(color + (channel * block_pixels)), vdupq_n_f32(0.0f));
+		const float32x4_t excess = vmulq_n_f32(vmaxq_f32(vsubq_f32(linear, vdupq_n_f32(_knee)), vdupq_n_f32(0.0f)), _inverseShoulder);
+		const float32x4_t denominator = vaddq_f32(one, excess);
+		float32x4_t reciprocal = vrecpeq_f32(denominator);
+
+		reciprocal = vmulq_f32(reciprocal, vrecpsq_f32(denominator, reciprocal));
+		reciprocal = vmulq_f32(reciprocal, vrecpsq_f32(denominator, reciprocal));
+
+		const float32x4_t compressed = vmulq_f32(vmulq_f32(excess, vmlaq_n_f32(one, excess, _inversePeakSquared)), reciprocal);
+		const float32x4_t mapped = vminq_f32(vmlaq_n_f32(vminq_f32(linear, vdupq_n_f32(_knee)), compressed, _shoulder), one);
+
+		vst1q_s32(levels + (channel * block_pixels), vcvtq_s32_f32(vmlaq_n_f32(vdupq_n_f32(0.5f), mapped, maxLevel)));
+	}
+#else
+	for (size_t i = 0; i < 3 * block_pixels; ++i)
+	{
+		const float linear = std::max(color[i], 0.0f);
+		const float excess = std::max(linear - _knee, 0.0f) * _inverseShoulder;
+		const float compressed = (excess * (1.0f + (excess * _inversePeakSquared))) / (1.0f + excess);
+		const float mapped = std::min(std::min(linear, _knee) + (compressed * _shoulder), 1.0f);
+
+		levels[i] = static_cast<int32_t>((mapped * maxLevel) + 0.5f);
+	}
+#endif
+
+	for (size_t i = 0; i < block_pixels; ++i)
+	{
+		uint8_t* pixel = out + (i * channels);
+
+		pixel[0] = _encode[levels[(2 * block_pixels) + i]];
+		pixel[1] = _encode[levels[block_pixels + i]];
+		pixel[2] = _encode[levels[i]];
+		pixel[3] = 0xFF;
+	}
+}
+
+const wchar_t* pixel_converter::name()
+{
+#if defined(CONVERT_SSE2)
+	return L"SSE2";
+#elif defined(CONVERT_NEON)
+	return L"NEON";
+#else
+	return L"Scalar";
+#endif
+}
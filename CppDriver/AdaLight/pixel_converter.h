@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "settings.h"
+#include "frame_source.h"
+
+// Convert the pixels we sample from high bit depth and HDR frames to the 8-bit B, G, R, A
+// layout the rest of the sampler works with.
+//
+// SDR 10-bit frames are already sRGB, so they just drop the 2 low bits of each channel. Half
+// float frames are linear scRGB, where 1.0 is 80 nits, so we scale them to put the SDR white
+// level at 1.0, roll off anything brighter with a soft knee which reaches 1.0 at the peak level,
+// and encode the result with the sRGB curve through a lookup table. HDR10 frames decode the PQ
+// curve through another lookup table and convert the BT.2020 primaries to sRGB, and then go
+// through the same tone mapping as the half floats.
+//
+// Only the pixels which are actually sampled get converted, e.g. the grid of each LED. The
+// summed-area table converts the whole lines of each band and the mip pyramid every pixel under
+// the samples, though, which can be most of the frame, so the HDR formats are converted several
+// pixels at a time.
+class pixel_converter
+{
+public:
+	explicit pixel_converter(const settings::hdr_config& config);
+
+	// Convert a run of pixels to 8-bit B, G, R, A.
+	void convert(pixel_format format, const uint8_t* pixels, size_t count, uint8_t* out) const;
+
+	// Convert the pixel at every combination of the row and column offsets into a block of
+	// rows x columns 8-bit pixels, with up to max_gather_columns columns.
+	void gather(pixel_format format, const uint8_t* pixels, const uint32_t* rowOffsets, size_t rows,
+		const uint32_t* columnOffsets, size_t columns, uint8_t* out) const;
+
+	static constexpr size_t max_gather_columns = 64;
+
+	// Name of the conversion implementation, for diagnostics.
+	static const wchar_t* name();
+
+private:
+	static constexpr size_t encode_levels = 4096;
+	static constexpr size_t pq_levels = 1024;
+
+	// The HDR formats are converted a block of pixels at a time, with the channels of the block
+	// in planes so the SIMD paths work on the same channel of several pixels at once.
+	static constexpr size_t block_pixels = 4;
+
+	void convert_float(const uint8_t* pixels, size_t count, uint8_t* out) const;
+	void convert_pq(const uint8_t* pixels, size_t count, uint8_t* out) const;
+
+	// Decode a run of pixels a block at a time, and pad the rest of the last block.
+	template <void (pixel_converter::*decode)(const uint8_t*, float*) const>
+	void convert_blocks(const uint8_t* pixels, size_t count, size_t pixelSize, uint8_t* out) const;
+
+	// Decode a block of pixels to planes of linear red, green and blue, where 1.0 is SDR white.
+	void decode_float(const uint8_t* pixels, float* color) const;
+	void decode_pq(const uint8_t* pixels, float* color) const;
+
+	// Tone map a block of linear red, green and blue planes and encode it with the sRGB curve
+	// as 8-bit B, G, R, A.
+	void encode_linear(const float* color, uint8_t* out) const;
+
+	// Tone mapping parameters. Values up to the knee pass through, and the excess above it
+	// is compressed into the shoulder between the knee and 1.0.
+	float _scale;
+	float _knee;
+	float _shoulder;
+	float _inverseShoulder;
+	float _inversePeakSquared;
+
+	// sRGB encoding of linear values from 0.0 to 1.0 in encode_levels steps.
+	std::array<uint8_t, encode_levels> _encode;
+
+	// Linear value of each 10-bit PQ code, where 1.0 is SDR white.
+	std::array<float, pq_levels> _decodePq;
+};
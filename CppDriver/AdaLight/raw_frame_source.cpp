@@ -0,0 +1,101 @@
+#include "stdafx.h"
+#include "raw_frame_source.h"
+
+#include <fstream>
+#include <iterator>
+
+frame_source_list raw_frame_source::create_sources(const settings& parameters)
+{
+	frame_source_list sources;
+	const auto& source = parameters.frameSource;
+	const pixel_format format = configured_format(parameters);
+	const size_t frameSize = source.width * source.height * pixel_size(format);
+
+	if (frameSize == 0)
+	{
+		return sources;
+	}
+
+	auto pixels = std::make_shared<const std::vector<uint8_t>>(read_file(source.path));
+
+	if (pixels->size() < frameSize)
+	{
+		return sources;
+	}
+
+	// Every display plays back the same file.
+	sources.reserve(parameters.displays.size());
+
+	for (size_t i = 0; i < parameters.displays.size(); ++i)
+	{
+		sources.push_back(std::make_unique<raw_frame_source>(pixels, source.width, source.height, format));
+	}
+
+	return sources;
+}
+
+raw_frame_source::raw_frame_source(std::shared_ptr<const std::vector<uint8_t>> pixels, size_t width, size_t height, pixel_format format)
+	: _pixels(std::move(pixels))
+	, _width(width)
+	, _height(height)
+	, _format(format)
+	, _pitch(width * pixel_size(format))
+	, _frameCount(_pixels->size() / (_pitch * height))
+{
+}
+
+size_t raw_frame_source::width() const
+{
+	return _width;
+}
+
+size_t raw_frame_source::height() const
+{
+	return _height;
+}
+
+frame_status raw_frame_source::acquire_frame(UINT /*timeout*/)
+{
+	// A file with a single frame never changes after the first time.
+	if (_frameCount == 1
+		&& _started)
+	{
+		return frame_status::unchanged;
+	}
+
+	_frameIndex = (_frameIndex + 1) % _frameCount;
+	_started = true;
+
+	return frame_status::available;
+}
+
+frame_status raw_frame_source::map(frame_view& view)
+{
+	view.pixels = _pixels->data() + (_frameIndex * _pitch * _height);
+	view.pitch = _pitch;
+	view.format = _format;
+	view.width = _width;
+	view.height = _height;
+
+	return frame_status::available;
+}
+
+void raw_frame_source::unmap()
+{
+}
+
+std::vector<uint8_t> raw_frame_source::read_file(const std::wstring& path)
+{
+#ifdef _WIN32
+	std::ifstream ifs(path, std::ios::in | std::ios::binary);
+#else
+	std::ifstream ifs(std::string(path.cbegin(), path.cend()), std::ios::in | std::ios::binary);
+#endif
+
+	if (!ifs.is_open())
+	{
+		return {};
+	}
+
+	return std::vector<uint8_t>(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "frame_source.h"
+
+// Play back a file of packed frames with no header or row padding, e.g. a dump from
+// "ffmpeg -pix_fmt bgra -f rawvideo" for 32-bit BGRA frames, or "-pix_fmt x2bgr10le" for
+// 10-bit frames. The whole file is loaded up front and each frame advances to the next
+// image in the file, looping back to the start.
+class raw_frame_source
+	: public frame_source
+{
+public:
+	static frame_source_list create_sources(const settings& parameters);
+
+	raw_frame_source(std::shared_ptr<const std::vector<uint8_t>> pixels, size_t width, size_t height, pixel_format format);
+
+	size_t width() const override;
+	size_t height() const override;
+
+	frame_status acquire_frame(UINT timeout) override;
+	frame_status map(frame_view& view) override;
+	void unmap() override;
+
+private:
+	static std::vector<uint8_t> read_file(const std::wstring& path);
+
+	const std::shared_ptr<const std::vector<uint8_t>> _pixels;
+	const size_t _width;
+	const size_t _height;
+	const pixel_format _format;
+	const size_t _pitch;
+	const size_t _frameCount;
+	size_t _frameIndex = 0;
+	bool _started = false;
+};
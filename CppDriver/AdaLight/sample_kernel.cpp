@@ -0,0 +1,556 @@
+#include "stdafx.h"
+#include "sample_kernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define SAMPLE_KERNEL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(_M_ARM) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define SAMPLE_KERNEL_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(SAMPLE_KERNEL_X86) && !defined(_MSC_VER)
+// GCC and Clang only let us use the AVX2 intrinsics in functions which are compiled for AVX2,
+// we only call them after checking that the CPU supports it.
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+// Each axis of the weight table adds up to this, so the weight of every sample fits in the low
+// 16 bits of a signed 32-bit lane and can be multiplied with a pmaddwd.
+constexpr uint32_t axis_weight = 128;
+
+static inline uint32_t load_pixel(const uint8_t* line, uint32_t offset)
+{
+	uint32_t pixel;
+
+	memcpy(&pixel, line + offset, sizeof(pixel));
+
+	return pixel;
+}
+
+static inline void add_pixel(channel_sums& sums, uint32_t pixel)
+{
+	sums.b += pixel & 0xFF;
+	sums.g += (pixel >> 8) & 0xFF;
+	sums.r += (pixel >> 16) & 0xFF;
+}
+
+static inline void add_weighted_pixel(channel_sums& sums, uint32_t pixel, uint32_t weight)
+{
+	sums.b += (pixel & 0xFF) * weight;
+	sums.g += ((pixel >> 8) & 0xFF) * weight;
+	sums.r += ((pixel >> 16) & 0xFF) * weight;
+}
+
+// Every kernel is a template on the number of columns, so the compiler can unroll the inner
+// loop for the common grid sizes. Columns is 0 for any other grid size, and then we use the
+// columns argument instead.
+template <size_t Columns>
+static channel_sums sum_scalar(const uint8_t* pixels, const uint32_t* rowOffsets, size_t rows, const uint32_t* columnOffsets, size_t columns, const uint32_t* /*weights*/)
+{
+	const size_t count = Columns ? Columns : columns;
+	channel_sums sums = {};
+
+	for (size_t row = 0; row < rows; ++row)
+	{
+		const uint8_t* line = pixels + rowOffsets[row];
+
+		for (size_t col = 0; col < count; ++col)
+		{
+			add_pixel(sums, load_pixel(line, columnOffsets[col]));
+		}
+	}
+
+	return sums;
+}
+
+template <size_t Columns>
+static channel_sums weighted_scalar(const uint8_t* pixels, const uint32_t* rowOffsets, size_t rows, const uint32_t* columnOffsets, size_t columns, const uint32_t* weights)
+{
+	const size_t count = Columns ? Columns : columns;
+	channel_sums sums = {};
+
+	for (size_t row = 0; row < rows; ++row)
+	{
+		const uint8_t* line = pixels + rowOffsets[row];
+		const uint32_t* rowWeights = weights + (row * count);
+
+		for (size_t col = 0; col < count; ++col)
+		{
+			add_weighted_pixel(sums, load_pixel(line, columnOffsets[col]), rowWeights[col]);
+		}
+	}
+
+	return sums;
+}
+
+#ifdef SAMPLE_KERNEL_X86
+
+static inline uint32_t horizontal_sum(__m128i lanes)
+{
+	lanes = _mm_add_epi32(lanes, _mm_shuffle_epi32(lanes, _MM_SHUFFLE(1, 0, 3, 2)));
+	lanes = _mm_add_epi32(lanes, _mm_shuffle_epi32(lanes, _MM_SHUFFLE(2, 3, 0, 1)));
+
+	return static_cast<uint32_t>(_mm_cvtsi128_si32(lanes));
+}
+
+// SSE2 has no gather, so we load 4 pixels at a time and split the channels into 32-bit lanes.
+static inline __m128i load_quad(const uint8_t* line, const uint32_t* columnOffsets)
+{
+	return _mm_set_epi32(
+		static_cast<int>(load_pixel(line, columnOffsets[3])),
+		static_cast<int>(load_pixel(line, columnOffsets[2])),
+		static_cast<int>(load_pixel(line, columnOffsets[1])),
+		static_cast<int>(load_pixel(line, columnOffsets[0])));
+}
+
+template <size_t Columns>
+static channel_sums sum_sse2(const uint8_t* pixels, const uint32_t* rowOffsets, size_t rows, const uint32_t* columnOffsets, size_t columns, const uint32_t* /*weights*/)
+{
+	const size_t count = Columns ? Columns : columns;
+	const size_t vectorCount = count - (count % 4);
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	__m128i b = _mm_setzero_si128();
+	__m128i g = _mm_setzero_si128();
+	__m128i r = _mm_setzero_si128();
+	channel_sums sums = {};
+
+	for (size_t row = 0; row < rows; ++row)
+	{
+		const uint8_t* line = pixels + rowOffsets[row];
+		size_t col = 0;
+
+		for (; col < vectorCount; col += 4)
+		{
+			const __m128i quad = load_quad(line, columnOffsets + col);
+
+			b = _mm_add_epi32(b, _mm_and_si128(quad, mask));
+			g = _mm_add_epi32(g, _mm_and_si128(_mm_srli_epi32(quad, 8), mask));
+			r = _mm_add_epi32(r, _mm_and_si128(_mm_srli_epi32(quad, 16), mask));
+		}
+
+		for (; col < count; ++col)
+		{
+			add_pixel(sums, load_pixel(line, columnOffsets[col]));
+		}
+	}
+
+	sums.b += horizontal_sum(b);
+	sums.g += horizontal_sum(g);
+	sums.r += horizontal_sum(r);
+
+	return sums;
+}
+
+template <size_t Columns>
+static channel_sums weighted_sse2(const uint8_t* pixels, const uint32_t* rowOffsets, size_t rows, const uint32_t* columnOffsets, size_t columns, const uint32_t* weights)
+{
+	const size_t count = Columns ? Columns : columns;
+	const size_t vectorCount = count - (count % 4);
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	__m128i b = _mm_setzero_si128();
+	__m128i g = _mm_setzero_si128();
+	__m128i r = _mm_setzero_si128();
+	channel_sums sums = {};
+
+	for (size_t row = 0; row < rows; ++row)
+	{
+		const uint8_t* line = pixels + rowOffsets[row];
+		const uint32_t* rowWeights = weights + (row * count);
+		size_t col = 0;
+
+		// The channels and the weights both fit in the low 16 bits of each lane, so pmaddwd
+		// gives us the 32-bit product of each pair.
+		for (; col < vectorCount; col += 4)
+		{
+			const __m128i quad = load_quad(line, columnOffsets + col);
+			const __m128i weight = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowWeights + col));
+
+			b = _mm_add_epi32(b, _mm_madd_epi16(_mm_and_si128(quad, mask), weight));
+			g = _mm_add_epi32(g, _mm_madd_epi16(_mm_and_si128(_mm_srli_epi32(quad, 8), mask), weight));
+			r = _mm_add_epi32(r, _mm_madd_epi16(_mm_and_si128(_mm_srli_epi32(quad, 16), mask), weight));
+		}
+
+		for (; col < count; ++col)
+		{
+			add_weighted_pixel(sums, load_pixel(line, columnOffsets[col]), rowWeights[col]);
+		}
+	}
+
+	sums.b += horizontal_sum(b);
+	sums.g += horizontal_sum(g);
+	sums.r += horizontal_sum(r);
+
+	return sums;
+}
+
+TARGET_AVX2 static inline uint32_t horizontal_sum(__m256i lanes)
+{
+	return horizontal_sum(_mm_add_epi32(_mm256_castsi256_si128(lanes), _mm256_extracti128_si256(lanes, 1)));
+}
+
+template <size_t Columns>
+TARGET_AVX2 static channel_sums sum_avx2(const uint8_t* pixels, const uint32_t* rowOffsets, size_t rows, const uint32_t* columnOffsets, size_t columns, const uint32_t* /*weights*/)
+{
+	const size_t count = Columns ? Columns : columns;
+	const size_t vectorCount = count - (count % 8);
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	__m256i b = _mm256_setzero_si256();
+	__m256i g = _mm256_setzero_si256();
+	__m256i r = _mm256_setzero_si256();
+	channel_sums sums = {};
+
+	for (size_t row = 0; row < rows; ++row)
+	{
+		const uint8_t* line = pixels + rowOffsets[row];
+		size_t col = 0;
+
+		// Gather 8 pixels at a time from the same line, using the column offsets as the indices.
+		for (; col < vectorCount; col += 8)
+		{
+			const __m256i indices = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(columnOffsets + col));
+			const __m256i octet = _mm256_i32gather_epi32(reinterpret_cast<const int*>(line), indices, 1);
+
+			b = _mm256_add_epi32(b, _mm256_and_si256(octet, mask));
+			g = _mm256_add_epi32(g, _mm256_and_si256(_mm256_srli_epi32(octet, 8), mask));
+			r = _mm256_add_epi32(r, _mm256_and_si256(_mm256_srli_epi32(octet, 16), mask));
+		}
+
+		for (; col < count; ++col)
+		{
+			add_pixel(sums, load_pixel(line, columnOffsets[col]));
+		}
+	}
+
+	sums.b += horizontal_sum(b);
+	sums.g += horizontal_sum(g);
+	sums.r += horizontal_sum(r);
+
+	return sums;
+}
+
+template <size_t Columns>
+TARGET_AVX2 static channel_sums weighted_avx2(const uint8_t* pixels, const uint32_t* rowOffsets, size_t rows, const uint32_t* columnOffsets, size_t columns, const uint32_t* weights)
+{
+	const size_t count = Columns ? Columns : columns;
+	const size_t vectorCount = count - (count % 8);
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	__m256i b = _mm256_setzero_si256();
+	__m256i g = _mm256_setzero_si256();
+	__m256i r = _mm256_setzero_si256();
+	channel_sums sums = {};
+
+	for (size_t row = 0; row < rows; ++row)
+	{
+		const uint8_t* line = pixels + rowOffsets[row];
+		const uint32_t* rowWeights = weights + (row * count);
+		size_t col = 0;
+
+		for (; col < vectorCount; col += 8)
+		{
+			const __m256i indices = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(columnOffsets + col));
+			const __m256i octet = _mm256_i32gather_epi32(reinterpret_cast<const int*>(line), indices, 1);
+			const __m256i weight = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rowWeights + col));
+
+			b = _mm256_add_epi32(b, _mm256_madd_epi16(_mm256_and_si256(octet, mask), weight));
+			g = _mm256_add_epi32(g, _mm256_madd_epi16(_mm256_and_si256(_mm256_srli_epi32(octet, 8), mask), weight));
+			r = _mm256_add_epi32(r, _mm256_madd_epi16(_mm256_and_si256(_mm256_srli_epi32(octet, 16), mask), weight));
+		}
+
+		for (; col < count; ++col)
+		{
+			add_weighted_pixel(sums, load_pixel(line, columnOffsets[col]), rowWeights[col]);
+		}
+	}
+
+	sums.b += horizontal_sum(b);
+	sums.g += horizontal_sum(g);
+	sums.r += horizontal_sum(r);
+
+	return sums;
+}
+
+static bool cpu_supports_sse2()
+{
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 1);
+
+	return !!(info[3] & (1 << 26));
+#else
+	return !!__builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool cpu_supports_avx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 0);
+
+	if (info[0] < 7)
+	{
+		return false;
+	}
+
+	// The OS also needs to save the YMM registers.
+	__cpuid(info, 1);
+
+	if (!(info[2] & (1 << 27))
+		|| (_xgetbv(0) & 0x6) != 0x6)
+	{
+		return false;
+	}
+
+	__cpuidex(info, 7, 0);
+
+	return !!(info[1] & (1 << 5));
+#else
+	return !!__builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // SAMPLE_KERNEL_X86
+
+#ifdef SAMPLE_KERNEL_NEON
+
+static inline uint32_t horizontal_sum(uint32x4_t lanes)
+{
+#if defined(_M_ARM64) || defined(__aarch64__)
+	return vaddvq_u32(lanes);
+#else
+	const uint32x2_t pairs = vadd_u32(vget_low_u32(lanes), vget_high_u32(lanes));
+
+	return vget_lane_u32(vpadd_u32(pairs, pairs), 0);
+#endif
+}
+
+static inline uint32x4_t load_quad(const uint8_t* line, const uint32_t* columnOffsets)
+{
+	uint32x4_t quad = vdupq_n_u32(load_pixel(line, columnOffsets[0]));
+
+	quad = vsetq_lane_u32(load_pixel(line, columnOffsets[1]), quad, 1);
+	quad = vsetq_lane_u32(load_pixel(line, columnOffsets[2]), quad, 2);
+	quad = vsetq_lane_u32(load_pixel(line, columnOffsets[3]), quad, 3);
+
+	return quad;
+}
+
+template <size_t Columns>
+static channel_sums sum_neon(const uint8_t* pixels, const uint32_t* rowOffsets, size_t rows, const uint32_t* columnOffsets, size_t columns, const uint32_t* /*weights*/)
+{
+	const size_t count = Columns ? Columns : columns;
+	const size_t vectorCount = count - (count % 4);
+	const uint32x4_t mask = vdupq_n_u32(0xFF);
+	uint32x4_t b = vdupq_n_u32(0);
+	uint32x4_t g = vdupq_n_u32(0);
+	uint32x4_t r = vdupq_n_u32(0);
+	channel_sums sums = {};
+
+	for (size_t row = 0; row < rows; ++row)
+	{
+		const uint8_t* line = pixels + rowOffsets[row];
+		size_t col = 0;
+
+		for (; col < vectorCount; col += 4)
+		{
+			const uint32x4_t quad = load_quad(line, columnOffsets + col);
+
+			b = vaddq_u32(b, vandq_u32(quad, mask));
+			g = vaddq_u32(g, vandq_u32(vshrq_n_u32(quad, 8), mask));
+			r = vaddq_u32(r, vandq_u32(vshrq_n_u32(quad, 16), mask));
+		}
+
+		for (; col < count; ++col)
+		{
+			add_pixel(sums, load_pixel(line, columnOffsets[col]));
+		}
+	}
+
+	sums.b += horizontal_sum(b);
+	sums.g += horizontal_sum(g);
+	sums.r += horizontal_sum(r);
+
+	return sums;
+}
+
+template <size_t Columns>
+static channel_sums weighted_neon(const uint8_t* pixels, const uint32_t* rowOffsets, size_t rows, const uint32_t* columnOffsets, size_t columns, const uint32_t* weights)
+{
+	const size_t count = Columns ? Columns : columns;
+	const size_t vectorCount = count - (count % 4);
+	const uint32x4_t mask = vdupq_n_u32(0xFF);
+	uint32x4_t b = vdupq_n_u32(0);
+	uint32x4_t g = vdupq_n_u32(0);
+	uint32x4_t r = vdupq_n_u32(0);
+	channel_sums sums = {};
+
+	for (size_t row = 0; row < rows; ++row)
+	{
+		const uint8_t* line = pixels + rowOffsets[row];
+		const uint32_t* rowWeights = weights + (row * count);
+		size_t col = 0;
+
+		for (; col < vectorCount; col += 4)
+		{
+			const uint32x4_t quad = load_quad(line, columnOffsets + col);
+			const uint32x4_t weight = vld1q_u32(rowWeights + col);
+
+			b = vmlaq_u32(b, vandq_u32(quad, mask), weight);
+			g = vmlaq_u32(g, vandq_u32(vshrq_n_u32(quad, 8), mask), weight);
+			r = vmlaq_u32(r, vandq_u32(vshrq_n_u32(quad, 16), mask), weight);
+		}
+
+		for (; col < count; ++col)
+		{
+			add_weighted_pixel(sums, load_pixel(line, columnOffsets[col]), rowWeights[col]);
+		}
+	}
+
+	sums.b += horizontal_sum(b);
+	sums.g += horizontal_sum(g);
+	sums.r += horizontal_sum(r);
+
+	return sums;
+}
+
+#endif // SAMPLE_KERNEL_NEON
+
+// Pick the specialization of a kernel for the grid size.
+#define SELECT_KERNEL(kernel, columns) \
+	((columns) == 16 ? &kernel<16> \
+		: (columns) == 8 ? &kernel<8> \
+		: (columns) == 4 ? &kernel<4> \
+		: &kernel<0>)
+
+// Split axis_weight between the samples on one axis of the grid along a Gaussian curve with a
+// standard deviation of a quarter of the grid. We round down and hand out what's left to the
+// samples which lost the most, so the weights always add up to exactly axis_weight.
+static std::vector<uint32_t> gaussian_weights(size_t gridSize)
+{
+	const double center = static_cast<double>(gridSize - 1) / 2.0;
+	const double sigma = static_cast<double>(gridSize) / 4.0;
+	std::vector<double> curve(gridSize);
+
+	for (size_t i = 0; i < gridSize; ++i)
+	{
+		const double distance = (static_cast<double>(i) - center) / sigma;
+
+		curve[i] = std::exp(-0.5 * distance * distance);
+	}
+
+	const double scale = static_cast<double>(axis_weight) / std::accumulate(curve.cbegin(), curve.cend(), 0.0);
+	std::vector<uint32_t> weights(gridSize);
+	std::vector<size_t> order(gridSize);
+	uint32_t remaining = axis_weight;
+
+	for (size_t i = 0; i < gridSize; ++i)
+	{
+		curve[i] *= scale;
+		weights[i] = static_cast<uint32_t>(curve[i]);
+		remaining -= weights[i];
+		curve[i] -= static_cast<double>(weights[i]);
+		order[i] = i;
+	}
+
+	std::stable_sort(order.begin(), order.end(), [&curve](size_t lhs, size_t rhs)
+	{
+		return curve[lhs] > curve[rhs];
+	});
+
+	for (size_t i = 0; remaining > 0; ++i, --remaining)
+	{
+		++weights[order[i % gridSize]];
+	}
+
+	return weights;
+}
+
+sample_kernel::sample_kernel(const settings::sampling_config& sampling, bool useSimd)
+	: _gridSize(std::min(std::max(sampling.gridSize, size_t(1)), max_grid_size))
+	, _weighted(settings::weight_profile::uniform != sampling.weights)
+	, _name(L"scalar")
+{
+	if (_weighted)
+	{
+		// The weights are separable, so each sample gets the product of its row and column weight.
+		const auto axis = gaussian_weights(_gridSize);
+
+		_weights.resize(_gridSize * _gridSize);
+
+		for (size_t row = 0; row < _gridSize; ++row)
+		{
+			for (size_t col = 0; col < _gridSize; ++col)
+			{
+				_weights[(row * _gridSize) + col] = axis[row] * axis[col];
+			}
+		}
+
+		_totalWeight = axis_weight * axis_weight;
+		_sum = SELECT_KERNEL(weighted_scalar, _gridSize);
+	}
+	else
+	{
+		_totalWeight = static_cast<uint32_t>(_gridSize * _gridSize);
+		_sum = SELECT_KERNEL(sum_scalar, _gridSize);
+	}
+
+	if (!useSimd)
+	{
+		return;
+	}
+
+#if defined(SAMPLE_KERNEL_X86)
+	if (cpu_supports_avx2())
+	{
+		_sum = _weighted
+			? SELECT_KERNEL(weighted_avx2, _gridSize)
+			: SELECT_KERNEL(sum_avx2, _gridSize);
+		_name = L"AVX2";
+	}
+	else if (cpu_supports_sse2())
+	{
+		_sum = _weighted
+			? SELECT_KERNEL(weighted_sse2, _gridSize)
+			: SELECT_KERNEL(sum_sse2, _gridSize);
+		_name = L"SSE2";
+	}
+#elif defined(SAMPLE_KERNEL_NEON)
+	_sum = _weighted
+		? SELECT_KERNEL(weighted_neon, _gridSize)
+		: SELECT_KERNEL(sum_neon, _gridSize);
+	_name = L"NEON";
+#endif
+}
+
+channel_sums sample_kernel::sum(const uint8_t* pixels, const uint32_t* rowOffsets, const uint32_t* columnOffsets) const
+{
+	return _sum(pixels, rowOffsets, _gridSize, columnOffsets, _gridSize, _weights.data());
+}
+
+size_t sample_kernel::grid_size() const
+{
+	return _gridSize;
+}
+
+uint32_t sample_kernel::total_weight() const
+{
+	return _totalWeight;
+}
+
+const wchar_t* sample_kernel::name() const
+{
+	return _name;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "settings.h"
+
+// Sums of the B, G and R channels of a block of sampled pixels.
+struct channel_sums
+{
+	uint32_t b;
+	uint32_t g;
+	uint32_t r;
+};
+
+// Add up the channels of a block of sampled 32-bit BGRA pixels. The work is done in integer
+// lanes with SSE2, AVX2 or NEON depending on what the CPU supports, and the scalar fallback
+// produces exactly the same sums.
+//
+// The block is a square grid of samples with the size and weights from the sampling settings.
+// Uniform weights just add up the samples, otherwise each sample is multiplied by its entry in
+// a table of integer weights which we compute once up front.
+class sample_kernel
+{
+public:
+	static constexpr size_t max_grid_size = 64;
+
+	// Pick the fastest implementation for this CPU and grid size, or always use the scalar
+	// implementation if useSimd is false, e.g. to compare the results.
+	explicit sample_kernel(const settings::sampling_config& sampling, bool useSimd = true);
+
+	// Sample every combination of the grid_size() row and column byte offsets, so each row is a
+	// gather of the same columns from one line of pixels.
+	channel_sums sum(const uint8_t* pixels, const uint32_t* rowOffsets, const uint32_t* columnOffsets) const;
+
+	// Number of samples on each side of the grid, clamped to [1, max_grid_size].
+	size_t grid_size() const;
+
+	// Divide the sums by this to get the weighted average of the samples.
+	uint32_t total_weight() const;
+
+	// Name of the implementation we picked, for diagnostics.
+	const wchar_t* name() const;
+
+	typedef channel_sums(*sum_function)(const uint8_t* pixels, const uint32_t* rowOffsets, size_t rows, const uint32_t* columnOffsets, size_t columns, const uint32_t* weights);
+
+private:
+	const size_t _gridSize;
+	const bool _weighted;
+	std::vector<uint32_t> _weights;
+	uint32_t _totalWeight;
+	sum_function _sum;
+	const wchar_t* _name;
+};
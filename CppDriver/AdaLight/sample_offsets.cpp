@@ -0,0 +1,80 @@
+#include "stdafx.h"
+#include "sample_offsets.h"
+
+void sample_offsets::resize(size_t ledCount, size_t rows, size_t columns)
+{
+	_rows = rows;
+	_columns = columns;
+	_pitch = 0;
+	_pixelSize = 0;
+
+	_x.assign(ledCount * columns, 0);
+	_y.assign(ledCount * rows, 0);
+	_rowOffsets.assign(ledCount * rows, 0);
+	_columnOffsets.assign(ledCount * columns, 0);
+}
+
+void sample_offsets::set_led(size_t led, const uint32_t* y, const uint32_t* x)
+{
+	uint32_t* rowY = _y.data() + (led * _rows);
+	uint32_t* columnX = _x.data() + (led * _columns);
+
+	for (size_t row = 0; row < _rows; ++row)
+	{
+		rowY[row] = y[row];
+	}
+
+	for (size_t col = 0; col < _columns; ++col)
+	{
+		columnX[col] = x[col];
+	}
+
+	// Force the offsets to be resolved again on the next frame.
+	_pitch = 0;
+	_pixelSize = 0;
+}
+
+void sample_offsets::update_layout(size_t pitch, size_t pixelSize)
+{
+	if (pitch == _pitch
+		&& pixelSize == _pixelSize)
+	{
+		return;
+	}
+
+	const uint32_t rowPitch = static_cast<uint32_t>(pitch);
+	const uint32_t columnPitch = static_cast<uint32_t>(pixelSize);
+
+	for (size_t i = 0; i < _y.size(); ++i)
+	{
+		_rowOffsets[i] = _y[i] * rowPitch;
+	}
+
+	for (size_t i = 0; i < _x.size(); ++i)
+	{
+		_columnOffsets[i] = _x[i] * columnPitch;
+	}
+
+	_pitch = pitch;
+	_pixelSize = pixelSize;
+}
+
+const uint32_t* sample_offsets::row_offsets(size_t led) const
+{
+	return _rowOffsets.data() + (led * _rows);
+}
+
+const uint32_t* sample_offsets::column_offsets(size_t led) const
+{
+	return _columnOffsets.data() + (led * _columns);
+}
+
+size_t sample_offsets::rows() const
+{
+	return _rows;
+}
+
+size_t sample_offsets::columns() const
+{
+	return _columns;
+}
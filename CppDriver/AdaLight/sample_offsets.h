@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Flat table of the pixels sampled for every LED on a display. Each LED samples a grid of
+// rows x columns pixels, and since every row of the grid shares the same columns we only need
+// to store the byte offset of each row (y * pitch) and each column (x * pixel size). The offsets
+// depend on the pitch and format of the mapped frame, so they're resolved again only if those
+// change.
+class sample_offsets
+{
+public:
+	void resize(size_t ledCount, size_t rows, size_t columns);
+
+	// Set the pixel coordinates of the sampled rows and columns for an LED.
+	void set_led(size_t led, const uint32_t* y, const uint32_t* x);
+
+	// Resolve the offsets for the pitch and pixel size of the mapped frame.
+	void update_layout(size_t pitch, size_t pixelSize);
+
+	const uint32_t* row_offsets(size_t led) const;
+	const uint32_t* column_offsets(size_t led) const;
+
+	size_t rows() const;
+	size_t columns() const;
+
+private:
+	size_t _rows = 0;
+	size_t _columns = 0;
+	size_t _pitch = 0;
+	size_t _pixelSize = 0;
+
+	std::vector<uint32_t> _x;
+	std::vector<uint32_t> _y;
+	std::vector<uint32_t> _rowOffsets;
+	std::vector<uint32_t> _columnOffsets;
+};
@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include "screen_samples.h"
 
+#include <algorithm>
+
 #ifdef _DEBUG
 #include <string>
 #include <sstream>
@@ -11,8 +13,22 @@
 
 screen_samples::screen_samples(const settings& parameters, const gamma_correction& gamma)
 	: _parameters(parameters)
-	, _gamma(gamma)
+	, _kernel(parameters.sampling)
+	, _converter(parameters.hdr)
+	, _colors(parameters, gamma)
 {
+	_telemetry.set_led_count(parameters.totalLedCount);
+
+	const size_t gridSize = _kernel.grid_size();
+
+	_packedRows.resize(gridSize);
+	_packedColumns.resize(gridSize);
+
+	for (size_t i = 0; i < gridSize; ++i)
+	{
+		_packedRows[i] = static_cast<uint32_t>(i * gridSize * 4);
+		_packedColumns[i] = static_cast<uint32_t>(i * 4);
+	}
 }
 
 bool screen_samples::create_resources()
@@ -21,155 +37,201 @@ bool screen_samples::create_resources()
 	{
 		return true;
 	}
-	else if (!get_factory())
+
+	_sources = create_frame_sources(_parameters);
+
+	if (_sources.empty())
 	{
 		return false;
 	}
 
-	_displays.reserve(_parameters.displays.size());
-
-	// Get the display dimensions and devices.
-	IDXGIAdapter1Ptr adapter;
-
-	for (UINT i = 0; _displays.size() < _parameters.displays.size() && SUCCEEDED(_factory->EnumAdapters1(i, &adapter)); ++i)
+	const bool areaMode = (settings::sampling_mode::area == _parameters.sampling.mode);
+	const bool pyramidMode = (settings::sampling_mode::pyramid == _parameters.sampling.mode);
+
+	_sampleOffsets.resize(_sources.size());
+	_areaTables.resize(areaMode ? _sources.size() : 0);
+	_pyramids.resize(pyramidMode ? _sources.size() : 0);
+	_tiles.resize(_sources.size());
+	_letterboxes.resize(_parameters.letterbox.enabled ? _sources.size() : 0);
+	_changes.resize(_sources.size());
+	_converted.resize(_sources.size());
+	_sums.resize(_sources.size());
+	_acquired.resize(_sources.size());
+	_displayTelemetry.resize(_sources.size());
+
+	for (size_t i = 0; i < _sources.size(); ++i)
 	{
-		IDXGIOutputPtr output;
+		const auto& source = *_sources[i];
 
-		for (UINT j = 0; _displays.size() < _parameters.displays.size() && SUCCEEDED(adapter->EnumOutputs(j, &output)); ++j)
+		if (!_letterboxes.empty())
 		{
-			IDXGIOutput1Ptr output1(output);
-			DXGI_OUTPUT_DESC outputDescription;
-			IDXGIOutputDuplicationPtr duplication;
-			ID3D11DevicePtr device;
-			ID3D11DeviceContextPtr context;
-
-			constexpr D3D_DRIVER_TYPE driverType = D3D_DRIVER_TYPE_UNKNOWN;
-			constexpr ULONG createFlags = D3D11_CREATE_DEVICE_SINGLETHREADED | D3D11_CREATE_DEVICE_BGRA_SUPPORT;
-
-			if (output1
-				&& SUCCEEDED(output1->GetDesc(&outputDescription))
-				&& outputDescription.AttachedToDesktop
-				&& SUCCEEDED(D3D11CreateDevice(adapter, driverType, NULL, createFlags, nullptr, 0, D3D11_SDK_VERSION, &device, nullptr, &context))
-				&& SUCCEEDED(output1->DuplicateOutput(device, &duplication)))
-			{
-				DXGI_OUTDUPL_DESC duplicationDescription;
+			_letterboxes[i].reset(_parameters.letterbox, source.width(), source.height());
+		}
 
-				duplication->GetDesc(&duplicationDescription);
+		_sums[i].resize(_parameters.displays[i].positions.size());
+		map_leds(i, { 0, 0, source.width(), source.height() });
+	}
 
-				const bool useMapDesktopSurface = !!duplicationDescription.DesktopImageInSystemMemory;
-				ID3D11Texture2DPtr staging;
-				const RECT& bounds = outputDescription.DesktopCoordinates;
-				const LONG width = bounds.right - bounds.left;
-				const LONG height = bounds.bottom - bounds.top;
+	// Start the workers once everything they use for their display is ready.
+	_workers.reserve(_sources.size());
 
-				if (!useMapDesktopSurface)
-				{
-					D3D11_TEXTURE2D_DESC textureDescription;
-
-					textureDescription.Width = static_cast<UINT>(width);
-					textureDescription.Height = static_cast<UINT>(height);
-					textureDescription.MipLevels = 1;
-					textureDescription.ArraySize = 1;
-					textureDescription.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-					textureDescription.SampleDesc.Count = 1;
-					textureDescription.SampleDesc.Quality = 0;
-					textureDescription.Usage = D3D11_USAGE_STAGING;
-					textureDescription.BindFlags = 0;
-					textureDescription.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-					textureDescription.MiscFlags = 0;
-
-					device->CreateTexture2D(&textureDescription, NULL, &staging);
-				}
+	for (size_t i = 0; i < _sources.size(); ++i)
+	{
+		_workers.push_back(std::make_unique<capture_worker>([this, i]()
+		{
+			capture_display(i);
+		}));
+	}
 
-				if (useMapDesktopSurface || staging)
-				{
-					_displays.push_back({
-						adapter,
-						device,
-						context,
-						duplication,
-						staging,
-						false,
-						{ width, height }
-					});
-				}
-			}
+	// Re-initialize the previous colors for fades.
+	_colors.reset();
 
-			output.Release();
-		}
+	_acquiredResources = true;
+	_startTick = GetTickCount64();
 
-		adapter.Release();
-	}
+	return true;
+}
 
-	if (_displays.empty())
+void screen_samples::map_leds(size_t index, const pixel_rect& active)
+{
+	const auto& display = _parameters.displays[index];
+	const auto& source = *_sources[index];
+	const size_t gridSize = _kernel.grid_size();
+	const double depth = std::min(std::max(_parameters.sampling.depth, 0.0), 1.0);
+	const bool areaMode = !_areaTables.empty();
+	const bool pyramidMode = !_pyramids.empty();
+	const double activeWidth = static_cast<double>(active.right - active.left);
+	const double activeHeight = static_cast<double>(active.bottom - active.top);
+	const double rangeX = (activeWidth / static_cast<double>(display.horizontalCount));
+	const double rangeY = (activeHeight / static_cast<double>(display.verticalCount));
+	std::vector<uint32_t> x(gridSize);
+	std::vector<uint32_t> y(gridSize);
+	std::vector<pixel_rect> rects(display.positions.size());
+	std::vector<uint32_t> sampleColumns(pyramidMode ? display.positions.size() * gridSize : 0);
+	std::vector<uint32_t> sampleRows(sampleColumns.size());
+	std::vector<size_t> levels(pyramidMode ? display.positions.size() : 0);
+
+	_sampleOffsets[index].resize(display.positions.size(), gridSize, gridSize);
+
+	// Calculate the sub-sampled pixel offsets within the active picture area.
+	for (size_t j = 0; j < display.positions.size(); ++j)
 	{
-		return false;
-	}
+		const auto& led = display.positions[j];
+		double left = static_cast<double>(active.left) + (rangeX * static_cast<double>(led.x));
+		double top = static_cast<double>(active.top) + (rangeY * static_cast<double>(led.y));
+		double width = rangeX;
+		double height = rangeY;
+
+		// LEDs on an edge of the display only sample the part of the block nearest that edge.
+		if (led.x == 0)
+		{
+			width *= depth;
+		}
+		else if (led.x + 1 == display.horizontalCount)
+		{
+			left += width * (1.0 - depth);
+			width *= depth;
+		}
 
-	// Samples take the center point of each cell in a 16x16 grid
-	constexpr size_t pixel_samples = 16;
-	static_assert(pixel_samples * pixel_samples == offset_array().size(), "size mismatch!");
+		if (led.y == 0)
+		{
+			height *= depth;
+		}
+		else if (led.y + 1 == display.verticalCount)
+		{
+			top += height * (1.0 - depth);
+			height *= depth;
+		}
 
-	_pixelOffsets.resize(_displays.size());
+		auto& rect = rects[j];
 
-	// Calculate the sub-sampled pixel offsets
-	for (size_t i = 0; i < _displays.size(); ++i)
-	{
-		const auto& display = _parameters.displays[i];
+		if (areaMode)
+		{
+			// Cover at least 1 pixel, even if the depth is 0.
+			rect.left = std::min(static_cast<size_t>(left), source.width() - 1);
+			rect.top = std::min(static_cast<size_t>(top), source.height() - 1);
+			rect.right = std::min(std::max(static_cast<size_t>(left + width), rect.left + 1), source.width());
+			rect.bottom = std::min(std::max(static_cast<size_t>(top + height), rect.top + 1), source.height());
+			continue;
+		}
 
-		_pixelOffsets[i].resize(display.positions.size());
+		// Samples take the center point of each cell in the grid.
+		const double stepX = width / static_cast<double>(gridSize);
+		const double stepY = height / static_cast<double>(gridSize);
+		const double startX = left + (stepX / 2.0);
+		const double startY = top + (stepY / 2.0);
 
-		for (size_t j = 0; j < display.positions.size(); ++j)
+		for (size_t k = 0; k < gridSize; ++k)
 		{
-			auto& offsets = _pixelOffsets[i][j];
-			const auto& led = display.positions[j];
-			const auto& displayBounds = _displays[i].bounds;
-			const double rangeX = (static_cast<double>(displayBounds.cx) / static_cast<double>(display.horizontalCount));
-			const double stepX = rangeX / static_cast<double>(pixel_samples);
-			const double startX = (rangeX * static_cast<double>(led.x)) + (stepX / 2.0);
-			const double rangeY = (static_cast<double>(displayBounds.cy) / static_cast<double>(display.verticalCount));
-			const double stepY = rangeY / static_cast<double>(pixel_samples);
-			const double startY = (rangeY * static_cast<double>(led.y)) + (stepY / 2.0);
-
-			size_t x[pixel_samples];
-			size_t y[pixel_samples];
-
-			for (size_t j = 0; j < pixel_samples; ++j)
+			x[k] = static_cast<uint32_t>(startX + (stepX * static_cast<double>(k)));
+			y[k] = static_cast<uint32_t>(startY + (stepY * static_cast<double>(k)));
+		}
+
+		if (pyramidMode)
+		{
+			// Read from the highest level where the samples are still at least 1 pixel apart,
+			// using the closer spacing so the LEDs along the edges stay inside their depth.
+			const double spacing = std::min(stepX, stepY);
+			size_t level = 1;
+
+			while (level < mip_pyramid::max_level
+				&& static_cast<double>(size_t(2) << level) <= spacing
+				&& (source.width() >> (level + 1)) > 0
+				&& (source.height() >> (level + 1)) > 0)
 			{
-				x[j] = static_cast<size_t>(startX + (stepX * static_cast<double>(j)));
-				y[j] = static_cast<size_t>(startY + (stepY * static_cast<double>(j)));
+				++level;
 			}
 
-			for (size_t row = 0; row < pixel_samples; ++row)
+			const size_t levelWidth = source.width() >> level;
+			const size_t levelHeight = source.height() >> level;
+			const uint32_t firstRow = static_cast<uint32_t>(mip_pyramid::first_row(source.height(), level));
+
+			// Each sample becomes the block of 2^level x 2^level pixels around it.
+			for (size_t k = 0; k < gridSize; ++k)
 			{
-				for (size_t col = 0; col < pixel_samples; ++col)
-				{
-					const size_t pixelIndex = (row * pixel_samples) + col;
-					const size_t pixelOffset = y[row] * static_cast<size_t>(displayBounds.cx) + x[col];
+				x[k] = std::min(x[k] >> level, static_cast<uint32_t>(levelWidth - 1));
+				y[k] = std::min(y[k] >> level, static_cast<uint32_t>(levelHeight - 1));
+			}
 
-					offsets[pixelIndex] = { x[col], y[row] };
-				}
+			const pixel_rect region = { x.front(), y.front(), static_cast<size_t>(x.back()) + 1, static_cast<size_t>(y.back()) + 1 };
+
+			std::copy(x.cbegin(), x.cend(), sampleColumns.begin() + (j * gridSize));
+			std::copy(y.cbegin(), y.cend(), sampleRows.begin() + (j * gridSize));
+			levels[j] = level;
+
+			for (size_t k = 0; k < gridSize; ++k)
+			{
+				y[k] += firstRow;
 			}
+
+			_sampleOffsets[index].set_led(j, y.data(), x.data());
+
+			// The samples depend on every pixel in the blocks under the region.
+			rect = {
+				region.left << level,
+				region.top << level,
+				std::min(region.right << level, source.width()),
+				std::min(region.bottom << level, source.height()),
+			};
+			continue;
 		}
+
+		_sampleOffsets[index].set_led(j, y.data(), x.data());
+
+		// The grid only depends on the pixels between the first and last samples.
+		rect = { x.front(), y.front(), static_cast<size_t>(x.back()) + 1, static_cast<size_t>(y.back()) + 1 };
 	}
 
-	// Re-initialize the previous colors for fades.
-	if (_previousColors.empty())
+	if (areaMode)
 	{
-		_previousColors.resize(_parameters.totalLedCount, _parameters.minBrightnessColor);
+		_areaTables[index].resize(rects);
 	}
-	else
+	else if (pyramidMode)
 	{
-		for (auto& previousColor : _previousColors)
-		{
-			previousColor = _parameters.minBrightnessColor;
-		}
+		_pyramids[index].resize(source.width(), source.height(), gridSize, sampleColumns, sampleRows, levels);
 	}
 
-	_acquiredResources = true;
-	_startTick = GetTickCount64();
-
-	return true;
+	_tiles[index].resize(source.width(), source.height(), rects);
 }
 
 bool screen_samples::take_samples(serial_buffer& serial)
@@ -179,182 +241,243 @@ bool screen_samples::take_samples(serial_buffer& serial)
 		return false;
 	}
 
-	// Take a screenshot for all of the devices that require a staging texture.
-	for (auto& device : _displays)
-	{
-		if (!device.staging)
-		{
-			continue;
-		}
+	const auto deadline = capture_worker::clock::now() + std::chrono::milliseconds(_parameters.delay);
+	size_t firstLed = 0;
 
-		const auto& displayBounds = device.bounds;
-		const UINT displayWidth = static_cast<UINT>(displayBounds.cx);
-		const UINT displayHeight = static_cast<UINT>(displayBounds.cy);
-		IDXGIResourcePtr resource;
-		DXGI_OUTDUPL_FRAME_INFO info;
-		ID3D11Texture2DPtr screenTexture;
+	// Pick up any displays which finished after the last deadline, and start capturing all of
+	// the displays which aren't still busy with an earlier frame.
+	for (size_t i = 0; i < _workers.size(); firstLed += _parameters.displays[i++].positions.size())
+	{
+		auto& worker = *_workers[i];
 
-		if (device.acquiredFrame)
+		if (worker.finished())
 		{
-			device.duplication->ReleaseFrame();
-			device.acquiredFrame = false;
+			if (!collect_samples(i, firstLed))
+			{
+				// Recreate all of the sources if one of them was lost.
+				free_resources();
+				return false;
+			}
+
+			worker.reset();
 		}
 
-		HRESULT hr = device.duplication->AcquireNextFrame(_parameters.delay, &info, &resource);
+		worker.start();
+	}
 
-		if (SUCCEEDED(hr))
-		{
-			device.acquiredFrame = true;
-			screenTexture = resource;
+	firstLed = 0;
 
-			if (screenTexture)
-			{
-				device.context->CopyResource(device.staging, screenTexture);
-			}
+	// Join the latest frame from each display. A display which misses the deadline reuses the
+	// sums from its last frame, the same as if it didn't have any new content, so it doesn't
+	// hold up the others.
+	for (size_t i = 0; i < _workers.size(); firstLed += _parameters.displays[i++].positions.size())
+	{
+		auto& worker = *_workers[i];
 
-			screenTexture.Release();
-			resource.Release();
+		if (!worker.wait_until(deadline))
+		{
+			_telemetry.add_stall(i);
+			continue;
 		}
-		else if (DXGI_ERROR_ACCESS_LOST == hr
-			|| DXGI_ERROR_INVALID_CALL == hr)
+
+		if (!collect_samples(i, firstLed))
 		{
-			// Recreate the duplication interface if this fails with with an expected error that invalidates
-			// the duplication interface or that might allow us to switch to MapDesktopSurface.
+			// Recreate all of the sources if one of them was lost.
 			free_resources();
 			return false;
 		}
+
+		worker.reset();
 	}
 
-	auto output = serial.begin();
-	auto previousColor = _previousColors.begin();
+	_colors.process(serial, _telemetry);
+
+	++_frameCount;
+	_telemetry.next_frame();
+
+	return true;
+}
+
+void screen_samples::capture_display(size_t index)
+{
+	const auto& display = _parameters.displays[index];
+	auto& source = *_sources[index];
+	auto& telemetry = _displayTelemetry[index];
+	auto& status = _acquired[index];
+	frame_view view;
 
-	for (size_t i = 0; i < _displays.size(); ++i)
 	{
-		const auto& display = _parameters.displays[i];
-		const auto& device = _displays[i];
+		frame_telemetry::scoped_timer timer(telemetry, frame_telemetry::stage::acquire);
 
-		for (size_t j = 0; j < display.positions.size(); ++j)
+		// Only wait for half of the frame period, so a display which doesn't have a new frame
+		// yet still leaves time to sample one that does before the deadline.
+		status = source.acquire_frame(_parameters.delay / 2);
+	}
+
+	if (frame_status::unchanged == status
+		|| frame_status::lost == status)
+	{
+		// There's no new content, so let any fades finish with the sums from the last frame.
+		return;
+	}
+
+	// Map each display once per frame and sample all of its LEDs from the same view.
+	{
+		frame_telemetry::scoped_timer timer(telemetry, frame_telemetry::stage::map);
+
+		status = source.map(view);
+	}
+
+	if (frame_status::unavailable == status)
+	{
+		// Reuse the samples from the last frame for this display, and sample all of them
+		// again next time since we may have missed some changes.
+		_tiles[index].invalidate();
+		return;
+	}
+	else if (frame_status::available != status)
+	{
+		return;
+	}
+
+	if (!_letterboxes.empty())
+	{
+		frame_telemetry::scoped_timer timer(telemetry, frame_telemetry::stage::letterbox);
+		auto& letterbox = _letterboxes[index];
+
+		if (letterbox.update(view, _converter))
 		{
-			const auto& offsets = _pixelOffsets[i][j];
-			const auto& led = display.positions[j];
+			// Spread the LEDs over the new picture area, which samples all of them again.
+			map_leds(index, letterbox.active());
+		}
+	}
 
-			D3D11_MAPPED_SUBRESOURCE stagingMap;
-			DXGI_MAPPED_RECT desktopMap;
-			const uint8_t* pixels = nullptr;
-			size_t pitch = 0;
+	// Find the LEDs which overlap anything that changed since the last frame.
+	auto& tiles = _tiles[index];
+	auto& changes = _changes[index];
 
-			if (device.staging)
-			{
-				if (FAILED(device.context->Map(device.staging, 0, D3D11_MAP_READ, 0, &stagingMap)))
-				{
-					continue;
-				}
+	{
+		frame_telemetry::scoped_timer timer(telemetry, frame_telemetry::stage::changes);
 
-				pixels = reinterpret_cast<const uint8_t*>(stagingMap.pData);
-				pitch = static_cast<size_t>(stagingMap.RowPitch);
-			}
-			else
-			{
-				HRESULT hr = device.duplication->MapDesktopSurface(&desktopMap);
+		tiles.begin_frame();
 
-				if (DXGI_ERROR_ACCESS_LOST == hr
-					|| DXGI_ERROR_UNSUPPORTED == hr
-					|| DXGI_ERROR_INVALID_CALL == hr)
-				{
-					// Recreate the duplication interface if this fails with with an expected error that invalidates
-					// the duplication interface or requires that we switch to AcquireNextFrame.
-					free_resources();
-					return false;
-				}
-				else if (FAILED(hr))
-				{
-					continue;
-				}
+		if (source.dirty_rects(changes))
+		{
+			tiles.mark_changes(changes);
+		}
+		else if (!_areaTables.empty())
+		{
+			// Hashing the tiles costs about as much as reading the pixels for the grid, but
+			// it saves building the summed-area tables for the bands that didn't change. It
+			// costs as much as filtering the mip pyramid, so that doesn't bother.
+			tiles.mark_hashed_tiles(view);
+		}
+		else
+		{
+			tiles.mark_all();
+		}
+	}
 
-				pixels = reinterpret_cast<const uint8_t*>(desktopMap.pBits);
-				pitch = static_cast<size_t>(desktopMap.Pitch);
-			}
+	const auto& dirtyLeds = tiles.dirty_leds();
+	auto& sums = _sums[index];
 
-			// Get the average RGB values for the sampled pixels.
-			constexpr double divisor = static_cast<double>(offset_array().size());
-			double r = 0.0;
-			double g = 0.0;
-			double b = 0.0;
+	if (!_areaTables.empty())
+	{
+		auto& table = _areaTables[index];
 
-			for (auto offset : offsets)
-			{
-				const size_t byteOffset = (offset.y * pitch) + (offset.x * sizeof(DWORD));
+		{
+			frame_telemetry::scoped_timer timer(telemetry, frame_telemetry::stage::table);
 
-				b += static_cast<double>(pixels[byteOffset]);
-				g += static_cast<double>(pixels[byteOffset + 1]);
-				r += static_cast<double>(pixels[byteOffset + 2]);
-			}
+			table.build(view, _converter, dirtyLeds);
+		}
 
-			if (device.staging)
-			{
-				device.context->Unmap(device.staging, 0);
-			}
-			else
+		frame_telemetry::scoped_timer timer(telemetry, frame_telemetry::stage::sample);
+
+		for (size_t j = 0; j < display.positions.size(); ++j)
+		{
+			if (dirtyLeds[j])
 			{
-				device.duplication->UnMapDesktopSurface();
+				sums[j] = table.sum(j);
 			}
+		}
+	}
+	else
+	{
+		frame_view sampled = view;
 
-			r /= divisor;
-			g /= divisor;
-			b /= divisor;
+		if (!_pyramids.empty())
+		{
+			frame_telemetry::scoped_timer timer(telemetry, frame_telemetry::stage::pyramid);
+			auto& pyramid = _pyramids[index];
 
-			// Average in the previous color if fading is enabled.
-			if (_parameters.fade > 0.0)
-			{
-				r = (r * _parameters.weight) + (static_cast<double>((*previousColor & 0xFF000000) >> 24) * _parameters.fade);
-				g = (g * _parameters.weight) + (static_cast<double>((*previousColor & 0xFF0000) >> 16) * _parameters.fade);
-				b = (b * _parameters.weight) + (static_cast<double>((*previousColor & 0xFF00) >> 8) * _parameters.fade);
-			}
+			pyramid.build(view, _converter, dirtyLeds);
+			sampled = pyramid.view();
+		}
+
+		frame_telemetry::scoped_timer timer(telemetry, frame_telemetry::stage::sample);
+		auto& offsets = _sampleOffsets[index];
 
-			const double minBrightness = static_cast<double>(_parameters.minBrightness);
-			const double sum = r + g + b;
+		offsets.update_layout(sampled.pitch, pixel_size(sampled.format));
 
-			// Boost pixels that fall below the minimum brightness.
-			if (sum < minBrightness)
+		if (pixel_format::b8g8r8a8 != sampled.format)
+		{
+			auto& converted = _converted[index];
+
+			converted.resize(offsets.rows() * offsets.columns() * 4);
+
+			for (size_t j = 0; j < display.positions.size(); ++j)
 			{
-				if (sum == 0.0)
+				if (dirtyLeds[j])
 				{
-					// Spread equally to R, G, and B.
-					const double value = minBrightness / 3.0;
-
-					r = value;
-					g = value;
-					b = value;
+					_converter.gather(sampled.format, sampled.pixels, offsets.row_offsets(j), offsets.rows(),
+						offsets.column_offsets(j), offsets.columns(), converted.data());
+					sums[j] = _kernel.sum(converted.data(), _packedRows.data(), _packedColumns.data());
 				}
-				else
+			}
+		}
+		else
+		{
+			for (size_t j = 0; j < display.positions.size(); ++j)
+			{
+				if (dirtyLeds[j])
 				{
-					// Spread the "brightness deficit" back into R, G, and B in proportion
-					// to their individual contribition to that deficit.  Rather than simply
-					// boosting all pixels at the low end, this allows deep (but saturated)
-					// colors to stay saturated...they don't "pink out."
-					const double deficit = minBrightness - sum;
-					const double sum2 = 2.0 * sum;
-
-					r += (deficit * (sum - r)) / sum2;
-					g += (deficit * (sum - g)) / sum2;
-					b += (deficit * (sum - b)) / sum2;
+					sums[j] = _kernel.sum(sampled.pixels, offsets.row_offsets(j), offsets.column_offsets(j));
 				}
 			}
+		}
+	}
 
-			const uint8_t ledR = static_cast<uint8_t>(r);
-			const uint8_t ledG = static_cast<uint8_t>(g);
-			const uint8_t ledB = static_cast<uint8_t>(b);
+	frame_telemetry::scoped_timer timer(telemetry, frame_telemetry::stage::map);
 
-			*(previousColor++) = (ledB << 24) | (ledG << 16) | (ledR << 8) | 0xFF;
+	source.unmap();
+}
 
-			// Write the _gamma corrected values to the serial data.
-			*(output++) = _gamma.red(ledR);
-			*(output++) = _gamma.green(ledG);
-			*(output++) = _gamma.blue(ledB);
-		}
+bool screen_samples::collect_samples(size_t index, size_t firstLed)
+{
+	const auto status = _acquired[index];
+
+	_telemetry.merge(_displayTelemetry[index]);
+
+	if (frame_status::lost == status)
+	{
+		return false;
+	}
+	else if (frame_status::available != status)
+	{
+		return true;
 	}
 
-	++_frameCount;
+	const auto& dirtyLeds = _tiles[index].dirty_leds();
+	const auto& sums = _sums[index];
+	const bool areaMode = !_areaTables.empty();
+
+	for (size_t j = 0; j < sums.size(); ++j)
+	{
+		if (dirtyLeds[j])
+		{
+			_colors.set_samples(firstLed + j, sums[j], areaMode ? _areaTables[index].area(j) : _kernel.total_weight());
+		}
+	}
 
 	return true;
 }
@@ -366,17 +489,27 @@ void screen_samples::free_resources()
 		return;
 	}
 
-	for (auto& display : _displays)
+	// Stop the workers before releasing anything they use.
+	_workers.clear();
+
+#ifdef _DEBUG
+	const bool converted = std::any_of(_converted.cbegin(), _converted.cend(), [](const std::vector<uint8_t>& pixels)
 	{
-		if (display.acquiredFrame)
-		{
-			display.duplication->ReleaseFrame();
-			display.acquiredFrame = false;
-		}
-	}
+		return !pixels.empty();
+	});
+#endif
 
-	_displays.clear();
-	_pixelOffsets.clear();
+	_sources.clear();
+	_sampleOffsets.clear();
+	_areaTables.clear();
+	_pyramids.clear();
+	_tiles.clear();
+	_letterboxes.clear();
+	_changes.clear();
+	_converted.clear();
+	_sums.clear();
+	_acquired.clear();
+	_displayTelemetry.clear();
 
 	if (_startTick > 0)
 	{
@@ -388,10 +521,37 @@ void screen_samples::free_resources()
 		std::wostringstream oss;
 
 		oss << L"Frame Rate: " << _frameRate << std::endl;
+
+		if (converted)
+		{
+			oss << L"Pixel Converter: " << pixel_converter::name() << std::endl;
+		}
+
+		if (settings::sampling_mode::area == _parameters.sampling.mode)
+		{
+			oss << L"Summed Area Table: " << summed_area_table::name() << std::endl;
+		}
+		else
+		{
+			if (settings::sampling_mode::pyramid == _parameters.sampling.mode)
+			{
+				oss << L"Mip Pyramid: " << mip_pyramid::name() << std::endl;
+			}
+
+			oss << L"Sample Kernel: " << _kernel.name() << L" (" << _kernel.grid_size() << L"x" << _kernel.grid_size() << L")" << std::endl;
+		}
+
+		if (_colors.calibrated())
+		{
+			oss << L"Color LUT: " << color_lut::name() << std::endl;
+		}
+
+		_telemetry.report(oss);
 		OutputDebugStringW(oss.str().c_str());
 #endif
 	}
 
+	_telemetry.reset();
 	_acquiredResources = false;
 }
 
@@ -400,12 +560,7 @@ bool screen_samples::empty() const
 	return !_acquiredResources;
 }
 
-bool screen_samples::get_factory()
+const frame_telemetry& screen_samples::telemetry() const
 {
-	if (!_factory)
-	{
-		CreateDXGIFactory1(_uuidof(IDXGIFactory1), reinterpret_cast<void**>(&_factory));
-	}
-
-	return _factory;
+	return _telemetry;
 }
@@ -1,25 +1,22 @@
 #pragma once
 
-#include <comdef.h>
-#include <d3d11.h>
-#include <dxgi1_2.h>
-
+#include <memory>
 #include <vector>
-#include <array>
 
 #include "settings.h"
 #include "gamma_correction.h"
 #include "serial_buffer.h"
-
-_COM_SMARTPTR_TYPEDEF(IDXGIFactory1, __uuidof(IDXGIFactory1));
-_COM_SMARTPTR_TYPEDEF(IDXGIAdapter1, __uuidof(IDXGIAdapter1));
-_COM_SMARTPTR_TYPEDEF(IDXGIOutput, __uuidof(IDXGIOutput));
-_COM_SMARTPTR_TYPEDEF(IDXGIOutput1, __uuidof(IDXGIOutput1));
-_COM_SMARTPTR_TYPEDEF(IDXGIOutputDuplication, __uuidof(IDXGIOutputDuplication));
-_COM_SMARTPTR_TYPEDEF(IDXGIResource, __uuidof(IDXGIResource));
-_COM_SMARTPTR_TYPEDEF(ID3D11Device, __uuidof(ID3D11Device));
-_COM_SMARTPTR_TYPEDEF(ID3D11DeviceContext, __uuidof(ID3D11DeviceContext));
-_COM_SMARTPTR_TYPEDEF(ID3D11Texture2D, __uuidof(ID3D11Texture2D));
+#include "frame_source.h"
+#include "sample_kernel.h"
+#include "sample_offsets.h"
+#include "pixel_converter.h"
+#include "summed_area_table.h"
+#include "mip_pyramid.h"
+#include "tile_index.h"
+#include "letterbox_detector.h"
+#include "frame_telemetry.h"
+#include "capture_worker.h"
+#include "color_pipeline.h"
 
 class screen_samples
 {
@@ -32,36 +29,47 @@ public:
 
 	bool empty() const;
 
-private:
-	bool get_factory();
+	// Average cost of each stage per frame since the resources were created.
+	const frame_telemetry& telemetry() const;
 
-	struct display_resources
-	{
-		IDXGIAdapter1Ptr adapter;
-		ID3D11DevicePtr device;
-		ID3D11DeviceContextPtr context;
-		IDXGIOutputDuplicationPtr duplication;
-		ID3D11Texture2DPtr staging;
-		bool acquiredFrame;
-		SIZE bounds;
-	};
+private:
+	// Build the sample offsets, summed-area table or mip pyramid, and tile index for the LEDs
+	// on a display, spread over the active picture area.
+	void map_leds(size_t index, const pixel_rect& active);
 
-	struct pixel_offset
-	{
-		size_t x;
-		size_t y;
-	};
+	// Acquire, map and sample the LEDs on a display. This runs on the display's capture_worker,
+	// so it only touches the state for that display.
+	void capture_display(size_t index);
 
-	typedef std::array<pixel_offset, 256> offset_array;
+	// Pass the sums from a display's finished capture to the color pipeline, starting at its
+	// first LED. Returns false if the display was lost.
+	bool collect_samples(size_t index, size_t firstLed);
 
 	const settings& _parameters;
-	const gamma_correction& _gamma;
-	IDXGIFactory1Ptr _factory;
-	std::vector<display_resources> _displays;
-	std::vector<std::vector<offset_array>> _pixelOffsets;
-	std::vector<DWORD> _previousColors;
+	const sample_kernel _kernel;
+	const pixel_converter _converter;
+	frame_source_list _sources;
+	std::vector<sample_offsets> _sampleOffsets;
+	std::vector<summed_area_table> _areaTables;
+	std::vector<mip_pyramid> _pyramids;
+	std::vector<tile_index> _tiles;
+	std::vector<letterbox_detector> _letterboxes;
+	std::vector<std::vector<pixel_rect>> _changes;
+
+	// Frames in any other format than 8-bit BGRA have the grid for each LED converted into a
+	// packed block first, which the kernel samples with these fixed offsets.
+	std::vector<std::vector<uint8_t>> _converted;
+	std::vector<uint32_t> _packedRows;
+	std::vector<uint32_t> _packedColumns;
+
+	std::vector<std::vector<channel_sums>> _sums;
+	std::vector<frame_status> _acquired;
+	std::vector<frame_telemetry> _displayTelemetry;
+	std::vector<std::unique_ptr<capture_worker>> _workers;
+	color_pipeline _colors;
 	bool _acquiredResources = false;
 	size_t _frameCount = 0;
 	ULONGLONG _startTick = 0;
 	double _frameRate = 0.0;
+	frame_telemetry _telemetry;
 };
@@ -1,10 +1,95 @@
 #include "stdafx.h"
 #include "serial_buffer.h"
 
+#include <algorithm>
+
+#include "ada_protocol.h"
+
+constexpr size_t bytes_per_led = 3;
+
+static inline bool same_color(const uint8_t* lhs, const uint8_t* rhs)
+{
+	return lhs[0] == rhs[0]
+		&& lhs[1] == rhs[1]
+		&& lhs[2] == rhs[2];
+}
+
+// Append the run-length ops for the LEDs to out. If there's a previous frame, the LEDs which
+// match it become skips and the trailing ones are left off entirely.
+static void append_ops(const uint8_t* leds, const uint8_t* previous, size_t count, serial_buffer::vector_type& out)
+{
+	const auto unchanged = [leds, previous](size_t led)
+	{
+		return nullptr != previous
+			&& same_color(leds + (led * bytes_per_led), previous + (led * bytes_per_led));
+	};
+
+	while (count > 0
+		&& unchanged(count - 1))
+	{
+		--count;
+	}
+
+	size_t i = 0;
+
+	while (i < count)
+	{
+		const uint8_t* color = leds + (i * bytes_per_led);
+		size_t run = 1;
+
+		if (unchanged(i))
+		{
+			while (i + run < count
+				&& run < ada_max_run
+				&& unchanged(i + run))
+			{
+				++run;
+			}
+
+			out.push_back(static_cast<uint8_t>(ada_op_skip | (run - 1)));
+			i += run;
+			continue;
+		}
+
+		while (i + run < count
+			&& run < ada_max_run
+			&& same_color(color, color + (run * bytes_per_led)))
+		{
+			++run;
+		}
+
+		if (run > 1)
+		{
+			out.push_back(static_cast<uint8_t>(ada_op_repeat | (run - 1)));
+			out.insert(out.end(), color, color + bytes_per_led);
+			i += run;
+			continue;
+		}
+
+		// Extend the literal up to the next LED which starts a repeat or a skip.
+		while (i + run < count
+			&& run < ada_max_run
+			&& !unchanged(i + run)
+			&& !(i + run + 1 < count && same_color(color + (run * bytes_per_led), color + ((run + 1) * bytes_per_led))))
+		{
+			++run;
+		}
+
+		out.push_back(static_cast<uint8_t>(ada_op_literal | (run - 1)));
+		out.insert(out.end(), color, color + (run * bytes_per_led));
+		i += run;
+	}
+}
+
 serial_buffer::serial_buffer(const settings& parameters)
-	: _offset(parameters.totalLedCount)
+	: serial_buffer(parameters.totalLedCount)
 {
-	const size_t serialDataSize = 3 * parameters.totalLedCount;
+}
+
+serial_buffer::serial_buffer(size_t ledCount)
+	: _offset(ledCount)
+{
+	const size_t serialDataSize = bytes_per_led * ledCount;
 
 	_buffer.resize(_offset.size() + serialDataSize, 0);
 	memcpy_s(_buffer.data(), _buffer.size(), _offset.data(), _offset.size());
@@ -15,6 +100,11 @@ serial_buffer::vector_type::iterator serial_buffer::begin()
 	return _buffer.begin() + _offset.size();
 }
 
+serial_buffer::vector_type::const_iterator serial_buffer::begin() const
+{
+	return _buffer.cbegin() + _offset.size();
+}
+
 serial_buffer::vector_type::const_pointer serial_buffer::data() const
 {
 	return _buffer.data();
@@ -30,6 +120,89 @@ void serial_buffer::clear()
 	memset(_buffer.data() + _offset.size(), 0, _buffer.size() - _offset.size());
 }
 
+void serial_buffer::assign(const serial_buffer& other)
+{
+	_buffer.assign(other._buffer.cbegin(), other._buffer.cend());
+}
+
+void serial_buffer::assign(const serial_buffer& other, size_t firstLed)
+{
+	const auto source = other._buffer.cbegin() + other._offset.size() + (firstLed * bytes_per_led);
+
+	std::copy(source, source + (led_count() * bytes_per_led), begin());
+}
+
+size_t serial_buffer::led_count() const
+{
+	return (_buffer.size() - _offset.size()) / bytes_per_led;
+}
+
+void serial_buffer::encode(uint8_t sequence, const serial_buffer* previous, vector_type& out) const
+{
+	const size_t ledCount = led_count();
+	const size_t rawSize = ledCount * bytes_per_led;
+	const size_t payloadOffset = ada_header_size + ada_frame_header_size;
+	const uint8_t* leds = _buffer.data() + _offset.size();
+	ada_frame_type type = ada_frame_type::rle;
+
+	// The v2 header starts the same as v1 with a different magic word.
+	out.assign(_buffer.cbegin(), _buffer.cbegin() + ada_header_size);
+	out[sizeof(ada_magic) - 1] = ada_magic_v2;
+	out.resize(payloadOffset);
+
+	append_ops(leds, nullptr, ledCount, out);
+
+	size_t payloadSize = out.size() - payloadOffset;
+
+	if (nullptr != previous)
+	{
+		const size_t rleEnd = out.size();
+
+		append_ops(leds, previous->_buffer.data() + previous->_offset.size(), ledCount, out);
+
+		const size_t deltaSize = out.size() - rleEnd;
+
+		// Only send a delta if it's smaller, since a key frame resynchronizes the decoder.
+		if (deltaSize < payloadSize
+			&& deltaSize < rawSize)
+		{
+			std::copy(out.cbegin() + rleEnd, out.cend(), out.begin() + payloadOffset);
+			type = ada_frame_type::delta;
+			payloadSize = deltaSize;
+		}
+	}
+
+	if (ada_frame_type::rle == type
+		&& payloadSize >= rawSize)
+	{
+		type = ada_frame_type::raw;
+		payloadSize = rawSize;
+		out.resize(payloadOffset);
+		out.insert(out.end(), leds, leds + rawSize);
+	}
+
+	out.resize(payloadOffset + payloadSize);
+
+	const uint8_t lengthHi = static_cast<uint8_t>(payloadSize >> 8);
+	const uint8_t lengthLo = static_cast<uint8_t>(payloadSize & 0xFF);
+	uint8_t* frameHeader = out.data() + ada_header_size;
+
+	frameHeader[0] = static_cast<uint8_t>(type);
+	frameHeader[1] = sequence;
+	frameHeader[2] = lengthHi;
+	frameHeader[3] = lengthLo;
+	frameHeader[4] = static_cast<uint8_t>(type) ^ sequence ^ lengthHi ^ lengthLo ^ 0x55;
+
+	uint8_t checksum = 0;
+
+	for (size_t i = payloadOffset; i < out.size(); ++i)
+	{
+		checksum ^= out[i];
+	}
+
+	out.push_back(checksum);
+}
+
 serial_buffer::header::header(size_t totalLedCount)
 {
 	const uint8_t ledCountHi = ((totalLedCount - 1) & 0xFF00) >> 8;
@@ -8,15 +8,34 @@ struct serial_buffer
 {
 	serial_buffer(const settings& parameters);
 
+	// A buffer for a device which only drives part of the strip, see settings::devices.
+	explicit serial_buffer(size_t ledCount);
+
 	typedef std::vector<uint8_t> vector_type;
 
 	vector_type::iterator begin();
+	vector_type::const_iterator begin() const;
 
 	vector_type::const_pointer data() const;
 	size_t size() const;
 
 	void clear();
 
+	// Copy the serial data from another buffer for the same settings, without reallocating.
+	void assign(const serial_buffer& other);
+
+	// Copy our share of the LEDs from a buffer for the whole strip, starting at firstLed, and
+	// keep our own header.
+	void assign(const serial_buffer& other, size_t firstLed);
+
+	size_t led_count() const;
+
+	// Encode the LEDs as a protocol version 2 frame (see ada_protocol.h) in out, using whichever
+	// of the raw, run-length or delta encodings is smallest. The delta is against the last frame
+	// we sent, and passing nullptr for that forces a raw or run-length key frame. This only
+	// works for up to ada_max_v2_leds LEDs.
+	void encode(uint8_t sequence, const serial_buffer* previous, vector_type& out) const;
+
 private:
 	struct header
 	{
@@ -0,0 +1,88 @@
+#include "stdafx.h"
+#include "serial_devices.h"
+
+#include <algorithm>
+
+#undef min
+#undef max
+
+serial_devices::device::device(const settings& parameters, size_t index)
+	: port(parameters, index)
+	, writer(parameters, port, index)
+{
+}
+
+serial_devices::serial_devices(const settings& parameters)
+{
+	_devices.reserve(parameters.devices.size());
+
+	for (size_t i = 0; i < parameters.devices.size(); ++i)
+	{
+		_devices.push_back(std::make_unique<device>(parameters, i));
+	}
+}
+
+bool serial_devices::open()
+{
+	bool opened = true;
+
+	// Keep going after a failure, so the devices which are there are ready the next time.
+	for (const auto& device : _devices)
+	{
+		opened = device->port.open() && opened;
+	}
+
+	return opened;
+}
+
+void serial_devices::start()
+{
+	for (const auto& device : _devices)
+	{
+		device->writer.start();
+	}
+}
+
+DWORD serial_devices::frame_time() const
+{
+	DWORD frameTime = 0;
+
+	for (const auto& device : _devices)
+	{
+		frameTime = std::max(frameTime, device->writer.frame_time());
+	}
+
+	return frameTime;
+}
+
+void serial_devices::send(const serial_buffer& buffer)
+{
+	for (const auto& device : _devices)
+	{
+		device->writer.send(buffer);
+	}
+}
+
+void serial_devices::stop()
+{
+	for (const auto& device : _devices)
+	{
+		device->writer.stop();
+	}
+}
+
+void serial_devices::close()
+{
+	for (const auto& device : _devices)
+	{
+		device->port.close();
+	}
+}
+
+void serial_devices::ports_changed()
+{
+	for (const auto& device : _devices)
+	{
+		device->port.ports_changed();
+	}
+}
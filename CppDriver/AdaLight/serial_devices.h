@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "settings.h"
+#include "serial_buffer.h"
+#include "serial_port.h"
+#include "serial_writer.h"
+
+// Fan each frame out to the devices in settings::devices. Every device has its own serial_port
+// and serial_writer, so the links run in parallel and the total throughput grows with the
+// number of devices, while the sampler still fills a single serial_buffer for the whole strip.
+class serial_devices
+{
+public:
+	serial_devices(const settings& parameters);
+
+	// Open every device which isn't open yet. Returns true once all of them are open.
+	bool open();
+
+	// Start the writers once the ports are open.
+	void start();
+
+	// The longest serial_writer::frame_time of any device, which limits the frame rate for all
+	// of them.
+	DWORD frame_time() const;
+
+	// Queue each device's share of the frame.
+	void send(const serial_buffer& buffer);
+
+	// Send the last frame and stop the writers, e.g. before closing the ports.
+	void stop();
+	void close();
+
+	// A serial port was added to the system, see serial_port::ports_changed.
+	void ports_changed();
+
+private:
+	struct device
+	{
+		device(const settings& parameters, size_t index);
+
+		serial_port port;
+		serial_writer writer;
+	};
+
+	std::vector<std::unique_ptr<device>> _devices;
+};
@@ -1,217 +1,357 @@
 #include "stdafx.h"
 #include "serial_port.h"
 
-#include <array>
-#include <memory>
-#include <list>
-#include <string>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <sstream>
+#include <thread>
 
-constexpr uint8_t cookie[] = { 'A', 'd', 'a', '\n' };
+// How long to wait for the device to answer a command once we know it's listening.
+constexpr ULONGLONG handshake_reply_time = 500;
 
-struct port_resources
+// Where we remember the last port we found each device on between runs, AdaLight.port for the
+// first device and AdaLight.1.port and so on for the others.
+static std::wstring port_cache_file(size_t device)
 {
-	~port_resources();
+	std::wostringstream oss;
 
-	HANDLE portHandle = INVALID_HANDLE_VALUE;
-	DCB configuration = { sizeof(configuration) };
-	uint8_t portNumber = 0;
-	HANDLE waitHandle = INVALID_HANDLE_VALUE;
-	std::array<uint8_t, _countof(cookie)> buffer;
-	size_t cb = 0;
-	OVERLAPPED overlapped = {};
-};
+	oss << L"AdaLight.";
 
-port_resources::~port_resources()
-{
-	if (INVALID_HANDLE_VALUE != portHandle)
+	if (device > 0)
 	{
-		CancelIo(portHandle);
-		SetCommState(portHandle, &configuration);
-		CloseHandle(portHandle);
+		oss << device << L".";
 	}
 
-	if (INVALID_HANDLE_VALUE != waitHandle)
-	{
-		CloseHandle(waitHandle);
-	}
+	oss << L"port";
+
+	return oss.str();
+}
+
+static std::wstring load_cached_port(size_t device)
+{
+	const auto path = port_cache_file(device);
+#ifdef _WIN32
+	std::wifstream ifs(path);
+#else
+	std::wifstream ifs(std::string(path.cbegin(), path.cend()));
+#endif
+	std::wstring portName;
+
+	std::getline(ifs, portName);
+
+	return portName;
+}
+
+static void save_cached_port(size_t device, const std::wstring& portName)
+{
+	const auto path = port_cache_file(device);
+#ifdef _WIN32
+	std::wofstream ofs(path, std::ios::out | std::ios::trunc);
+#else
+	std::wofstream ofs(std::string(path.cbegin(), path.cend()), std::ios::out | std::ios::trunc);
+#endif
+
+	ofs << portName << std::endl;
 }
 
-serial_port::serial_port(const settings& parameters)
+serial_port::serial_port(const settings& parameters, size_t device)
 	: _parameters(parameters)
+	, _device(device)
 {
 }
 
 bool serial_port::open()
 {
-	if (INVALID_HANDLE_VALUE == _portHandle)
+	if (is_open())
 	{
-		if (0 == _portNumber)
+		return true;
+	}
+
+	const auto& path = _parameters.devices[_device].path;
+
+	if (!path.empty())
+	{
+		_portName = path;
+	}
+	else
+	{
+		if (!_cacheLoaded)
 		{
-			constexpr uint8_t maxPortNumber = 255;
-			std::list<std::unique_ptr<port_resources>> pendingPorts;
-			size_t portCount = 0;
-			DWORD cb = 0;
+			_portName = load_cached_port(_device);
+			_cacheLoaded = true;
+		}
 
-			// Try to open every possible port from COM1 - COM255
-			for (uint8_t i = 0; i < maxPortNumber; ++i)
-			{
-				// See if any pending asynch reads have finished.
-				if (!pendingPorts.empty())
-				{
-					auto itr = pendingPorts.cbegin();
-
-					while (itr != pendingPorts.cend())
-					{
-						if (GetOverlappedResult((*itr)->portHandle, &(*itr)->overlapped, &cb, false))
-						{
-							if (sizeof(cookie) == cb
-								&& 0 == memcmp(cookie, (*itr)->buffer.data(), sizeof(cookie)))
-							{
-								// We found a match!
-								_portNumber = (*itr)->portNumber;
-								break;
-							}
-						}
-						else if (ERROR_IO_INCOMPLETE == GetLastError())
-						{
-							// Still pending, go on to the next port.
-							++itr;
-							continue;
-						}
-
-						// Any mismatched data or other error means we can't read from the port at all.
-						itr = pendingPorts.erase(itr);
-					}
-
-					if (0 != _portNumber)
-					{
-						// If we found a match, we can skip waiting for the rest of the I/O to complete below.
-						pendingPorts.clear();
-						break;
-					}
-				}
-
-				// Try opening the next port.
-				auto port = std::make_unique<port_resources>();
-
-				port->portNumber = i + 1;
-				std::tie(port->portHandle, port->configuration) = get_port(port->portNumber, true);
-				if (INVALID_HANDLE_VALUE == port->portHandle)
-				{
-					continue;
-				}
-
-				// Start an overlapped I/O call to look for the cookie sent from the Arduino.
-				port->waitHandle = CreateEventW(nullptr, true, false, nullptr);
-				port->overlapped.hEvent = port->waitHandle;
-				if (!ReadFile(port->portHandle, reinterpret_cast<void*>(port->buffer.data()), sizeof(port->buffer), nullptr, &port->overlapped)
-					&& ERROR_IO_PENDING != GetLastError())
-				{
-					// Any other error means we can't read from the port at all.
-					continue;
-				}
-
-				// Add the new port to the list for the next iteration.
-				pendingPorts.push_back(std::move(port));
-			}
+		// Don't probe the same ports again unless something was plugged in.
+		auto ports = list_ports();
+		const bool portsChanged = _portsChanged.exchange(false);
 
-			// Finish waiting for any outstanding I/O.
-			for (const auto& port : pendingPorts)
-			{
-				if (GetOverlappedResult(port->portHandle, &port->overlapped, &cb, true)
-					&& sizeof(cookie) == cb
-					&& 0 == memcmp(cookie, port->buffer.data(), sizeof(cookie)))
-				{
-					// We found a match!
-					_portNumber = port->portNumber;
-					break;
-				}
-			}
+		if (!portsChanged
+			&& ports == _scannedPorts)
+		{
+			return false;
 		}
 
-		if (0 != _portNumber)
+		_scannedPorts = ports;
+
+#ifdef _DEBUG
+		const ULONGLONG start = GetTickCount64();
+#endif
+		const auto lastPort = std::find(ports.begin(), ports.end(), _portName);
+		bool found = false;
+
+		// The last port we found the device on is the most likely place to find it again.
+		if (lastPort != ports.end())
 		{
-			// Once we find the right port we can just open it directly.
-			std::tie(_portHandle, std::ignore) = get_port(_portNumber, false);
+			found = find_port({ _portName });
+			ports.erase(lastPort);
 		}
-	}
 
-	return INVALID_HANDLE_VALUE != _portHandle;
-}
+		if (!found)
+		{
+			found = find_port(ports);
+		}
 
-bool serial_port::send(const serial_buffer& buffer)
-{
-	if (INVALID_HANDLE_VALUE == _portHandle)
-	{
-		return false;
+#ifdef _DEBUG
+		std::wostringstream oss;
+
+		oss << L"Serial Discovery: "
+			<< (found ? _portName : std::wstring(L"no device"))
+			<< L" in " << (GetTickCount64() - start) << L" ms, "
+			<< _scannedPorts.size() << L" ports" << std::endl;
+		OutputDebugStringW(oss.str().c_str());
+#endif
+
+		if (!found)
+		{
+			return false;
+		}
+
+		save_cached_port(_device, _portName);
 	}
 
-	DWORD cbWritten = 0;
+	_baudRate = ada_default_baud_rate;
+	_capabilities = device_capabilities();
+	_flowControl = false;
+
+	// If discovery left the port open, the device already sent its cookie and is listening.
+	const bool listening = is_open();
 
-	if (!WriteFile(_portHandle, reinterpret_cast<const void*>(buffer.data()), buffer.size(), &cbWritten, nullptr)
-		|| buffer.size() != static_cast<size_t>(cbWritten))
+	if (!open_port()
+		|| (_parameters.serialPort.handshake && !negotiate(listening)))
 	{
 		close();
 		return false;
 	}
 
+	// If we lose the device after this, look for it again the next time even if the ports
+	// didn't change, e.g. if the port just failed.
+	_scannedPorts.clear();
+
 	return true;
 }
 
-void serial_port::close()
+bool serial_port::send(const serial_buffer& buffer)
+{
+	return send(buffer.data(), buffer.size());
+}
+
+const std::wstring& serial_port::name() const
 {
-	if (INVALID_HANDLE_VALUE != _portHandle)
+	return _portName;
+}
+
+const device_capabilities& serial_port::capabilities() const
+{
+	return _capabilities;
+}
+
+uint32_t serial_port::baud_rate() const
+{
+	return _baudRate;
+}
+
+bool serial_port::flow_control() const
+{
+	return _flowControl;
+}
+
+bool serial_port::wait_ready(DWORD timeout)
+{
+	const ULONGLONG deadline = GetTickCount64() + timeout;
+
+	// Anything else, like the idle "Ada\n", doesn't count.
+	while (GetTickCount64() < deadline)
 	{
-		CloseHandle(_portHandle);
-		_portHandle = INVALID_HANDLE_VALUE;
+		uint8_t value = 0;
+		bool received = false;
+
+		if (!read_byte(value, received))
+		{
+			close();
+			return false;
+		}
+
+		if (received
+			&& ada_ready_token == value)
+		{
+			return true;
+		}
 	}
+
+	return false;
 }
 
-std::pair<HANDLE, DCB> serial_port::get_port(uint8_t portNumber, bool readTest)
+void serial_port::ports_changed()
 {
-	std::wostringstream oss;
+	_portsChanged = true;
+}
 
-	oss << L"COM" << static_cast<int>(portNumber);
+bool serial_port::negotiate(bool listening)
+{
+	device_handshake handshake;
 
-	std::wstring portName(oss.str());
-	const DWORD desiredAccess = readTest ? GENERIC_READ : GENERIC_WRITE;
-	const DWORD flagsAndAttributes = readTest ? FILE_FLAG_OVERLAPPED : FILE_ATTRIBUTE_NORMAL;
-	HANDLE portHandle = CreateFileW(portName.c_str(), desiredAccess, 0, nullptr, OPEN_EXISTING, flagsAndAttributes, NULL);
-	DCB configuration = { sizeof(configuration) };
+	// Opening the port may have reset the Arduino, so until we hear from it give it as long
+	// as it takes to start up.
+	ULONGLONG deadline = GetTickCount64() + (listening ? handshake_reply_time : _parameters.timeout);
+	bool retried = listening;
+	bool success = write_command(device_handshake::query());
 
-	if (INVALID_HANDLE_VALUE != portHandle)
+	while (success)
 	{
-		if (GetCommState(portHandle, &configuration))
+		const auto reply = wait_for_reply(handshake, deadline);
+
+		if (device_handshake::reply::capabilities == reply)
 		{
-			DCB reconfigured = configuration;
-
-			reconfigured.BaudRate = CBR_115200;
-			reconfigured.ByteSize = 8;
-			reconfigured.StopBits = ONESTOPBIT;
-			reconfigured.Parity = NOPARITY;
-
-			COMMTIMEOUTS timeouts = {
-				0,						// ReadIntervalTimeout
-				0,						// ReadTotalTimeoutMultiplier
-				_parameters.timeout,	// ReadTotalTimeoutConstant
-				0,						// WriteTotalTimeoutMultiplier
-				_parameters.delay		// WriteTotalTimeoutConstant
-			};
-
-			// Configure the port.
-			if (SetCommState(portHandle, &reconfigured)
-				&& SetCommTimeouts(portHandle, &timeouts))
+			_capabilities = handshake.capabilities();
+			break;
+		}
+		else if (device_handshake::reply::none == reply
+			|| (device_handshake::reply::ack == reply && retried))
+		{
+			// Older sketches never answer, and send the idle cookie instead, so keep the defaults.
+			break;
+		}
+		else if (device_handshake::reply::ack == reply)
+		{
+			// That's the cookie the sketch sends when it starts or while it's idle. It might have
+			// still been starting up when we sent the query, but it's listening now, so ask once
+			// more and only wait as long as a newer sketch takes to answer.
+			retried = true;
+			deadline = GetTickCount64() + handshake_reply_time;
+			success = write_command(device_handshake::query());
+		}
+	}
+
+	const uint32_t baudRate = device_handshake::select_baud_rate(_capabilities, _parameters.serialPort.maxBaudRate);
+
+	if (success
+		&& ada_default_baud_rate != baudRate)
+	{
+		// The device answers at the old rate before it switches.
+		success = write_command(device_handshake::set_baud_rate(baudRate));
+
+		if (success
+			&& wait_for_reply(handshake, device_handshake::reply::baud_rate, GetTickCount64() + handshake_reply_time))
+		{
+			// Make sure we can still hear each other at the new rate. If not, go back to the default
+			// rate and give the device time to do the same.
+			success = set_baud_rate(baudRate)
+				&& write_command(device_handshake::query());
+
+			if (success
+				&& !wait_for_reply(handshake, device_handshake::reply::capabilities, GetTickCount64() + handshake_reply_time))
 			{
-				return { portHandle, configuration };
+				success = set_baud_rate(ada_default_baud_rate);
+				std::this_thread::sleep_for(std::chrono::milliseconds(ada_baud_revert_time + handshake_reply_time));
 			}
+		}
+	}
 
-			SetCommState(portHandle, &configuration);
+	if (success
+		&& _parameters.serialPort.flowControl
+		&& _capabilities.extended)
+	{
+		// Sketches from before the ready tokens don't answer this.
+		success = write_command(device_handshake::set_flow_control(true));
+		_flowControl = success
+			&& wait_for_reply(handshake, device_handshake::reply::flow_control, GetTickCount64() + handshake_reply_time);
+	}
+
+#ifdef _DEBUG
+	std::wostringstream oss;
+
+	oss << L"Serial Device: " << _portName << L", " << _baudRate << L" baud";
+
+	if (_capabilities.extended)
+	{
+		oss << L", protocol version " << _capabilities.protocolVersion
+			<< L", " << _capabilities.maxLeds << L" LEDs, "
+			<< std::wstring(_capabilities.chip.cbegin(), _capabilities.chip.cend());
+	}
+	else
+	{
+		oss << L", no handshake";
+	}
+
+	if (_flowControl)
+	{
+		oss << L", ready tokens";
+	}
+
+	oss << std::endl;
+	OutputDebugStringW(oss.str().c_str());
+#endif
+
+	return success;
+}
+
+bool serial_port::write_command(const device_handshake::command& command)
+{
+	return send(command.data(), command.size());
+}
+
+device_handshake::reply serial_port::wait_for_reply(device_handshake& handshake, ULONGLONG deadline)
+{
+	// Read one byte at a time so nothing after the reply is lost.
+	while (GetTickCount64() < deadline)
+	{
+		uint8_t value = 0;
+		bool received = false;
+
+		if (!read_byte(value, received))
+		{
+			break;
 		}
 
-		CloseHandle(portHandle);
-		portHandle = INVALID_HANDLE_VALUE;
+		if (received)
+		{
+			const auto reply = handshake.push(value);
+
+			if (device_handshake::reply::none != reply)
+			{
+				return reply;
+			}
+		}
 	}
 
-	return { portHandle, configuration };
+	return device_handshake::reply::none;
+}
+
+bool serial_port::wait_for_reply(device_handshake& handshake, device_handshake::reply expected, ULONGLONG deadline)
+{
+	// Skip any other replies still on their way, e.g. the answer to a query we sent twice.
+	for (;;)
+	{
+		const auto reply = wait_for_reply(handshake, deadline);
+
+		if (expected == reply)
+		{
+			return true;
+		}
+		else if (device_handshake::reply::none == reply)
+		{
+			return false;
+		}
+	}
 }
@@ -1,25 +1,114 @@
 #pragma once
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
+#include <atomic>
+#include <string>
 #include <tuple>
+#include <vector>
 
 #include "settings.h"
 #include "serial_buffer.h"
+#include "device_handshake.h"
 
+// Serial connection to the Arduino running LEDstream. On Windows this is a COM port, and on
+// other platforms it's a tty configured with termios (see serial_port_win32.cpp and
+// serial_port_posix.cpp). Unless a path is configured, open() looks for the port where the
+// device is sending its "Ada\n" cookie, and then remembers it for the next time.
+//
+// Discovery tries the last port the device was found on first, even from a previous run, and
+// then probes every other port which exists at once with a single deadline. If that doesn't find
+// anything, open() fails right away until the set of ports changes or ports_changed() is called,
+// rather than probing the same ports again on every retry.
 class serial_port
 {
 public:
-	serial_port(const settings& parameters);
+	// Open the port for one of the devices in settings::devices.
+	serial_port(const settings& parameters, size_t device);
+	~serial_port();
 
 	bool open();
 	bool send(const serial_buffer& buffer);
+	bool send(const uint8_t* data, size_t size);
 	void close();
 
+	// The port we opened or last found the device on, e.g. for debug output.
+	const std::wstring& name() const;
+
+	// What the device on the open port supports, from the handshake.
+	const device_capabilities& capabilities() const;
+
+	// The baud rate we ended up with after the handshake.
+	uint32_t baud_rate() const;
+
+	// True if the device agreed to send a ready token after every frame it latches.
+	bool flow_control() const;
+
+	// Wait up to timeout ms for the next ready token. Returns false if it didn't come or the
+	// port failed.
+	bool wait_ready(DWORD timeout);
+
+	// A serial port was added to the system, e.g. from WM_DEVICECHANGE. The next call to open()
+	// looks for the device again, even if the port has the same name as before.
+	void ports_changed();
+
 private:
-	std::pair<HANDLE, DCB> get_port(uint8_t portNumber, bool readTest);
+	// Drives discovery and the reads on a pty, see Tests/serial_port_tests.cpp.
+	friend class serial_port_tests;
+
+	bool is_open() const;
+
+	// List the serial ports which exist right now, sorted so we can tell if they changed.
+	std::vector<std::wstring> list_ports();
+
+	// Open all of the ports at once and wait for the first one which sends the cookie. Sets
+	// _portName if it finds the device.
+	bool find_port(const std::vector<std::wstring>& ports);
+
+	// Open _portName for the handshake and the frames, unless find_port left it open already.
+	bool open_port();
+
+#ifdef _WIN32
+	std::pair<HANDLE, DCB> get_port(const std::wstring& portName, bool readTest);
+#endif
+
+	// Ask the device what it supports, switch to a faster baud rate if we can, and turn on the
+	// ready tokens if they're configured. Returns false if the port failed, not if the device is
+	// too old to answer. If the device is already listening, e.g. we just heard its cookie, the
+	// first idle cookie or handshake_reply_time without an answer means it's too old, otherwise
+	// that only starts after the cookie it sends when it starts up.
+	bool negotiate(bool listening);
+	bool write_command(const device_handshake::command& command);
+	device_handshake::reply wait_for_reply(device_handshake& handshake, ULONGLONG deadline);
+	bool wait_for_reply(device_handshake& handshake, device_handshake::reply expected, ULONGLONG deadline);
+
+	// Wait up to handshake_poll_time for a byte from the device. Returns false if the port
+	// failed, and sets received if there was a byte.
+	bool read_byte(uint8_t& value, bool& received);
+	bool set_baud_rate(uint32_t baudRate);
+
+	static constexpr DWORD handshake_poll_time = 50;
 
 	const settings& _parameters;
+	const size_t _device;
+	std::wstring _portName;
+	uint32_t _baudRate = ada_default_baud_rate;
+	device_capabilities _capabilities;
+	bool _flowControl = false;
+
+	// Discovery state, see open().
+	bool _cacheLoaded = false;
+	std::vector<std::wstring> _scannedPorts;
+	std::atomic<bool> _portsChanged { true };
+
+#ifdef _WIN32
 	HANDLE _portHandle = INVALID_HANDLE_VALUE;
-	uint8_t _portNumber = 0;
+#else
+	int _portHandle = -1;
+
+	// An inotify watch on /dev on Linux, so we notice a tty coming back with the same name.
+	int _hotplug = -1;
+#endif
 };
@@ -0,0 +1,484 @@
+#include "stdafx.h"
+#include "serial_port.h"
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+#if defined(__APPLE__)
+#include <IOKit/serial/ioss.h>
+#endif
+
+constexpr uint8_t cookie[] = { 'A', 'd', 'a', '\n' };
+
+// Where USB serial adapters and native USB boards usually show up.
+static const char* const port_patterns[] = {
+	"/dev/ttyACM*",
+	"/dev/ttyUSB*",
+	"/dev/cu.usbmodem*",
+	"/dev/cu.usbserial*",
+};
+
+#if defined(__linux__) && defined(TCGETS2) \
+	&& (defined(__x86_64__) || defined(__i386__) || defined(__aarch64__) || defined(__arm__) || defined(__riscv))
+#define SERIAL_TERMIOS2
+
+// Linux sets baud rates which don't have a B* constant through termios2, but <asm/termbits.h>
+// conflicts with <termios.h>, so declare the kernel's struct for the architectures we know.
+struct termios2
+{
+	tcflag_t c_iflag;
+	tcflag_t c_oflag;
+	tcflag_t c_cflag;
+	tcflag_t c_lflag;
+	cc_t c_line;
+	cc_t c_cc[19];
+	speed_t c_ispeed;
+	speed_t c_ospeed;
+};
+
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#endif
+
+static std::string narrow(const std::wstring& path)
+{
+	return std::string(path.cbegin(), path.cend());
+}
+
+static bool standard_speed(uint32_t baudRate, speed_t& speed)
+{
+	switch (baudRate)
+	{
+		case 9600:
+			speed = B9600;
+			return true;
+
+		case 19200:
+			speed = B19200;
+			return true;
+
+		case 38400:
+			speed = B38400;
+			return true;
+
+		case 57600:
+			speed = B57600;
+			return true;
+
+		case 115200:
+			speed = B115200;
+			return true;
+
+		case 230400:
+			speed = B230400;
+			return true;
+
+#ifdef B500000
+		case 500000:
+			speed = B500000;
+			return true;
+#endif
+
+#ifdef B1000000
+		case 1000000:
+			speed = B1000000;
+			return true;
+#endif
+
+#ifdef B2000000
+		case 2000000:
+			speed = B2000000;
+			return true;
+#endif
+
+		default:
+			return false;
+	}
+}
+
+// Set the baud rate, including rates like 250000 which don't have a termios constant.
+static bool configure_speed(int fd, uint32_t baudRate)
+{
+	speed_t speed;
+
+	if (standard_speed(baudRate, speed))
+	{
+		struct termios tty;
+
+		return 0 == tcgetattr(fd, &tty)
+			&& 0 == cfsetispeed(&tty, speed)
+			&& 0 == cfsetospeed(&tty, speed)
+			&& 0 == tcsetattr(fd, TCSANOW, &tty);
+	}
+
+#if defined(SERIAL_TERMIOS2)
+	struct termios2 tty;
+
+	if (0 != ioctl(fd, TCGETS2, &tty))
+	{
+		return false;
+	}
+
+	tty.c_cflag = (tty.c_cflag & ~CBAUD) | BOTHER;
+	tty.c_ispeed = baudRate;
+	tty.c_ospeed = baudRate;
+
+	return 0 == ioctl(fd, TCSETS2, &tty);
+#elif defined(__APPLE__)
+	speed = static_cast<speed_t>(baudRate);
+
+	return 0 == ioctl(fd, IOSSIOSPEED, &speed);
+#else
+	return false;
+#endif
+}
+
+// Open the tty without blocking and put it in raw 8N1 mode at the default baud rate.
+static int open_tty(const std::string& path)
+{
+	const int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	struct termios tty;
+
+	// Like a COM port on Windows, only one of our devices should have the tty open at a time.
+	if (0 == ioctl(fd, TIOCEXCL)
+		&& 0 == tcgetattr(fd, &tty))
+	{
+		cfmakeraw(&tty);
+		tty.c_cflag |= CLOCAL | CREAD;
+		tty.c_cflag &= ~(CSTOPB | PARENB);
+#ifdef CRTSCTS
+		tty.c_cflag &= ~CRTSCTS;
+#endif
+		tty.c_cc[VMIN] = 0;
+		tty.c_cc[VTIME] = 0;
+
+		if (0 == tcsetattr(fd, TCSANOW, &tty)
+			&& configure_speed(fd, ada_default_baud_rate))
+		{
+			return fd;
+		}
+	}
+
+	::close(fd);
+
+	return -1;
+}
+
+serial_port::~serial_port()
+{
+	close();
+
+	if (_hotplug >= 0)
+	{
+		::close(_hotplug);
+	}
+}
+
+bool serial_port::is_open() const
+{
+	return _portHandle >= 0;
+}
+
+std::vector<std::wstring> serial_port::list_ports()
+{
+#if defined(__linux__)
+	if (_hotplug < 0)
+	{
+		_hotplug = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+		if (_hotplug >= 0
+			&& inotify_add_watch(_hotplug, "/dev", IN_CREATE) < 0)
+		{
+			::close(_hotplug);
+			_hotplug = -1;
+		}
+	}
+
+	// A tty which comes back with the same name doesn't change the list, so watch for it being
+	// created again. There's nothing like this for the /dev/cu.usb* ports on macOS, where the
+	// sorted glob below is all open() compares. That still notices ports which come or go
+	// between two calls, but not one unplugged and plugged back in between them, which needs
+	// ports_changed().
+	alignas(struct inotify_event) char events[4096];
+	ssize_t cbRead;
+
+	while (_hotplug >= 0
+		&& (cbRead = read(_hotplug, events, sizeof(events))) > 0)
+	{
+		for (ssize_t i = 0; i < cbRead;)
+		{
+			const auto event = reinterpret_cast<const struct inotify_event*>(events + i);
+
+			if (event->len > 0
+				&& (0 == strncmp(event->name, "ttyACM", 6) || 0 == strncmp(event->name, "ttyUSB", 6)))
+			{
+				_portsChanged = true;
+			}
+
+			i += sizeof(struct inotify_event) + event->len;
+		}
+	}
+#endif
+
+	std::vector<std::wstring> ports;
+	glob_t matches = {};
+
+	for (size_t i = 0; i < _countof(port_patterns); ++i)
+	{
+		glob(port_patterns[i], (i > 0) ? GLOB_APPEND : 0, nullptr, &matches);
+	}
+
+	for (size_t i = 0; i < matches.gl_pathc; ++i)
+	{
+		const std::string path(matches.gl_pathv[i]);
+
+		ports.push_back(std::wstring(path.cbegin(), path.cend()));
+	}
+
+	globfree(&matches);
+	std::sort(ports.begin(), ports.end());
+
+	return ports;
+}
+
+bool serial_port::open_port()
+{
+	// Unlike on Windows we keep the port we found the device on open, so opening it again
+	// doesn't reset the Arduino a second time.
+	if (_portHandle < 0)
+	{
+		_portHandle = open_tty(narrow(_portName));
+	}
+
+	return _portHandle >= 0;
+}
+
+bool serial_port::send(const uint8_t* data, size_t size)
+{
+	if (_portHandle < 0)
+	{
+		return false;
+	}
+
+	// The port doesn't block, so wait for room in the output buffer, with the same overall write
+	// timeout as on Windows.
+	const ULONGLONG deadline = GetTickCount64() + _parameters.delay;
+
+	while (size > 0)
+	{
+		const ssize_t cbWritten = write(_portHandle, data, size);
+
+		if (cbWritten > 0)
+		{
+			data += cbWritten;
+			size -= static_cast<size_t>(cbWritten);
+			continue;
+		}
+		else if (cbWritten < 0
+			&& EINTR == errno)
+		{
+			continue;
+		}
+
+		const ULONGLONG now = GetTickCount64();
+		struct pollfd writable = { _portHandle, POLLOUT, 0 };
+
+		if ((cbWritten < 0 && EAGAIN != errno && EWOULDBLOCK != errno)
+			|| now >= deadline
+			|| poll(&writable, 1, static_cast<int>(deadline - now)) <= 0)
+		{
+			close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void serial_port::close()
+{
+	if (_portHandle >= 0)
+	{
+		::close(_portHandle);
+		_portHandle = -1;
+	}
+}
+
+bool serial_port::read_byte(uint8_t& value, bool& received)
+{
+	received = false;
+
+	if (_portHandle < 0)
+	{
+		return false;
+	}
+
+	struct pollfd readable = { _portHandle, POLLIN, 0 };
+	const int ready = poll(&readable, 1, static_cast<int>(handshake_poll_time));
+
+	if (ready <= 0)
+	{
+		return 0 == ready || EINTR == errno;
+	}
+
+	const ssize_t cbRead = read(_portHandle, &value, sizeof(value));
+
+	if (cbRead < 0)
+	{
+		return EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno;
+	}
+
+	// Reading nothing after poll said there was data means the device hung up.
+	received = (sizeof(value) == static_cast<size_t>(cbRead));
+
+	return received;
+}
+
+bool serial_port::set_baud_rate(uint32_t baudRate)
+{
+	// Drop anything we got at the old rate.
+	if (!configure_speed(_portHandle, baudRate)
+		|| 0 != tcflush(_portHandle, TCIFLUSH))
+	{
+		return false;
+	}
+
+	_baudRate = baudRate;
+
+	return true;
+}
+
+bool serial_port::find_port(const std::vector<std::wstring>& ports)
+{
+	struct pending_port
+	{
+		std::string path;
+		int fd;
+		std::array<uint8_t, sizeof(cookie)> received;
+	};
+
+	std::vector<pending_port> pendingPorts;
+
+	for (const auto& portName : ports)
+	{
+		const std::string path = narrow(portName);
+		const int fd = open_tty(path);
+
+		if (fd >= 0)
+		{
+			pendingPorts.push_back({ path, fd, {} });
+		}
+	}
+
+	// Wait for the cookie on all of the ports at once.
+	const ULONGLONG deadline = GetTickCount64() + _parameters.timeout;
+	std::vector<struct pollfd> readable;
+	int found = -1;
+
+	while (found < 0
+		&& !pendingPorts.empty())
+	{
+		const ULONGLONG now = GetTickCount64();
+
+		if (now >= deadline)
+		{
+			break;
+		}
+
+		readable.clear();
+
+		for (const auto& port : pendingPorts)
+		{
+			readable.push_back({ port.fd, POLLIN, 0 });
+		}
+
+		if (poll(readable.data(), readable.size(), static_cast<int>(deadline - now)) < 0
+			&& EINTR != errno)
+		{
+			break;
+		}
+
+		for (size_t i = readable.size(); found < 0 && i-- > 0;)
+		{
+			auto& port = pendingPorts[i];
+			bool failed = (0 != (readable[i].revents & (POLLERR | POLLNVAL)));
+
+			if (0 != (readable[i].revents & (POLLIN | POLLHUP)))
+			{
+				uint8_t buffer[64];
+				const ssize_t cbRead = read(port.fd, buffer, sizeof(buffer));
+
+				// Keep the last few bytes, in case the cookie comes in pieces.
+				for (ssize_t j = 0; j < cbRead; ++j)
+				{
+					std::copy(port.received.cbegin() + 1, port.received.cend(), port.received.begin());
+					port.received.back() = buffer[j];
+
+					if (0 == memcmp(cookie, port.received.data(), sizeof(cookie)))
+					{
+						// We found a match!
+						found = port.fd;
+						_portName.assign(port.path.cbegin(), port.path.cend());
+						break;
+					}
+				}
+
+				failed = failed
+					|| 0 == cbRead
+					|| (cbRead < 0 && EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno);
+			}
+
+			if (found < 0
+				&& failed)
+			{
+				// We can't read from this port at all.
+				::close(port.fd);
+				pendingPorts.erase(pendingPorts.begin() + i);
+			}
+		}
+	}
+
+	for (const auto& port : pendingPorts)
+	{
+		if (port.fd != found)
+		{
+			::close(port.fd);
+		}
+	}
+
+	if (found < 0)
+	{
+		return false;
+	}
+
+	// Keep the port open for open_port().
+	close();
+	_portHandle = found;
+
+	return true;
+}
+
+#endif
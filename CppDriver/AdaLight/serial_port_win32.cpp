@@ -0,0 +1,315 @@
+#include "stdafx.h"
+#include "serial_port.h"
+
+#ifdef _WIN32
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <list>
+#include <string>
+
+#undef min
+#undef max
+
+constexpr uint8_t cookie[] = { 'A', 'd', 'a', '\n' };
+
+struct port_resources
+{
+	~port_resources();
+
+	HANDLE portHandle = INVALID_HANDLE_VALUE;
+	DCB configuration = { sizeof(configuration) };
+	std::wstring portName;
+	HANDLE waitHandle = INVALID_HANDLE_VALUE;
+	std::array<uint8_t, _countof(cookie)> buffer;
+	size_t cb = 0;
+	OVERLAPPED overlapped = {};
+};
+
+port_resources::~port_resources()
+{
+	if (INVALID_HANDLE_VALUE != portHandle)
+	{
+		CancelIo(portHandle);
+		SetCommState(portHandle, &configuration);
+		CloseHandle(portHandle);
+	}
+
+	if (INVALID_HANDLE_VALUE != waitHandle)
+	{
+		CloseHandle(waitHandle);
+	}
+}
+
+serial_port::~serial_port()
+{
+	close();
+}
+
+bool serial_port::is_open() const
+{
+	return INVALID_HANDLE_VALUE != _portHandle;
+}
+
+std::vector<std::wstring> serial_port::list_ports()
+{
+	std::vector<std::wstring> ports;
+	HKEY key = NULL;
+
+	// Every serial port which exists right now has a value here, e.g. \Device\USBSER000 = COM3.
+	if (ERROR_SUCCESS == RegOpenKeyExW(HKEY_LOCAL_MACHINE, L"HARDWARE\\DEVICEMAP\\SERIALCOMM", 0, KEY_QUERY_VALUE, &key))
+	{
+		std::array<wchar_t, 256> valueName;
+		std::array<wchar_t, 256> data;
+
+		for (DWORD i = 0;; ++i)
+		{
+			DWORD cchValueName = static_cast<DWORD>(valueName.size());
+			DWORD cbData = static_cast<DWORD>(data.size() * sizeof(wchar_t));
+			DWORD type = REG_NONE;
+			const LONG result = RegEnumValueW(key, i, valueName.data(), &cchValueName, nullptr, &type, reinterpret_cast<LPBYTE>(data.data()), &cbData);
+
+			if (ERROR_MORE_DATA == result)
+			{
+				continue;
+			}
+			else if (ERROR_SUCCESS != result)
+			{
+				break;
+			}
+
+			if (REG_SZ == type
+				&& cbData >= sizeof(wchar_t))
+			{
+				// The \\.\ prefix lets us open ports above COM9.
+				std::wstring portName(data.data(), cbData / sizeof(wchar_t));
+
+				portName.erase(std::find(portName.begin(), portName.end(), L'\0'), portName.end());
+				ports.push_back(L"\\\\.\\" + portName);
+			}
+		}
+
+		RegCloseKey(key);
+	}
+
+	std::sort(ports.begin(), ports.end());
+
+	return ports;
+}
+
+bool serial_port::find_port(const std::vector<std::wstring>& ports)
+{
+	std::list<std::unique_ptr<port_resources>> pendingPorts;
+	DWORD cb = 0;
+
+	for (const auto& portName : ports)
+	{
+		auto port = std::make_unique<port_resources>();
+
+		port->portName = portName;
+		std::tie(port->portHandle, port->configuration) = get_port(port->portName, true);
+		if (INVALID_HANDLE_VALUE == port->portHandle)
+		{
+			continue;
+		}
+
+		// Start an overlapped I/O call to look for the cookie sent from the Arduino.
+		port->waitHandle = CreateEventW(nullptr, true, false, nullptr);
+		port->overlapped.hEvent = port->waitHandle;
+		if (!ReadFile(port->portHandle, reinterpret_cast<void*>(port->buffer.data()), sizeof(port->buffer), nullptr, &port->overlapped)
+			&& ERROR_IO_PENDING != GetLastError())
+		{
+			// Any other error means we can't read from the port at all.
+			continue;
+		}
+
+		pendingPorts.push_back(std::move(port));
+	}
+
+	// Wait for the cookie on all of the ports at once.
+	const ULONGLONG deadline = GetTickCount64() + _parameters.timeout;
+	std::vector<HANDLE> waitHandles;
+	bool found = false;
+
+	while (!found
+		&& !pendingPorts.empty())
+	{
+		const ULONGLONG now = GetTickCount64();
+
+		if (now >= deadline)
+		{
+			break;
+		}
+
+		// We can only wait on MAXIMUM_WAIT_OBJECTS at a time, so if there are more than that, wake
+		// up now and then to check the rest.
+		DWORD waitTime = static_cast<DWORD>(deadline - now);
+
+		waitHandles.clear();
+
+		for (const auto& port : pendingPorts)
+		{
+			if (waitHandles.size() == MAXIMUM_WAIT_OBJECTS)
+			{
+				waitTime = std::min(waitTime, handshake_poll_time);
+				break;
+			}
+
+			waitHandles.push_back(port->waitHandle);
+		}
+
+		if (WAIT_FAILED == WaitForMultipleObjects(static_cast<DWORD>(waitHandles.size()), waitHandles.data(), false, waitTime))
+		{
+			break;
+		}
+
+		auto itr = pendingPorts.cbegin();
+
+		while (itr != pendingPorts.cend())
+		{
+			if (GetOverlappedResult((*itr)->portHandle, &(*itr)->overlapped, &cb, false))
+			{
+				if (sizeof(cookie) == cb
+					&& 0 == memcmp(cookie, (*itr)->buffer.data(), sizeof(cookie)))
+				{
+					// We found a match!
+					_portName = (*itr)->portName;
+					found = true;
+					break;
+				}
+			}
+			else if (ERROR_IO_INCOMPLETE == GetLastError())
+			{
+				// Still pending, go on to the next port.
+				++itr;
+				continue;
+			}
+
+			// Any mismatched data or other error means we can't read from the port at all.
+			itr = pendingPorts.erase(itr);
+		}
+	}
+
+	return found;
+}
+
+bool serial_port::open_port()
+{
+	// Once we find the right port we can just open it directly.
+	std::tie(_portHandle, std::ignore) = get_port(_portName, false);
+
+	return INVALID_HANDLE_VALUE != _portHandle;
+}
+
+bool serial_port::send(const uint8_t* data, size_t size)
+{
+	if (INVALID_HANDLE_VALUE == _portHandle)
+	{
+		return false;
+	}
+
+	DWORD cbWritten = 0;
+
+	if (!WriteFile(_portHandle, reinterpret_cast<const void*>(data), static_cast<DWORD>(size), &cbWritten, nullptr)
+		|| size != static_cast<size_t>(cbWritten))
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void serial_port::close()
+{
+	if (INVALID_HANDLE_VALUE != _portHandle)
+	{
+		CloseHandle(_portHandle);
+		_portHandle = INVALID_HANDLE_VALUE;
+	}
+}
+
+bool serial_port::read_byte(uint8_t& value, bool& received)
+{
+	DWORD cbRead = 0;
+
+	if (!ReadFile(_portHandle, reinterpret_cast<void*>(&value), sizeof(value), &cbRead, nullptr))
+	{
+		return false;
+	}
+
+	received = (sizeof(value) == cbRead);
+
+	return true;
+}
+
+bool serial_port::set_baud_rate(uint32_t baudRate)
+{
+	DCB configuration = { sizeof(configuration) };
+
+	if (!GetCommState(_portHandle, &configuration))
+	{
+		return false;
+	}
+
+	configuration.BaudRate = baudRate;
+
+	// Drop anything we got at the old rate.
+	if (!SetCommState(_portHandle, &configuration)
+		|| !PurgeComm(_portHandle, PURGE_RXCLEAR))
+	{
+		return false;
+	}
+
+	_baudRate = baudRate;
+
+	return true;
+}
+
+std::pair<HANDLE, DCB> serial_port::get_port(const std::wstring& portName, bool readTest)
+{
+	const DWORD desiredAccess = readTest ? GENERIC_READ : (GENERIC_READ | GENERIC_WRITE);
+	const DWORD flagsAndAttributes = readTest ? FILE_FLAG_OVERLAPPED : FILE_ATTRIBUTE_NORMAL;
+	HANDLE portHandle = CreateFileW(portName.c_str(), desiredAccess, 0, nullptr, OPEN_EXISTING, flagsAndAttributes, NULL);
+	DCB configuration = { sizeof(configuration) };
+
+	if (INVALID_HANDLE_VALUE != portHandle)
+	{
+		if (GetCommState(portHandle, &configuration))
+		{
+			DCB reconfigured = configuration;
+
+			reconfigured.BaudRate = ada_default_baud_rate;
+			reconfigured.ByteSize = 8;
+			reconfigured.StopBits = ONESTOPBIT;
+			reconfigured.Parity = NOPARITY;
+
+			// We only read from the port we keep open during the handshake, so reads return as soon
+			// as any bytes arrive, or after handshake_poll_time.
+			COMMTIMEOUTS timeouts = {
+				readTest ? 0 : MAXDWORD,								// ReadIntervalTimeout
+				readTest ? 0 : MAXDWORD,								// ReadTotalTimeoutMultiplier
+				readTest ? _parameters.timeout : handshake_poll_time,	// ReadTotalTimeoutConstant
+				0,														// WriteTotalTimeoutMultiplier
+				_parameters.delay										// WriteTotalTimeoutConstant
+			};
+
+			// Configure the port.
+			if (SetCommState(portHandle, &reconfigured)
+				&& SetCommTimeouts(portHandle, &timeouts))
+			{
+				return { portHandle, configuration };
+			}
+
+			SetCommState(portHandle, &configuration);
+		}
+
+		CloseHandle(portHandle);
+		portHandle = INVALID_HANDLE_VALUE;
+	}
+
+	return { portHandle, configuration };
+}
+
+#endif
@@ -0,0 +1,60 @@
+#include "stdafx.h"
+#include "serial_ring.h"
+
+serial_ring::serial_ring(size_t ledCount)
+{
+	_slots.reserve(capacity);
+
+	for (size_t i = 0; i < capacity; ++i)
+	{
+		_slots.emplace_back(ledCount);
+	}
+}
+
+bool serial_ring::push(const serial_buffer& frame, size_t firstLed)
+{
+	const size_t head = _head.load(std::memory_order_relaxed);
+
+	if (head - _tail.load(std::memory_order_acquire) >= capacity)
+	{
+		return false;
+	}
+
+	_slots[head % capacity].assign(frame, firstLed);
+	_head.store(head + 1, std::memory_order_release);
+
+	return true;
+}
+
+const serial_buffer* serial_ring::acquire_latest(size_t& skipped)
+{
+	const size_t head = _head.load(std::memory_order_acquire);
+	const size_t tail = _tail.load(std::memory_order_relaxed);
+
+	if (head == tail)
+	{
+		skipped = 0;
+		return nullptr;
+	}
+
+	// Hand the slots of the frames we skipped back to the producer, and keep the one we read.
+	skipped = head - 1 - tail;
+	_tail.store(head - 1, std::memory_order_release);
+
+	return &_slots[(head - 1) % capacity];
+}
+
+void serial_ring::release()
+{
+	_tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+bool serial_ring::empty() const
+{
+	return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+}
+
+size_t serial_ring::size() const
+{
+	return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "settings.h"
+#include "serial_buffer.h"
+
+// Lock-free single producer, single consumer ring of serial frames between the sampler and the
+// thread which writes them to the serial port.
+//
+// The consumer only ever wants the newest frame, so taking a frame skips over any older frames
+// which queued up behind it and frees their slots right away. That way the producer only runs
+// out of room if the consumer is stuck sending one frame for the whole length of the ring, and
+// then it drops the new frame instead of blocking the sampler.
+class serial_ring
+{
+public:
+	static constexpr size_t capacity = 4;
+
+	// Every slot holds ledCount LEDs, which may only be part of the frames we push.
+	explicit serial_ring(size_t ledCount);
+
+	// Producer: copy our share of a frame, starting at firstLed, into the next free slot. Returns
+	// false if the ring is full and the frame was dropped.
+	bool push(const serial_buffer& frame, size_t firstLed);
+
+	// Consumer: take the newest frame and skip the older ones, counting them in skipped. Returns
+	// nullptr if the ring is empty. The frame stays valid until the next call to release.
+	const serial_buffer* acquire_latest(size_t& skipped);
+	void release();
+
+	bool empty() const;
+
+	// How many frames are waiting, including one the consumer is still sending.
+	size_t size() const;
+
+private:
+	std::vector<serial_buffer> _slots;
+
+	// Both indices count up forever and wrap around the slots. The producer owns _head and the
+	// consumer owns _tail, and each only reads the other's.
+	std::atomic<size_t> _head { 0 };
+	std::atomic<size_t> _tail { 0 };
+};
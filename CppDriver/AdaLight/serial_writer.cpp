@@ -0,0 +1,239 @@
+#include "stdafx.h"
+#include "serial_writer.h"
+
+#include <algorithm>
+
+#ifdef _DEBUG
+#include <sstream>
+#endif
+
+#include "ada_protocol.h"
+
+#undef min
+#undef max
+
+// Serial ports send 10 bits for every byte with 8N1, and we only plan on using this much of the
+// link so the frames don't slowly back up in the driver.
+constexpr uint64_t bits_per_byte = 10;
+constexpr uint64_t link_budget_percent = 90;
+
+// How much longer than the frame time to wait for a ready token before we assume it got lost.
+constexpr DWORD ready_slack = 50;
+
+serial_writer::serial_writer(const settings& parameters, serial_port& port, size_t device)
+	: _port(port)
+	, _firstLed(parameters.devices[device].firstLed)
+	, _ring(parameters.devices[device].ledCount)
+	, _output(output_encoder::create(parameters))
+	, _outputLedCount(_output
+		? _output->frame_size(parameters.devices[device].ledCount) / 3
+		: parameters.devices[device].ledCount)
+	, _outputFrame(_outputLedCount)
+	, _protocolVersion(parameters.protocol.version)
+	, _ledCount(parameters.devices[device].ledCount)
+	, _keyFrameInterval(parameters.protocol.keyFrameInterval)
+	, _previous(_outputLedCount)
+{
+}
+
+serial_writer::~serial_writer()
+{
+	stop();
+}
+
+bool serial_writer::start()
+{
+	if (_started)
+	{
+		return false;
+	}
+
+	_stopping = false;
+	_dropped = 0;
+	_sent = 0;
+	_startTick = GetTickCount64();
+	_queuedFrames = 0;
+	_totalBacklog = 0;
+	_peakBacklog = 0;
+
+	// The port may have been opened on a different device, or the device may have reset, so
+	// check what it supports and start over with a key frame.
+	const auto& device = _port.capabilities();
+
+	_encode = (_protocolVersion >= 2
+		&& device.protocolVersion >= 2
+		&& _outputLedCount <= device.maxLeds);
+	_sinceKeyFrame = 0;
+	_awaitingReady = false;
+
+	// Plan on sending a raw key frame every time, since the smaller frames don't come with any
+	// guarantees.
+	if (device.extended
+		&& 0 == device.maxBaudRate)
+	{
+		_frameTime = 0;
+	}
+	else
+	{
+		const uint64_t frameSize = _encode
+			? ada_header_size + ada_frame_header_size + (3 * _outputLedCount) + 1
+			: ada_header_size + (3 * _outputLedCount);
+		const uint64_t linkRate = static_cast<uint64_t>(_port.baud_rate()) * link_budget_percent / 100;
+
+		_frameTime = static_cast<DWORD>(((frameSize * bits_per_byte * 1000) + linkRate - 1) / linkRate);
+	}
+
+#ifdef _DEBUG
+	std::wostringstream oss;
+
+	oss << L"Serial Budget: " << _port.name() << L", " << _frameTime << L" ms per frame" << std::endl;
+	OutputDebugStringW(oss.str().c_str());
+#endif
+
+	_thread = std::thread(&serial_writer::run, this);
+	_started = true;
+
+	return true;
+}
+
+bool serial_writer::send(const serial_buffer& buffer)
+{
+	if (!_started)
+	{
+		return false;
+	}
+
+	if (!_ring.push(buffer, _firstLed))
+	{
+		++_dropped;
+		return false;
+	}
+
+	const size_t backlog = _ring.size();
+
+	++_queuedFrames;
+	_totalBacklog += backlog;
+	_peakBacklog = std::max(_peakBacklog, backlog);
+
+	// Take the lock so the writer can't miss the notification between checking the ring and
+	// going to sleep.
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+	}
+
+	_queued.notify_one();
+
+	return true;
+}
+
+void serial_writer::stop()
+{
+	if (!_started)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_stopping = true;
+	}
+
+	_queued.notify_one();
+	_thread.join();
+	_started = false;
+
+#ifdef _DEBUG
+	std::wostringstream oss;
+
+	const ULONGLONG elapsed = GetTickCount64() - _startTick;
+
+	oss << L"Serial Frames: " << _port.name() << L", " << _sent << L" sent, " << _dropped << L" dropped";
+
+	if (elapsed > 0)
+	{
+		oss << L", " << (static_cast<double>(_sent * 1000) / static_cast<double>(elapsed)) << L" FPS";
+	}
+
+	if (_queuedFrames > 0)
+	{
+		oss << L", backlog " << (static_cast<double>(_totalBacklog) / static_cast<double>(_queuedFrames))
+			<< L" average, " << _peakBacklog << L" peak";
+	}
+
+	oss << std::endl;
+	OutputDebugStringW(oss.str().c_str());
+#endif
+}
+
+DWORD serial_writer::frame_time() const
+{
+	return _frameTime;
+}
+
+void serial_writer::run()
+{
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+
+			_queued.wait(lock, [this]()
+			{
+				return _stopping || !_ring.empty();
+			});
+
+			if (_stopping
+				&& _ring.empty())
+			{
+				return;
+			}
+		}
+
+		// Don't send the next frame until the device latched the last one, and then send the
+		// newest frame we got in the meantime. If the token got lost, e.g. because the device
+		// dropped a bad frame, go ahead anyway.
+		if (_awaitingReady)
+		{
+			_port.wait_ready(_frameTime + ready_slack);
+			_awaitingReady = false;
+		}
+
+		size_t skipped = 0;
+		const auto frame = _ring.acquire_latest(skipped);
+
+		_dropped += skipped;
+
+		if (nullptr == frame)
+		{
+			continue;
+		}
+
+		const serial_buffer* output = frame;
+
+		if (_output)
+		{
+			_output->encode(&*frame->begin(), _ledCount, &*_outputFrame.begin());
+			output = &_outputFrame;
+		}
+
+		if (_encode)
+		{
+			const bool keyFrame = (0 == _sinceKeyFrame);
+
+			output->encode(_sequence++, keyFrame ? nullptr : &_previous, _encoded);
+			_previous.assign(*output);
+			_sinceKeyFrame = (_sinceKeyFrame + 1) % std::max<size_t>(_keyFrameInterval, 1);
+			_port.send(_encoded.data(), _encoded.size());
+		}
+		else
+		{
+			_port.send(*output);
+		}
+
+		_awaitingReady = _port.flow_control();
+
+		_ring.release();
+		++_sent;
+	}
+}
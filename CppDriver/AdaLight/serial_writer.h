@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "settings.h"
+#include "serial_buffer.h"
+#include "serial_ring.h"
+#include "serial_port.h"
+#include "output_encoder.h"
+
+// Write the serial frames to the port on a thread of its own, so sampling the next frame
+// overlaps sending the last one. At 115200 baud a 100 LED frame keeps the line busy for about
+// 26 ms, which used to block the update thread for most of each frame.
+//
+// The frames go through a serial_ring, and the writer always sends the newest frame it has,
+// dropping any which queued up while it was busy. With protocol version 2 the frames are
+// encoded here rather than in the sampler, so the deltas are always against the last frame
+// which actually went out on the port.
+//
+// Each writer only sends the range of LEDs which belong to its device in settings::devices, so
+// with several devices each one has its own thread, ring and encoding state.
+//
+// If the LED chips need something other than R, G, B (see settings::output), the writer encodes
+// the frames for the chips first, and the protocol encoding works on those bytes.
+class serial_writer
+{
+public:
+	serial_writer(const settings& parameters, serial_port& port, size_t device);
+
+	// Stop the thread if it's still running.
+	~serial_writer();
+
+	// Start the writer once the port is open. Returns false if it was already running.
+	bool start();
+
+	// Queue this device's share of a frame for the whole strip. Returns false if the writer isn't
+	// running or the frame was dropped.
+	bool send(const serial_buffer& buffer);
+
+	// Send the newest frame if there is one and stop the thread, e.g. before closing the port.
+	void stop();
+
+	// How long it takes to send one frame at the port's baud rate, in ms, so the caller can keep
+	// the frame rate within what the link can carry. It's 0 for native USB boards, which don't
+	// care about the baud rate. Only valid after start().
+	DWORD frame_time() const;
+
+private:
+	void run();
+
+	serial_port& _port;
+	const size_t _firstLed;
+	serial_ring _ring;
+	bool _started = false;
+
+	// Encoder for the LED chips, or nullptr to send R, G, B. The encoded frames are counted in
+	// units of 3 bytes, so _outputLedCount is the LED count we send in the headers.
+	const std::unique_ptr<output_encoder> _output;
+	const size_t _outputLedCount;
+	serial_buffer _outputFrame;
+
+	// Protocol version 2 encoding state, only touched by the writer thread. We only encode if
+	// the device said it supports version 2 when the port was opened.
+	const UINT _protocolVersion;
+	const size_t _ledCount;
+	const size_t _keyFrameInterval;
+	bool _encode = false;
+	DWORD _frameTime = 0;
+	bool _awaitingReady = false;
+	serial_buffer _previous;
+	serial_buffer::vector_type _encoded;
+	uint8_t _sequence = 0;
+	size_t _sinceKeyFrame = 0;
+
+	std::mutex _mutex;
+	std::condition_variable _queued;
+	bool _stopping = false;
+	std::thread _thread;
+
+	// Frames which were never sent because a newer frame replaced them or the ring was full.
+	std::atomic<size_t> _dropped { 0 };
+	size_t _sent = 0;
+
+	// How many frames were waiting in the ring each time we queued one, to report the backlog
+	// along with the frame rate when the writer stops.
+	ULONGLONG _startTick = 0;
+	size_t _queuedFrames = 0;
+	size_t _totalBacklog = 0;
+	size_t _peakBacklog = 0;
+};
@@ -8,7 +8,8 @@ struct settings
 	// We serialize to/from AdaLight.config.json in the current directory. See the
 	// included AdaLight.config.json for an example and a starting point. If the config file
 	// does not exist we'll use the default values in this header and save them out to
-	// Adalight.config.json for customization.
+	// Adalight.config.json for customization. Builds without cpprestsdk, like the headless
+	// tools on other platforms, define ADALIGHT_NO_CONFIG_FILE and only use the default values.
 	settings(std::wstring&& configFilePath);
 
 	// Minimum LED brightness; some users prefer a small amount of backlighting
@@ -31,11 +32,246 @@ struct settings
 	// will actually be lower.
 	UINT fpsMax = 30;
 
+	// Serial port for the Arduino, e.g. "COM3" on Windows or "/dev/ttyACM0" elsewhere. If
+	// the path is empty, we look for the device on every port, starting with the last one we
+	// found it on, which we keep in AdaLight.port.
+	//
+	// After opening the port we ask the LEDstream sketch what it supports, and switch to the
+	// fastest baud rate up to maxBaudRate which it can handle. Older sketches don't answer,
+	// so we keep using 115200 baud and version 1 of the protocol with them, the same as if
+	// handshake is false. Telling them apart takes up to half a second after the sketch sends
+	// its "Ada\n", so set handshake to false to skip that with an older sketch.
+	//
+	// The frame rate is also capped to what fits through the link at the baud rate we end up
+	// with, so frames don't queue up in the driver. With flowControl, we also ask the sketch to
+	// send a ready token every time it latches a frame, and wait for that before sending the
+	// next one, so we never get ahead of the LEDs.
+	struct serial_port_config
+	{
+		std::wstring path;
+		bool handshake;
+		UINT maxBaudRate;
+		bool flowControl;
+	};
+
+	serial_port_config serialPort = { L"", true, 1000000, false };
+
+	// Split the LEDs across several Arduinos, each on its own serial port with its own writer
+	// thread, e.g. when one 115200 baud link can't keep up with a large wall. Each device takes
+	// ledCount LEDs starting at firstLed, counting across all of the displays, and gets a
+	// frame with only those LEDs. The handshake and maxBaudRate from serialPort apply to all of
+	// them. Give each device a path if there's more than one, since they all send the same
+	// cookie. If the list is empty and there aren't any udpDevices either, a single device on
+	// serialPort.path gets all of the LEDs.
+	struct device_config
+	{
+		std::wstring path;
+		size_t firstLed;
+		size_t ledCount;
+	};
+
+	std::vector<device_config> devices;
+
+	// Send a range of LEDs to a controller on the network over UDP, with E1.31 (sACN),
+	// Art-Net or the WLED realtime protocol. E1.31 and Art-Net put 170 LEDs in each DMX
+	// universe, starting at the given universe and counting up for longer ranges, and E1.31
+	// sends to the multicast address for each universe if the host is empty. WLED uses a
+	// single DRGB packet for up to 490 LEDs, and DNRGB packets with a start index for longer
+	// ranges, ignoring the universe. A port of 0 uses the standard port for the protocol.
+	enum class udp_protocol
+	{
+		e131,
+		artnet,
+		wled,
+	};
+
+	struct udp_device_config
+	{
+		udp_protocol protocol;
+		std::wstring host;
+		UINT port;
+		UINT universe;
+		size_t firstLed;
+		size_t ledCount;
+	};
+
+	std::vector<udp_device_config> udpDevices;
+
+	// Highest serial protocol version to use. Version 1 sends 3 bytes for every LED in every
+	// frame, which works with any LEDstream sketch. Version 2 needs a sketch which says it
+	// supports it in the handshake, and it sends run-length encoded frames or deltas from the
+	// last frame when they're smaller, with a full key frame at least every keyFrameInterval
+	// frames to recover from any errors. It only applies to strips which fit in the sketch's
+	// buffer, longer strips always use version 1.
+	struct protocol_config
+	{
+		UINT version;
+		size_t keyFrameInterval;
+	};
+
+	protocol_config protocol = { 2, 30 };
+
+	// What the LEDs on the serial devices expect, so the driver sends the exact bytes for the
+	// chips and the sketch only has to pass them through. WS2801 takes the colors as they are.
+	// LPD8806 takes 7 bits per color with the high bit set, followed by the latch bytes. APA102
+	// takes a start frame, then a 5-bit global brightness (0 - 31) and the colors for each LED,
+	// then an end frame. The order is the order the colors go out for each LED, e.g. Adafruit's
+	// LPD8806 strips take "grb" and APA102 strips take "bgr". The sketch counts in units of 3
+	// bytes, so an APA102 frame takes a third more of its buffer than the number of LEDs. The
+	// sketch sends its own startup test pattern and blacks the LEDs out when the host goes
+	// quiet, so LED_CHIP in LEDstream.pde has to name the same chip. The udpDevices always get
+	// R, G, B.
+	enum class led_chip
+	{
+		ws2801,
+		lpd8806,
+		apa102,
+	};
+
+	enum class color_order
+	{
+		rgb,
+		rbg,
+		grb,
+		gbr,
+		brg,
+		bgr,
+	};
+
+	struct output_config
+	{
+		led_chip chip;
+		color_order order;
+		uint8_t brightness;
+	};
+
+	output_config output = { led_chip::ws2801, color_order::rgb, 31 };
+
 	// Timer frequency (in milliseconds) when we're throttled, e.g. when a UAC prompt
 	// is displayed. If this value is higher, we'll use less CPU when we can't sample
 	// the display, but it will take longer to resume sampling again.
 	UINT throttleTimer = 3000; // 3 seconds
 
+	// Where the frames we sample come from. The default is to duplicate the desktop
+	// with DXGI. The synthetic source renders a scrolling test pattern and the raw
+	// file source plays back a file of packed 32-bit BGRA frames, which lets you
+	// profile the sampler without a Windows desktop. Both of those create one
+	// source per entry in displays with the width and height given here, and the
+	// format picks between 8-bit BGRA, 10-bit sRGB, 10-bit HDR10 and FP16 scRGB pixels.
+	// DXGI uses the format of the desktop, which is FP16 or HDR10 when HDR is turned on.
+	enum class source_type
+	{
+		dxgi,
+		synthetic,
+		raw_file,
+	};
+
+	enum class frame_format
+	{
+		bgra8,
+		r10g10b10a2,
+		hdr10,
+		fp16,
+	};
+
+	struct source_config
+	{
+		source_type type;
+		std::wstring path;
+		size_t width;
+		size_t height;
+		frame_format format;
+	};
+
+	source_config frameSource = { source_type::dxgi, L"", 3840, 2160, frame_format::bgra8 };
+
+	// Brightness in nits of SDR white and of the brightest highlights on an HDR display.
+	// FP16 and HDR10 frames are scaled relative to SDR white, and the top of the range
+	// rolls off gradually so the peak level reaches full brightness on the LEDs instead
+	// of every highlight clipping.
+	struct hdr_config
+	{
+		double whiteLevel;
+		double peakLevel;
+	};
+
+	hdr_config hdr = { 200.0, 1000.0 };
+
+	// How each LED samples the block of the display next to it. Every LED takes a
+	// gridSize x gridSize grid of evenly spaced points (up to 64). A smaller grid is
+	// cheaper and reacts faster to fast moving content. The depth is the fraction of
+	// the block to sample, measured in from the edge of the display, so 1.0 samples
+	// the whole block and 0.25 only samples the quarter next to the LED. The uniform
+	// weights take a plain average, and the gaussian weights favor the middle of the
+	// sampled region so the result looks more like light from a diffuser.
+	//
+	// The area mode ignores the grid and weights, and takes the exact average of every
+	// pixel in the sampled region from a summed-area table instead. That avoids aliasing
+	// on thin text and HUD elements, and the cost per LED doesn't depend on the size of
+	// the region.
+	//
+	// The pyramid mode samples the grid from a mip pyramid of 2x2 box filtered copies of
+	// the regions next to the LEDs, picking the level where the samples are about 1 pixel
+	// apart, so each sample is the average of the block around it rather than 1 pixel.
+	enum class weight_profile
+	{
+		uniform,
+		gaussian,
+	};
+
+	enum class sampling_mode
+	{
+		grid,
+		area,
+		pyramid,
+	};
+
+	struct sampling_config
+	{
+		size_t gridSize;
+		double depth;
+		weight_profile weights;
+		sampling_mode mode;
+	};
+
+	sampling_config sampling = { 16, 1.0, weight_profile::uniform, sampling_mode::grid };
+
+	// Detect black bars around a letterboxed or pillarboxed movie and sample the active
+	// picture instead, so the LEDs next to the bars don't go dark. A line counts as black
+	// if none of the R, G or B values we check are above the threshold, and a bar needs to
+	// measure the same for the given number of frames in a row before we switch to it.
+	// Each frame only measures one of the 4 edges.
+	struct letterbox_config
+	{
+		bool enabled;
+		uint8_t threshold;
+		size_t frames;
+	};
+
+	letterbox_config letterbox = { false, 16, 8 };
+
+	// Adapt the fade for each LED to how much it changed since the last frame. An LED which
+	// barely changed fades with the heavier smoothing, which calms jitter from noisy content
+	// like game HUDs, and it blends towards the regular fade as the largest change of any
+	// channel approaches the threshold. If the fraction of LEDs which changed by more than
+	// the threshold reaches sceneCut, e.g. on a hard cut in a film, every LED snaps to the
+	// new color instead of fading.
+	struct temporal_filter_config
+	{
+		bool enabled;
+		double smoothing;
+		uint8_t threshold;
+		double sceneCut;
+	};
+
+	temporal_filter_config temporalFilter = { false, 0.75, 24, 0.5 };
+
+	// Path to a 3D LUT in the .cube format which calibrates the colors of the LEDs to match
+	// the display, e.g. when the strip and the panel have different white points. It's
+	// applied after the fade and minimum brightness and before the gamma correction. An
+	// empty path disables it.
+	std::wstring colorLut;
+
 	// This struct contains the 2D coordinates corresponding to each pixel in the
 	// LED strand, in the order that they're connected (i.e. the first element
 	// here belongs to the first LED in the strand, second element is the second
@@ -114,11 +350,14 @@ struct settings
 		//},
 	};
 
-	DWORD minBrightnessColor;
 	size_t totalLedCount;
-	double weight;
 	UINT delay;
 
 private:
+	// Implemented with cpprestsdk in settings_json.cpp. Reading returns false if the file is
+	// missing or invalid.
+	bool read_config_file();
+	void write_config_file() const;
+
 	const std::wstring _configFilePath;
 };
@@ -0,0 +1,662 @@
+#include "stdafx.h"
+#include "settings.h"
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <cpprest/json.h>
+
+#ifndef _WIN32
+#include <codecvt>
+#include <locale>
+#endif
+
+#undef min
+#undef max
+
+using namespace web::json;
+
+#ifdef _WIN32
+// cpprestsdk uses the same wide strings as the rest of the driver on Windows.
+static const utility::string_t& to_string_t(const std::wstring& text)
+{
+	return text;
+}
+
+static const std::wstring& from_string_t(const utility::string_t& text)
+{
+	return text;
+}
+#else
+// Everywhere else it uses UTF-8 in a std::string, and so do the file paths.
+static utility::string_t to_string_t(const std::wstring& text)
+{
+	return std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(text);
+}
+
+static std::wstring from_string_t(const utility::string_t& text)
+{
+	return std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(text);
+}
+#endif
+
+static settings::source_type parse_source_type(const utility::string_t& type)
+{
+	if (type == U("dxgi"))
+	{
+		return settings::source_type::dxgi;
+	}
+	else if (type == U("synthetic"))
+	{
+		return settings::source_type::synthetic;
+	}
+	else if (type == U("rawFile"))
+	{
+		return settings::source_type::raw_file;
+	}
+
+	throw json_exception(U("Unknown frameSource type"));
+}
+
+static utility::string_t format_source_type(settings::source_type type)
+{
+	switch (type)
+	{
+		case settings::source_type::synthetic:
+			return U("synthetic");
+
+		case settings::source_type::raw_file:
+			return U("rawFile");
+
+		default:
+			return U("dxgi");
+	}
+}
+
+static settings::frame_format parse_frame_format(const utility::string_t& format)
+{
+	if (format == U("bgra8"))
+	{
+		return settings::frame_format::bgra8;
+	}
+	else if (format == U("r10g10b10a2"))
+	{
+		return settings::frame_format::r10g10b10a2;
+	}
+	else if (format == U("hdr10"))
+	{
+		return settings::frame_format::hdr10;
+	}
+	else if (format == U("fp16"))
+	{
+		return settings::frame_format::fp16;
+	}
+
+	throw json_exception(U("Unknown frameSource format"));
+}
+
+static utility::string_t format_frame_format(settings::frame_format format)
+{
+	switch (format)
+	{
+		case settings::frame_format::r10g10b10a2:
+			return U("r10g10b10a2");
+
+		case settings::frame_format::hdr10:
+			return U("hdr10");
+
+		case settings::frame_format::fp16:
+			return U("fp16");
+
+		default:
+			return U("bgra8");
+	}
+}
+
+static settings::udp_protocol parse_udp_protocol(const utility::string_t& protocol)
+{
+	if (protocol == U("e131"))
+	{
+		return settings::udp_protocol::e131;
+	}
+	else if (protocol == U("artnet"))
+	{
+		return settings::udp_protocol::artnet;
+	}
+	else if (protocol == U("wled"))
+	{
+		return settings::udp_protocol::wled;
+	}
+
+	throw json_exception(U("Unknown udpDevices protocol"));
+}
+
+static utility::string_t format_udp_protocol(settings::udp_protocol protocol)
+{
+	switch (protocol)
+	{
+		case settings::udp_protocol::artnet:
+			return U("artnet");
+
+		case settings::udp_protocol::wled:
+			return U("wled");
+
+		default:
+			return U("e131");
+	}
+}
+
+static settings::led_chip parse_led_chip(const utility::string_t& chip)
+{
+	if (chip == U("ws2801"))
+	{
+		return settings::led_chip::ws2801;
+	}
+	else if (chip == U("lpd8806"))
+	{
+		return settings::led_chip::lpd8806;
+	}
+	else if (chip == U("apa102"))
+	{
+		return settings::led_chip::apa102;
+	}
+
+	throw json_exception(U("Unknown output chip"));
+}
+
+static utility::string_t format_led_chip(settings::led_chip chip)
+{
+	switch (chip)
+	{
+		case settings::led_chip::lpd8806:
+			return U("lpd8806");
+
+		case settings::led_chip::apa102:
+			return U("apa102");
+
+		default:
+			return U("ws2801");
+	}
+}
+
+static settings::color_order parse_color_order(const utility::string_t& order)
+{
+	if (order == U("rgb"))
+	{
+		return settings::color_order::rgb;
+	}
+	else if (order == U("rbg"))
+	{
+		return settings::color_order::rbg;
+	}
+	else if (order == U("grb"))
+	{
+		return settings::color_order::grb;
+	}
+	else if (order == U("gbr"))
+	{
+		return settings::color_order::gbr;
+	}
+	else if (order == U("brg"))
+	{
+		return settings::color_order::brg;
+	}
+	else if (order == U("bgr"))
+	{
+		return settings::color_order::bgr;
+	}
+
+	throw json_exception(U("Unknown output order"));
+}
+
+static utility::string_t format_color_order(settings::color_order order)
+{
+	switch (order)
+	{
+		case settings::color_order::rbg:
+			return U("rbg");
+
+		case settings::color_order::grb:
+			return U("grb");
+
+		case settings::color_order::gbr:
+			return U("gbr");
+
+		case settings::color_order::brg:
+			return U("brg");
+
+		case settings::color_order::bgr:
+			return U("bgr");
+
+		default:
+			return U("rgb");
+	}
+}
+
+static settings::weight_profile parse_weight_profile(const utility::string_t& weights)
+{
+	if (weights == U("uniform"))
+	{
+		return settings::weight_profile::uniform;
+	}
+	else if (weights == U("gaussian"))
+	{
+		return settings::weight_profile::gaussian;
+	}
+
+	throw json_exception(U("Unknown sampling weights"));
+}
+
+static utility::string_t format_weight_profile(settings::weight_profile weights)
+{
+	switch (weights)
+	{
+		case settings::weight_profile::gaussian:
+			return U("gaussian");
+
+		default:
+			return U("uniform");
+	}
+}
+
+static settings::sampling_mode parse_sampling_mode(const utility::string_t& mode)
+{
+	if (mode == U("grid"))
+	{
+		return settings::sampling_mode::grid;
+	}
+	else if (mode == U("area"))
+	{
+		return settings::sampling_mode::area;
+	}
+	else if (mode == U("pyramid"))
+	{
+		return settings::sampling_mode::pyramid;
+	}
+
+	throw json_exception(U("Unknown sampling mode"));
+}
+
+static utility::string_t format_sampling_mode(settings::sampling_mode mode)
+{
+	switch (mode)
+	{
+		case settings::sampling_mode::area:
+			return U("area");
+
+		case settings::sampling_mode::pyramid:
+			return U("pyramid");
+
+		default:
+			return U("grid");
+	}
+}
+
+bool settings::read_config_file()
+{
+	auto root = value::null();
+	utility::ifstream_t ifs(to_string_t(_configFilePath));
+
+	if (ifs.is_open())
+	{
+		ifs >> root;
+
+		try
+		{
+			const auto& read = root.as_object();
+
+			minBrightness = static_cast<uint8_t>(read.at(U("minBrightness")).as_integer());
+			fade = read.at(U("fade")).as_double();
+			timeout = static_cast<DWORD>(read.at(U("timeout")).as_integer());
+			fpsMax = static_cast<UINT>(read.at(U("fpsMax")).as_integer());
+			throttleTimer = static_cast<UINT>(read.at(U("throttleTimer")).as_integer());
+
+			// The serialPort is optional, older config files will use the handshake.
+			const auto serialPortEntry = read.find(U("serialPort"));
+
+			if (serialPortEntry != read.cend())
+			{
+				const auto& serialPortObject = serialPortEntry->second.as_object();
+
+				serialPort.path = from_string_t(serialPortObject.at(U("path")).as_string());
+				serialPort.handshake = serialPortObject.at(U("handshake")).as_bool();
+				serialPort.maxBaudRate = static_cast<UINT>(serialPortObject.at(U("maxBaudRate")).as_integer());
+
+				const auto flowControlEntry = serialPortObject.find(U("flowControl"));
+
+				if (flowControlEntry != serialPortObject.cend())
+				{
+					serialPort.flowControl = flowControlEntry->second.as_bool();
+				}
+			}
+
+			// The devices are optional, older config files will use a single device.
+			const auto devicesEntry = read.find(U("devices"));
+
+			if (devicesEntry != read.cend())
+			{
+				const auto& deviceArray = devicesEntry->second.as_array();
+
+				devices.resize(deviceArray.size());
+				std::transform(deviceArray.cbegin(), deviceArray.cend(), devices.begin(), [](const value& deviceEntry)
+				{
+					const auto& deviceObject = deviceEntry.as_object();
+					device_config device;
+
+					device.path = from_string_t(deviceObject.at(U("path")).as_string());
+					device.firstLed = static_cast<size_t>(deviceObject.at(U("firstLed")).as_integer());
+					device.ledCount = static_cast<size_t>(deviceObject.at(U("ledCount")).as_integer());
+
+					return device;
+				});
+			}
+
+			// The network devices are optional too.
+			const auto udpDevicesEntry = read.find(U("udpDevices"));
+
+			if (udpDevicesEntry != read.cend())
+			{
+				const auto& udpDeviceArray = udpDevicesEntry->second.as_array();
+
+				udpDevices.resize(udpDeviceArray.size());
+				std::transform(udpDeviceArray.cbegin(), udpDeviceArray.cend(), udpDevices.begin(), [](const value& udpDeviceEntry)
+				{
+					const auto& udpDeviceObject = udpDeviceEntry.as_object();
+					udp_device_config device;
+
+					device.protocol = parse_udp_protocol(udpDeviceObject.at(U("protocol")).as_string());
+					device.host = from_string_t(udpDeviceObject.at(U("host")).as_string());
+					device.port = static_cast<UINT>(udpDeviceObject.at(U("port")).as_integer());
+					device.universe = static_cast<UINT>(udpDeviceObject.at(U("universe")).as_integer());
+					device.firstLed = static_cast<size_t>(udpDeviceObject.at(U("firstLed")).as_integer());
+					device.ledCount = static_cast<size_t>(udpDeviceObject.at(U("ledCount")).as_integer());
+
+					return device;
+				});
+			}
+
+			// The protocol is optional, older config files will use version 2 if the device supports it.
+			const auto protocolEntry = read.find(U("protocol"));
+
+			if (protocolEntry != read.cend())
+			{
+				const auto& protocolObject = protocolEntry->second.as_object();
+
+				protocol.version = static_cast<UINT>(protocolObject.at(U("version")).as_integer());
+				protocol.keyFrameInterval = static_cast<size_t>(protocolObject.at(U("keyFrameInterval")).as_integer());
+			}
+
+			// The output is optional, older config files will keep sending R, G, B for WS2801.
+			const auto outputEntry = read.find(U("output"));
+
+			if (outputEntry != read.cend())
+			{
+				const auto& outputObject = outputEntry->second.as_object();
+
+				output.chip = parse_led_chip(outputObject.at(U("chip")).as_string());
+				output.order = parse_color_order(outputObject.at(U("order")).as_string());
+				output.brightness = static_cast<uint8_t>(outputObject.at(U("brightness")).as_integer());
+			}
+
+			// The frameSource is optional, older config files will keep using DXGI.
+			const auto frameSourceEntry = read.find(U("frameSource"));
+
+			if (frameSourceEntry != read.cend())
+			{
+				const auto& sourceObject = frameSourceEntry->second.as_object();
+
+				frameSource.type = parse_source_type(sourceObject.at(U("type")).as_string());
+				frameSource.path = from_string_t(sourceObject.at(U("path")).as_string());
+				frameSource.width = static_cast<size_t>(sourceObject.at(U("width")).as_integer());
+				frameSource.height = static_cast<size_t>(sourceObject.at(U("height")).as_integer());
+
+				const auto formatEntry = sourceObject.find(U("format"));
+
+				if (formatEntry != sourceObject.cend())
+				{
+					frameSource.format = parse_frame_format(formatEntry->second.as_string());
+				}
+			}
+
+			// The HDR levels are optional, and only matter for FP16 frames.
+			const auto hdrEntry = read.find(U("hdr"));
+
+			if (hdrEntry != read.cend())
+			{
+				const auto& hdrObject = hdrEntry->second.as_object();
+
+				hdr.whiteLevel = hdrObject.at(U("whiteLevel")).as_double();
+				hdr.peakLevel = hdrObject.at(U("peakLevel")).as_double();
+			}
+
+			// The sampling kernel is optional too, the default matches the original 16x16 grid.
+			const auto samplingEntry = read.find(U("sampling"));
+
+			if (samplingEntry != read.cend())
+			{
+				const auto& samplingObject = samplingEntry->second.as_object();
+
+				sampling.gridSize = static_cast<size_t>(samplingObject.at(U("gridSize")).as_integer());
+				sampling.depth = samplingObject.at(U("depth")).as_double();
+				sampling.weights = parse_weight_profile(samplingObject.at(U("weights")).as_string());
+
+				const auto modeEntry = samplingObject.find(U("mode"));
+
+				if (modeEntry != samplingObject.cend())
+				{
+					sampling.mode = parse_sampling_mode(modeEntry->second.as_string());
+				}
+			}
+
+			// So is the letterbox detection, which is disabled by default.
+			const auto letterboxEntry = read.find(U("letterbox"));
+
+			if (letterboxEntry != read.cend())
+			{
+				const auto& letterboxObject = letterboxEntry->second.as_object();
+
+				letterbox.enabled = letterboxObject.at(U("enabled")).as_bool();
+				letterbox.threshold = static_cast<uint8_t>(letterboxObject.at(U("threshold")).as_integer());
+				letterbox.frames = static_cast<size_t>(letterboxObject.at(U("frames")).as_integer());
+			}
+
+			// The temporal filter is optional and disabled by default.
+			const auto temporalFilterEntry = read.find(U("temporalFilter"));
+
+			if (temporalFilterEntry != read.cend())
+			{
+				const auto& filterObject = temporalFilterEntry->second.as_object();
+
+				temporalFilter.enabled = filterObject.at(U("enabled")).as_bool();
+				temporalFilter.smoothing = filterObject.at(U("smoothing")).as_double();
+				temporalFilter.threshold = static_cast<uint8_t>(filterObject.at(U("threshold")).as_integer());
+				temporalFilter.sceneCut = filterObject.at(U("sceneCut")).as_double();
+			}
+
+			// The color LUT is also optional, and there isn't one by default.
+			const auto colorLutEntry = read.find(U("colorLut"));
+
+			if (colorLutEntry != read.cend())
+			{
+				colorLut = from_string_t(colorLutEntry->second.as_string());
+			}
+
+			const auto& displayArray = read.at(U("displays")).as_array();
+
+			displays.resize(displayArray.size());
+			std::transform(displayArray.cbegin(), displayArray.cend(), displays.begin(), [](const value& displayEntry)
+			{
+				const auto& displayObject = displayEntry.as_object();
+				display_config display;
+
+				display.horizontalCount = static_cast<size_t>(displayObject.at(U("horizontalCount")).as_integer());
+				display.verticalCount = static_cast<size_t>(displayObject.at(U("verticalCount")).as_integer());
+
+				const auto& positionArray = displayEntry.at(U("positions")).as_array();
+
+				display.positions.resize(positionArray.size());
+				std::transform(positionArray.cbegin(), positionArray.cend(), display.positions.begin(), [](const value& positionEntry)
+				{
+					const auto& positionObject = positionEntry.as_object();
+					led_pos position;
+
+					position.x = static_cast<size_t>(positionObject.at(U("x")).as_integer());
+					position.y = static_cast<size_t>(positionObject.at(U("y")).as_integer());
+
+					return position;
+				});
+
+				return display;
+			});
+		}
+		catch (const json_exception& ex)
+		{
+			std::cerr << "Error parsing the config file: "
+				<< ex.what()
+				<< std::endl;
+
+			// reset root to a null value and continue
+			root = value::null();
+		}
+	}
+
+	return !root.is_null();
+}
+
+void settings::write_config_file() const
+{
+	utility::ofstream_t ofs(to_string_t(_configFilePath), std::ios::out | std::ios::trunc);
+
+	if (ofs.is_open())
+	{
+		auto root = value::object(true);
+
+		auto& write = root.as_object();
+
+		write[U("minBrightness")] = minBrightness;
+		write[U("fade")] = fade;
+		write[U("timeout")] = static_cast<uint32_t>(timeout);
+		write[U("fpsMax")] = fpsMax;
+		write[U("throttleTimer")] = throttleTimer;
+
+		auto serialPortEntry = value::object(true);
+
+		serialPortEntry[U("path")] = value::string(to_string_t(serialPort.path));
+		serialPortEntry[U("handshake")] = serialPort.handshake;
+		serialPortEntry[U("maxBaudRate")] = serialPort.maxBaudRate;
+		serialPortEntry[U("flowControl")] = value::boolean(serialPort.flowControl);
+		write[U("serialPort")] = serialPortEntry;
+
+		auto& deviceArray = write[U("devices")];
+
+		deviceArray = value::array(devices.size());
+		std::transform(devices.cbegin(), devices.cend(), deviceArray.as_array().begin(), [](const device_config& device)
+		{
+			auto deviceEntry = value::object(true);
+
+			deviceEntry[U("path")] = value::string(to_string_t(device.path));
+			deviceEntry[U("firstLed")] = device.firstLed;
+			deviceEntry[U("ledCount")] = device.ledCount;
+
+			return deviceEntry;
+		});
+
+		auto& udpDeviceArray = write[U("udpDevices")];
+
+		udpDeviceArray = value::array(udpDevices.size());
+		std::transform(udpDevices.cbegin(), udpDevices.cend(), udpDeviceArray.as_array().begin(), [](const udp_device_config& device)
+		{
+			auto udpDeviceEntry = value::object(true);
+
+			udpDeviceEntry[U("protocol")] = value::string(format_udp_protocol(device.protocol));
+			udpDeviceEntry[U("host")] = value::string(to_string_t(device.host));
+			udpDeviceEntry[U("port")] = device.port;
+			udpDeviceEntry[U("universe")] = device.universe;
+			udpDeviceEntry[U("firstLed")] = device.firstLed;
+			udpDeviceEntry[U("ledCount")] = device.ledCount;
+
+			return udpDeviceEntry;
+		});
+
+		auto protocolEntry = value::object(true);
+
+		protocolEntry[U("version")] = protocol.version;
+		protocolEntry[U("keyFrameInterval")] = protocol.keyFrameInterval;
+		write[U("protocol")] = protocolEntry;
+
+		auto outputEntry = value::object(true);
+
+		outputEntry[U("chip")] = value::string(format_led_chip(output.chip));
+		outputEntry[U("order")] = value::string(format_color_order(output.order));
+		outputEntry[U("brightness")] = output.brightness;
+		write[U("output")] = outputEntry;
+
+		auto sourceEntry = value::object(true);
+
+		sourceEntry[U("type")] = value::string(format_source_type(frameSource.type));
+		sourceEntry[U("path")] = value::string(to_string_t(frameSource.path));
+		sourceEntry[U("width")] = frameSource.width;
+		sourceEntry[U("height")] = frameSource.height;
+		sourceEntry[U("format")] = value::string(format_frame_format(frameSource.format));
+		write[U("frameSource")] = sourceEntry;
+
+		auto hdrEntry = value::object(true);
+
+		hdrEntry[U("whiteLevel")] = hdr.whiteLevel;
+		hdrEntry[U("peakLevel")] = hdr.peakLevel;
+		write[U("hdr")] = hdrEntry;
+
+		auto samplingEntry = value::object(true);
+
+		samplingEntry[U("gridSize")] = sampling.gridSize;
+		samplingEntry[U("depth")] = sampling.depth;
+		samplingEntry[U("weights")] = value::string(format_weight_profile(sampling.weights));
+		samplingEntry[U("mode")] = value::string(format_sampling_mode(sampling.mode));
+		write[U("sampling")] = samplingEntry;
+
+		auto letterboxEntry = value::object(true);
+
+		letterboxEntry[U("enabled")] = value::boolean(letterbox.enabled);
+		letterboxEntry[U("threshold")] = letterbox.threshold;
+		letterboxEntry[U("frames")] = letterbox.frames;
+		write[U("letterbox")] = letterboxEntry;
+
+		auto temporalFilterEntry = value::object(true);
+
+		temporalFilterEntry[U("enabled")] = value::boolean(temporalFilter.enabled);
+		temporalFilterEntry[U("smoothing")] = temporalFilter.smoothing;
+		temporalFilterEntry[U("threshold")] = temporalFilter.threshold;
+		temporalFilterEntry[U("sceneCut")] = temporalFilter.sceneCut;
+		write[U("temporalFilter")] = temporalFilterEntry;
+
+		write[U("colorLut")] = value::string(to_string_t(colorLut));
+
+		auto& displayArray = write[U("displays")];
+
+		displayArray = value::array(displays.size());
+		std::transform(displays.cbegin(), displays.cend(), displayArray.as_array().begin(), [](const display_config& display)
+		{
+			auto displayEntry = value::object(true);
+
+			displayEntry[U("horizontalCount")] = display.horizontalCount;
+			displayEntry[U("verticalCount")] = display.verticalCount;
+
+			auto& positionArray = displayEntry[U("positions")];
+
+			positionArray = value::array(display.positions.size());
+			std::transform(display.positions.cbegin(), display.positions.cend(), positionArray.as_array().begin(), [](const led_pos& position)
+			{
+				auto positionEntry = value::object(true);
+
+				positionEntry[U("x")] = position.x;
+				positionEntry[U("y")] = position.y;
+
+				return positionEntry;
+			});
+
+			return displayEntry;
+		});
+
+		ofs << root;
+	}
+}
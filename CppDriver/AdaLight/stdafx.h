@@ -5,14 +5,21 @@
 
 #pragma once
 
+#ifdef _WIN32
+
 #include "targetver.h"
 
 #include <stdio.h>
 #include <tchar.h>
 
+// Winsock 2 has to come before anything which includes windows.h, like comdef.h, or windows.h
+// pulls in the old winsock.h and the two redefine each other.
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <comdef.h>
 #include <windows.h>
 #include <WtsApi32.h>
+#include <Dbt.h>
 #include <d3d11.h>
 #include <dxgi1_2.h>
 
@@ -25,3 +32,45 @@ _COM_SMARTPTR_TYPEDEF(IDXGIResource, __uuidof(IDXGIResource));
 _COM_SMARTPTR_TYPEDEF(ID3D11Device, __uuidof(ID3D11Device));
 _COM_SMARTPTR_TYPEDEF(ID3D11DeviceContext, __uuidof(ID3D11DeviceContext));
 _COM_SMARTPTR_TYPEDEF(ID3D11Texture2D, __uuidof(ID3D11Texture2D));
+
+#else
+
+// The sampling engine (screen_samples and the portable frame_source implementations) also builds
+// headless on other platforms so it can be profiled without a Windows desktop. These are the few
+// Win32 definitions it shares with the rest of the project.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <chrono>
+
+typedef uint32_t DWORD;
+typedef unsigned int UINT;
+typedef uint64_t ULONGLONG;
+
+#define _countof(array) (sizeof(array) / sizeof((array)[0]))
+
+inline int memcpy_s(void* dest, size_t destSize, const void* src, size_t count)
+{
+	if (count > destSize)
+	{
+		return -1;
+	}
+
+	memcpy(dest, src, count);
+	return 0;
+}
+
+inline ULONGLONG GetTickCount64()
+{
+	return static_cast<ULONGLONG>(std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+inline void OutputDebugStringW(const wchar_t* message)
+{
+	fputws(message, stderr);
+}
+
+#endif
@@ -0,0 +1,406 @@
+#include "stdafx.h"
+#include "summed_area_table.h"
+
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PREFIX_SUM_SSE2
+#include <emmintrin.h>
+#elif defined(_M_ARM) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define PREFIX_SUM_NEON
+#include <arm_neon.h>
+#endif
+
+// Each entry holds the sums of the B, G, R and A channels.
+constexpr size_t channels = 4;
+
+#if defined(PREFIX_SUM_SSE2)
+
+static inline void add_pixel(__m128i pixel, uint32_t* columnSums)
+{
+	__m128i* sums = reinterpret_cast<__m128i*>(columnSums);
+
+	_mm_storeu_si128(sums, _mm_add_epi32(_mm_loadu_si128(sums), pixel));
+}
+
+// Add each pixel in a line to the sums of its column.
+static void add_row(const uint8_t* line, size_t width, uint32_t* columnSums)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t x = 0;
+
+	// Widen 4 pixels at a time to 32-bit lanes, one pixel per register.
+	for (; x + 4 <= width; x += 4)
+	{
+		const __m128i quad = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line + (x * channels)));
+		const __m128i low = _mm_unpacklo_epi8(quad, zero);
+		const __m128i high = _mm_unpackhi_epi8(quad, zero);
+		uint32_t* sums = columnSums + (x * channels);
+
+		add_pixel(_mm_unpacklo_epi16(low, zero), sums);
+		add_pixel(_mm_unpackhi_epi16(low, zero), sums + channels);
+		add_pixel(_mm_unpacklo_epi16(high, zero), sums + (2 * channels));
+		add_pixel(_mm_unpackhi_epi16(high, zero), sums + (3 * channels));
+	}
+
+	for (; x < width; ++x)
+	{
+		int32_t pixel;
+
+		memcpy(&pixel, line + (x * channels), sizeof(pixel));
+		add_pixel(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero), zero), columnSums + (x * channels));
+	}
+}
+
+// Fill in a row of the table with the prefix sum of the column sums. Every pixel fills a whole
+// register, so each block of 4 pixels is scanned with 2 steps of shift-and-add, where shifting
+// by 1 or 2 pixels means adding the register 1 or 2 to the left. Only the last add of a block
+// waits for the running total carried over from the blocks before it, rather than every pixel
+// waiting for the one before it.
+static void prefix_row(const uint32_t* columnSums, size_t width, uint32_t* out)
+{
+	const __m128i* sums = reinterpret_cast<const __m128i*>(columnSums);
+	__m128i* entries = reinterpret_cast<__m128i*>(out);
+	__m128i running = _mm_setzero_si128();
+	size_t x = 0;
+
+	for (; x + 4 <= width; x += 4)
+	{
+		const __m128i p0 = _mm_loadu_si128(sums + x);
+		const __m128i p1 = _mm_loadu_si128(sums + x + 1);
+		const __m128i p2 = _mm_loadu_si128(sums + x + 2);
+		const __m128i p3 = _mm_loadu_si128(sums + x + 3);
+
+		// Shift by 1 pixel and add.
+		const __m128i s1 = _mm_add_epi32(p1, p0);
+		const __m128i s2 = _mm_add_epi32(p2, p1);
+		const __m128i s3 = _mm_add_epi32(p3, p2);
+
+		// Shift by 2 pixels and add, which leaves the sums from the start of the block.
+		const __m128i t2 = _mm_add_epi32(s2, p0);
+		const __m128i t3 = _mm_add_epi32(s3, s1);
+
+		_mm_storeu_si128(entries + x, _mm_add_epi32(running, p0));
+		_mm_storeu_si128(entries + x + 1, _mm_add_epi32(running, s1));
+		_mm_storeu_si128(entries + x + 2, _mm_add_epi32(running, t2));
+		running = _mm_add_epi32(running, t3);
+		_mm_storeu_si128(entries + x + 3, running);
+	}
+
+	for (; x < width; ++x)
+	{
+		running = _mm_add_epi32(running, _mm_loadu_si128(sums + x));
+		_mm_storeu_si128(entries + x, running);
+	}
+}
+
+static const wchar_t* prefix_sum_name = L"SSE2";
+
+#elif defined(PREFIX_SUM_NEON)
+
+static inline void add_pixel(uint16x4_t pixel, uint32_t* columnSums)
+{
+	vst1q_u32(columnSums, vaddw_u16(vld1q_u32(columnSums), pixel));
+}
+
+static void add_row(const uint8_t* line, size_t width, uint32_t* columnSums)
+{
+	size_t x = 0;
+
+	for (; x + 4 <= width; x += 4)
+	{
+		const uint8x16_t quad = vld1q_u8(line + (x * channels));
+		const uint16x8_t low = vmovl_u8(vget_low_u8(quad));
+		const uint16x8_t high = vmovl_u8(vget_high_u8(quad));
+		uint32_t* sums = columnSums + (x * channels);
+
+		add_pixel(vget_low_u16(low), sums);
+		add_pixel(vget_high_u16(low), sums + channels);
+		add_pixel(vget_low_u16(high), sums + (2 * channels));
+		add_pixel(vget_high_u16(high), sums + (3 * channels));
+	}
+
+	for (; x < width; ++x)
+	{
+		uint32_t pixel;
+
+		memcpy(&pixel, line + (x * channels), sizeof(pixel));
+		add_pixel(vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(pixel)))), columnSums + (x * channels));
+	}
+}
+
+static void prefix_row(const uint32_t* columnSums, size_t width, uint32_t* out)
+{
+	uint32x4_t running = vdupq_n_u32(0);
+	size_t x = 0;
+
+	for (; x + 4 <= width; x += 4)
+	{
+		const uint32_t* sums = columnSums + (x * channels);
+		uint32_t* entries = out + (x * channels);
+		const uint32x4_t p0 = vld1q_u32(sums);
+		const uint32x4_t p1 = vld1q_u32(sums + channels);
+		const uint32x4_t p2 = vld1q_u32(sums + (2 * channels));
+		const uint32x4_t p3 = vld1q_u32(sums + (3 * channels));
+		const uint32x4_t s1 = vaddq_u32(p1, p0);
+		const uint32x4_t s2 = vaddq_u32(p2, p1);
+		const uint32x4_t s3 = vaddq_u32(p3, p2);
+		const uint32x4_t t2 = vaddq_u32(s2, p0);
+		const uint32x4_t t3 = vaddq_u32(s3, s1);
+
+		vst1q_u32(entries, vaddq_u32(running, p0));
+		vst1q_u32(entries + channels, vaddq_u32(running, s1));
+		vst1q_u32(entries + (2 * channels), vaddq_u32(running, t2));
+		running = vaddq_u32(running, t3);
+		vst1q_u32(entries + (3 * channels), running);
+	}
+
+	for (; x < width; ++x)
+	{
+		running = vaddq_u32(running, vld1q_u32(columnSums + (x * channels)));
+		vst1q_u32(out + (x * channels), running);
+	}
+}
+
+static const wchar_t* prefix_sum_name = L"NEON";
+
+#else
+
+static void add_row(const uint8_t* line, size_t width, uint32_t* columnSums)
+{
+	for (size_t i = 0; i < width * channels; ++i)
+	{
+		columnSums[i] += line[i];
+	}
+}
+
+static void prefix_row(const uint32_t* columnSums, size_t width, uint32_t* out)
+{
+	uint32_t running[channels] = {};
+
+	for (size_t x = 0; x < width; ++x)
+	{
+		for (size_t channel = 0; channel < channels; ++channel)
+		{
+			const size_t entry = (x * channels) + channel;
+
+			running[channel] += columnSums[entry];
+			out[entry] = running[channel];
+		}
+	}
+}
+
+static const wchar_t* prefix_sum_name = L"scalar";
+
+#endif
+
+void summed_area_table::resize(const std::vector<pixel_rect>& leds)
+{
+	constexpr size_t unassigned = static_cast<size_t>(-1);
+	std::vector<size_t> ledBands(leds.size(), unassigned);
+
+	_bands.clear();
+
+	const auto add_band = [&leds, &ledBands, this](std::vector<size_t>&& members, const pixel_rect& bounds)
+	{
+		band merged = { bounds, {}, std::move(members), 0 };
+
+		for (size_t member : merged.leds)
+		{
+			const auto& led = leds[member];
+
+			merged.rows.push_back(led.top - bounds.top);
+			merged.rows.push_back(led.bottom - bounds.top);
+			ledBands[member] = _bands.size();
+		}
+
+		std::sort(merged.rows.begin(), merged.rows.end());
+		merged.rows.erase(std::unique(merged.rows.begin(), merged.rows.end()), merged.rows.end());
+		_bands.push_back(std::move(merged));
+	};
+
+	// Make a band out of every group of at least 2 LEDs which share the same edges on one axis
+	// and touch each other along the other, so e.g. the LEDs on the left and right edges don't
+	// end up in a band which spans the whole display. Sorting the LEDs which aren't in a band yet
+	// by the edges they share and then by where they start along the band puts each group in a
+	// run of its own, which ends at the first LED that doesn't touch the ones before it.
+	typedef size_t pixel_rect::* edge;
+
+	const auto group = [&leds, &ledBands, &add_band](edge sharedFirst, edge sharedLast, edge alongFirst, edge alongLast)
+	{
+		std::vector<size_t> order;
+
+		for (size_t i = 0; i < leds.size(); ++i)
+		{
+			if (ledBands[i] == unassigned)
+			{
+				order.push_back(i);
+			}
+		}
+
+		std::sort(order.begin(), order.end(), [&leds, sharedFirst, sharedLast, alongFirst](size_t lhs, size_t rhs)
+		{
+			const auto& left = leds[lhs];
+			const auto& right = leds[rhs];
+
+			return std::tie(left.*sharedFirst, left.*sharedLast, left.*alongFirst, lhs)
+				< std::tie(right.*sharedFirst, right.*sharedLast, right.*alongFirst, rhs);
+		});
+
+		for (size_t first = 0; first < order.size();)
+		{
+			const auto& seed = leds[order[first]];
+			pixel_rect bounds = seed;
+			size_t last = first + 1;
+
+			for (; last < order.size(); ++last)
+			{
+				const auto& led = leds[order[last]];
+
+				if (led.*sharedFirst != seed.*sharedFirst
+					|| led.*sharedLast != seed.*sharedLast
+					|| led.*alongFirst > bounds.*alongLast)
+				{
+					break;
+				}
+
+				bounds.*alongLast = std::max(bounds.*alongLast, led.*alongLast);
+			}
+
+			if (last - first >= 2)
+			{
+				add_band(std::vector<size_t>(order.cbegin() + first, order.cbegin() + last), bounds);
+			}
+
+			first = last;
+		}
+	};
+
+	group(&pixel_rect::top, &pixel_rect::bottom, &pixel_rect::left, &pixel_rect::right);
+	group(&pixel_rect::left, &pixel_rect::right, &pixel_rect::top, &pixel_rect::bottom);
+
+	// Anything left over gets a band of its own.
+	for (size_t i = 0; i < leds.size(); ++i)
+	{
+		if (ledBands[i] == unassigned)
+		{
+			add_band(std::vector<size_t>(1, i), leds[i]);
+		}
+	}
+
+	// Each row of a table has an extra column of zeroes on the left, which we never write to, so
+	// the corners of a rectangle touching the left edge of the band don't need a check.
+	size_t size = 0;
+	size_t maxWidth = 0;
+
+	for (auto& entry : _bands)
+	{
+		const size_t width = entry.bounds.right - entry.bounds.left;
+
+		entry.offset = size;
+		size += (width + 1) * entry.rows.size() * channels;
+		maxWidth = std::max(maxWidth, width);
+	}
+
+	_table.assign(size, 0);
+	_columnSums.resize(maxWidth * channels);
+	_line.resize(maxWidth * channels);
+	_leds.resize(leds.size());
+
+	const auto find_row = [](const band& entry, size_t y)
+	{
+		return static_cast<size_t>(std::lower_bound(entry.rows.cbegin(), entry.rows.cend(), y - entry.bounds.top) - entry.rows.cbegin());
+	};
+
+	for (size_t i = 0; i < leds.size(); ++i)
+	{
+		const auto& led = leds[i];
+		const auto& entry = _bands[ledBands[i]];
+		const size_t stride = (entry.bounds.right - entry.bounds.left + 1) * channels;
+		const size_t left = (led.left - entry.bounds.left) * channels;
+		const size_t right = (led.right - entry.bounds.left) * channels;
+		const size_t top = entry.offset + (find_row(entry, led.top) * stride);
+		const size_t bottom = entry.offset + (find_row(entry, led.bottom) * stride);
+
+		_leds[i] = {
+			top + left,
+			top + right,
+			bottom + left,
+			bottom + right,
+			static_cast<uint32_t>((led.right - led.left) * (led.bottom - led.top)),
+		};
+	}
+}
+
+void summed_area_table::build(const frame_view& view, const pixel_converter& converter, const std::vector<uint8_t>& dirtyLeds)
+{
+	const bool convert = (pixel_format::b8g8r8a8 != view.format);
+	const size_t pixelSize = pixel_size(view.format);
+
+	for (const auto& entry : _bands)
+	{
+		if (std::none_of(entry.leds.cbegin(), entry.leds.cend(), [&dirtyLeds](size_t led)
+		{
+			return dirtyLeds[led] != 0;
+		}))
+		{
+			continue;
+		}
+
+		const size_t width = entry.bounds.right - entry.bounds.left;
+		const size_t stride = (width + 1) * channels;
+		const uint8_t* line = view.pixels + (entry.bounds.top * view.pitch) + (entry.bounds.left * pixelSize);
+		uint32_t* columnSums = _columnSums.data();
+		uint32_t* out = _table.data() + entry.offset + channels;
+		size_t y = 0;
+
+		std::fill(columnSums, columnSums + (width * channels), 0);
+
+		for (size_t row : entry.rows)
+		{
+			for (; y < row; ++y)
+			{
+				if (convert)
+				{
+					converter.convert(view.format, line, width, _line.data());
+					add_row(_line.data(), width, columnSums);
+				}
+				else
+				{
+					add_row(line, width, columnSums);
+				}
+
+				line += view.pitch;
+			}
+
+			prefix_row(columnSums, width, out);
+			out += stride;
+		}
+	}
+}
+
+channel_sums summed_area_table::sum(size_t led) const
+{
+	const auto& corners = _leds[led];
+	const uint32_t* table = _table.data();
+	channel_sums sums;
+
+	// The unsigned math wraps around the same way the running sums did.
+	sums.b = table[corners.bottomRight] - table[corners.topRight] - table[corners.bottomLeft] + table[corners.topLeft];
+	sums.g = table[corners.bottomRight + 1] - table[corners.topRight + 1] - table[corners.bottomLeft + 1] + table[corners.topLeft + 1];
+	sums.r = table[corners.bottomRight + 2] - table[corners.topRight + 2] - table[corners.bottomLeft + 2] + table[corners.topLeft + 2];
+
+	return sums;
+}
+
+uint32_t summed_area_table::area(size_t led) const
+{
+	return _leds[led].area;
+}
+
+const wchar_t* summed_area_table::name()
+{
+	return prefix_sum_name;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "frame_source.h"
+#include "sample_kernel.h"
+#include "pixel_converter.h"
+
+// Summed-area tables (integral images) over the parts of a display covered by the LEDs, so the
+// sum of every pixel in an LED's rectangle takes 4 lookups no matter how big the rectangle is.
+//
+// Rather than building one table over the whole frame, the LEDs are grouped into bands: LEDs
+// which share the same rows (e.g. along the top or bottom edge) or the same columns (e.g. along
+// the left or right edge) get a table over the bounding box of the group, and anything left
+// over gets a table of its own.
+//
+// The lookups only ever touch the rows of the table at the top or bottom edge of an LED, so
+// that's all we store. Building a band keeps a running sum of each column, which is one SIMD
+// add per pixel into a buffer that stays in the cache, and when it reaches one of the LED edges
+// it does a SIMD prefix scan across the columns to fill in that row of the table.
+//
+// Each entry holds the sums of all 4 channels in 32-bit lanes. The sums wrap around on large
+// bands, but the difference of the corners is still exact as long as the sum over one LED's
+// rectangle fits in 32 bits, i.e. the rectangle has fewer than 2^24 pixels.
+class summed_area_table
+{
+public:
+	// Group the LED rectangles into bands and allocate the tables.
+	void resize(const std::vector<pixel_rect>& leds);
+
+	// Fill in the tables from a mapped frame, skipping the bands which don't have any LEDs
+	// flagged in dirtyLeds. Frames in any other format than 8-bit BGRA are converted one line
+	// of a band at a time.
+	void build(const frame_view& view, const pixel_converter& converter, const std::vector<uint8_t>& dirtyLeds);
+
+	// Channel sums and number of pixels in an LED's rectangle.
+	channel_sums sum(size_t led) const;
+	uint32_t area(size_t led) const;
+
+	// Name of the prefix sum implementation, for diagnostics.
+	static const wchar_t* name();
+
+private:
+	struct band
+	{
+		pixel_rect bounds;
+
+		// Rows of the band we keep in the table, relative to the top of the band, in order.
+		std::vector<size_t> rows;
+
+		// LEDs which are sampled from this band.
+		std::vector<size_t> leds;
+		size_t offset;
+	};
+
+	// Offsets of the entries at the corners of an LED's rectangle.
+	struct led_corners
+	{
+		size_t topLeft;
+		size_t topRight;
+		size_t bottomLeft;
+		size_t bottomRight;
+		uint32_t area;
+	};
+
+	std::vector<band> _bands;
+	std::vector<led_corners> _leds;
+	std::vector<uint32_t> _table;
+	std::vector<uint32_t> _columnSums;
+	std::vector<uint8_t> _line;
+};
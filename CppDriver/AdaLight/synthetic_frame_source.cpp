@@ -0,0 +1,192 @@
+#include "stdafx.h"
+#include "synthetic_frame_source.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "hdr_constants.h"
+
+#undef min
+#undef max
+
+// Convert a float to the nearest half float. This only handles the non-negative values up to
+// 65504 which the pattern uses.
+static uint16_t float_to_half(float value)
+{
+	constexpr float smallest_normal = 6.103515625e-05f;
+
+	if (value < smallest_normal)
+	{
+		// Denormals count in steps of 2^-24.
+		return static_cast<uint16_t>((value * 16777216.0f) + 0.5f);
+	}
+
+	uint32_t bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+
+	// Round the mantissa to nearest even and rebias the exponent from 127 to 15.
+	bits += 0x00000FFF + ((bits >> 13) & 1);
+
+	return static_cast<uint16_t>((bits >> 13) - (112 << 10));
+}
+
+// Encode a brightness in nits as a 10-bit SMPTE ST 2084 (PQ) code.
+static uint32_t encode_pq(double nits)
+{
+	const double scaled = pow(std::max(nits, 0.0) / pq_max_nits, pq_m1);
+	const double encoded = pow((pq_c1 + (pq_c2 * scaled)) / (1.0 + (pq_c3 * scaled)), pq_m2);
+
+	return static_cast<uint32_t>((std::min(encoded, 1.0) * 1023.0) + 0.5);
+}
+
+frame_source_list synthetic_frame_source::create_sources(const settings& parameters)
+{
+	frame_source_list sources;
+	const auto& source = parameters.frameSource;
+
+	if (source.width > 0 && source.height > 0)
+	{
+		sources.reserve(parameters.displays.size());
+
+		for (size_t i = 0; i < parameters.displays.size(); ++i)
+		{
+			sources.push_back(std::make_unique<synthetic_frame_source>(source.width, source.height, configured_format(parameters), parameters.hdr));
+		}
+	}
+
+	return sources;
+}
+
+synthetic_frame_source::synthetic_frame_source(size_t width, size_t height, pixel_format format, const settings::hdr_config& hdr)
+	: _width(width)
+	, _height(height)
+	, _format(format)
+	, _pitch(width * pixel_size(format))
+{
+	const size_t rows = _height + pattern_rows;
+	std::array<double, 256> linear;
+	std::array<uint16_t, 256> halves;
+
+	_pixels.resize(rows * _pitch);
+
+	for (size_t i = 0; i < linear.size(); ++i)
+	{
+		const double encoded = static_cast<double>(i) / 255.0;
+
+		linear[i] = (encoded <= 0.04045)
+			? (encoded / 12.92)
+			: pow((encoded + 0.055) / 1.055, 2.4);
+	}
+
+	if (pixel_format::r16g16b16a16_float == _format)
+	{
+		const double scale = hdr.whiteLevel / scrgb_nits;
+
+		for (size_t i = 0; i < halves.size(); ++i)
+		{
+			halves[i] = float_to_half(static_cast<float>(linear[i] * scale));
+		}
+	}
+
+	// Blue ramps across the display, green ramps down every 256 rows, and red
+	// is a checkered pattern made from both coordinates. That only depends on the
+	// row modulo 256, so we render the first pattern_rows rows and copy the rest.
+	for (size_t y = 0; y < std::min(rows, pattern_rows); ++y)
+	{
+		uint8_t* row = _pixels.data() + (y * _pitch);
+
+		for (size_t x = 0; x < _width; ++x)
+		{
+			const uint8_t blue = static_cast<uint8_t>((x * 256) / _width);
+			const uint8_t green = static_cast<uint8_t>(y & 0xFF);
+			const uint8_t red = static_cast<uint8_t>((x ^ y) & 0xFF);
+
+			switch (_format)
+			{
+				case pixel_format::r10g10b10a2:
+				{
+					const uint32_t packed = (((red * 1023u) + 127u) / 255u)
+						| ((((green * 1023u) + 127u) / 255u) << 10)
+						| ((((blue * 1023u) + 127u) / 255u) << 20)
+						| (3u << 30);
+
+					memcpy(row + (x * 4), &packed, sizeof(packed));
+					break;
+				}
+
+				case pixel_format::r10g10b10a2_pq:
+				{
+					const double color[] = { linear[red], linear[green], linear[blue] };
+					uint32_t packed = 3u << 30;
+
+					for (size_t channel = 0; channel < 3; ++channel)
+					{
+						const auto& weights = bt709_to_bt2020[channel];
+						const double mixed = (weights[0] * color[0]) + (weights[1] * color[1]) + (weights[2] * color[2]);
+
+						packed |= encode_pq(mixed * hdr.whiteLevel) << (channel * 10);
+					}
+
+					memcpy(row + (x * 4), &packed, sizeof(packed));
+					break;
+				}
+
+				case pixel_format::r16g16b16a16_float:
+				{
+					const uint16_t pixel[] = { halves[red], halves[green], halves[blue], float_to_half(1.0f) };
+
+					memcpy(row + (x * 8), pixel, sizeof(pixel));
+					break;
+				}
+
+				default:
+					row[x * 4] = blue;
+					row[x * 4 + 1] = green;
+					row[x * 4 + 2] = red;
+					row[x * 4 + 3] = 0xFF;
+					break;
+			}
+		}
+	}
+
+	for (size_t y = pattern_rows; y < rows; ++y)
+	{
+		memcpy(_pixels.data() + (y * _pitch), _pixels.data() + ((y % pattern_rows) * _pitch), _pitch);
+	}
+}
+
+size_t synthetic_frame_source::width() const
+{
+	return _width;
+}
+
+size_t synthetic_frame_source::height() const
+{
+	return _height;
+}
+
+frame_status synthetic_frame_source::acquire_frame(UINT /*timeout*/)
+{
+	++_frameCount;
+
+	return frame_status::available;
+}
+
+frame_status synthetic_frame_source::map(frame_view& view)
+{
+	const size_t firstRow = pattern_rows - 1 - (_frameCount % pattern_rows);
+
+	view.pixels = _pixels.data() + (firstRow * _pitch);
+	view.pitch = _pitch;
+	view.format = _format;
+	view.width = _width;
+	view.height = _height;
+
+	return frame_status::available;
+}
+
+void synthetic_frame_source::unmap()
+{
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "frame_source.h"
+
+// Generate a test pattern which scrolls down by one row every frame. The pattern repeats
+// every 256 rows, so we render it once with that many extra rows and each frame just
+// maps a view starting at a different row. That keeps the cost of "capturing" a frame
+// out of the way when profiling the sampler at large resolutions.
+//
+// The pattern is the same in every format. 10-bit frames scale each channel up to 10 bits,
+// FP16 frames decode the sRGB values to linear scRGB with the white level from the HDR
+// settings, and HDR10 frames convert those to BT.2020 and encode them with the PQ curve, so
+// they should sample to nearly the same colors as the 8-bit pattern, apart from the tone
+// mapping near white.
+class synthetic_frame_source
+	: public frame_source
+{
+public:
+	static frame_source_list create_sources(const settings& parameters);
+
+	synthetic_frame_source(size_t width, size_t height, pixel_format format, const settings::hdr_config& hdr);
+
+	size_t width() const override;
+	size_t height() const override;
+
+	frame_status acquire_frame(UINT timeout) override;
+	frame_status map(frame_view& view) override;
+	void unmap() override;
+
+private:
+	static constexpr size_t pattern_rows = 256;
+
+	const size_t _width;
+	const size_t _height;
+	const pixel_format _format;
+	const size_t _pitch;
+	std::vector<uint8_t> _pixels;
+	size_t _frameCount = 0;
+};
@@ -0,0 +1,232 @@
+#include "stdafx.h"
+#include "tile_index.h"
+
+#include <algorithm>
+#include <cstring>
+
+#undef min
+#undef max
+
+// The hash reads 32-bit words, which evenly divide the pixels in every format.
+constexpr size_t word_size = 4;
+
+static inline bool intersects(const pixel_rect& lhs, const pixel_rect& rhs)
+{
+	return lhs.left < rhs.right
+		&& rhs.left < lhs.right
+		&& lhs.top < rhs.bottom
+		&& rhs.top < lhs.bottom;
+}
+
+// Mix one word into a lane of the hash, the same way as a round of xxHash64.
+static inline uint64_t mix(uint64_t lane, uint64_t word)
+{
+	constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+	constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+
+	lane += word * prime2;
+	lane = (lane << 31) | (lane >> 33);
+
+	return lane * prime1;
+}
+
+// Hash a tile in 4 independent lanes so the multiplies can overlap.
+static uint64_t hash_tile(const uint8_t* pixels, size_t pitch, size_t bytes, size_t height)
+{
+	uint64_t lanes[4] = { 1, 2, 3, 4 };
+
+	for (size_t y = 0; y < height; ++y)
+	{
+		const uint8_t* line = pixels + (y * pitch);
+		size_t i = 0;
+
+		for (; i + 32 <= bytes; i += 32)
+		{
+			uint64_t words[4];
+
+			memcpy(words, line + i, sizeof(words));
+
+			lanes[0] = mix(lanes[0], words[0]);
+			lanes[1] = mix(lanes[1], words[1]);
+			lanes[2] = mix(lanes[2], words[2]);
+			lanes[3] = mix(lanes[3], words[3]);
+		}
+
+		for (; i < bytes; i += word_size)
+		{
+			uint32_t word;
+
+			memcpy(&word, line + i, sizeof(word));
+			lanes[0] = mix(lanes[0], word);
+		}
+	}
+
+	return mix(mix(mix(lanes[0], lanes[1]), lanes[2]), lanes[3]);
+}
+
+void tile_index::resize(size_t width, size_t height, const std::vector<pixel_rect>& leds)
+{
+	_width = width;
+	_height = height;
+	_columns = (width + tile_size - 1) / tile_size;
+	_rows = (height + tile_size - 1) / tile_size;
+	_invalid = true;
+
+	_dirty.assign(leds.size(), 1);
+	_leds.resize(leds.size());
+
+	// Clip the LEDs to the display, so they only overlap the tiles and changes inside it.
+	std::transform(leds.cbegin(), leds.cend(), _leds.begin(), [width, height](const pixel_rect& led)
+	{
+		return pixel_rect {
+			std::min(led.left, width),
+			std::min(led.top, height),
+			std::min(led.right, width),
+			std::min(led.bottom, height),
+		};
+	});
+
+	const size_t tileCount = _columns * _rows;
+	std::vector<size_t> counts(tileCount, 0);
+
+	// Count the LEDs in each tile, and then fill them in.
+	const auto visit_tiles = [this](const pixel_rect& led, auto&& visit)
+	{
+		if (led.left >= led.right
+			|| led.top >= led.bottom)
+		{
+			return;
+		}
+
+		for (size_t row = led.top / tile_size; row <= (led.bottom - 1) / tile_size; ++row)
+		{
+			for (size_t column = led.left / tile_size; column <= (led.right - 1) / tile_size; ++column)
+			{
+				visit((row * _columns) + column);
+			}
+		}
+	};
+
+	for (const auto& led : _leds)
+	{
+		visit_tiles(led, [&counts](size_t tile)
+		{
+			++counts[tile];
+		});
+	}
+
+	_tileStart.resize(tileCount + 1);
+	_tileStart[0] = 0;
+
+	for (size_t tile = 0; tile < tileCount; ++tile)
+	{
+		_tileStart[tile + 1] = _tileStart[tile] + counts[tile];
+		counts[tile] = _tileStart[tile];
+	}
+
+	_tileLeds.resize(_tileStart[tileCount]);
+
+	for (size_t i = 0; i < _leds.size(); ++i)
+	{
+		visit_tiles(_leds[i], [this, &counts, i](size_t tile)
+		{
+			_tileLeds[counts[tile]++] = i;
+		});
+	}
+
+	_tileHashes.assign(tileCount, 0);
+}
+
+void tile_index::begin_frame()
+{
+	std::fill(_dirty.begin(), _dirty.end(), _invalid ? 1 : 0);
+	_invalid = false;
+}
+
+void tile_index::invalidate()
+{
+	_invalid = true;
+}
+
+void tile_index::mark_changes(const std::vector<pixel_rect>& changes)
+{
+	for (const auto& rect : changes)
+	{
+		const pixel_rect change = {
+			rect.left,
+			rect.top,
+			std::min(rect.right, _width),
+			std::min(rect.bottom, _height),
+		};
+
+		if (change.left >= change.right
+			|| change.top >= change.bottom)
+		{
+			continue;
+		}
+
+		for (size_t row = change.top / tile_size; row <= (change.bottom - 1) / tile_size; ++row)
+		{
+			for (size_t column = change.left / tile_size; column <= (change.right - 1) / tile_size; ++column)
+			{
+				mark_tile((row * _columns) + column, change);
+			}
+		}
+	}
+}
+
+void tile_index::mark_hashed_tiles(const frame_view& view)
+{
+	const size_t pixelSize = pixel_size(view.format);
+
+	for (size_t row = 0; row < _rows; ++row)
+	{
+		for (size_t column = 0; column < _columns; ++column)
+		{
+			const size_t tile = (row * _columns) + column;
+
+			if (_tileStart[tile] == _tileStart[tile + 1])
+			{
+				continue;
+			}
+
+			const pixel_rect bounds = {
+				column * tile_size,
+				row * tile_size,
+				std::min((column + 1) * tile_size, _width),
+				std::min((row + 1) * tile_size, _height),
+			};
+			const uint64_t hash = hash_tile(view.pixels + (bounds.top * view.pitch) + (bounds.left * pixelSize), view.pitch,
+				(bounds.right - bounds.left) * pixelSize, bounds.bottom - bounds.top);
+
+			if (hash != _tileHashes[tile])
+			{
+				_tileHashes[tile] = hash;
+				mark_tile(tile, bounds);
+			}
+		}
+	}
+}
+
+void tile_index::mark_all()
+{
+	std::fill(_dirty.begin(), _dirty.end(), 1);
+}
+
+const std::vector<uint8_t>& tile_index::dirty_leds() const
+{
+	return _dirty;
+}
+
+void tile_index::mark_tile(size_t tile, const pixel_rect& change)
+{
+	for (size_t i = _tileStart[tile]; i < _tileStart[tile + 1]; ++i)
+	{
+		const size_t led = _tileLeds[i];
+
+		if (intersects(_leds[led], change))
+		{
+			_dirty[led] = 1;
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "frame_source.h"
+
+// Spatial index from square tiles of a display to the LEDs whose sampled regions overlap them,
+// so each frame we only need to sample the LEDs which could have changed and reuse the sums
+// from the last frame for the rest.
+//
+// The changes either come from the frame_source (e.g. the DXGI dirty and move rects), or if it
+// can't tell us, from comparing a hash of each tile that has any LEDs on it with the hash from
+// the last frame.
+class tile_index
+{
+public:
+	static constexpr size_t tile_size = 64;
+
+	// Index the regions sampled by each LED on a display. Every LED is flagged as dirty on the
+	// first frame after this.
+	void resize(size_t width, size_t height, const std::vector<pixel_rect>& leds);
+
+	// Start a new frame by clearing the dirty flags.
+	void begin_frame();
+
+	// Flag every LED as dirty on the next frame, e.g. because we couldn't map the last one.
+	void invalidate();
+
+	// Flag the LEDs which overlap any of the changed rectangles.
+	void mark_changes(const std::vector<pixel_rect>& changes);
+
+	// Hash every tile which has any LEDs on it and flag the LEDs in the tiles which changed.
+	void mark_hashed_tiles(const frame_view& view);
+
+	// Flag every LED.
+	void mark_all();
+
+	// One flag per LED, non-zero if the LED needs to be sampled again.
+	const std::vector<uint8_t>& dirty_leds() const;
+
+private:
+	void mark_tile(size_t tile, const pixel_rect& change);
+
+	size_t _width = 0;
+	size_t _height = 0;
+	size_t _columns = 0;
+	size_t _rows = 0;
+	bool _invalid = true;
+
+	std::vector<pixel_rect> _leds;
+	std::vector<uint8_t> _dirty;
+
+	// The LEDs in each tile are stored together, starting at _tileStart[tile] and ending at
+	// _tileStart[tile + 1] in _tileLeds.
+	std::vector<size_t> _tileStart;
+	std::vector<size_t> _tileLeds;
+	std::vector<uint64_t> _tileHashes;
+};
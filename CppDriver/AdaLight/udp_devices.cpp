@@ -0,0 +1,431 @@
+#include "stdafx.h"
+#include "udp_devices.h"
+
+#include <algorithm>
+#include <random>
+
+#ifdef _DEBUG
+#include <sstream>
+#endif
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+#undef min
+#undef max
+
+constexpr size_t bytes_per_led = 3;
+
+// A DMX universe has 512 channels, which fits 170 LEDs.
+constexpr size_t leds_per_universe = 170;
+
+constexpr UINT e131_port = 5568;
+constexpr size_t e131_sequence_offset = 111;
+constexpr size_t e131_header_size = 126;
+constexpr uint8_t e131_priority = 100;
+
+constexpr UINT artnet_port = 6454;
+constexpr size_t artnet_sequence_offset = 12;
+constexpr size_t artnet_header_size = 18;
+constexpr uint8_t artnet_protocol_version = 14;
+
+constexpr UINT wled_port = 21324;
+constexpr uint8_t wled_drgb = 2;
+constexpr uint8_t wled_dnrgb = 4;
+constexpr size_t wled_drgb_leds = 490;
+constexpr size_t wled_dnrgb_leds = 489;
+
+// WLED goes back to its own effects if it doesn't hear from us for this many seconds.
+constexpr uint8_t wled_timeout = 2;
+
+constexpr char source_name[] = "AdaLight";
+
+static void put_uint16(uint8_t* data, size_t value)
+{
+	data[0] = static_cast<uint8_t>((value >> 8) & 0xFF);
+	data[1] = static_cast<uint8_t>(value & 0xFF);
+}
+
+static void put_uint32(uint8_t* data, uint32_t value)
+{
+	put_uint16(data, value >> 16);
+	put_uint16(data + 2, value & 0xFFFF);
+}
+
+// E1.31 data packet with the root, framing and DMP layers filled in for one universe.
+static std::vector<uint8_t> e131_packet(const std::array<uint8_t, 16>& cid, UINT universe, size_t ledCount, size_t& colorOffset)
+{
+	static constexpr uint8_t acn_packet_identifier[] = { 'A', 'S', 'C', '-', 'E', '1', '.', '1', '7', 0, 0, 0 };
+	const size_t channels = ledCount * bytes_per_led;
+	std::vector<uint8_t> data(e131_header_size + channels, 0);
+
+	// Root layer
+	put_uint16(&data[0], 0x0010);
+	put_uint16(&data[2], 0x0000);
+	std::copy(std::cbegin(acn_packet_identifier), std::cend(acn_packet_identifier), data.begin() + 4);
+	put_uint16(&data[16], 0x7000 | (data.size() - 16));
+	put_uint32(&data[18], 0x00000004);
+	std::copy(cid.cbegin(), cid.cend(), data.begin() + 22);
+
+	// Framing layer
+	put_uint16(&data[38], 0x7000 | (data.size() - 38));
+	put_uint32(&data[40], 0x00000002);
+	std::copy(std::cbegin(source_name), std::cend(source_name), data.begin() + 44);
+	data[108] = e131_priority;
+	put_uint16(&data[113], universe);
+
+	// DMP layer, with the DMX start code before the channels.
+	put_uint16(&data[115], 0x7000 | (data.size() - 115));
+	data[117] = 0x02;
+	data[118] = 0xA1;
+	put_uint16(&data[119], 0x0000);
+	put_uint16(&data[121], 0x0001);
+	put_uint16(&data[123], 1 + channels);
+
+	colorOffset = e131_header_size;
+
+	return data;
+}
+
+// Art-Net ArtDmx packet for one universe. The length has to be even, so an odd number of
+// channels gets a padding byte.
+static std::vector<uint8_t> artnet_packet(UINT universe, size_t ledCount, size_t& colorOffset)
+{
+	static constexpr uint8_t artnet_id[] = { 'A', 'r', 't', '-', 'N', 'e', 't', 0 };
+	const size_t channels = ledCount * bytes_per_led;
+	const size_t length = channels + (channels & 1);
+	std::vector<uint8_t> data(artnet_header_size + length, 0);
+
+	std::copy(std::cbegin(artnet_id), std::cend(artnet_id), data.begin());
+	data[8] = 0x00;		// OpDmx, low byte first
+	data[9] = 0x50;
+	put_uint16(&data[10], artnet_protocol_version);
+	data[14] = static_cast<uint8_t>(universe & 0xFF);
+	data[15] = static_cast<uint8_t>((universe >> 8) & 0x7F);
+	put_uint16(&data[16], length);
+
+	colorOffset = artnet_header_size;
+
+	return data;
+}
+
+// WLED realtime packet, DRGB if it covers the whole strip or DNRGB starting at startIndex.
+static std::vector<uint8_t> wled_packet(bool indexed, size_t startIndex, size_t ledCount, size_t& colorOffset)
+{
+	colorOffset = indexed ? 4 : 2;
+
+	std::vector<uint8_t> data(colorOffset + (ledCount * bytes_per_led), 0);
+
+	data[0] = indexed ? wled_dnrgb : wled_drgb;
+	data[1] = wled_timeout;
+
+	if (indexed)
+	{
+		put_uint16(&data[2], startIndex);
+	}
+
+	return data;
+}
+
+static bool resolve_host(const std::wstring& host, UINT port, sockaddr_storage& address, socklen_t& addressLength)
+{
+	const std::string node(host.cbegin(), host.cend());
+	const std::string service = std::to_string(port);
+	addrinfo hints = {};
+	addrinfo* results = nullptr;
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	if (0 != getaddrinfo(node.c_str(), service.c_str(), &hints, &results))
+	{
+		return false;
+	}
+
+	memcpy(&address, results->ai_addr, results->ai_addrlen);
+	addressLength = static_cast<socklen_t>(results->ai_addrlen);
+	freeaddrinfo(results);
+
+	return true;
+}
+
+// E1.31 receivers listen on 239.255.<universe high byte>.<universe low byte>.
+static void multicast_address(UINT universe, UINT port, sockaddr_storage& address, socklen_t& addressLength)
+{
+	sockaddr_in ipv4 = {};
+
+	ipv4.sin_family = AF_INET;
+	ipv4.sin_port = htons(static_cast<uint16_t>(port));
+	ipv4.sin_addr.s_addr = htonl(0xEFFF0000 | (universe & 0xFFFF));
+
+	memset(&address, 0, sizeof(address));
+	memcpy(&address, &ipv4, sizeof(ipv4));
+	addressLength = static_cast<socklen_t>(sizeof(ipv4));
+}
+
+udp_devices::udp_devices(const settings& parameters)
+	: _parameters(parameters)
+{
+	std::random_device random;
+
+	std::generate(_cid.begin(), _cid.end(), [&random]()
+	{
+		return static_cast<uint8_t>(random());
+	});
+
+	// Make it a version 4 (random) UUID.
+	_cid[6] = static_cast<uint8_t>((_cid[6] & 0x0F) | 0x40);
+	_cid[8] = static_cast<uint8_t>((_cid[8] & 0x3F) | 0x80);
+}
+
+udp_devices::~udp_devices()
+{
+	close();
+
+#ifdef _WIN32
+	if (_startedWinsock)
+	{
+		WSACleanup();
+	}
+#endif
+}
+
+bool udp_devices::open()
+{
+	if (_opened)
+	{
+		return true;
+	}
+
+#ifdef _WIN32
+	if (!_startedWinsock)
+	{
+		WSADATA data = {};
+
+		_startedWinsock = (0 == WSAStartup(MAKEWORD(2, 2), &data));
+
+		if (!_startedWinsock)
+		{
+			return false;
+		}
+	}
+#endif
+
+	_devices.reserve(_parameters.udpDevices.size());
+
+	for (const auto& config : _parameters.udpDevices)
+	{
+		device output;
+		const bool opened = open_device(config, output);
+
+		_devices.push_back(std::move(output));
+
+		if (!opened)
+		{
+			close();
+			return false;
+		}
+	}
+
+	_opened = true;
+
+	return true;
+}
+
+bool udp_devices::send(const serial_buffer& buffer)
+{
+	if (!_opened)
+	{
+		return false;
+	}
+
+	const auto leds = buffer.begin();
+	bool success = true;
+
+	++_sequence;
+	_artnetSequence = static_cast<uint8_t>((_artnetSequence % 255) + 1);
+
+	for (size_t i = 0; i < _devices.size(); ++i)
+	{
+		auto& output = _devices[i];
+		const auto protocol = _parameters.udpDevices[i].protocol;
+
+		for (auto& packet : output.packets)
+		{
+			const auto source = leds + (packet.firstLed * bytes_per_led);
+
+			std::copy(source, source + (packet.ledCount * bytes_per_led), packet.data.begin() + packet.colorOffset);
+
+			switch (protocol)
+			{
+				case settings::udp_protocol::e131:
+					packet.data[e131_sequence_offset] = _sequence;
+					break;
+
+				case settings::udp_protocol::artnet:
+					packet.data[artnet_sequence_offset] = _artnetSequence;
+					break;
+
+				default:
+					break;
+			}
+
+			if (sendto(output.socket, reinterpret_cast<const char*>(packet.data.data()), static_cast<int>(packet.data.size()), 0,
+				reinterpret_cast<const sockaddr*>(&packet.address), packet.addressLength) < 0)
+			{
+				++output.failed;
+				success = false;
+			}
+			else
+			{
+				++output.sent;
+			}
+		}
+	}
+
+	return success;
+}
+
+void udp_devices::close()
+{
+	for (auto& output : _devices)
+	{
+#ifdef _WIN32
+		if (INVALID_SOCKET != output.socket)
+		{
+			closesocket(output.socket);
+		}
+#else
+		if (output.socket >= 0)
+		{
+			::close(output.socket);
+		}
+#endif
+
+#ifdef _DEBUG
+		if (_opened)
+		{
+			std::wostringstream oss;
+
+			oss << L"UDP Packets: " << output.host << L", " << output.packets.size() << L" per frame, "
+				<< output.sent << L" sent, " << output.failed << L" failed" << std::endl;
+			OutputDebugStringW(oss.str().c_str());
+		}
+#endif
+	}
+
+	_devices.clear();
+	_opened = false;
+}
+
+bool udp_devices::open_device(const settings::udp_device_config& config, device& output) const
+{
+	UINT port = config.port;
+
+	if (0 == port)
+	{
+		switch (config.protocol)
+		{
+			case settings::udp_protocol::artnet:
+				port = artnet_port;
+				break;
+
+			case settings::udp_protocol::wled:
+				port = wled_port;
+				break;
+
+			default:
+				port = e131_port;
+				break;
+		}
+	}
+
+	const bool multicast = (settings::udp_protocol::e131 == config.protocol && config.host.empty());
+	sockaddr_storage address = {};
+	socklen_t addressLength = 0;
+
+	output.host = multicast ? std::wstring(L"multicast") : config.host;
+	output.sent = 0;
+	output.failed = 0;
+	output.packets.clear();
+#ifdef _WIN32
+	output.socket = INVALID_SOCKET;
+#else
+	output.socket = -1;
+#endif
+
+	if (multicast)
+	{
+		multicast_address(config.universe, port, address, addressLength);
+	}
+	else if (!resolve_host(config.host, port, address, addressLength))
+	{
+		return false;
+	}
+
+	// Split the range into packets. WLED only needs to split it if it doesn't fit in one DRGB
+	// packet, and the DMX protocols use one packet per universe.
+	const bool wled = (settings::udp_protocol::wled == config.protocol);
+	const bool indexed = wled && config.ledCount > wled_drgb_leds;
+	const size_t ledsPerPacket = wled
+		? (indexed ? wled_dnrgb_leds : wled_drgb_leds)
+		: leds_per_universe;
+
+	for (size_t offset = 0; offset < config.ledCount; offset += ledsPerPacket)
+	{
+		const size_t ledCount = std::min(ledsPerPacket, config.ledCount - offset);
+		const UINT universe = config.universe + static_cast<UINT>(offset / ledsPerPacket);
+		packet item;
+
+		switch (config.protocol)
+		{
+			case settings::udp_protocol::e131:
+				item.data = e131_packet(_cid, universe, ledCount, item.colorOffset);
+				break;
+
+			case settings::udp_protocol::artnet:
+				item.data = artnet_packet(universe, ledCount, item.colorOffset);
+				break;
+
+			default:
+				item.data = wled_packet(indexed, offset, ledCount, item.colorOffset);
+				break;
+		}
+
+		item.firstLed = config.firstLed + offset;
+		item.ledCount = ledCount;
+
+		if (multicast)
+		{
+			multicast_address(universe, port, item.address, item.addressLength);
+		}
+		else
+		{
+			item.address = address;
+			item.addressLength = addressLength;
+		}
+
+		output.packets.push_back(std::move(item));
+	}
+
+	output.socket = socket(address.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+
+#ifdef _WIN32
+	if (INVALID_SOCKET == output.socket)
+#else
+	if (output.socket < 0)
+#endif
+	{
+		return false;
+	}
+
+	// Art-Net nodes are often addressed with a broadcast address.
+	const int broadcast = 1;
+
+	setsockopt(output.socket, SOL_SOCKET, SO_BROADCAST, reinterpret_cast<const char*>(&broadcast), sizeof(broadcast));
+
+	return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#endif
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "settings.h"
+#include "serial_buffer.h"
+
+// Send the LEDs to controllers on the network over UDP, with E1.31 (sACN), Art-Net or the
+// WLED realtime protocol (see settings::udpDevices). Ranges which don't fit in one packet are
+// split across universes, or across DNRGB packets for WLED.
+//
+// All of the packets are allocated with their headers filled in when the devices are opened,
+// so sending a frame only copies each device's share of the colors into place and updates the
+// sequence numbers.
+class udp_devices
+{
+public:
+	udp_devices(const settings& parameters);
+	~udp_devices();
+
+	// Look up the hosts and open a socket for each device. Returns true once all of them are open.
+	bool open();
+
+	// Send each device's share of the frame. Returns false if any of the packets failed.
+	bool send(const serial_buffer& buffer);
+	void close();
+
+private:
+#ifdef _WIN32
+	typedef SOCKET socket_type;
+#else
+	typedef int socket_type;
+#endif
+
+	struct packet
+	{
+		std::vector<uint8_t> data;
+		size_t colorOffset;
+		size_t firstLed;
+		size_t ledCount;
+		sockaddr_storage address;
+		socklen_t addressLength;
+	};
+
+	struct device
+	{
+		std::wstring host;
+		socket_type socket;
+		std::vector<packet> packets;
+		size_t sent;
+		size_t failed;
+	};
+
+	bool open_device(const settings::udp_device_config& config, device& output) const;
+
+	const settings& _parameters;
+	std::vector<device> _devices;
+	bool _opened = false;
+
+	// E1.31 identifies the sender with a UUID, which we pick once per run.
+	std::array<uint8_t, 16> _cid;
+	uint8_t _sequence = 0;
+
+	// Art-Net counts from 1 to 255, since 0 turns off reordering.
+	uint8_t _artnetSequence = 0;
+
+#ifdef _WIN32
+	bool _startedWinsock = false;
+#endif
+};
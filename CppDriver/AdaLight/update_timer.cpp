@@ -1,6 +1,11 @@
 #include "stdafx.h"
 #include "update_timer.h"
 
+#include <algorithm>
+
+#undef min
+#undef max
+
 update_timer::update_timer(const settings& parameters, std::function<void(std::shared_ptr<update_timer>)>&& onUpdate, std::function<void(std::shared_ptr<update_timer>)>&& onStop)
 	: _parameters(parameters)
 	, _onUpdate(std::move(onUpdate))
@@ -47,7 +52,7 @@ bool update_timer::start()
 			{
 				const auto delay = std::chrono::milliseconds(timer->_timerThrottled
 					? timer->_parameters.throttleTimer
-					: timer->_parameters.delay);
+					: std::max(timer->_parameters.delay, timer->_minimumDelay.load()));
 
 				// This should always timeout as long as the _timerMutex is locked by the main thread.
 				stopped = timerLock.try_lock_for(delay);
@@ -102,6 +107,11 @@ bool update_timer::throttle()
 	return false;
 }
 
+void update_timer::limit(UINT delay)
+{
+	_minimumDelay = delay;
+}
+
 bool update_timer::resume()
 {
 	if (_timerThrottled)
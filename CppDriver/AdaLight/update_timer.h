@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <functional>
 #include <mutex>
@@ -20,6 +21,10 @@ public:
 	bool throttle();
 	bool resume();
 
+	// Keep the updates at least the larger of settings::delay and this many ms apart, e.g. so the
+	// frames fit through the serial link. 0 goes back to settings::delay.
+	void limit(UINT delay);
+
 private:
 	const settings& _parameters;
 	const std::function<void(std::shared_ptr<update_timer>)> _onUpdate;
@@ -29,6 +34,7 @@ private:
 	bool _timerThrottled = false;
 	bool _timerFired = false;
 	bool _workerStarted = false;
+	std::atomic<UINT> _minimumDelay { 0 };
 
 	std::timed_mutex _timerMutex;
 	std::mutex _workerMutex;
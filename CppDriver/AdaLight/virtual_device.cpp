@@ -0,0 +1,284 @@
+#include "stdafx.h"
+#include "virtual_device.h"
+
+#ifndef _WIN32
+
+#include <algorithm>
+
+#ifdef _DEBUG
+#include <sstream>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+// How long the thread waits for the host before it runs the emulator anyway, in ms.
+constexpr int poll_time = 1;
+
+// The baud rate the host set on its end of the pty, or 0 if it's one we don't recognize, e.g.
+// a custom rate set with termios2.
+static uint32_t host_baud_rate(int fd)
+{
+	struct termios tty;
+
+	if (0 != tcgetattr(fd, &tty))
+	{
+		return 0;
+	}
+
+	switch (cfgetospeed(&tty))
+	{
+		case B9600:
+			return 9600;
+
+		case B19200:
+			return 19200;
+
+		case B38400:
+			return 38400;
+
+		case B57600:
+			return 57600;
+
+		case B115200:
+			return 115200;
+
+		case B230400:
+			return 230400;
+
+#ifdef B500000
+		case B500000:
+			return 500000;
+#endif
+
+#ifdef B1000000
+		case B1000000:
+			return 1000000;
+#endif
+
+#ifdef B2000000
+		case B2000000:
+			return 2000000;
+#endif
+
+		default:
+			return 0;
+	}
+}
+
+virtual_device::virtual_device(const ledstream_emulator::config& parameters)
+	: _emulator(parameters)
+	, _resetOnOpen(0 != parameters.maxBaudRate)
+{
+}
+
+virtual_device::~virtual_device()
+{
+	close();
+}
+
+bool virtual_device::open(const std::wstring& linkPath)
+{
+	if (_master >= 0)
+	{
+		return true;
+	}
+
+	_master = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if (_master < 0)
+	{
+		return false;
+	}
+
+	const char* slave = nullptr;
+
+	if (0 != grantpt(_master)
+		|| 0 != unlockpt(_master)
+		|| 0 != fcntl(_master, F_SETFL, O_NONBLOCK)
+		|| nullptr == (slave = ptsname(_master)))
+	{
+		close();
+		return false;
+	}
+
+	const std::string path(slave);
+
+	// Open and close our end once, so the pty reports a hangup until the host opens it.
+	const int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+
+	if (fd >= 0)
+	{
+		::close(fd);
+	}
+
+	if (!linkPath.empty())
+	{
+		_link.assign(linkPath.cbegin(), linkPath.cend());
+		unlink(_link.c_str());
+
+		if (0 != symlink(path.c_str(), _link.c_str()))
+		{
+			_link.clear();
+			close();
+			return false;
+		}
+	}
+
+	_name.assign(path.cbegin(), path.cend());
+	_start = std::chrono::steady_clock::now();
+
+	{
+		std::lock_guard<std::mutex> lock(_emulatorMutex);
+
+		_emulator.reset(0);
+	}
+
+	_stopped = false;
+	_thread = std::thread(&virtual_device::run, this);
+
+	return true;
+}
+
+void virtual_device::close()
+{
+	_stopped = true;
+
+	if (_thread.joinable())
+	{
+		_thread.join();
+	}
+
+	if (!_link.empty())
+	{
+		unlink(_link.c_str());
+		_link.clear();
+	}
+
+	if (_master >= 0)
+	{
+		::close(_master);
+		_master = -1;
+
+#ifdef _DEBUG
+		const auto stats = this->stats();
+		const uint64_t elapsed = stats.lastLatch - stats.firstLatch;
+		std::wostringstream oss;
+
+		oss << L"LEDstream Emulator: " << _name << L", " << stats.frames << L" frames, "
+			<< ((stats.frames > 1 && elapsed > 0) ? (stats.frames - 1) * 1000000.0 / elapsed : 0.0) << L" FPS, latch gap "
+			<< (stats.minLatchGap / 1000.0) << L"/"
+			<< ((stats.frames > 1) ? elapsed / 1000.0 / (stats.frames - 1) : 0.0) << L"/"
+			<< (stats.maxLatchGap / 1000.0) << L" ms min/avg/max, "
+			<< stats.skippedFrames << L" skipped, "
+			<< stats.underruns << L" underrun holds (" << (stats.underrunTime / 1000.0) << L" ms), "
+			<< stats.droppedBytes << L" dropped bytes, "
+			<< stats.garbledBytes << L" garbled bytes, "
+			<< stats.blackouts << L" blackouts" << std::endl;
+		OutputDebugStringW(oss.str().c_str());
+#endif
+	}
+}
+
+const std::wstring& virtual_device::name() const
+{
+	return _name;
+}
+
+ledstream_emulator::statistics virtual_device::stats() const
+{
+	std::lock_guard<std::mutex> lock(_emulatorMutex);
+
+	return _emulator.stats();
+}
+
+std::vector<uint8_t> virtual_device::leds() const
+{
+	std::lock_guard<std::mutex> lock(_emulatorMutex);
+
+	return _emulator.leds();
+}
+
+void virtual_device::run()
+{
+	// Nobody has the port open until the pty stops reporting a hangup.
+	bool hungUp = true;
+	uint8_t buffer[4096];
+
+	while (!_stopped)
+	{
+		size_t space = 0;
+
+		{
+			std::lock_guard<std::mutex> lock(_emulatorMutex);
+
+			space = std::min(_emulator.receive_space(), sizeof(buffer));
+		}
+
+		// Don't read what the emulator can't take yet, so the host's writes block instead.
+		struct pollfd readable = { _master, static_cast<short>((space > 0) ? POLLIN : 0), 0 };
+
+		if (poll(&readable, 1, poll_time) < 0
+			&& EINTR != errno)
+		{
+			break;
+		}
+
+		const bool hangup = (0 != (readable.revents & POLLHUP));
+		ssize_t cbRead = 0;
+
+		if (0 != (readable.revents & POLLIN))
+		{
+			cbRead = read(_master, buffer, space);
+		}
+
+		std::lock_guard<std::mutex> lock(_emulatorMutex);
+		const uint64_t time = now();
+
+		if (hungUp
+			&& !hangup
+			&& _resetOnOpen)
+		{
+			_emulator.reset(time);
+		}
+
+		hungUp = hangup;
+
+		if (cbRead > 0
+			&& !hungUp)
+		{
+			_emulator.receive(buffer, static_cast<size_t>(cbRead), time, host_baud_rate(_master));
+		}
+
+		_emulator.run(time);
+
+		// Like a real port, anything the sketch sends while nobody is listening is lost.
+		const auto output = _emulator.transmit();
+
+		if (!hungUp
+			&& !output.empty()
+			&& write(_master, output.data(), output.size()) < 0
+			&& EAGAIN != errno
+			&& EWOULDBLOCK != errno)
+		{
+			break;
+		}
+
+		if (hungUp)
+		{
+			// The pty keeps reporting the hangup without waiting.
+			std::this_thread::sleep_for(std::chrono::milliseconds(poll_time));
+		}
+	}
+}
+
+uint64_t virtual_device::now() const
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start).count());
+}
+
+#endif
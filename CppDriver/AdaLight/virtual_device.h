@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ledstream_emulator.h"
+
+#ifndef _WIN32
+// A serial port with the emulated LEDstream sketch on the other end (see ledstream_emulator), so
+// we can run the driver and measure what the LEDs would do without an Arduino. It creates a
+// pseudo-terminal and runs the emulator in real time on its own thread, feeding it whatever the
+// host writes to the pty at the baud rate the host set, and writing back whatever the sketch
+// sends. Point one of settings::devices at name() to use it.
+//
+// Like an Arduino which resets on DTR, the emulator starts over every time the host opens the
+// port, unless it's a native USB board. Windows doesn't have pseudo-terminals, so this is only
+// available on other platforms.
+class virtual_device
+{
+public:
+	explicit virtual_device(const ledstream_emulator::config& parameters);
+	~virtual_device();
+
+	// Create the pty and start the sketch. If linkPath isn't empty, also make a symlink to the pty
+	// there, e.g. /dev/ttyACM9 so serial_port discovery finds it.
+	bool open(const std::wstring& linkPath = std::wstring());
+	void close();
+
+	// Path of the pty for the host to open.
+	const std::wstring& name() const;
+
+	// Snapshots from the emulator while it keeps running.
+	ledstream_emulator::statistics stats() const;
+	std::vector<uint8_t> leds() const;
+
+private:
+	void run();
+
+	// Time in us since open(), which is the emulator's clock.
+	uint64_t now() const;
+
+	ledstream_emulator _emulator;
+	mutable std::mutex _emulatorMutex;
+	const bool _resetOnOpen;
+
+	int _master = -1;
+	std::wstring _name;
+	std::string _link;
+	std::chrono::steady_clock::time_point _start;
+	std::atomic<bool> _stopped { true };
+	std::thread _thread;
+};
+#endif
@@ -0,0 +1,320 @@
+// AdaLightHeadless.cpp
+//
+// Run the AdaLight driver without a Windows desktop, e.g. on a headless Linux box, with the
+// synthetic test pattern or a raw file of frames standing in for the display. It reads the same
+// AdaLight.config.json as AdaLight.exe when it's built with cpprestsdk, and sends the LEDs to the
+// same serial and network devices. There's no desktop to duplicate, so a config which asks for
+// DXGI gets the synthetic source instead.
+//
+// Usage:
+//   AdaLightHeadless [--frames N] [--sample-only] [config file]
+//     Run until interrupted, or for N frames, and report the average cost of each stage.
+//     --sample-only doesn't open any of the devices.
+//   AdaLightHeadless --benchmark [--frames N] [--max-ratio R]
+//     Sample N frames of the synthetic source at 1080p, 4K and 8K in every frame format and
+//     sampling mode, and report the time per frame. The grid mode is the sampler the summed-area
+//     table and the mip pyramid are measured against. With --max-ratio, fail if the area or
+//     pyramid mode takes more than R times as long with a frame format which has to be converted
+//     as it does with bgra8 at the same size.
+
+#include "stdafx.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "settings.h"
+#include "gamma_correction.h"
+#include "serial_buffer.h"
+#include "screen_samples.h"
+#include "serial_devices.h"
+#include "udp_devices.h"
+#include "update_timer.h"
+
+// Frames to sample at each size and format in the benchmark.
+constexpr size_t benchmark_frames = 100;
+
+// Give every frame as long as it takes in the benchmark, so a slow frame counts against the time
+// per frame instead of being skipped as a stall.
+constexpr UINT benchmark_delay = 10000;
+
+// How often the main thread checks whether it's time to stop, in ms.
+constexpr UINT stop_poll_time = 100;
+
+struct benchmark_size
+{
+	const wchar_t* name;
+	size_t width;
+	size_t height;
+};
+
+static const benchmark_size benchmark_sizes[] = {
+	{ L"1080p", 1920, 1080 },
+	{ L"4K", 3840, 2160 },
+	{ L"8K", 7680, 4320 },
+};
+
+struct benchmark_format
+{
+	const wchar_t* name;
+	settings::frame_format format;
+};
+
+static const benchmark_format benchmark_formats[] = {
+	{ L"bgra8", settings::frame_format::bgra8 },
+	{ L"r10g10b10a2", settings::frame_format::r10g10b10a2 },
+	{ L"hdr10", settings::frame_format::hdr10 },
+	{ L"fp16", settings::frame_format::fp16 },
+};
+
+struct benchmark_mode
+{
+	const wchar_t* name;
+	settings::sampling_mode mode;
+};
+
+static const benchmark_mode benchmark_modes[] = {
+	{ L"grid", settings::sampling_mode::grid },
+	{ L"area", settings::sampling_mode::area },
+	{ L"pyramid", settings::sampling_mode::pyramid },
+};
+
+static std::atomic<bool> s_stopped { false };
+
+static void stop_handler(int /*signal*/)
+{
+	s_stopped = true;
+}
+
+// Sample the synthetic source at each size, format and sampling mode without sending the frames
+// anywhere. The area and pyramid modes convert most of the frame, so if maxRatio isn't 0 they
+// fail when converting costs more than maxRatio times as much as sampling bgra8.
+static bool run_benchmark(size_t frames, double maxRatio)
+{
+	bool withinRatio = true;
+
+	std::wcout << L"Sampling " << frames << L" frames at each size" << std::endl;
+
+	for (const auto& size : benchmark_sizes)
+	{
+		// Time per frame in bgra8 in each mode, which comes first.
+		double bgra8Times[_countof(benchmark_modes)] = {};
+
+		for (const auto& format : benchmark_formats)
+		{
+			for (size_t m = 0; m < _countof(benchmark_modes); ++m)
+			{
+				const auto& mode = benchmark_modes[m];
+				settings parameters(L"");
+
+				parameters.frameSource = { settings::source_type::synthetic, L"", size.width, size.height, format.format };
+				parameters.sampling.mode = mode.mode;
+				parameters.delay = benchmark_delay;
+
+				serial_buffer serial(parameters);
+				gamma_correction gamma;
+				screen_samples samples(parameters, gamma);
+
+				if (!samples.create_resources())
+				{
+					std::wcerr << L"Failed to create the " << size.name << L" " << format.name << L" source" << std::endl;
+					return false;
+				}
+
+				const auto start = std::chrono::steady_clock::now();
+
+				for (size_t i = 0; i < frames; ++i)
+				{
+					samples.take_samples(serial);
+				}
+
+				const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+				const double time = elapsed.count() / static_cast<double>(frames);
+				const auto& telemetry = samples.telemetry();
+
+				// The table and the pyramid are only built in their own modes, the others report 0.
+				std::wcout << size.name << L" " << format.name << L" " << mode.name << L": "
+					<< time << L" ms/frame, table "
+					<< telemetry.milliseconds_per_frame(frame_telemetry::stage::table) << L", pyramid "
+					<< telemetry.milliseconds_per_frame(frame_telemetry::stage::pyramid) << L", sample "
+					<< telemetry.milliseconds_per_frame(frame_telemetry::stage::sample) << L" ms/frame" << std::endl;
+
+				if (settings::frame_format::bgra8 == format.format)
+				{
+					bgra8Times[m] = time;
+				}
+				else if (0.0 != maxRatio
+					&& settings::sampling_mode::grid != mode.mode
+					&& time > maxRatio * bgra8Times[m])
+				{
+					std::wcerr << size.name << L" " << format.name << L" " << mode.name << L" takes "
+						<< (time / bgra8Times[m]) << L" times as long as bgra8, more than " << maxRatio << std::endl;
+					withinRatio = false;
+				}
+
+				samples.free_resources();
+			}
+		}
+	}
+
+	return withinRatio;
+}
+
+// The same loop as AdaLight.exe, driven by an update_timer until we're interrupted or we've sent
+// enough frames.
+static void run_driver(settings& parameters, size_t frames, bool sampleOnly)
+{
+	if (settings::source_type::dxgi == parameters.frameSource.type)
+	{
+		parameters.frameSource.type = settings::source_type::synthetic;
+	}
+
+	serial_buffer serial(parameters);
+	gamma_correction gamma;
+	screen_samples samples(parameters, gamma);
+	serial_devices devices(parameters);
+	udp_devices network(parameters);
+	std::atomic<size_t> frameCount { 0 };
+
+	auto timer = std::make_shared<update_timer>(parameters,
+		[&](std::shared_ptr<update_timer> timer)
+	{
+		// Try to get the resources and resume the timer.
+		if (samples.empty())
+		{
+			if (!sampleOnly)
+			{
+				// Nothing else may touch the ports while they're being opened.
+				devices.stop();
+			}
+
+			if ((sampleOnly
+					|| (devices.open()
+						&& network.open()))
+				&& samples.create_resources())
+			{
+				if (!sampleOnly)
+				{
+					devices.start();
+
+					// Don't sample frames faster than the slowest link can send them.
+					timer->limit(devices.frame_time());
+				}
+
+				timer->resume();
+			}
+			else if (timer->throttle())
+			{
+				serial.clear();
+			}
+		}
+
+		samples.take_samples(serial);
+
+		if (!sampleOnly)
+		{
+			devices.send(serial);
+			network.send(serial);
+		}
+
+		if (!samples.empty())
+		{
+			++frameCount;
+		}
+	}, [&](std::shared_ptr<update_timer> /*timer*/)
+	{
+		// Report the stages before the resources and the telemetry with them go away.
+		std::wcout << frameCount.load() << L" frames" << std::endl;
+		samples.telemetry().report(std::wcout);
+
+		if (!sampleOnly)
+		{
+			// Reset the LED strip, and wait for the writers to send that before closing the ports.
+			serial.clear();
+			devices.send(serial);
+			network.send(serial);
+			devices.stop();
+		}
+
+		samples.free_resources();
+
+		if (!sampleOnly)
+		{
+			devices.close();
+			network.close();
+		}
+	});
+
+	timer->resume();
+	timer->start();
+
+	while (!s_stopped
+		&& (0 == frames
+			|| frameCount < frames))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(stop_poll_time));
+	}
+
+	timer->stop();
+}
+
+int main(int argc, char** argv)
+{
+	bool benchmark = false;
+	bool sampleOnly = false;
+	size_t frames = 0;
+	double maxRatio = 0.0;
+	std::string configFilePath = "AdaLight.config.json";
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg(argv[i]);
+
+		if (arg == "--benchmark")
+		{
+			benchmark = true;
+		}
+		else if (arg == "--sample-only")
+		{
+			sampleOnly = true;
+		}
+		else if (arg == "--frames"
+			&& i + 1 < argc)
+		{
+			frames = static_cast<size_t>(std::stoul(argv[++i]));
+		}
+		else if (arg == "--max-ratio"
+			&& i + 1 < argc)
+		{
+			maxRatio = std::stod(argv[++i]);
+		}
+		else if (!arg.empty()
+			&& '-' != arg.front())
+		{
+			configFilePath = arg;
+		}
+		else
+		{
+			std::wcerr << L"Usage: AdaLightHeadless [--frames N] [--sample-only] [config file]" << std::endl
+				<< L"       AdaLightHeadless --benchmark [--frames N] [--max-ratio R]" << std::endl;
+			return 1;
+		}
+	}
+
+	if (benchmark)
+	{
+		return run_benchmark((0 == frames) ? benchmark_frames : frames, maxRatio) ? 0 : 2;
+	}
+
+	std::signal(SIGINT, stop_handler);
+	std::signal(SIGTERM, stop_handler);
+
+	settings parameters(std::wstring(configFilePath.cbegin(), configFilePath.cend()));
+
+	run_driver(parameters, frames, sampleOnly);
+
+	return 0;
+}
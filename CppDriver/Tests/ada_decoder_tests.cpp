@@ -0,0 +1,318 @@
+// Round trip the version 2 frames from serial_buffer::encode through the ada_decoder, and
+// measure how fast both ends go.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "ada_protocol.h"
+#include "ada_decoder.h"
+#include "serial_buffer.h"
+
+#include "test_check.h"
+
+constexpr size_t bytes_per_led = 3;
+constexpr size_t led_count = 100;
+
+// Frames to encode and decode in the benchmark.
+constexpr size_t benchmark_frames = 2000;
+
+// Where the frame type is in an encoded frame.
+constexpr size_t frame_type_offset = ada_header_size;
+
+// Give every LED a different color from a simple generator, so nothing repeats by accident.
+static void fill_unique(serial_buffer& serial, uint32_t seed)
+{
+	auto output = serial.begin();
+
+	for (size_t i = 0; i < serial.led_count() * bytes_per_led; ++i)
+	{
+		seed = (seed * 1103515245) + 12345;
+		*(output++) = static_cast<uint8_t>(seed >> 16);
+	}
+}
+
+static void set_led(serial_buffer& serial, size_t led, uint8_t r, uint8_t g, uint8_t b)
+{
+	auto output = serial.begin() + (led * bytes_per_led);
+
+	*(output++) = r;
+	*(output++) = g;
+	*output = b;
+}
+
+static bool same_leds(const ada_decoder& decoder, const serial_buffer& serial)
+{
+	return decoder.leds().size() == serial.led_count() * bytes_per_led
+		&& std::equal(decoder.leds().cbegin(), decoder.leds().cend(), serial.begin());
+}
+
+static ada_frame_type frame_type(const serial_buffer::vector_type& frame)
+{
+	return static_cast<ada_frame_type>(frame[frame_type_offset]);
+}
+
+// Encode a frame and feed it to the decoder. Returns true if the decoder applied it.
+static bool send(ada_decoder& decoder, const serial_buffer& serial, uint8_t sequence, const serial_buffer* previous, ada_frame_type expected)
+{
+	serial_buffer::vector_type frame;
+
+	serial.encode(sequence, previous, frame);
+	CHECK(expected == frame_type(frame));
+
+	return 1 == decoder.push(frame.data(), frame.size());
+}
+
+// Unique colors need a raw key frame, a solid color fits in a run-length one, and a few changes
+// after that go in a delta.
+static void test_key_and_delta_frames()
+{
+	ada_decoder decoder;
+	serial_buffer serial(led_count);
+	serial_buffer previous(led_count);
+
+	fill_unique(serial, 1);
+	CHECK(send(decoder, serial, 0, nullptr, ada_frame_type::raw));
+	CHECK(same_leds(decoder, serial));
+	CHECK(2 == decoder.version());
+
+	std::fill(serial.begin(), serial.begin() + (led_count * bytes_per_led), static_cast<uint8_t>(0x40));
+	CHECK(send(decoder, serial, 1, nullptr, ada_frame_type::rle));
+	CHECK(same_leds(decoder, serial));
+
+	previous.assign(serial);
+	set_led(serial, 3, 1, 2, 3);
+	set_led(serial, 50, 4, 5, 6);
+	CHECK(send(decoder, serial, 2, &previous, ada_frame_type::delta));
+	CHECK(same_leds(decoder, serial));
+
+	// Changing the last LED means the delta can't stop early.
+	previous.assign(serial);
+	set_led(serial, led_count - 1, 7, 8, 9);
+	CHECK(send(decoder, serial, 3, &previous, ada_frame_type::delta));
+	CHECK(same_leds(decoder, serial));
+
+	// Changing everything is a key frame even with a previous frame to compare against.
+	previous.assign(serial);
+	fill_unique(serial, 2);
+	CHECK(send(decoder, serial, 4, &previous, ada_frame_type::raw));
+	CHECK(same_leds(decoder, serial));
+
+	CHECK(5 == decoder.frames());
+	CHECK(0 == decoder.errors());
+}
+
+// Runs just under, at and just over the longest run one op can hold, as repeats in a key frame
+// and as skips and repeats in a delta.
+static void test_run_lengths()
+{
+	for (size_t run : { ada_max_run - 1, ada_max_run, ada_max_run + 1 })
+	{
+		const size_t first = 5;
+		ada_decoder decoder;
+		serial_buffer serial(led_count);
+		serial_buffer previous(led_count);
+
+		fill_unique(serial, static_cast<uint32_t>(run));
+
+		for (size_t i = first; i < first + run; ++i)
+		{
+			set_led(serial, i, 10, 20, 30);
+		}
+
+		CHECK(send(decoder, serial, 0, nullptr, ada_frame_type::rle));
+		CHECK(same_leds(decoder, serial));
+
+		// The run stays the same and the LEDs on either side of it change.
+		previous.assign(serial);
+		set_led(serial, first - 1, 1, 1, 1);
+		set_led(serial, first + run, 2, 2, 2);
+		CHECK(send(decoder, serial, 1, &previous, ada_frame_type::delta));
+		CHECK(same_leds(decoder, serial));
+
+		// The run changes to another solid color.
+		previous.assign(serial);
+
+		for (size_t i = first; i < first + run; ++i)
+		{
+			set_led(serial, i, 40, 50, 60);
+		}
+
+		CHECK(send(decoder, serial, 2, &previous, ada_frame_type::delta));
+		CHECK(same_leds(decoder, serial));
+		CHECK(0 == decoder.errors());
+	}
+}
+
+// The sketch can decode version 2 frames for up to ada_max_v2_leds LEDs, and skips longer ones.
+static void test_max_v2_leds()
+{
+	ada_decoder decoder;
+	serial_buffer longest(ada_max_v2_leds);
+	serial_buffer tooLong(ada_max_v2_leds + 1);
+
+	fill_unique(longest, 3);
+	CHECK(send(decoder, longest, 0, nullptr, ada_frame_type::raw));
+	CHECK(same_leds(decoder, longest));
+
+	fill_unique(tooLong, 4);
+	CHECK(!send(decoder, tooLong, 1, nullptr, ada_frame_type::raw));
+	CHECK(same_leds(decoder, longest));
+	CHECK(1 == decoder.frames());
+	CHECK(1 == decoder.errors());
+}
+
+// A frame which fails its checksum leaves the LEDs partly updated, so the deltas after it have
+// to wait for the next key frame.
+static void test_corrupt_frame()
+{
+	ada_decoder decoder;
+	serial_buffer serial(led_count);
+	serial_buffer previous(led_count);
+	serial_buffer::vector_type frame;
+
+	fill_unique(serial, 5);
+	CHECK(send(decoder, serial, 0, nullptr, ada_frame_type::raw));
+
+	previous.assign(serial);
+	set_led(serial, 10, 1, 2, 3);
+	serial.encode(1, &previous, frame);
+	CHECK(ada_frame_type::delta == frame_type(frame));
+	frame.back() ^= 0xFF;
+	CHECK(0 == decoder.push(frame.data(), frame.size()));
+
+	const std::vector<uint8_t> afterCorrupt = decoder.leds();
+
+	previous.assign(serial);
+	set_led(serial, 20, 4, 5, 6);
+	CHECK(!send(decoder, serial, 2, &previous, ada_frame_type::delta));
+	CHECK(afterCorrupt == decoder.leds());
+
+	previous.assign(serial);
+	set_led(serial, 30, 7, 8, 9);
+	CHECK(!send(decoder, serial, 3, &previous, ada_frame_type::delta));
+	CHECK(afterCorrupt == decoder.leds());
+
+	CHECK(send(decoder, serial, 4, nullptr, ada_frame_type::raw));
+	CHECK(same_leds(decoder, serial));
+
+	previous.assign(serial);
+	set_led(serial, 40, 10, 11, 12);
+	CHECK(send(decoder, serial, 5, &previous, ada_frame_type::delta));
+	CHECK(same_leds(decoder, serial));
+
+	CHECK(3 == decoder.frames());
+	CHECK(3 == decoder.errors());
+}
+
+// A delta only applies after the frame with the sequence number before it, including across
+// the wrap from 255 to 0.
+static void test_sequence_gaps()
+{
+	ada_decoder decoder;
+	serial_buffer serial(led_count);
+	serial_buffer previous(led_count);
+
+	fill_unique(serial, 6);
+	CHECK(send(decoder, serial, 254, nullptr, ada_frame_type::raw));
+
+	previous.assign(serial);
+	set_led(serial, 1, 1, 1, 1);
+	CHECK(send(decoder, serial, 255, &previous, ada_frame_type::delta));
+	CHECK(same_leds(decoder, serial));
+
+	previous.assign(serial);
+	set_led(serial, 2, 2, 2, 2);
+	CHECK(send(decoder, serial, 0, &previous, ada_frame_type::delta));
+	CHECK(same_leds(decoder, serial));
+
+	// Frame 1 goes missing, so 2 and 3 don't apply even though 3 follows 2.
+	previous.assign(serial);
+	set_led(serial, 3, 3, 3, 3);
+	previous.assign(serial);
+	set_led(serial, 4, 4, 4, 4);
+	CHECK(!send(decoder, serial, 2, &previous, ada_frame_type::delta));
+
+	const std::vector<uint8_t> afterGap = decoder.leds();
+
+	previous.assign(serial);
+	set_led(serial, 5, 5, 5, 5);
+	CHECK(!send(decoder, serial, 3, &previous, ada_frame_type::delta));
+	CHECK(afterGap == decoder.leds());
+
+	// A repeated sequence number is a gap too.
+	CHECK(send(decoder, serial, 4, nullptr, ada_frame_type::raw));
+	previous.assign(serial);
+	set_led(serial, 6, 6, 6, 6);
+	CHECK(!send(decoder, serial, 4, &previous, ada_frame_type::delta));
+
+	CHECK(send(decoder, serial, 5, nullptr, ada_frame_type::raw));
+	CHECK(same_leds(decoder, serial));
+
+	CHECK(5 == decoder.frames());
+	CHECK(3 == decoder.errors());
+}
+
+// Encode and decode a strip of the longest length with a pattern which scrolls one LED every
+// frame, which is what a moving picture looks like to the encoder, and report the throughput.
+static void benchmark()
+{
+	serial_buffer serial(ada_max_v2_leds);
+	serial_buffer previous(ada_max_v2_leds);
+	serial_buffer::vector_type frame;
+	std::vector<serial_buffer::vector_type> frames(benchmark_frames);
+	size_t bytes = 0;
+
+	const auto encodeStart = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < benchmark_frames; ++i)
+	{
+		for (size_t led = 0; led < ada_max_v2_leds; ++led)
+		{
+			const uint8_t level = static_cast<uint8_t>(((led + i) / 8) * 8);
+
+			set_led(serial, led, level, static_cast<uint8_t>(255 - level), 0x80);
+		}
+
+		serial.encode(static_cast<uint8_t>(i), (0 == i % 30) ? nullptr : &previous, frames[i]);
+		previous.assign(serial);
+		bytes += frames[i].size();
+	}
+
+	const std::chrono::duration<double, std::milli> encodeTime = std::chrono::steady_clock::now() - encodeStart;
+	ada_decoder decoder;
+	size_t decoded = 0;
+
+	const auto decodeStart = std::chrono::steady_clock::now();
+
+	for (const auto& encoded : frames)
+	{
+		decoded += decoder.push(encoded.data(), encoded.size());
+	}
+
+	const std::chrono::duration<double, std::milli> decodeTime = std::chrono::steady_clock::now() - decodeStart;
+
+	CHECK(benchmark_frames == decoded);
+	CHECK(same_leds(decoder, serial));
+
+	std::wcout << benchmark_frames << L" frames of " << ada_max_v2_leds << L" LEDs, "
+		<< (static_cast<double>(bytes) / static_cast<double>(benchmark_frames)) << L" bytes/frame (raw "
+		<< (ada_max_v2_leds * bytes_per_led) << L")" << std::endl
+		<< L"Encode: " << (encodeTime.count() * 1000.0 / static_cast<double>(benchmark_frames)) << L" us/frame" << std::endl
+		<< L"Decode: " << (decodeTime.count() * 1000.0 / static_cast<double>(benchmark_frames)) << L" us/frame, "
+		<< (static_cast<double>(bytes) / (decodeTime.count() * 1000.0)) << L" MB/s" << std::endl;
+}
+
+int main()
+{
+	test_key_and_delta_frames();
+	test_run_lengths();
+	test_max_v2_leds();
+	test_corrupt_frame();
+	test_sequence_gaps();
+	benchmark();
+
+	return test_result();
+}
@@ -0,0 +1,223 @@
+// Compare the fixed point color_pipeline with the floating point math it replaced in
+// screen_samples::take_samples, over every average of each channel from 0 to 255.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "settings.h"
+#include "gamma_correction.h"
+#include "serial_buffer.h"
+#include "color_pipeline.h"
+#include "frame_telemetry.h"
+
+#include "test_check.h"
+
+// The uniform 16x16 grid, which is the default.
+constexpr uint32_t total_weight = 256;
+
+constexpr size_t frame_count = 8;
+
+struct color
+{
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+};
+
+// The double math from before the color_pipeline, which keeps the 8-bit colors it sent for the
+// fades.
+class reference_pipeline
+{
+public:
+	reference_pipeline(double fade, uint8_t minBrightness, size_t count)
+		: _fade(fade)
+		, _minBrightness(static_cast<double>(minBrightness))
+		, _previous(count, { static_cast<uint8_t>(minBrightness / 3), static_cast<uint8_t>(minBrightness / 3), static_cast<uint8_t>(minBrightness / 3) })
+	{
+	}
+
+	color process(size_t index, const channel_sums& sums)
+	{
+		double r = static_cast<double>(sums.r) / static_cast<double>(total_weight);
+		double g = static_cast<double>(sums.g) / static_cast<double>(total_weight);
+		double b = static_cast<double>(sums.b) / static_cast<double>(total_weight);
+		auto& previous = _previous[index];
+
+		if (_fade > 0.0)
+		{
+			const double weight = 1.0 - _fade;
+
+			r = (r * weight) + (static_cast<double>(previous.r) * _fade);
+			g = (g * weight) + (static_cast<double>(previous.g) * _fade);
+			b = (b * weight) + (static_cast<double>(previous.b) * _fade);
+		}
+
+		const double sum = r + g + b;
+
+		if (sum < _minBrightness)
+		{
+			if (sum == 0.0)
+			{
+				r = g = b = _minBrightness / 3.0;
+			}
+			else
+			{
+				const double deficit = _minBrightness - sum;
+				const double sum2 = 2.0 * sum;
+
+				r += (deficit * (sum - r)) / sum2;
+				g += (deficit * (sum - g)) / sum2;
+				b += (deficit * (sum - b)) / sum2;
+			}
+		}
+
+		previous = { static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b) };
+
+		return previous;
+	}
+
+private:
+	const double _fade;
+	const double _minBrightness;
+	std::vector<color> _previous;
+};
+
+// How many steps away from expected the 8-bit value behind a gamma corrected output is. The
+// gamma tables map several low values to the same output, so this is the smallest distance to
+// any of them.
+template <class Lookup>
+static int gamma_distance(uint8_t output, uint8_t expected, Lookup lookup)
+{
+	for (int distance = 0; distance < 256; ++distance)
+	{
+		if ((expected >= distance && lookup(static_cast<uint8_t>(expected - distance)) == output)
+			|| (expected + distance <= 255 && lookup(static_cast<uint8_t>(expected + distance)) == output))
+		{
+			return distance;
+		}
+	}
+
+	return 256;
+}
+
+// Every average from 0 to 255 for each channel on its own, a coarse grid of mixed colors, and
+// every color in the dim range where the minimum brightness boost kicks in. The sums also have
+// fractions of a step left over.
+static std::vector<channel_sums> test_colors()
+{
+	std::vector<color> colors;
+
+	for (int value = 0; value < 256; ++value)
+	{
+		const auto v = static_cast<uint8_t>(value);
+
+		colors.push_back({ v, 0, 0 });
+		colors.push_back({ 0, v, 0 });
+		colors.push_back({ 0, 0, v });
+		colors.push_back({ v, v, v });
+	}
+
+	for (int r = 0; r < 256; r += 15)
+	{
+		for (int g = 0; g < 256; g += 15)
+		{
+			for (int b = 0; b < 256; b += 15)
+			{
+				colors.push_back({ static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b) });
+			}
+		}
+	}
+
+	for (int r = 0; r < 32; ++r)
+	{
+		for (int g = 0; g < 32; ++g)
+		{
+			for (int b = 0; b < 32; ++b)
+			{
+				colors.push_back({ static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b) });
+			}
+		}
+	}
+
+	std::vector<channel_sums> sums(colors.size());
+	uint32_t fraction = 1;
+
+	std::transform(colors.cbegin(), colors.cend(), sums.begin(), [&fraction](const color& value)
+	{
+		fraction = (fraction * 1103515245 + 12345) & 0x7FFFFFFF;
+
+		const uint32_t extra = fraction % total_weight;
+
+		return channel_sums {
+			(value.b * total_weight) + ((value.b < 255) ? extra : 0),
+			(value.g * total_weight) + ((value.g < 255) ? (total_weight - 1 - extra) : 0),
+			(value.r * total_weight) + ((value.r < 255) ? (extra / 2) : 0),
+		};
+	});
+
+	return sums;
+}
+
+// Run several frames through both pipelines, with each LED taking a different color every frame
+// so the fades blend different colors, and return the largest distance of any channel.
+static int largest_difference(double fade, uint8_t minBrightness)
+{
+	const auto sums = test_colors();
+	const size_t count = sums.size();
+	settings parameters(L"");
+
+	parameters.fade = fade;
+	parameters.minBrightness = minBrightness;
+	parameters.totalLedCount = count;
+
+	const gamma_correction gamma;
+	serial_buffer serial(count);
+	frame_telemetry telemetry;
+	color_pipeline pipeline(parameters, gamma);
+	reference_pipeline reference(fade, minBrightness, count);
+	int largest = 0;
+
+	pipeline.reset();
+
+	for (size_t frame = 0; frame < frame_count; ++frame)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			pipeline.set_samples(i, sums[(i + (frame * 7919)) % count], total_weight);
+		}
+
+		pipeline.process(serial, telemetry);
+
+		auto output = serial.begin();
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const color expected = reference.process(i, sums[(i + (frame * 7919)) % count]);
+
+			largest = std::max(largest, gamma_distance(*(output++), expected.r, [&gamma](uint8_t r) { return gamma.red(r); }));
+			largest = std::max(largest, gamma_distance(*(output++), expected.g, [&gamma](uint8_t g) { return gamma.green(g); }));
+			largest = std::max(largest, gamma_distance(*(output++), expected.b, [&gamma](uint8_t b) { return gamma.blue(b); }));
+		}
+	}
+
+	std::wcout << L"fade " << fade << L", minBrightness " << static_cast<int>(minBrightness) << L": within "
+		<< largest << L" steps" << std::endl;
+
+	return largest;
+}
+
+int main()
+{
+	// Averaging, fading or boosting on their own match exactly, but a fade which ends up below the
+	// minimum brightness can round the fraction it carries into the boost differently.
+	CHECK(largest_difference(0.0, 0) == 0);
+	CHECK(largest_difference(0.0, 64) == 0);
+	CHECK(largest_difference(0.5, 0) == 0);
+	CHECK(largest_difference(0.5, 64) <= 1);
+	CHECK(largest_difference(0.75, 0) == 0);
+	CHECK(largest_difference(0.75, 64) <= 1);
+
+	return test_result();
+}
@@ -0,0 +1,196 @@
+// Feed the ledstream_emulator frames the way the driver encodes them, at 115200 baud on the
+// simulated clock, and check what the LEDs show and how the sketch got there.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "ada_protocol.h"
+#include "serial_buffer.h"
+#include "ledstream_emulator.h"
+
+#include "test_check.h"
+
+constexpr size_t bytes_per_led = 3;
+constexpr size_t led_count = 100;
+constexpr uint32_t baud_rate = 115200;
+
+// How long a byte takes at 115200 baud with 8N1, rounded like the emulator, in us.
+constexpr uint64_t byte_time = 87;
+
+// How long to let the sketch run after the last byte arrives, which is plenty to latch.
+constexpr uint64_t settle_time = 10000;
+
+// LEDstream turns the LEDs off after 15 seconds without a byte from the host, in us.
+constexpr uint64_t serial_timeout = 15000000;
+
+static ledstream_emulator::config emulator_config()
+{
+	ledstream_emulator::config parameters;
+
+	// Skip the 2.4 second test pattern, so the frames start at 0.
+	parameters.testPattern = false;
+
+	return parameters;
+}
+
+static void fill_unique(serial_buffer& serial, uint32_t seed)
+{
+	auto output = serial.begin();
+
+	for (size_t i = 0; i < serial.led_count() * bytes_per_led; ++i)
+	{
+		seed = (seed * 1103515245) + 12345;
+		*(output++) = static_cast<uint8_t>(seed >> 16);
+	}
+}
+
+static bool same_leds(const ledstream_emulator& emulator, const serial_buffer& serial)
+{
+	return emulator.leds().size() == serial.led_count() * bytes_per_led
+		&& std::equal(emulator.leds().cbegin(), emulator.leds().cend(), serial.begin());
+}
+
+// Send the bytes at time now and run the sketch until they've all arrived and it's had time
+// to latch them. Returns the time it ran until.
+static uint64_t send(ledstream_emulator& emulator, const uint8_t* data, size_t size, uint64_t now)
+{
+	const uint64_t end = now + (size * byte_time) + settle_time;
+
+	emulator.receive(data, size, now, baud_rate);
+	emulator.run(end);
+
+	return end;
+}
+
+// A version 1 frame goes out to the LEDs as it arrives, so at 115200 baud the sketch keeps
+// running out of bytes and holding off the LEDs until more come.
+static void test_version_1_frame()
+{
+	ledstream_emulator emulator(emulator_config());
+	serial_buffer serial(led_count);
+
+	CHECK("Ada\n" == std::string(reinterpret_cast<const char*>(emulator.transmit().data()), 4));
+
+	fill_unique(serial, 1);
+
+	send(emulator, serial.data(), serial.size(), 0);
+
+	const auto& stats = emulator.stats();
+
+	CHECK(same_leds(emulator, serial));
+	CHECK(1 == stats.frames);
+	CHECK(stats.lastLatch >= serial.size() * byte_time);
+	CHECK(stats.underruns > 0);
+	CHECK(stats.underrunTime > 0);
+	CHECK(0 == stats.skippedFrames);
+	CHECK(0 == stats.droppedBytes);
+	CHECK(0 == stats.garbledBytes);
+}
+
+// A version 2 frame is decoded before it goes out, so it never underruns, and a delta only
+// applies on top of the frame before it.
+static void test_version_2_frames()
+{
+	ledstream_emulator emulator(emulator_config());
+	serial_buffer serial(led_count);
+	serial_buffer previous(led_count);
+	serial_buffer::vector_type frame;
+	uint64_t now = 0;
+
+	fill_unique(serial, 2);
+	serial.encode(0, nullptr, frame);
+	now = send(emulator, frame.data(), frame.size(), now);
+
+	CHECK(same_leds(emulator, serial));
+
+	previous.assign(serial);
+	std::fill(serial.begin() + 30, serial.begin() + 60, static_cast<uint8_t>(0x40));
+	serial.encode(1, &previous, frame);
+	CHECK(ada_frame_type::delta == static_cast<ada_frame_type>(frame[ada_header_size]));
+	now = send(emulator, frame.data(), frame.size(), now);
+
+	CHECK(same_leds(emulator, serial));
+
+	// Sequence 3 doesn't follow 1, so the LEDs keep the last frame.
+	const std::vector<uint8_t> latched = emulator.leds();
+
+	previous.assign(serial);
+	std::fill(serial.begin() + 90, serial.begin() + 120, static_cast<uint8_t>(0x80));
+	serial.encode(3, &previous, frame);
+	CHECK(ada_frame_type::delta == static_cast<ada_frame_type>(frame[ada_header_size]));
+	now = send(emulator, frame.data(), frame.size(), now);
+
+	CHECK(latched == emulator.leds());
+
+	const auto& stats = emulator.stats();
+
+	CHECK(2 == stats.frames);
+	CHECK(1 == stats.skippedFrames);
+	CHECK(0 == stats.underruns);
+}
+
+// Bytes sent at a different baud rate than the sketch listens at are garbage to it.
+static void test_baud_rate_mismatch()
+{
+	ledstream_emulator emulator(emulator_config());
+	serial_buffer serial(led_count);
+
+	fill_unique(serial, 4);
+	emulator.receive(serial.data(), serial.size(), 0, 500000);
+	emulator.run(100000);
+
+	CHECK(0 == emulator.stats().frames);
+	CHECK(serial.size() == emulator.stats().garbledBytes);
+}
+
+// After 15 seconds without a byte the sketch turns the LEDs off, and keeps sending its cookie
+// every second while it waits.
+static void test_blackout()
+{
+	ledstream_emulator emulator(emulator_config());
+	serial_buffer serial(led_count);
+
+	fill_unique(serial, 5);
+
+	const uint64_t arrived = send(emulator, serial.data(), serial.size(), 0) - settle_time;
+
+	CHECK(same_leds(emulator, serial));
+	emulator.transmit();
+
+	emulator.run(arrived + serial_timeout - 100000);
+
+	CHECK(same_leds(emulator, serial));
+	CHECK(0 == emulator.stats().blackouts);
+
+	const auto idle = emulator.transmit();
+	const std::string cookies(idle.cbegin(), idle.cend());
+
+	CHECK(14 <= cookies.size() / 4);
+	CHECK(0 == cookies.find("Ada\nAda\n"));
+
+	emulator.run(arrived + serial_timeout + 100000);
+
+	CHECK(1 == emulator.stats().blackouts);
+	CHECK(led_count * bytes_per_led == emulator.leds().size());
+	CHECK(std::all_of(emulator.leds().cbegin(), emulator.leds().cend(), [](uint8_t value) { return 0 == value; }));
+
+	// A new frame brings the LEDs back, once the sketch is done shifting out the black.
+	fill_unique(serial, 6);
+	send(emulator, serial.data(), serial.size(), arrived + serial_timeout + 1000000);
+
+	CHECK(same_leds(emulator, serial));
+	CHECK(2 == emulator.stats().frames);
+}
+
+int main()
+{
+	test_version_1_frame();
+	test_version_2_frames();
+	test_baud_rate_mismatch();
+	test_blackout();
+
+	return test_result();
+}
@@ -0,0 +1,247 @@
+// Check the exact bytes the output_encoder sends for every LED chip and color order: the
+// colors in the right places, the LPD8806 high bits and latch bytes, the APA102 start frame,
+// brightness and end frame, and the padding to a multiple of 3 bytes.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "settings.h"
+#include "output_encoder.h"
+
+#include "test_check.h"
+
+constexpr size_t bytes_per_led = 3;
+
+// Written past the end of every frame, which the encoder must not touch.
+constexpr uint8_t guard_byte = 0xAA;
+constexpr size_t guard_size = 8;
+
+// Strip lengths either side of where the LPD8806 latch and the APA102 end frame get longer.
+constexpr size_t led_counts[] = { 1, 2, 3, 15, 16, 17, 63, 64, 65, 128, 129 };
+
+struct order_offsets
+{
+	settings::color_order order;
+
+	// Offsets in R, G, B of the colors in the order they go out.
+	size_t first;
+	size_t second;
+	size_t third;
+};
+
+static const order_offsets orders[] = {
+	{ settings::color_order::rgb, 0, 1, 2 },
+	{ settings::color_order::rbg, 0, 2, 1 },
+	{ settings::color_order::grb, 1, 0, 2 },
+	{ settings::color_order::gbr, 1, 2, 0 },
+	{ settings::color_order::brg, 2, 0, 1 },
+	{ settings::color_order::bgr, 2, 1, 0 },
+};
+
+static std::vector<uint8_t> make_leds(size_t ledCount)
+{
+	std::vector<uint8_t> leds(ledCount * bytes_per_led);
+
+	for (size_t i = 0; i < leds.size(); ++i)
+	{
+		leds[i] = static_cast<uint8_t>((i * 37) + (i >> 3));
+	}
+
+	return leds;
+}
+
+static void pad(std::vector<uint8_t>& frame, uint8_t value)
+{
+	while (0 != frame.size() % bytes_per_led)
+	{
+		frame.push_back(value);
+	}
+}
+
+// What each chip expects, built straight from the data sheets.
+static std::vector<uint8_t> ws2801_frame(const std::vector<uint8_t>& leds, const order_offsets& order)
+{
+	std::vector<uint8_t> frame;
+
+	for (size_t i = 0; i < leds.size(); i += bytes_per_led)
+	{
+		frame.push_back(leds[i + order.first]);
+		frame.push_back(leds[i + order.second]);
+		frame.push_back(leds[i + order.third]);
+	}
+
+	return frame;
+}
+
+static std::vector<uint8_t> lpd8806_frame(const std::vector<uint8_t>& leds, const order_offsets& order)
+{
+	const size_t ledCount = leds.size() / bytes_per_led;
+	std::vector<uint8_t> frame;
+
+	for (size_t i = 0; i < leds.size(); i += bytes_per_led)
+	{
+		frame.push_back(static_cast<uint8_t>(0x80 | (leds[i + order.first] >> 1)));
+		frame.push_back(static_cast<uint8_t>(0x80 | (leds[i + order.second] >> 1)));
+		frame.push_back(static_cast<uint8_t>(0x80 | (leds[i + order.third] >> 1)));
+	}
+
+	frame.insert(frame.end(), ((ledCount + 63) / 64) * 3, 0);
+
+	return frame;
+}
+
+static std::vector<uint8_t> apa102_frame(const std::vector<uint8_t>& leds, const order_offsets& order, uint8_t brightness)
+{
+	const size_t ledCount = leds.size() / bytes_per_led;
+	std::vector<uint8_t> frame(4, 0);
+
+	for (size_t i = 0; i < leds.size(); i += bytes_per_led)
+	{
+		frame.push_back(static_cast<uint8_t>(0xE0 | brightness));
+		frame.push_back(leds[i + order.first]);
+		frame.push_back(leds[i + order.second]);
+		frame.push_back(leds[i + order.third]);
+	}
+
+	frame.insert(frame.end(), (ledCount + 15) / 16, 0xFF);
+	pad(frame, 0xFF);
+
+	return frame;
+}
+
+static std::unique_ptr<output_encoder> create(settings::led_chip chip, settings::color_order order, uint8_t brightness)
+{
+	settings parameters(L"");
+
+	parameters.output = { chip, order, brightness };
+
+	return output_encoder::create(parameters);
+}
+
+// Returns true if the encoder produced exactly the expected frame and stayed inside it.
+static bool same_frame(const output_encoder& encoder, const std::vector<uint8_t>& leds, const std::vector<uint8_t>& expected)
+{
+	const size_t ledCount = leds.size() / bytes_per_led;
+	const size_t size = encoder.frame_size(ledCount);
+	std::vector<uint8_t> out(size + guard_size, guard_byte);
+
+	encoder.encode(leds.data(), ledCount, out.data());
+
+	return 0 == size % bytes_per_led
+		&& expected.size() == size
+		&& std::equal(expected.cbegin(), expected.cend(), out.cbegin())
+		&& std::all_of(out.cbegin() + size, out.cend(), [](uint8_t value) { return guard_byte == value; });
+}
+
+// A few frames spelled out byte by byte, so the tests don't only agree with themselves.
+static void test_literal_frames()
+{
+	const std::vector<uint8_t> leds = { 0x11, 0x22, 0x33, 0x80, 0x81, 0xFF };
+
+	const auto ws2801 = create(settings::led_chip::ws2801, settings::color_order::gbr, 31);
+
+	CHECK(ws2801 && same_frame(*ws2801, leds, { 0x22, 0x33, 0x11, 0x81, 0xFF, 0x80 }));
+
+	const auto lpd8806 = create(settings::led_chip::lpd8806, settings::color_order::grb, 31);
+
+	CHECK(lpd8806 && same_frame(*lpd8806, leds, { 0x91, 0x88, 0x99, 0xC0, 0xC0, 0xFF, 0x00, 0x00, 0x00 }));
+
+	const auto apa102 = create(settings::led_chip::apa102, settings::color_order::bgr, 5);
+
+	CHECK(apa102 && same_frame(*apa102, leds, {
+		0x00, 0x00, 0x00, 0x00,
+		0xE5, 0x33, 0x22, 0x11,
+		0xE5, 0xFF, 0x81, 0x80,
+		0xFF, 0xFF, 0xFF,
+	}));
+}
+
+// WS2801 in R, G, B order is what the sampler already produces, so there's no encoder.
+static void test_ws2801()
+{
+	CHECK(!create(settings::led_chip::ws2801, settings::color_order::rgb, 31));
+
+	for (const auto& order : orders)
+	{
+		if (settings::color_order::rgb == order.order)
+		{
+			continue;
+		}
+
+		const auto encoder = create(settings::led_chip::ws2801, order.order, 31);
+
+		CHECK(encoder);
+
+		for (size_t ledCount : led_counts)
+		{
+			const auto leds = make_leds(ledCount);
+
+			CHECK(encoder && same_frame(*encoder, leds, ws2801_frame(leds, order)));
+		}
+	}
+}
+
+static void test_lpd8806()
+{
+	for (const auto& order : orders)
+	{
+		const auto encoder = create(settings::led_chip::lpd8806, order.order, 31);
+
+		CHECK(encoder);
+
+		for (size_t ledCount : led_counts)
+		{
+			const auto leds = make_leds(ledCount);
+
+			CHECK(encoder && same_frame(*encoder, leds, lpd8806_frame(leds, order)));
+		}
+	}
+
+	// 3 latch bytes for up to 64 LEDs, and 3 more for every 64 after that.
+	const auto encoder = create(settings::led_chip::lpd8806, settings::color_order::grb, 31);
+
+	CHECK((64 * 3) + 3 == encoder->frame_size(64));
+	CHECK((65 * 3) + 6 == encoder->frame_size(65));
+}
+
+// The brightness only has 5 bits, so anything above 31 is full brightness.
+static void test_apa102()
+{
+	for (const uint8_t brightness : { 0, 1, 17, 31 })
+	{
+		for (const auto& order : orders)
+		{
+			const auto encoder = create(settings::led_chip::apa102, order.order, brightness);
+
+			CHECK(encoder);
+
+			for (size_t ledCount : led_counts)
+			{
+				const auto leds = make_leds(ledCount);
+
+				CHECK(encoder && same_frame(*encoder, leds, apa102_frame(leds, order, brightness)));
+			}
+		}
+	}
+
+	const auto leds = make_leds(17);
+	const auto clamped = create(settings::led_chip::apa102, settings::color_order::bgr, 200);
+
+	CHECK(clamped && same_frame(*clamped, leds, apa102_frame(leds, orders[5], 31)));
+
+	// The start frame, 4 bytes per LED and an end byte for every 16 LEDs, padded to 3 bytes.
+	CHECK(4 + (16 * 4) + 1 == clamped->frame_size(16));
+	CHECK(4 + (17 * 4) + 2 + 1 == clamped->frame_size(17));
+}
+
+int main()
+{
+	test_literal_frames();
+	test_ws2801();
+	test_lpd8806();
+	test_apa102();
+
+	return test_result();
+}
@@ -0,0 +1,353 @@
+// Check the pixel_converter against double precision math for the 10-bit, HDR10 and FP16
+// formats, on both hand made pixels and the synthetic test pattern.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "settings.h"
+#include "hdr_constants.h"
+#include "pixel_converter.h"
+#include "synthetic_frame_source.h"
+
+#include "test_check.h"
+
+#undef min
+#undef max
+
+constexpr size_t channels = 4;
+
+// The default white and peak levels from settings.h.
+static const settings::hdr_config hdr = { 200.0, 1000.0 };
+
+// Pattern size for the synthetic frames, with a width which isn't a multiple of 4 so the SIMD
+// paths and the leftover pixels both get used.
+constexpr size_t pattern_width = 259;
+constexpr size_t pattern_height = 4;
+
+static double srgb_to_linear(double encoded)
+{
+	return (encoded <= 0.04045)
+		? (encoded / 12.92)
+		: pow((encoded + 0.055) / 1.055, 2.4);
+}
+
+// Encode a linear value from 0.0 to 1.0 with the sRGB curve, scaled to 8 bits.
+static double linear_to_srgb(double linear)
+{
+	const double encoded = (linear <= 0.0031308)
+		? (linear * 12.92)
+		: ((1.055 * pow(linear, 1.0 / 2.4)) - 0.055);
+
+	return encoded * 255.0;
+}
+
+// The tone mapping and sRGB encoding described in pixel_converter.h, for a linear value where
+// 1.0 is SDR white, without the lookup tables.
+static double reference_tone_map(double linear)
+{
+	const double knee = 0.75;
+	const double shoulder = 1.0 - knee;
+	const double peakExcess = std::max(((hdr.peakLevel / hdr.whiteLevel) - knee) / shoulder, 1.0);
+	const double excess = std::max(linear - knee, 0.0) / shoulder;
+	const double compressed = (excess * (1.0 + (excess / (peakExcess * peakExcess)))) / (1.0 + excess);
+
+	return linear_to_srgb(std::max(std::min(std::min(linear, knee) + (compressed * shoulder), 1.0), 0.0));
+}
+
+static double decode_pq(uint32_t code)
+{
+	const double scaled = pow(static_cast<double>(code) / 1023.0, 1.0 / pq_m2);
+
+	return pq_max_nits * pow(std::max(scaled - pq_c1, 0.0) / (pq_c2 - (pq_c3 * scaled)), 1.0 / pq_m1);
+}
+
+static uint32_t encode_pq(double nits)
+{
+	const double scaled = pow(nits / pq_max_nits, pq_m1);
+
+	return static_cast<uint32_t>((pow((pq_c1 + (pq_c2 * scaled)) / (1.0 + (pq_c3 * scaled)), pq_m2) * 1023.0) + 0.5);
+}
+
+static uint16_t float_to_half(float value)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	bits += 0x00000FFF + ((bits >> 13) & 1);
+
+	return static_cast<uint16_t>((bits >> 13) - (112 << 10));
+}
+
+static double half_to_double(uint16_t half)
+{
+	const int exponent = (half >> 10) & 0x1F;
+	const int mantissa = half & 0x3FF;
+
+	return (0 == exponent)
+		? ldexp(mantissa, -24)
+		: ldexp(mantissa + 1024, exponent - 25);
+}
+
+// How far a converted channel is from the expected value, in 8-bit steps.
+static double distance(uint8_t converted, double expected)
+{
+	return std::abs(static_cast<double>(converted) - expected);
+}
+
+// Every 8-bit value goes through 10 bits and back unchanged, with R and B swapped.
+static void test_r10g10b10a2()
+{
+	std::vector<uint32_t> pixels(256);
+	std::vector<uint8_t> out(pixels.size() * channels);
+	const pixel_converter converter(hdr);
+
+	for (uint32_t value = 0; value < 256; ++value)
+	{
+		const uint32_t red = ((value * 1023) + 127) / 255;
+		const uint32_t green = (((255 - value) * 1023) + 127) / 255;
+		const uint32_t blue = (((value / 2) * 1023) + 127) / 255;
+
+		pixels[value] = red | (green << 10) | (blue << 20) | (3u << 30);
+	}
+
+	converter.convert(pixel_format::r10g10b10a2, reinterpret_cast<const uint8_t*>(pixels.data()), pixels.size(), out.data());
+
+	for (uint32_t value = 0; value < 256; ++value)
+	{
+		const uint8_t* pixel = out.data() + (value * channels);
+
+		CHECK(value / 2 == pixel[0]);
+		CHECK(255 - value == pixel[1]);
+		CHECK(value == pixel[2]);
+		CHECK(0xFF == pixel[3]);
+	}
+}
+
+// Every finite positive half float in every channel, compared with the double math. The
+// scalar and SSE2 paths also round the same way, so they come out exactly the same as the same
+// math in float.
+static void test_fp16()
+{
+	const pixel_converter converter(hdr);
+	const bool exact = (std::wstring(L"NEON") != pixel_converter::name());
+	std::vector<uint16_t> pixels;
+	double largest = 0.0;
+	size_t mismatches = 0;
+
+	for (uint16_t half = 0; half <= 0x7BFF; ++half)
+	{
+		pixels.push_back(half);
+		pixels.push_back(static_cast<uint16_t>(0x7BFF - half));
+		pixels.push_back(static_cast<uint16_t>((half * 7) % 0x7C00));
+		pixels.push_back(float_to_half(1.0f));
+	}
+
+	std::vector<uint8_t> out(pixels.size());
+
+	converter.convert(pixel_format::r16g16b16a16_float, reinterpret_cast<const uint8_t*>(pixels.data()), pixels.size() / channels, out.data());
+
+	const float scale = static_cast<float>(scrgb_nits / hdr.whiteLevel);
+	const float knee = 0.75f;
+	const float shoulder = 1.0f - knee;
+	const float inverseShoulder = 1.0f / shoulder;
+	const float peakExcess = std::max((static_cast<float>(hdr.peakLevel / hdr.whiteLevel) - knee) * inverseShoulder, 1.0f);
+	const float inversePeakSquared = 1.0f / (peakExcess * peakExcess);
+
+	for (size_t i = 0; i < pixels.size(); ++i)
+	{
+		if (channels - 1 == i % channels)
+		{
+			continue;
+		}
+
+		// The converter stores B, G, R, A.
+		const size_t pixel = i - (i % channels);
+		const uint8_t converted = out[pixel + 2 - (i % channels)];
+		const double linear = half_to_double(pixels[i]) * scrgb_nits / hdr.whiteLevel;
+
+		largest = std::max(largest, distance(converted, reference_tone_map(linear)));
+
+		const float color = static_cast<float>(half_to_double(pixels[i])) * scale;
+		const float excess = std::max(color - knee, 0.0f) * inverseShoulder;
+		const float compressed = (excess * (1.0f + (excess * inversePeakSquared))) / (1.0f + excess);
+		const float mapped = std::min(std::min(color, knee) + (compressed * shoulder), 1.0f);
+		const size_t level = static_cast<size_t>((mapped * 4095.0f) + 0.5f);
+		const double encoded = linear_to_srgb(static_cast<double>(level) / 4095.0);
+		const uint8_t expected = static_cast<uint8_t>(encoded + 0.5);
+
+		if (exact
+			&& expected != converted
+			&& std::abs(encoded - std::floor(encoded) - 0.5) > 1e-6)
+		{
+			++mismatches;
+		}
+	}
+
+	std::wcout << pixel_converter::name() << L" FP16: within " << largest << L" steps, "
+		<< mismatches << L" levels rounded differently" << std::endl;
+
+	CHECK(largest <= 1.0);
+	CHECK(0 == mismatches);
+
+	// Negative values clamp to black, and infinity and NaN clamp to white.
+	const uint16_t clamped[] = { 0xBC00, 0x7C00, 0x7E00, 0x3C00 };
+	uint8_t pixel[channels];
+
+	converter.convert(pixel_format::r16g16b16a16_float, reinterpret_cast<const uint8_t*>(clamped), 1, pixel);
+
+	CHECK(0xFF == pixel[0]);
+	CHECK(0xFF == pixel[1]);
+	CHECK(0 == pixel[2]);
+
+	// SDR white is inside the shoulder, and the peak level reaches full brightness.
+	const uint16_t levels[] = {
+		float_to_half(static_cast<float>(hdr.whiteLevel / scrgb_nits)),
+		float_to_half(static_cast<float>(hdr.peakLevel / scrgb_nits)),
+		0,
+		float_to_half(1.0f),
+	};
+
+	converter.convert(pixel_format::r16g16b16a16_float, reinterpret_cast<const uint8_t*>(levels), 1, pixel);
+
+	CHECK(distance(pixel[2], reference_tone_map(1.0)) <= 1.0);
+	CHECK(pixel[2] < 0xFF);
+	CHECK(0xFF == pixel[1]);
+	CHECK(0 == pixel[0]);
+}
+
+// Every 10-bit PQ code in every channel, compared with decoding the curve and converting the
+// primaries in double.
+static void test_hdr10()
+{
+	const pixel_converter converter(hdr);
+	std::vector<uint32_t> pixels;
+	double largest = 0.0;
+
+	for (uint32_t code = 0; code < 1024; ++code)
+	{
+		pixels.push_back(code | (code << 10) | (code << 20) | (3u << 30));
+		pixels.push_back(code | (((code * 3) & 0x3FF) << 10) | ((1023 - code) << 20) | (3u << 30));
+	}
+
+	std::vector<uint8_t> out(pixels.size() * channels);
+
+	converter.convert(pixel_format::r10g10b10a2_pq, reinterpret_cast<const uint8_t*>(pixels.data()), pixels.size(), out.data());
+
+	for (size_t i = 0; i < pixels.size(); ++i)
+	{
+		const double nits[] = {
+			decode_pq(pixels[i] & 0x3FF),
+			decode_pq((pixels[i] >> 10) & 0x3FF),
+			decode_pq((pixels[i] >> 20) & 0x3FF),
+		};
+
+		for (size_t channel = 0; channel < 3; ++channel)
+		{
+			const auto& weights = bt2020_to_bt709[channel];
+			const double linear = ((weights[0] * nits[0]) + (weights[1] * nits[1]) + (weights[2] * nits[2])) / hdr.whiteLevel;
+
+			largest = std::max(largest, distance(out[(i * channels) + 2 - channel], reference_tone_map(linear)));
+		}
+	}
+
+	std::wcout << L"HDR10: within " << largest << L" steps" << std::endl;
+
+	CHECK(largest <= 1.0);
+
+	// Grey at SDR white comes out the same as FP16, and 10000 nits is full brightness.
+	const uint32_t white = encode_pq(hdr.whiteLevel);
+	const uint32_t levels[] = {
+		white | (white << 10) | (white << 20),
+		1023 | (1023 << 10) | (1023 << 20),
+	};
+	uint8_t pixel[2 * channels];
+
+	converter.convert(pixel_format::r10g10b10a2_pq, reinterpret_cast<const uint8_t*>(levels), 2, pixel);
+
+	CHECK(distance(pixel[0], reference_tone_map(1.0)) <= 1.0);
+	CHECK(pixel[0] == pixel[1]);
+	CHECK(pixel[1] == pixel[2]);
+	CHECK(0xFF == pixel[channels]);
+
+	// The sRGB red primary in BT.2020 stays red.
+	const double red[] = { bt709_to_bt2020[0][0], bt709_to_bt2020[1][0], bt709_to_bt2020[2][0] };
+	const uint32_t pureRed = encode_pq(red[0] * hdr.whiteLevel / 2.0)
+		| (encode_pq(red[1] * hdr.whiteLevel / 2.0) << 10)
+		| (encode_pq(red[2] * hdr.whiteLevel / 2.0) << 20);
+
+	converter.convert(pixel_format::r10g10b10a2_pq, reinterpret_cast<const uint8_t*>(&pureRed), 1, pixel);
+
+	CHECK(distance(pixel[2], reference_tone_map(0.5)) <= 2.0);
+	CHECK(pixel[1] <= 4);
+	CHECK(pixel[0] <= 4);
+}
+
+// Convert a frame of the synthetic test pattern in format and compare it with the 8-bit
+// pattern in linear light, where 1.0 is SDR white. Below the knee it should match to within
+// tolerance, and above it the tone mapping can only compress it down towards the knee. HDR10
+// needs more room, because 10 bits of PQ in BT.2020 can't hold a dim channel next to a bright
+// one as closely as 8 bits of sRGB.
+static void test_pattern(pixel_format format, const wchar_t* name, double tolerance)
+{
+	synthetic_frame_source expected(pattern_width, pattern_height, pixel_format::b8g8r8a8, hdr);
+	synthetic_frame_source actual(pattern_width, pattern_height, format, hdr);
+	const pixel_converter converter(hdr);
+	frame_view expectedView;
+	frame_view actualView;
+	std::vector<uint8_t> out(pattern_width * channels);
+	const double knee = 0.75;
+	double largest = 0.0;
+
+	CHECK(frame_status::available == expected.acquire_frame(0));
+	CHECK(frame_status::available == actual.acquire_frame(0));
+	CHECK(frame_status::available == expected.map(expectedView));
+	CHECK(frame_status::available == actual.map(actualView));
+
+	for (size_t y = 0; y < pattern_height; ++y)
+	{
+		const uint8_t* row = expectedView.pixels + (y * expectedView.pitch);
+
+		converter.convert(actualView.format, actualView.pixels + (y * actualView.pitch), pattern_width, out.data());
+
+		for (size_t i = 0; i < out.size(); ++i)
+		{
+			const double value = srgb_to_linear(static_cast<double>(row[i]) / 255.0);
+			const double converted = srgb_to_linear(static_cast<double>(out[i]) / 255.0);
+
+			if (value <= knee)
+			{
+				largest = std::max(largest, std::abs(converted - value));
+			}
+			else
+			{
+				CHECK(converted <= value + tolerance);
+				CHECK(converted + tolerance >= knee);
+			}
+		}
+	}
+
+	expected.unmap();
+	actual.unmap();
+
+	std::wcout << name << L" pattern: within " << largest << L" of SDR white below the knee" << std::endl;
+
+	CHECK(largest <= tolerance);
+}
+
+int main()
+{
+	test_r10g10b10a2();
+	test_fp16();
+	test_hdr10();
+
+	test_pattern(pixel_format::r10g10b10a2, L"10-bit", 0.0);
+	test_pattern(pixel_format::r16g16b16a16_float, L"FP16", 0.005);
+	test_pattern(pixel_format::r10g10b10a2_pq, L"HDR10", 0.01);
+
+	return test_result();
+}
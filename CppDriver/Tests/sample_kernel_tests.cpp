@@ -0,0 +1,124 @@
+// Compare the SIMD sample_kernel this CPU gets with the scalar one, which have to produce
+// exactly the same sums, for every specialization of the grid size and both weight profiles.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "settings.h"
+#include "sample_kernel.h"
+
+#include "test_check.h"
+
+constexpr size_t bytes_per_pixel = 4;
+
+// A 1080p frame, so the offsets reach well past the first lines.
+constexpr size_t width = 1920;
+constexpr size_t height = 1080;
+
+constexpr size_t blocks = 2000;
+
+// The kernels are specialized for 16, 8 and 4 columns, and everything else takes the general
+// path, including the largest grid.
+constexpr size_t grid_sizes[] = { 16, 8, 4, 1, 3, 5, 12, 31, sample_kernel::max_grid_size };
+
+class random_numbers
+{
+public:
+	explicit random_numbers(uint32_t seed)
+		: _state(seed)
+	{
+	}
+
+	uint32_t next()
+	{
+		_state = (_state * 1103515245) + 12345;
+
+		return _state >> 8;
+	}
+
+private:
+	uint32_t _state;
+};
+
+// Random rows and columns of the frame in any order, sometimes the same one twice.
+static void random_offsets(random_numbers& random, size_t gridSize, std::vector<uint32_t>& rowOffsets, std::vector<uint32_t>& columnOffsets)
+{
+	rowOffsets.resize(gridSize);
+	columnOffsets.resize(gridSize);
+
+	for (auto& offset : rowOffsets)
+	{
+		offset = static_cast<uint32_t>((random.next() % height) * width * bytes_per_pixel);
+	}
+
+	for (auto& offset : columnOffsets)
+	{
+		offset = static_cast<uint32_t>((random.next() % width) * bytes_per_pixel);
+	}
+}
+
+static bool same_sums(const channel_sums& lhs, const channel_sums& rhs)
+{
+	return lhs.b == rhs.b && lhs.g == rhs.g && lhs.r == rhs.r;
+}
+
+// Returns how many blocks summed differently.
+static size_t compare_kernels(const std::vector<uint8_t>& pixels, size_t gridSize, settings::weight_profile weights)
+{
+	const settings::sampling_config sampling = { gridSize, 1.0, weights, settings::sampling_mode::grid };
+	const sample_kernel simd(sampling);
+	const sample_kernel scalar(sampling, false);
+	random_numbers random(static_cast<uint32_t>(gridSize));
+	std::vector<uint32_t> rowOffsets;
+	std::vector<uint32_t> columnOffsets;
+	size_t mismatches = 0;
+
+	CHECK(simd.grid_size() == scalar.grid_size());
+	CHECK(simd.total_weight() == scalar.total_weight());
+
+	for (size_t block = 0; block < blocks; ++block)
+	{
+		random_offsets(random, simd.grid_size(), rowOffsets, columnOffsets);
+
+		if (!same_sums(simd.sum(pixels.data(), rowOffsets.data(), columnOffsets.data()),
+			scalar.sum(pixels.data(), rowOffsets.data(), columnOffsets.data())))
+		{
+			++mismatches;
+		}
+	}
+
+	std::wcout << simd.name() << L" " << ((settings::weight_profile::uniform == weights) ? L"uniform" : L"gaussian")
+		<< L" " << gridSize << L"x" << gridSize << L": " << mismatches << L" mismatches" << std::endl;
+
+	return mismatches;
+}
+
+int main()
+{
+	std::vector<uint8_t> pixels(width * height * bytes_per_pixel);
+	random_numbers random(1);
+
+	for (auto& value : pixels)
+	{
+		value = static_cast<uint8_t>(random.next());
+	}
+
+	for (size_t gridSize : grid_sizes)
+	{
+		CHECK(0 == compare_kernels(pixels, gridSize, settings::weight_profile::uniform));
+		CHECK(0 == compare_kernels(pixels, gridSize, settings::weight_profile::gaussian));
+	}
+
+	// All white is the largest sum each kernel has to hold without overflowing.
+	std::fill(pixels.begin(), pixels.end(), static_cast<uint8_t>(0xFF));
+
+	for (size_t gridSize : grid_sizes)
+	{
+		CHECK(0 == compare_kernels(pixels, gridSize, settings::weight_profile::uniform));
+		CHECK(0 == compare_kernels(pixels, gridSize, settings::weight_profile::gaussian));
+	}
+
+	return test_result();
+}
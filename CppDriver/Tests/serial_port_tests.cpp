@@ -0,0 +1,357 @@
+// Check the POSIX serial_port against a pseudo terminal standing in for the Arduino: finding
+// the cookie however it arrives, the raw tty settings, writes which don't all fit at once, and
+// the device hanging up.
+
+#include "stdafx.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "settings.h"
+#include "serial_port.h"
+
+#include "test_check.h"
+
+// Bigger than the buffers between the two ends of a pty, so the writes can't all go at once.
+constexpr size_t large_write = 256 * 1024;
+
+// The deadlines count whole ms from GetTickCount64, so they can expire a little early.
+constexpr auto tick_slack = std::chrono::milliseconds(10);
+
+// The private parts of serial_port which discovery and the handshake use.
+class serial_port_tests
+{
+public:
+	static bool find_port(serial_port& port, const std::vector<std::wstring>& ports)
+	{
+		return port.find_port(ports);
+	}
+
+	static bool read_byte(serial_port& port, uint8_t& value, bool& received)
+	{
+		return port.read_byte(value, received);
+	}
+
+	static bool is_open(const serial_port& port)
+	{
+		return port.is_open();
+	}
+};
+
+// The master end of a pty, which plays the device. serial_port opens the slave end.
+class pseudo_terminal
+{
+public:
+	pseudo_terminal()
+		: _master(posix_openpt(O_RDWR | O_NOCTTY))
+	{
+		const char* slave = nullptr;
+
+		if (_master >= 0
+			&& 0 == grantpt(_master)
+			&& 0 == unlockpt(_master)
+			&& nullptr != (slave = ptsname(_master)))
+		{
+			const std::string path(slave);
+
+			_slave.assign(path.cbegin(), path.cend());
+
+			// A serial device doesn't echo what it sends back to itself, but a new pty does until
+			// the driver opens it and makes it raw.
+			struct termios tty;
+
+			if (0 == tcgetattr(_master, &tty))
+			{
+				tty.c_lflag &= ~ECHO;
+				tcsetattr(_master, TCSANOW, &tty);
+			}
+		}
+	}
+
+	~pseudo_terminal()
+	{
+		hang_up();
+	}
+
+	bool valid() const
+	{
+		return _master >= 0 && !_slave.empty();
+	}
+
+	int master() const
+	{
+		return _master;
+	}
+
+	const std::wstring& slave() const
+	{
+		return _slave;
+	}
+
+	bool write(const std::string& data)
+	{
+		return static_cast<ssize_t>(data.size()) == ::write(_master, data.data(), data.size());
+	}
+
+	// Read whatever the driver sent within timeout ms.
+	std::string read(int timeout)
+	{
+		std::string data;
+		struct pollfd readable = { _master, POLLIN, 0 };
+
+		while (poll(&readable, 1, timeout) > 0)
+		{
+			char buffer[4096];
+			const ssize_t cbRead = ::read(_master, buffer, sizeof(buffer));
+
+			if (cbRead <= 0)
+			{
+				break;
+			}
+
+			data.append(buffer, static_cast<size_t>(cbRead));
+		}
+
+		return data;
+	}
+
+	void hang_up()
+	{
+		if (_master >= 0)
+		{
+			::close(_master);
+			_master = -1;
+		}
+	}
+
+private:
+	int _master;
+	std::wstring _slave;
+};
+
+static void test_cookie_in_pieces()
+{
+	pseudo_terminal device;
+	pseudo_terminal noise;
+
+	CHECK(device.valid() && noise.valid());
+
+	settings parameters(L"");
+
+	parameters.timeout = 2000;
+
+	serial_port port(parameters, 0);
+
+	// Garbage from a sketch starting up, and most of a cookie, before the cookie comes in two
+	// pieces. The other port only sends things which look like part of one.
+	std::thread sketch([&device, &noise]()
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		noise.write("Ada Ad\nda\nAd");
+		device.write(std::string("\x00\xFF\r\nAd", 6));
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		device.write("xAd");
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		device.write("a\n");
+	});
+
+	const auto start = std::chrono::steady_clock::now();
+	const bool found = serial_port_tests::find_port(port, { noise.slave(), device.slave() });
+	const auto elapsed = std::chrono::steady_clock::now() - start;
+
+	sketch.join();
+
+	CHECK(found);
+	CHECK(device.slave() == port.name());
+	CHECK(serial_port_tests::is_open(port));
+	CHECK(elapsed < std::chrono::milliseconds(1000));
+}
+
+static void test_no_cookie()
+{
+	pseudo_terminal device;
+
+	CHECK(device.valid());
+
+	settings parameters(L"");
+
+	parameters.timeout = 300;
+
+	serial_port port(parameters, 0);
+
+	CHECK(device.write("Ad\na\nAda"));
+
+	const auto start = std::chrono::steady_clock::now();
+
+	CHECK(!serial_port_tests::find_port(port, { device.slave() }));
+	CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(300) - tick_slack);
+	CHECK(!serial_port_tests::is_open(port));
+}
+
+// Returns a port which find_port left open on the device.
+static bool open_device(serial_port& port, pseudo_terminal& device)
+{
+	return device.write("Ada\n")
+		&& serial_port_tests::find_port(port, { device.slave() });
+}
+
+// The tty is raw 8N1 at the default baud rate, so every byte goes through unchanged both ways.
+static void test_raw_mode()
+{
+	pseudo_terminal device;
+	settings parameters(L"");
+
+	parameters.timeout = 1000;
+
+	serial_port port(parameters, 0);
+
+	CHECK(device.valid());
+	CHECK(open_device(port, device));
+
+	// The two ends of a pty share their settings.
+	struct termios tty;
+
+	CHECK(0 == tcgetattr(device.master(), &tty));
+	CHECK(0 == (tty.c_lflag & (ICANON | ECHO | ISIG | IEXTEN)));
+	CHECK(0 == (tty.c_iflag & (ICRNL | INLCR | IGNCR | ISTRIP | IXON)));
+	CHECK(0 == (tty.c_oflag & OPOST));
+	CHECK(CS8 == (tty.c_cflag & CSIZE));
+	CHECK(0 == (tty.c_cflag & (PARENB | CSTOPB)));
+	CHECK((CLOCAL | CREAD) == (tty.c_cflag & (CLOCAL | CREAD)));
+	CHECK(B115200 == cfgetospeed(&tty));
+
+	const uint8_t frame[] = { 'A', 'd', 'a', '\r', '\n', 0x03, 0x11, 0x13, 0x7F, 0x00, 0xFF };
+
+	CHECK(port.send(frame, sizeof(frame)));
+	CHECK(std::string(reinterpret_cast<const char*>(frame), sizeof(frame)) == device.read(100));
+
+	const std::string reply("\r\n\x03\x11\x13\x04\x7F\xFF", 8);
+
+	CHECK(device.write(reply));
+
+	std::string received;
+	uint8_t value = 0;
+	bool byteReceived = false;
+
+	while (serial_port_tests::read_byte(port, value, byteReceived)
+		&& byteReceived)
+	{
+		received.push_back(static_cast<char>(value));
+	}
+
+	CHECK(reply == received);
+
+	// Nothing left to read isn't a failure.
+	CHECK(serial_port_tests::read_byte(port, value, byteReceived));
+	CHECK(!byteReceived);
+}
+
+// A write which doesn't fit waits for the device to make room, up to settings::delay.
+static void test_partial_writes()
+{
+	pseudo_terminal device;
+	settings parameters(L"");
+
+	parameters.timeout = 1000;
+	parameters.delay = 5000;
+
+	serial_port port(parameters, 0);
+
+	CHECK(device.valid());
+	CHECK(open_device(port, device));
+
+	std::vector<uint8_t> data(large_write);
+
+	for (size_t i = 0; i < data.size(); ++i)
+	{
+		data[i] = static_cast<uint8_t>((i * 7) + (i >> 8));
+	}
+
+	// Read slowly, so most of the writes only go partway or find the buffer full.
+	std::string received;
+	std::thread reader([&device, &received]()
+	{
+		struct pollfd readable = { device.master(), POLLIN, 0 };
+
+		while (received.size() < large_write
+			&& poll(&readable, 1, 1000) > 0)
+		{
+			char buffer[1024];
+			const ssize_t cbRead = ::read(device.master(), buffer, sizeof(buffer));
+
+			if (cbRead <= 0)
+			{
+				break;
+			}
+
+			received.append(buffer, static_cast<size_t>(cbRead));
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+	});
+
+	CHECK(port.send(data.data(), data.size()));
+	reader.join();
+
+	CHECK(std::string(data.cbegin(), data.cend()) == received);
+	CHECK(serial_port_tests::is_open(port));
+
+	// If the device doesn't make room in time, the port fails and closes.
+	parameters.delay = 100;
+
+	const auto start = std::chrono::steady_clock::now();
+
+	CHECK(!port.send(data.data(), data.size()));
+	CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(100) - tick_slack);
+	CHECK(!serial_port_tests::is_open(port));
+	CHECK(!port.send(data.data(), 1));
+}
+
+// When the device goes away, the reads fail instead of waiting for bytes which won't come.
+static void test_hang_up()
+{
+	pseudo_terminal device;
+	settings parameters(L"");
+
+	parameters.timeout = 1000;
+
+	serial_port port(parameters, 0);
+
+	CHECK(device.valid());
+	CHECK(open_device(port, device));
+
+	uint8_t value = 0;
+	bool received = false;
+
+	CHECK(serial_port_tests::read_byte(port, value, received));
+	CHECK(!received);
+
+	device.hang_up();
+
+	CHECK(!serial_port_tests::read_byte(port, value, received));
+	CHECK(!received);
+
+	const auto start = std::chrono::steady_clock::now();
+
+	CHECK(!port.wait_ready(1000));
+	CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+	CHECK(!serial_port_tests::is_open(port));
+}
+
+int main()
+{
+	test_cookie_in_pieces();
+	test_no_cookie();
+	test_raw_mode();
+	test_partial_writes();
+	test_hang_up();
+
+	return test_result();
+}
@@ -0,0 +1,279 @@
+// Check the serial_ring on its own: taking the newest frame and counting the ones it skips,
+// dropping new frames when the consumer holds up a full ring, the indices wrapping around the
+// slots, and a producer and consumer on two threads.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "serial_buffer.h"
+#include "serial_ring.h"
+
+#include "test_check.h"
+
+constexpr size_t bytes_per_led = 3;
+
+// The ring holds part of a longer strip, like a device in settings::devices.
+constexpr size_t strip_leds = 30;
+constexpr size_t first_led = 5;
+constexpr size_t ring_leds = 10;
+
+// Enough frames for the indices to go around the slots many times.
+constexpr size_t wrap_frames = 10 * serial_ring::capacity;
+constexpr size_t thread_frames = 100000;
+
+// Every LED gets its own color, which changes every frame.
+static void fill_frame(serial_buffer& strip, size_t frame)
+{
+	auto output = strip.begin();
+
+	for (size_t i = 0; i < strip.led_count() * bytes_per_led; ++i)
+	{
+		*(output++) = static_cast<uint8_t>((i * 13) + (frame * 7) + (frame >> 8));
+	}
+}
+
+// True if the slot holds the ring's share of this frame of the strip.
+static bool same_leds(const serial_buffer* slot, size_t frame)
+{
+	serial_buffer strip(strip_leds);
+
+	fill_frame(strip, frame);
+
+	const auto expected = strip.begin() + (first_led * bytes_per_led);
+
+	return nullptr != slot
+		&& ring_leds == slot->led_count()
+		&& std::equal(expected, expected + (ring_leds * bytes_per_led), slot->begin());
+}
+
+static bool push(serial_ring& ring, size_t frame)
+{
+	serial_buffer strip(strip_leds);
+
+	fill_frame(strip, frame);
+
+	return ring.push(strip, first_led);
+}
+
+static void test_empty()
+{
+	serial_ring ring(ring_leds);
+	size_t skipped = 1;
+
+	CHECK(ring.empty());
+	CHECK(0 == ring.size());
+	CHECK(nullptr == ring.acquire_latest(skipped));
+	CHECK(0 == skipped);
+}
+
+// A frame stays in the ring while the consumer sends it, and only the newest one of several
+// waiting frames gets sent.
+static void test_acquire_latest()
+{
+	serial_ring ring(ring_leds);
+	size_t skipped = 1;
+
+	CHECK(push(ring, 1));
+	CHECK(1 == ring.size());
+	CHECK(same_leds(ring.acquire_latest(skipped), 1));
+	CHECK(0 == skipped);
+	CHECK(1 == ring.size());
+
+	ring.release();
+
+	CHECK(ring.empty());
+
+	CHECK(push(ring, 2));
+	CHECK(push(ring, 3));
+	CHECK(push(ring, 4));
+	CHECK(3 == ring.size());
+	CHECK(same_leds(ring.acquire_latest(skipped), 4));
+	CHECK(2 == skipped);
+
+	// The skipped frames give their slots back right away.
+	CHECK(1 == ring.size());
+
+	ring.release();
+
+	CHECK(ring.empty());
+	CHECK(nullptr == ring.acquire_latest(skipped));
+	CHECK(0 == skipped);
+}
+
+// If the consumer is busy sending the oldest frame of a full ring, a new frame gets dropped and
+// the frames which were already waiting stay the way they were.
+static void test_full()
+{
+	serial_ring ring(ring_leds);
+	size_t skipped = 0;
+
+	for (size_t frame = 0; frame < serial_ring::capacity; ++frame)
+	{
+		CHECK(push(ring, frame));
+	}
+
+	CHECK(!push(ring, serial_ring::capacity));
+	CHECK(serial_ring::capacity == ring.size());
+	CHECK(same_leds(ring.acquire_latest(skipped), serial_ring::capacity - 1));
+	CHECK(serial_ring::capacity - 1 == skipped);
+
+	// While the consumer still holds the newest frame, there's room for all but one.
+	for (size_t frame = 0; frame < serial_ring::capacity - 1; ++frame)
+	{
+		CHECK(push(ring, 100 + frame));
+	}
+
+	CHECK(!push(ring, 200));
+
+	ring.release();
+
+	CHECK(same_leds(ring.acquire_latest(skipped), 100 + serial_ring::capacity - 2));
+	CHECK(serial_ring::capacity - 2 == skipped);
+
+	ring.release();
+
+	CHECK(ring.empty());
+}
+
+// The indices keep counting up past the capacity and wrap around the slots, whether the
+// consumer takes every frame or skips some.
+static void test_wraparound()
+{
+	serial_ring ring(ring_leds);
+	size_t frame = 0;
+	size_t skipped = 0;
+
+	for (size_t i = 0; i < wrap_frames; ++i)
+	{
+		CHECK(push(ring, frame));
+		CHECK(same_leds(ring.acquire_latest(skipped), frame));
+		CHECK(0 == skipped);
+
+		ring.release();
+		++frame;
+	}
+
+	for (size_t i = 0; i < wrap_frames; ++i)
+	{
+		const size_t count = 1 + (i % serial_ring::capacity);
+
+		for (size_t j = 0; j < count; ++j)
+		{
+			CHECK(push(ring, frame++));
+		}
+
+		CHECK(same_leds(ring.acquire_latest(skipped), frame - 1));
+		CHECK(count - 1 == skipped);
+
+		ring.release();
+	}
+
+	CHECK(ring.empty());
+}
+
+// The consumer on another thread sees the frames in order, each one whole, and every frame is
+// either sent, skipped or dropped.
+static void test_threads()
+{
+	serial_ring ring(ring_leds);
+	std::atomic<bool> done { false };
+	size_t sent = 0;
+	size_t skippedTotal = 0;
+	size_t torn = 0;
+	size_t outOfOrder = 0;
+
+	std::thread consumer([&]()
+	{
+		size_t last = 0;
+		bool first = true;
+
+		for (;;)
+		{
+			const bool finished = done;
+			size_t skipped = 0;
+			const serial_buffer* slot = ring.acquire_latest(skipped);
+
+			if (nullptr == slot)
+			{
+				if (finished)
+				{
+					break;
+				}
+
+				std::this_thread::yield();
+				continue;
+			}
+
+			// The producer fills in the frame number as the first LED of our share.
+			const size_t frame = *slot->begin() | (static_cast<size_t>(*(slot->begin() + 1)) << 8)
+				| (static_cast<size_t>(*(slot->begin() + 2)) << 16);
+
+			if (!std::all_of(slot->begin() + bytes_per_led, slot->begin() + (ring_leds * bytes_per_led), [frame](uint8_t value)
+			{
+				return static_cast<uint8_t>(frame) == value;
+			}))
+			{
+				++torn;
+			}
+
+			if (!first
+				&& frame <= last)
+			{
+				++outOfOrder;
+			}
+
+			first = false;
+			last = frame;
+			skippedTotal += skipped;
+			++sent;
+
+			ring.release();
+		}
+	});
+
+	serial_buffer strip(strip_leds);
+	size_t dropped = 0;
+
+	for (size_t frame = 0; frame < thread_frames; ++frame)
+	{
+		auto output = strip.begin() + (first_led * bytes_per_led);
+
+		*(output++) = static_cast<uint8_t>(frame);
+		*(output++) = static_cast<uint8_t>(frame >> 8);
+		*(output++) = static_cast<uint8_t>(frame >> 16);
+		std::fill(output, strip.begin() + ((first_led + ring_leds) * bytes_per_led), static_cast<uint8_t>(frame));
+
+		if (!ring.push(strip, first_led))
+		{
+			++dropped;
+		}
+
+		// Give the consumer a chance to run in between, even on a single core.
+		std::this_thread::yield();
+	}
+
+	done = true;
+	consumer.join();
+
+	std::wcout << thread_frames << L" frames on two threads: " << sent << L" sent, " << skippedTotal
+		<< L" skipped, " << dropped << L" dropped" << std::endl;
+
+	CHECK(0 == torn);
+	CHECK(0 == outOfOrder);
+	CHECK(thread_frames == sent + skippedTotal + dropped);
+	CHECK(ring.empty());
+}
+
+int main()
+{
+	test_empty();
+	test_acquire_latest();
+	test_full();
+	test_wraparound();
+	test_threads();
+
+	return test_result();
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <iostream>
+
+// Just enough of a test framework for the test executables, which don't have any dependencies
+// beyond the driver. Each CHECK which fails prints where it was and counts as a failure, and
+// main returns test_result() so CTest sees the failures.
+
+inline int& test_failures()
+{
+	static int failures = 0;
+
+	return failures;
+}
+
+inline int test_result()
+{
+	if (test_failures() > 0)
+	{
+		std::wcerr << test_failures() << L" checks failed" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			std::wcerr << __FILE__ << L"(" << __LINE__ << L"): CHECK(" << #condition << L") failed" << std::endl; \
+			++test_failures(); \
+		} \
+	} while (false)
@@ -0,0 +1,252 @@
+// Send frames with udp_devices to sockets on 127.0.0.1 and check the E1.31, Art-Net and WLED
+// packets byte by byte.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "settings.h"
+#include "serial_buffer.h"
+#include "udp_devices.h"
+
+#include "test_check.h"
+
+constexpr size_t bytes_per_led = 3;
+constexpr size_t leds_per_universe = 170;
+constexpr size_t led_count = 1200;
+
+constexpr size_t e131_header_size = 126;
+constexpr size_t artnet_header_size = 18;
+
+// Enough frames for the sequence numbers to wrap.
+constexpr size_t frame_count = 300;
+
+// A UDP socket on an ephemeral port of 127.0.0.1, which plays a controller.
+class receiver
+{
+public:
+	receiver()
+		: _socket(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP))
+	{
+		sockaddr_in address = {};
+		socklen_t length = sizeof(address);
+
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		if (_socket >= 0
+			&& 0 == bind(_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address))
+			&& 0 == getsockname(_socket, reinterpret_cast<sockaddr*>(&address), &length))
+		{
+			_port = ntohs(address.sin_port);
+		}
+	}
+
+	~receiver()
+	{
+		if (_socket >= 0)
+		{
+			::close(_socket);
+		}
+	}
+
+	UINT port() const
+	{
+		return _port;
+	}
+
+	// The next packet, or an empty one if nothing came within a second.
+	std::vector<uint8_t> receive()
+	{
+		struct pollfd readable = { _socket, POLLIN, 0 };
+		std::vector<uint8_t> packet(2048);
+
+		if (poll(&readable, 1, 1000) <= 0)
+		{
+			return {};
+		}
+
+		const ssize_t cbRead = recv(_socket, packet.data(), packet.size(), 0);
+
+		packet.resize((cbRead > 0) ? static_cast<size_t>(cbRead) : 0);
+
+		return packet;
+	}
+
+	// True if nothing else is waiting.
+	bool empty()
+	{
+		struct pollfd readable = { _socket, POLLIN, 0 };
+
+		return 0 == poll(&readable, 1, 50);
+	}
+
+private:
+	int _socket;
+	UINT _port = 0;
+};
+
+static size_t get_uint16(const std::vector<uint8_t>& packet, size_t offset)
+{
+	return (static_cast<size_t>(packet[offset]) << 8) | packet[offset + 1];
+}
+
+// The flags and length field of an E1.31 layer, which covers the rest of the packet.
+static bool e131_length(const std::vector<uint8_t>& packet, size_t offset)
+{
+	return (0x7000 | (packet.size() - offset)) == get_uint16(packet, offset);
+}
+
+// Every LED gets its own color, which changes every frame.
+static void fill_frame(serial_buffer& serial, size_t frame)
+{
+	auto output = serial.begin();
+
+	for (size_t i = 0; i < led_count * bytes_per_led; ++i)
+	{
+		*(output++) = static_cast<uint8_t>((i * 13) + (frame * 7) + (i >> 8));
+	}
+}
+
+static bool same_leds(const std::vector<uint8_t>& packet, size_t colorOffset, const serial_buffer& serial, size_t firstLed, size_t ledCount)
+{
+	const auto expected = serial.begin() + (firstLed * bytes_per_led);
+
+	return packet.size() >= colorOffset + (ledCount * bytes_per_led)
+		&& std::equal(expected, expected + (ledCount * bytes_per_led), packet.cbegin() + colorOffset);
+}
+
+static void check_e131(receiver& controller, const serial_buffer& serial, size_t frame)
+{
+	// 400 LEDs from LED 10 fill universes 7 and 8 and 60 LEDs of universe 9.
+	for (size_t universe = 0; universe < 3; ++universe)
+	{
+		const auto packet = controller.receive();
+		const size_t ledCount = (universe < 2) ? leds_per_universe : 60;
+		const size_t channels = ledCount * bytes_per_led;
+
+		CHECK(e131_header_size + channels == packet.size());
+
+		if (packet.size() < e131_header_size)
+		{
+			continue;
+		}
+
+		CHECK(0x0010 == get_uint16(packet, 0));
+		CHECK(0 == memcmp(&packet[4], "ASC-E1.17\0\0\0", 12));
+		CHECK(e131_length(packet, 16));
+		CHECK(e131_length(packet, 38));
+		CHECK(0 == memcmp(&packet[44], "AdaLight", 9));
+		CHECK(100 == packet[108]);
+		CHECK(static_cast<uint8_t>(frame + 1) == packet[111]);
+		CHECK(7 + universe == get_uint16(packet, 113));
+		CHECK(e131_length(packet, 115));
+		CHECK(0x02 == packet[117] && 0xA1 == packet[118]);
+		CHECK(1 + channels == get_uint16(packet, 123));
+		CHECK(0 == packet[125]);
+		CHECK(same_leds(packet, e131_header_size, serial, 10 + (universe * leds_per_universe), ledCount));
+	}
+}
+
+static void check_artnet(receiver& controller, const serial_buffer& serial, size_t frame)
+{
+	// 171 LEDs from universe 0x37F, so the second universe is in the next net and has an odd
+	// number of channels.
+	for (size_t universe = 0; universe < 2; ++universe)
+	{
+		const auto packet = controller.receive();
+		const size_t ledCount = (0 == universe) ? leds_per_universe : 1;
+		const size_t length = (0 == universe) ? 510 : 4;
+
+		CHECK(artnet_header_size + length == packet.size());
+
+		if (packet.size() < artnet_header_size)
+		{
+			continue;
+		}
+
+		CHECK(0 == memcmp(&packet[0], "Art-Net\0", 8));
+		CHECK(0x00 == packet[8] && 0x50 == packet[9]);
+		CHECK(14 == get_uint16(packet, 10));
+		CHECK(static_cast<uint8_t>((frame % 255) + 1) == packet[12]);
+		CHECK(((0 == universe) ? 0x7F : 0x80) == packet[14]);
+		CHECK(0x03 == packet[15]);
+		CHECK(length == get_uint16(packet, 16));
+		CHECK(same_leds(packet, artnet_header_size, serial, 500 + (universe * leds_per_universe), ledCount));
+		CHECK(0 == universe || 0 == packet.back());
+	}
+}
+
+// WLED fits 490 LEDs in one DRGB packet, and splits longer strips into DNRGB packets of 489.
+static void check_wled(receiver& drgb, receiver& dnrgb, const serial_buffer& serial)
+{
+	const auto whole = drgb.receive();
+
+	CHECK(2 + (490 * bytes_per_led) == whole.size());
+	CHECK(whole.size() >= 2 && 2 == whole[0] && 2 == whole[1]);
+	CHECK(same_leds(whole, 2, serial, 0, 490));
+
+	for (size_t start : { 0, 489 })
+	{
+		const auto packet = dnrgb.receive();
+		const size_t ledCount = (0 == start) ? 489 : 2;
+
+		CHECK(4 + (ledCount * bytes_per_led) == packet.size());
+
+		if (packet.size() < 4)
+		{
+			continue;
+		}
+
+		CHECK(4 == packet[0] && 2 == packet[1]);
+		CHECK(start == get_uint16(packet, 2));
+		CHECK(same_leds(packet, 4, serial, 700 + start, ledCount));
+	}
+}
+
+int main()
+{
+	receiver e131;
+	receiver artnet;
+	receiver drgb;
+	receiver dnrgb;
+	settings parameters(L"");
+
+	CHECK(0 != e131.port() && 0 != artnet.port() && 0 != drgb.port() && 0 != dnrgb.port());
+
+	parameters.udpDevices = {
+		{ settings::udp_protocol::e131, L"127.0.0.1", e131.port(), 7, 10, 400 },
+		{ settings::udp_protocol::artnet, L"127.0.0.1", artnet.port(), 0x37F, 500, 171 },
+		{ settings::udp_protocol::wled, L"127.0.0.1", drgb.port(), 0, 0, 490 },
+		{ settings::udp_protocol::wled, L"127.0.0.1", dnrgb.port(), 0, 700, 491 },
+	};
+
+	udp_devices devices(parameters);
+	serial_buffer serial(led_count);
+
+	CHECK(devices.open());
+
+	for (size_t frame = 0; frame < frame_count; ++frame)
+	{
+		fill_frame(serial, frame);
+		CHECK(devices.send(serial));
+
+		check_e131(e131, serial, frame);
+		check_artnet(artnet, serial, frame);
+		check_wled(drgb, dnrgb, serial);
+	}
+
+	CHECK(e131.empty() && artnet.empty() && drgb.empty() && dnrgb.empty());
+
+	devices.close();
+
+	return test_result();
+}
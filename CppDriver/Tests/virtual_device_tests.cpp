@@ -0,0 +1,287 @@
+// Run the driver's serial_port and serial_writer against a virtual_device, so the handshake
+// and the frames go through a real tty to the emulated sketch in real time, and check the
+// writer keeps up frame by frame and sends the newest frame when it stops. With several
+// devices, each one gets its own share of the strip.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "settings.h"
+#include "serial_buffer.h"
+#include "serial_port.h"
+#include "serial_writer.h"
+#include "serial_devices.h"
+#include "virtual_device.h"
+
+#include "test_check.h"
+
+constexpr size_t bytes_per_led = 3;
+constexpr size_t frame_count = 10;
+
+// How long to wait for the sketch to latch a frame, in ms.
+constexpr int latch_timeout = 2000;
+
+static void fill_frame(serial_buffer& serial, size_t frame)
+{
+	auto output = serial.begin();
+
+	for (size_t i = 0; i < serial.led_count() * bytes_per_led; ++i)
+	{
+		*(output++) = static_cast<uint8_t>((i * 11) + (frame * 29));
+	}
+}
+
+// True if the sketch shows exactly ledCount LEDs of the strip, starting at firstLed.
+static bool same_leds(const std::vector<uint8_t>& leds, const serial_buffer& serial, size_t firstLed, size_t ledCount)
+{
+	const auto expected = serial.begin() + (firstLed * bytes_per_led);
+
+	return leds.size() == ledCount * bytes_per_led
+		&& std::equal(leds.cbegin(), leds.cend(), expected);
+}
+
+// Wait until the sketch has latched this many frames and shows its share of the last one.
+static bool wait_for_leds(const virtual_device& device, size_t frames, const serial_buffer& serial, size_t firstLed, size_t ledCount)
+{
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(latch_timeout);
+
+	while (std::chrono::steady_clock::now() < deadline)
+	{
+		if (device.stats().frames >= frames
+			&& same_leds(device.leds(), serial, firstLed, ledCount))
+		{
+			return true;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	return false;
+}
+
+static bool wait_for_leds(const virtual_device& device, size_t frames, const serial_buffer& serial)
+{
+	return wait_for_leds(device, frames, serial, 0, serial.led_count());
+}
+
+static ledstream_emulator::config device_config()
+{
+	ledstream_emulator::config config;
+
+	// Skip the 2.4 second test pattern after the port resets the sketch.
+	config.testPattern = false;
+
+	return config;
+}
+
+// Wait for each frame, so the writer doesn't drop any for newer ones.
+static void test_frames()
+{
+	const auto config = device_config();
+	virtual_device device(config);
+
+	CHECK(device.open());
+
+	settings parameters(L"");
+
+	parameters.devices[0].path = device.name();
+
+	serial_port port(parameters, 0);
+
+	CHECK(port.open());
+	CHECK(device.name() == port.name());
+	CHECK(port.capabilities().extended);
+	CHECK(2 == port.capabilities().protocolVersion);
+	CHECK(config.maxBaudRate == port.baud_rate());
+
+	serial_writer writer(parameters, port, 0);
+	serial_buffer serial(parameters);
+
+	CHECK(writer.start());
+
+	for (size_t frame = 0; frame < frame_count; ++frame)
+	{
+		fill_frame(serial, frame);
+		CHECK(writer.send(serial));
+		CHECK(wait_for_leds(device, frame + 1, serial));
+	}
+
+	writer.stop();
+	port.close();
+
+	const auto stats = device.stats();
+
+	CHECK(frame_count == stats.frames);
+	CHECK(0 == stats.skippedFrames);
+	CHECK(0 == stats.droppedBytes);
+	CHECK(0 == stats.garbledBytes);
+	CHECK(0 == stats.blackouts);
+
+	std::wcout << stats.frames << L" frames of " << serial.led_count() << L" LEDs at " << port.baud_rate()
+		<< L" baud, latch gap " << (stats.minLatchGap / 1000.0) << L"/" << (stats.maxLatchGap / 1000.0)
+		<< L" ms min/max" << std::endl;
+
+	device.close();
+}
+
+// Queue frames much faster than the link carries them and stop right away. The writer skips or
+// drops the frames it can't send in time, but it still sends the newest one it queued before
+// the thread goes away.
+static void test_stop()
+{
+	virtual_device device(device_config());
+
+	CHECK(device.open());
+
+	settings parameters(L"");
+
+	parameters.devices[0].path = device.name();
+
+	serial_port port(parameters, 0);
+
+	CHECK(port.open());
+
+	serial_writer writer(parameters, port, 0);
+	serial_buffer serial(parameters);
+	serial_buffer newest(parameters);
+	size_t queued = 0;
+
+	CHECK(writer.start());
+
+	for (size_t frame = 0; frame < frame_count; ++frame)
+	{
+		fill_frame(serial, frame);
+
+		if (writer.send(serial))
+		{
+			newest.assign(serial);
+			++queued;
+		}
+	}
+
+	writer.stop();
+
+	CHECK(queued > 0);
+	CHECK(!writer.send(serial));
+	CHECK(wait_for_leds(device, 1, newest));
+
+	port.close();
+
+	const auto stats = device.stats();
+
+	CHECK(stats.frames <= queued);
+	CHECK(0 == stats.droppedBytes);
+	CHECK(0 == stats.garbledBytes);
+
+	std::wcout << queued << L" frames queued before stopping, " << stats.frames << L" sent" << std::endl;
+
+	device.close();
+}
+
+// The frame time of one device on its own, with a writer of its own.
+static DWORD device_frame_time(const settings& parameters, size_t index)
+{
+	serial_port port(parameters, index);
+	serial_writer writer(parameters, port, index);
+
+	CHECK(port.open());
+	CHECK(writer.start());
+
+	const DWORD frameTime = writer.frame_time();
+
+	writer.stop();
+	port.close();
+
+	return frameTime;
+}
+
+// Split the strip across a native USB board and two boards with different baud rates. Each
+// sketch only gets its own share of every frame, and the slowest link sets the frame time.
+static void test_devices()
+{
+	auto usbConfig = device_config();
+	auto slowConfig = device_config();
+	auto fastConfig = device_config();
+
+	usbConfig.maxBaudRate = 0;
+	slowConfig.maxBaudRate = 115200;
+
+	virtual_device usb(usbConfig);
+	virtual_device slow(slowConfig);
+	virtual_device fast(fastConfig);
+
+	CHECK(usb.open() && slow.open() && fast.open());
+
+	settings parameters(L"");
+	serial_buffer serial(parameters);
+	const size_t third = serial.led_count() / 3;
+
+	CHECK(third > 0);
+
+	// The slowest device is in the middle, so it's neither the first nor the last one.
+	parameters.devices = {
+		{ usb.name(), 0, third },
+		{ slow.name(), third, third },
+		{ fast.name(), 2 * third, serial.led_count() - (2 * third) },
+	};
+
+	const DWORD usbFrameTime = device_frame_time(parameters, 0);
+	const DWORD slowFrameTime = device_frame_time(parameters, 1);
+	const DWORD fastFrameTime = device_frame_time(parameters, 2);
+
+	CHECK(0 == usbFrameTime);
+	CHECK(slowFrameTime > fastFrameTime);
+	CHECK(fastFrameTime > 0);
+
+	serial_devices devices(parameters);
+
+	CHECK(devices.open());
+	devices.start();
+
+	CHECK(slowFrameTime == devices.frame_time());
+
+	// Count the frames from here on, whatever the sketches latched while we measured them.
+	const size_t usbFrames = usb.stats().frames;
+	const size_t slowFrames = slow.stats().frames;
+	const size_t fastFrames = fast.stats().frames;
+
+	for (size_t frame = 0; frame < frame_count; ++frame)
+	{
+		fill_frame(serial, frame);
+		devices.send(serial);
+
+		CHECK(wait_for_leds(usb, usbFrames + frame + 1, serial, 0, third));
+		CHECK(wait_for_leds(slow, slowFrames + frame + 1, serial, third, third));
+		CHECK(wait_for_leds(fast, fastFrames + frame + 1, serial, 2 * third, serial.led_count() - (2 * third)));
+	}
+
+	devices.stop();
+	devices.close();
+
+	for (const auto device : { &usb, &slow, &fast })
+	{
+		const auto stats = device->stats();
+
+		CHECK(0 == stats.skippedFrames);
+		CHECK(0 == stats.droppedBytes);
+		CHECK(0 == stats.garbledBytes);
+
+		device->close();
+	}
+
+	std::wcout << L"Frame time " << devices.frame_time() << L" ms for 3 devices, " << usbFrameTime << L"/"
+		<< slowFrameTime << L"/" << fastFrameTime << L" ms each" << std::endl;
+}
+
+int main()
+{
+	test_frames();
+	test_stop();
+	test_devices();
+
+	return test_result();
+}